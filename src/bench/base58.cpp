@@ -0,0 +1,59 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "bench/bench_util.h"
+
+#include "base58.h"
+
+#include <string>
+#include <vector>
+
+static void Base58Encode(benchmark::State& state)
+{
+    const uint256 hash = BenchHash(0);
+    const std::vector<unsigned char> vch(hash.begin(), hash.end());
+
+    while (state.KeepRunning()) {
+        EncodeBase58(vch);
+    }
+}
+
+static void Base58CheckEncode(benchmark::State& state)
+{
+    const uint256 hash = BenchHash(0);
+    std::vector<unsigned char> vch(hash.begin(), hash.end());
+    vch.insert(vch.begin(), 0x80);
+
+    while (state.KeepRunning()) {
+        EncodeBase58Check(vch);
+    }
+}
+
+static void Base58Decode(benchmark::State& state)
+{
+    const std::string strAddr = CBitcoinAddress(BenchKey(0).GetPubKey().GetID()).ToString();
+    std::vector<unsigned char> vch;
+
+    while (state.KeepRunning()) {
+        bool fValid = DecodeBase58(strAddr, vch);
+        assert(fValid);
+    }
+}
+
+static void Base58AddressRoundTrip(benchmark::State& state)
+{
+    const CKeyID keyID = BenchKey(0).GetPubKey().GetID();
+
+    while (state.KeepRunning()) {
+        const CBitcoinAddress addr(CBitcoinAddress(keyID).ToString());
+        assert(addr.IsValid());
+    }
+}
+
+BENCHMARK(Base58Encode, 200 * 1000);
+BENCHMARK(Base58CheckEncode, 200 * 1000);
+BENCHMARK(Base58Decode, 200 * 1000);
+BENCHMARK(Base58AddressRoundTrip, 100 * 1000);
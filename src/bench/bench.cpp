@@ -0,0 +1,77 @@
+// Copyright (c) 2015-2016 The Bitcoin Core developers
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <regex>
+
+benchmark::BenchRunner::BenchmarkMap& benchmark::BenchRunner::benchmarks()
+{
+    static std::map<std::string, Bench> benchmarks_map;
+    return benchmarks_map;
+}
+
+benchmark::BenchRunner::BenchRunner(const std::string& name, benchmark::BenchFunction func, uint64_t num_iters)
+{
+    benchmarks().insert(std::make_pair(name, Bench{func, num_iters}));
+}
+
+bool benchmark::State::UpdateTimer(const benchmark::time_point finish_time)
+{
+    if (m_fStarted) {
+        m_elapsed_results.push_back(std::chrono::duration_cast<duration>(finish_time - m_start_time).count());
+        if (m_elapsed_results.size() == m_num_evals)
+            return false;
+    }
+    m_fStarted = true;
+    m_num_iters_left = m_num_iters - 1;
+    m_start_time = clock::now();
+    return true;
+}
+
+void benchmark::BenchRunner::RunAll(uint64_t num_evals, double scaling, const std::string& filter, bool fListOnly)
+{
+    std::regex reFilter(filter);
+    std::smatch baseMatch;
+
+    // Times are reported in nanoseconds per iteration; "total" is the
+    // wall time of all evaluations in seconds.
+    std::cout << "# Benchmark, evals, iterations, total, min, max, median" << std::endl;
+
+    for (const auto& p : benchmarks()) {
+        if (!std::regex_match(p.first, baseMatch, reFilter))
+            continue;
+
+        const uint64_t num_iters = std::max<uint64_t>(1, p.second.num_iters * scaling);
+        if (fListOnly) {
+            std::cout << p.first << ", " << num_evals << ", " << num_iters << ", 0, 0, 0, 0" << std::endl;
+            continue;
+        }
+
+        State state(p.first, num_evals, num_iters);
+        p.second.func(state);
+
+        std::vector<double>& results = state.m_elapsed_results;
+        if (results.empty()) {
+            std::cout << p.first << ", 0, 0, 0, 0, 0, 0" << std::endl;
+            continue;
+        }
+        std::sort(results.begin(), results.end());
+        const double total = std::accumulate(results.begin(), results.end(), 0.0);
+        const double iters = state.m_num_iters;
+        const size_t mid = results.size() / 2;
+        const double median = results.size() % 2 ? results[mid] : (results[mid - 1] + results[mid]) / 2;
+
+        std::cout << std::fixed << std::setprecision(1)
+                  << p.first << ", " << results.size() << ", " << state.m_num_iters << ", "
+                  << std::setprecision(6) << total / 1e9 << ", "
+                  << std::setprecision(1) << results.front() / iters << ", " << results.back() / iters << ", " << median / iters
+                  << std::endl;
+    }
+}
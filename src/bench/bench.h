@@ -0,0 +1,109 @@
+// Copyright (c) 2015-2016 The Bitcoin Core developers
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef OASIS_BENCH_BENCH_H
+#define OASIS_BENCH_BENCH_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+// Simple micro-benchmarking framework; API mostly matches a subset of the
+// Google Benchmark framework (see https://github.com/google/benchmark).
+// Why not use the Google Benchmark framework? Because adding another
+// dependency (that uses cmake as its build system and has lots of features
+// we don't need) isn't worth it.
+
+/*
+ * Usage:
+
+static void CODE_TO_TIME(benchmark::State& state)
+{
+    ... do any setup needed...
+    while (state.KeepRunning()) {
+       ... do stuff you want to time...
+    }
+    ... do any cleanup needed...
+}
+
+// default to running benchmark for 5000 iterations
+BENCHMARK(CODE_TO_TIME, 5000);
+
+ */
+
+namespace benchmark
+{
+typedef std::chrono::high_resolution_clock clock;
+typedef clock::time_point time_point;
+typedef std::chrono::duration<double, std::nano> duration;
+
+/**
+ * Timing state of a single benchmark. Every benchmark is run for a fixed
+ * number of iterations (scaled by -scaling) and this is repeated -evals
+ * times, so the amount of work done never depends on machine speed and the
+ * results of two runs can be compared line by line.
+ */
+class State
+{
+public:
+    std::string m_name;
+    uint64_t m_num_iters_left;
+    const uint64_t m_num_iters;
+    const uint64_t m_num_evals;
+    std::vector<double> m_elapsed_results;
+    time_point m_start_time;
+
+    State(const std::string& name, uint64_t num_evals, double num_iters) :
+        m_name(name), m_num_iters_left(0), m_num_iters(num_iters > 1 ? (uint64_t)num_iters : 1), m_num_evals(num_evals), m_fStarted(false)
+    {
+    }
+
+    inline bool KeepRunning()
+    {
+        if (m_num_iters_left > 0) {
+            --m_num_iters_left;
+            return true;
+        }
+        return UpdateTimer(clock::now());
+    }
+
+private:
+    bool m_fStarted;
+    bool UpdateTimer(time_point finish_time);
+};
+
+typedef std::function<void(State&)> BenchFunction;
+
+class BenchRunner
+{
+    struct Bench {
+        BenchFunction func;
+        uint64_t num_iters;
+    };
+    typedef std::map<std::string, Bench> BenchmarkMap;
+    static BenchmarkMap& benchmarks();
+
+public:
+    BenchRunner(const std::string& name, BenchFunction func, uint64_t num_iters);
+
+    /**
+     * Run every registered benchmark whose name matches the filter regex
+     * and print one CSV line per benchmark to stdout.
+     */
+    static void RunAll(uint64_t num_evals, double scaling, const std::string& filter, bool fListOnly);
+};
+}
+
+// BENCHMARK(foo, num_iters) expands to:  benchmark::BenchRunner bench_11foo("foo", foo, num_iters);
+#define BENCHMARK(n, num_iters) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n, (num_iters));
+
+#endif // OASIS_BENCH_BENCH_H
@@ -0,0 +1,63 @@
+// Copyright (c) 2015-2016 The Bitcoin Core developers
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "chainparams.h"
+#include "guiinterface.h"
+#include "key.h"
+#include "main.h"
+#include "pubkey.h"
+#include "random.h"
+#include "util.h"
+#ifdef ENABLE_WALLET
+#include "wallet/wallet.h"
+#endif
+
+#include <iostream>
+
+CClientUIInterface uiInterface;
+CWallet* pwalletMain;
+
+static const int64_t DEFAULT_BENCH_EVALUATIONS = 5;
+static const char* DEFAULT_BENCH_FILTER = ".*";
+static const char* DEFAULT_BENCH_SCALING = "1.0";
+
+int main(int argc, char** argv)
+{
+    ParseParameters(argc, argv);
+
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::cout << HelpMessageGroup(_("Options:"))
+                  << HelpMessageOpt("-?", _("Print this help message and exit"))
+                  << HelpMessageOpt("-list", _("List benchmarks without executing them"))
+                  << HelpMessageOpt("-filter=<regex>", strprintf(_("Regular expression filter to select benchmark by name (default: %s)"), DEFAULT_BENCH_FILTER))
+                  << HelpMessageOpt("-evals=<n>", strprintf(_("Number of measurement evaluations to perform (default: %u)"), DEFAULT_BENCH_EVALUATIONS))
+                  << HelpMessageOpt("-scaling=<n>", strprintf(_("Scaling factor for the benchmark's runtime (default: %s)"), DEFAULT_BENCH_SCALING));
+        return 0;
+    }
+
+    RandomInit();
+    ECC_Start();
+    ECCVerifyHandle verifyHandle;
+    SetupEnvironment();
+    fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::REGTEST);
+
+    const int64_t evals = GetArg("-evals", DEFAULT_BENCH_EVALUATIONS);
+    const std::string filter = GetArg("-filter", DEFAULT_BENCH_FILTER);
+    const double scaling = std::stod(GetArg("-scaling", DEFAULT_BENCH_SCALING));
+    const bool fListOnly = GetBoolArg("-list", false);
+
+    if (evals <= 0) {
+        std::cerr << "-evals must be positive" << std::endl;
+        return 1;
+    }
+
+    benchmark::BenchRunner::RunAll(evals, scaling, filter, fListOnly);
+
+    ECC_Stop();
+    return 0;
+}
@@ -0,0 +1,134 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench_util.h"
+
+#include "blocksignature.h"
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "hash.h"
+#include "main.h"
+#include "script/standard.h"
+#include "txmempool.h"
+
+uint256 BenchHash(uint32_t n)
+{
+    return Hash(BEGIN(n), END(n));
+}
+
+CKey BenchKey(uint32_t seed)
+{
+    const uint256 secret = BenchHash(0x6b657900 + seed);
+    CKey key;
+    key.Set(secret.begin(), secret.end(), true);
+    assert(key.IsValid());
+    return key;
+}
+
+CMutableTransaction BenchPaymentTx(uint32_t n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(BenchHash(n), n % 4);
+    // sized like a DER signature followed by a compressed public key
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = (n % 1000 + 1) * COIN;
+    tx.vout[0].scriptPubKey = GetScriptForDestination(CKeyID(Hash160(BEGIN(n), END(n))));
+    tx.vout[1].nValue = COIN / 2;
+    tx.vout[1].scriptPubKey = GetScriptForDestination(CKeyID(Hash160(tx.vout[0].scriptPubKey)));
+    return tx;
+}
+
+CBlock BenchPoSBlock(const CKey& key, unsigned int nTxs)
+{
+    CBlock block;
+    block.nVersion = 5;
+    block.hashPrevBlock = BenchHash(0x70726576);
+    block.nTime = Params().GenesisBlock().nTime + 60;
+    block.nBits = Params().GenesisBlock().nBits;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 1000 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].SetEmpty();
+    block.vtx.push_back(coinbase);
+
+    CMutableTransaction coinstake;
+    coinstake.vin.resize(1);
+    coinstake.vin[0].prevout = COutPoint(BenchHash(0x7374616b), 0);
+    coinstake.vout.resize(3);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1].nValue = 1000 * COIN;
+    coinstake.vout[1].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    coinstake.vout[2] = coinstake.vout[1];
+    block.vtx.push_back(coinstake);
+
+    for (unsigned int i = 0; i < nTxs; i++)
+        block.vtx.push_back(BenchPaymentTx(i));
+
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    bool fSigned = SignBlockWithKey(block, key);
+    assert(fSigned);
+    return block;
+}
+
+BenchChain::BenchChain(int nHeight) : pcoinsPrev(pcoinsTip)
+{
+    LOCK(cs_main);
+    const CBlock& genesis = Params().GenesisBlock();
+    const int64_t nSpacing = Params().GetConsensus().nTargetSpacing;
+
+    CBlockIndex* pprev = nullptr;
+    for (int h = 0; h <= nHeight; h++) {
+        CBlockIndex* pindex = new CBlockIndex();
+        pindex->nHeight = h;
+        pindex->nVersion = genesis.nVersion;
+        pindex->nTime = genesis.nTime + h * nSpacing;
+        pindex->nBits = genesis.nBits;
+        pindex->pprev = pprev;
+        pindex->nChainTx = h + 1;
+        pindex->BuildSkip();
+
+        const uint256 hash = h == 0 ? genesis.GetHash() : BenchHash(0x63680000 + h);
+        const auto ret = mapBlockIndex.insert(std::make_pair(hash, pindex));
+        assert(ret.second);
+        pindex->phashBlock = &(ret.first->first);
+
+        vIndex.push_back(pindex);
+        pprev = pindex;
+    }
+    chainActive.SetTip(Tip());
+
+    pcoinsTip = new CCoinsViewCache(&viewEmpty);
+    pcoinsTip->SetBestBlock(Tip()->GetBlockHash());
+}
+
+BenchChain::~BenchChain()
+{
+    LOCK(cs_main);
+    mempool.clear();
+    chainActive.SetTip(nullptr);
+    for (CBlockIndex* pindex : vIndex) {
+        mapBlockIndex.erase(pindex->GetBlockHash());
+        delete pindex;
+    }
+    delete pcoinsTip;
+    pcoinsTip = pcoinsPrev;
+}
+
+std::vector<COutPoint> BenchChain::FundCoins(unsigned int nCoins, CAmount nValue)
+{
+    LOCK(cs_main);
+    std::vector<COutPoint> vOutpoints;
+    vOutpoints.reserve(nCoins);
+    for (unsigned int i = 0; i < nCoins; i++) {
+        const COutPoint outpoint(BenchHash(0x66756e64 + i), 0);
+        pcoinsTip->AddCoin(outpoint, Coin(CTxOut(nValue, CScript() << OP_TRUE), 1, false, false), false);
+        vOutpoints.push_back(outpoint);
+    }
+    return vOutpoints;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef OASIS_BENCH_BENCH_UTIL_H
+#define OASIS_BENCH_BENCH_UTIL_H
+
+#include "coins.h"
+#include "key.h"
+#include "primitives/block.h"
+
+#include <vector>
+
+class CBlockIndex;
+
+/** Deterministic helpers shared by the benchmarks, so that every run works on identical data. */
+
+//! Pseudo-random but reproducible hash for the n-th fake object
+uint256 BenchHash(uint32_t n);
+
+//! Fixed private key derived from seed
+CKey BenchKey(uint32_t seed);
+
+//! Plain 1-input/2-output payment spending the n-th fake outpoint
+CMutableTransaction BenchPaymentTx(uint32_t n);
+
+/**
+ * Synthetic proof-of-stake block: empty coinbase, a coinstake paying to key
+ * and nTxs payments. The merkle root is filled in and the block is signed.
+ */
+CBlock BenchPoSBlock(const CKey& key, unsigned int nTxs);
+
+/**
+ * In-memory active chain of nHeight blocks on top of the genesis block, with
+ * an empty coins cache as pcoinsTip. The validation globals (chainActive,
+ * mapBlockIndex, pcoinsTip, mempool) are swapped in for the lifetime of the
+ * object and restored on destruction.
+ */
+class BenchChain
+{
+public:
+    explicit BenchChain(int nHeight);
+    ~BenchChain();
+
+    CBlockIndex* Tip() const { return vIndex.back(); }
+
+    /** Add nCoins OP_TRUE outputs of nValue to the tip coins view and return their outpoints */
+    std::vector<COutPoint> FundCoins(unsigned int nCoins, CAmount nValue);
+
+private:
+    std::vector<CBlockIndex*> vIndex;
+    CCoinsView viewEmpty;
+    CCoinsViewCache* pcoinsPrev;
+};
+
+#endif // OASIS_BENCH_BENCH_UTIL_H
@@ -0,0 +1,71 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "bench/bench_util.h"
+
+#include "coins.h"
+
+static const unsigned int BENCH_COINS = 1000;
+
+static std::vector<COutPoint> AddBenchCoins(CCoinsViewCache& view, unsigned int nCoins)
+{
+    std::vector<COutPoint> vOutpoints;
+    for (unsigned int i = 0; i < nCoins; i++) {
+        const COutPoint outpoint(BenchHash(i), i % 2);
+        view.AddCoin(outpoint, Coin(CTxOut((i + 1) * COIN, CScript() << OP_TRUE), 100 + i, false, false), false);
+        vOutpoints.push_back(outpoint);
+    }
+    return vOutpoints;
+}
+
+// Pull coins from a backing cache into a fresh child cache, as every
+// validation pass does on top of pcoinsTip.
+static void CoinsCacheFetch(benchmark::State& state)
+{
+    CCoinsView viewEmpty;
+    CCoinsViewCache viewBase(&viewEmpty);
+    const std::vector<COutPoint> vOutpoints = AddBenchCoins(viewBase, BENCH_COINS);
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&viewBase);
+        for (const COutPoint& outpoint : vOutpoints) {
+            const Coin& coin = view.AccessCoin(outpoint);
+            assert(!coin.IsSpent());
+        }
+    }
+}
+
+// Spend every coin of a backing cache in a child cache and write the result back.
+static void CoinsCacheSpendFlush(benchmark::State& state)
+{
+    CCoinsView viewEmpty;
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache viewBase(&viewEmpty);
+        const std::vector<COutPoint> vOutpoints = AddBenchCoins(viewBase, BENCH_COINS);
+        CCoinsViewCache view(&viewBase);
+        for (const COutPoint& outpoint : vOutpoints)
+            view.SpendCoin(outpoint);
+        view.Flush();
+    }
+}
+
+// Create new coins in a child cache and write them back to an empty parent.
+static void CoinsCacheAddFlush(benchmark::State& state)
+{
+    CCoinsView viewEmpty;
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache viewBase(&viewEmpty);
+        CCoinsViewCache view(&viewBase);
+        AddBenchCoins(view, BENCH_COINS);
+        view.Flush();
+    }
+}
+
+BENCHMARK(CoinsCacheFetch, 1000);
+BENCHMARK(CoinsCacheSpendFlush, 500);
+BENCHMARK(CoinsCacheAddFlush, 500);
@@ -0,0 +1,69 @@
+// Copyright (c) 2016 The Bitcoin Core developers
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "bench/bench_util.h"
+
+#include "blocksignature.h"
+#include "main.h"
+#include "streams.h"
+
+// A synthetic proof-of-stake block with 1000 payments (~230kB), the same
+// shape as a busy block on the network.
+static const unsigned int BENCH_BLOCK_TXS = 1000;
+
+static void SerializeBlock(benchmark::State& state)
+{
+    const CBlock block = BenchPoSBlock(BenchKey(0), BENCH_BLOCK_TXS);
+
+    while (state.KeepRunning()) {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << block;
+    }
+}
+
+static void DeserializeBlock(benchmark::State& state)
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << BenchPoSBlock(BenchKey(0), BENCH_BLOCK_TXS);
+    const std::string strBlock = stream.str();
+
+    while (state.KeepRunning()) {
+        CDataStream ss(strBlock.data(), strBlock.data() + strBlock.size(), SER_NETWORK, PROTOCOL_VERSION);
+        CBlock block;
+        ss >> block;
+    }
+}
+
+// Context-free checks only: no chain tip is set, so the masternode payment
+// checks are skipped exactly as they are during initial block download.
+static void CheckBlockPoS(benchmark::State& state)
+{
+    const CBlock block = BenchPoSBlock(BenchKey(0), BENCH_BLOCK_TXS);
+
+    while (state.KeepRunning()) {
+        block.fChecked = false;
+        block.fMerkleChecked = false;
+        CValidationState validationState;
+        bool fValid = CheckBlock(block, validationState, true, true, true);
+        assert(fValid);
+    }
+}
+
+static void CheckBlockSignaturePoS(benchmark::State& state)
+{
+    const CBlock block = BenchPoSBlock(BenchKey(0), BENCH_BLOCK_TXS);
+
+    while (state.KeepRunning()) {
+        block.fSignatureChecked = false;
+        bool fValid = CheckBlockSignature(block);
+        assert(fValid);
+    }
+}
+
+BENCHMARK(SerializeBlock, 500);
+BENCHMARK(DeserializeBlock, 500);
+BENCHMARK(CheckBlockPoS, 200);
+BENCHMARK(CheckBlockSignaturePoS, 5000);
@@ -0,0 +1,65 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "bench/bench_util.h"
+
+#include "main.h"
+#include "miner.h"
+#include "txmempool.h"
+
+#include <iostream>
+#include <memory>
+
+static const int BENCH_CHAIN_HEIGHT = 100;
+static const unsigned int BENCH_MEMPOOL_TXS = 2000;
+
+/**
+ * Proof-of-work template on top of an in-memory chain with a full mempool
+ * of independent OP_TRUE spends. The template includes TestBlockValidity,
+ * so this measures selection plus a full connect of the candidate block.
+ */
+static void CreateNewBlockBench(benchmark::State& state, bool fReuseSelection)
+{
+    BenchChain chain(BENCH_CHAIN_HEIGHT);
+    const std::vector<COutPoint> vCoins = chain.FundCoins(BENCH_MEMPOOL_TXS, 100 * COIN);
+    {
+        LOCK2(cs_main, mempool.cs);
+        for (unsigned int i = 0; i < vCoins.size(); i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = vCoins[i];
+            tx.vout.resize(1);
+            tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+            const CAmount nFee = 10000 + i * 10;
+            tx.vout[0].nValue = 100 * COIN - nFee;
+            mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, i, 0.0, BENCH_CHAIN_HEIGHT, 1));
+        }
+    }
+
+    const CScript scriptPubKey = CScript() << OP_TRUE;
+    while (state.KeepRunning()) {
+        // a mempool change forces a fresh package selection
+        if (!fReuseSelection)
+            mempool.AddTransactionsUpdated(1);
+        std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptPubKey, nullptr, false));
+        if (!pblocktemplate) {
+            std::cerr << state.m_name << ": CreateNewBlock failed" << std::endl;
+            return;
+        }
+    }
+}
+
+static void CreateNewBlockSelect(benchmark::State& state)
+{
+    CreateNewBlockBench(state, false);
+}
+
+static void CreateNewBlockCached(benchmark::State& state)
+{
+    CreateNewBlockBench(state, true);
+}
+
+BENCHMARK(CreateNewBlockSelect, 20);
+BENCHMARK(CreateNewBlockCached, 20);
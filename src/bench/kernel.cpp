@@ -0,0 +1,93 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "chainparams.h"
+#include "kernel.h"
+#include "stakeinput.h"
+
+static const unsigned int KERNEL_NBITS = 0x1e0ffff0;
+
+struct KernelSetup {
+    CBlockIndex indexPrev;
+    CBlockIndex indexFrom;
+    CTransaction txFrom;
+    int nTime;
+
+    KernelSetup(unsigned int nOutputs)
+    {
+        const int nHeightV2 = Params().GetConsensus().height_start_StakeModifierV2;
+        indexPrev.nHeight = nHeightV2;
+        indexPrev.nTime = 1600000000;
+        indexPrev.SetStakeModifier(uint256S("5f0c9c5e3d1a3f0ab2e98c1c0a7d4be3e2f3a1bd9c6f0e4d7a8b9c0d1e2f3a4b"));
+        indexFrom.nHeight = nHeightV2 - 1000;
+        indexFrom.nTime = 1590000000;
+
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        for (unsigned int i = 0; i < nOutputs; i++)
+            tx.vout.emplace_back(CTxOut((i + 1) * 1000 * COIN, CScript() << OP_TRUE));
+        txFrom = CTransaction(tx);
+        nTime = indexPrev.nTime + 15;
+    }
+};
+
+// One stake kernel hash, built from scratch the way CheckProofOfStake does.
+static void StakeKernelHash(benchmark::State& state)
+{
+    KernelSetup setup(1);
+    CPivStake stake;
+    stake.SetPrevout(setup.txFrom, 0, &setup.indexFrom);
+
+    while (state.KeepRunning()) {
+        const CStakeKernel kernel(&setup.indexPrev, &stake, KERNEL_NBITS, setup.nTime);
+        kernel.GetHash();
+    }
+}
+
+// Full kernel check (hash plus weighted target comparison).
+static void StakeKernelCheck(benchmark::State& state)
+{
+    KernelSetup setup(1);
+    CPivStake stake;
+    stake.SetPrevout(setup.txFrom, 0, &setup.indexFrom);
+    const CStakeKernel kernel(&setup.indexPrev, &stake, KERNEL_NBITS, setup.nTime);
+
+    while (state.KeepRunning()) {
+        kernel.CheckKernelHash(true);
+    }
+}
+
+// Batched search of one time slot over 100 candidate inputs, as the staker does.
+static void StakeKernelSearch(benchmark::State& state)
+{
+    KernelSetup setup(100);
+    const CStakeKernelSlot slot(&setup.indexPrev, KERNEL_NBITS, setup.nTime);
+    std::vector<CStakeKernelInput> vInputs;
+    for (unsigned int n = 0; n < setup.txFrom.vout.size(); n++) {
+        CStakeKernelInput input;
+        input.hashTx = setup.txFrom.GetHash();
+        input.n = n;
+        input.nValue = setup.txFrom.vout[n].nValue;
+        input.nHeightBlockFrom = setup.indexFrom.nHeight;
+        input.nTimeBlockFrom = setup.indexFrom.nTime;
+        vInputs.push_back(input);
+    }
+
+    while (state.KeepRunning()) {
+        int nHashes = 0;
+        size_t nStart = 0;
+        while (nStart < vInputs.size()) {
+            const int nPos = SearchStakeKernel(slot, vInputs, nStart, nHashes);
+            if (nPos < 0)
+                break;
+            nStart = nPos + 1;
+        }
+    }
+}
+
+BENCHMARK(StakeKernelHash, 100 * 1000);
+BENCHMARK(StakeKernelCheck, 100 * 1000);
+BENCHMARK(StakeKernelSearch, 1000);
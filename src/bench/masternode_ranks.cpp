@@ -0,0 +1,49 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "bench/bench_util.h"
+
+#include "masternode.h"
+#include "masternodeman.h"
+#include "timedata.h"
+
+static const int BENCH_CHAIN_HEIGHT = 200;
+static const unsigned int BENCH_MASTERNODES = 1000;
+
+static CMasternode BenchMasternode(uint32_t n)
+{
+    CMasternode mn;
+    mn.vin = CTxIn(COutPoint(BenchHash(0x6d6e0000 + n), n % 2));
+    mn.pubKeyCollateralAddress = BenchKey(n).GetPubKey();
+    mn.pubKeyMasternode = mn.pubKeyCollateralAddress;
+    // enabled without a collateral lookup in the UTXO set
+    mn.unitTest = true;
+    mn.lastPing.vin = mn.vin;
+    mn.lastPing.blockHash = BenchHash(n);
+    mn.lastPing.sigTime = GetAdjustedTime();
+    mn.sigTime = mn.lastPing.sigTime - MASTERNODE_MIN_MNP_SECONDS - 1;
+    return mn;
+}
+
+// Full rank table of 1000 enabled masternodes, as requested for every
+// payment vote, mnw relay and budget finalization.
+static void MasternodeRanks(benchmark::State& state)
+{
+    BenchChain chain(BENCH_CHAIN_HEIGHT);
+    CMasternodeMan mnman;
+    for (unsigned int i = 0; i < BENCH_MASTERNODES; i++) {
+        CMasternode mn = BenchMasternode(i);
+        mn.Check(true);
+        bool fAdded = mnman.Add(mn);
+        assert(fAdded);
+    }
+
+    while (state.KeepRunning()) {
+        const std::vector<std::pair<int, CMasternode> > vRanks = mnman.GetMasternodeRanks(BENCH_CHAIN_HEIGHT, 0);
+        assert(vRanks.size() == BENCH_MASTERNODES);
+    }
+}
+
+BENCHMARK(MasternodeRanks, 50);
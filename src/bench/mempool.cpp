@@ -0,0 +1,66 @@
+// Copyright (c) 2011-2016 The Bitcoin Core developers
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "bench/bench_util.h"
+
+#include "txmempool.h"
+
+#include <list>
+
+// 100 independent chains of 10 transactions each, so that every add and
+// removal has to walk and update ancestor/descendant state.
+static const unsigned int BENCH_CHAINS = 100;
+static const unsigned int BENCH_CHAIN_LENGTH = 10;
+
+static std::vector<CTransaction> BenchChainedTxs()
+{
+    std::vector<CTransaction> vtx;
+    for (unsigned int c = 0; c < BENCH_CHAINS; c++) {
+        CMutableTransaction tx = BenchPaymentTx(c);
+        for (unsigned int i = 0; i < BENCH_CHAIN_LENGTH; i++) {
+            vtx.push_back(tx);
+            tx.vin[0].prevout = COutPoint(vtx.back().GetHash(), 0);
+            tx.vout[0].nValue -= 10000;
+        }
+    }
+    return vtx;
+}
+
+static void AddTxs(CTxMemPool& pool, const std::vector<CTransaction>& vtx)
+{
+    int64_t nTime = 0;
+    for (const CTransaction& tx : vtx) {
+        const CAmount nFee = 10000 + (tx.GetHash().GetCheapHash() % 10000);
+        pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, nTime++, 0.0, 1, 2));
+    }
+}
+
+static void MempoolAddUnchecked(benchmark::State& state)
+{
+    const std::vector<CTransaction> vtx = BenchChainedTxs();
+
+    while (state.KeepRunning()) {
+        CTxMemPool pool(CFeeRate(1000));
+        AddTxs(pool, vtx);
+    }
+}
+
+// Fill the pool, then mine every transaction in dependency order.
+static void MempoolRemoveForBlock(benchmark::State& state)
+{
+    const std::vector<CTransaction> vtx = BenchChainedTxs();
+
+    while (state.KeepRunning()) {
+        CTxMemPool pool(CFeeRate(1000));
+        AddTxs(pool, vtx);
+        std::list<CTransaction> conflicts;
+        pool.removeForBlock(vtx, 2, conflicts);
+        assert(pool.size() == 0);
+    }
+}
+
+BENCHMARK(MempoolAddUnchecked, 100);
+BENCHMARK(MempoolRemoveForBlock, 100);
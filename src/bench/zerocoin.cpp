@@ -0,0 +1,42 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "bench/bench_util.h"
+
+#include "chainparams.h"
+#include "libzerocoin/CoinSpend.h"
+
+/**
+ * Zerocoin spends are no longer created, so the zero-knowledge proofs are
+ * never verified again; what a node still runs for every historical v2
+ * spend it reads is the serial range check and the serial pubkey signature.
+ */
+class BenchCoinSpend : public libzerocoin::CoinSpend
+{
+public:
+    explicit BenchCoinSpend(const CKey& key)
+    {
+        version = libzerocoin::PrivateCoin::PUBKEY_VERSION;
+        spendType = libzerocoin::SpendType::SPEND;
+        setDenom(libzerocoin::CoinDenomination::ZQ_ONE);
+        setTxOutHash(BenchHash(0x7a63));
+        setPubKey(key.GetPubKey(), true);
+        bool fSigned = key.Sign(signatureHash(), vchSig);
+        assert(fSigned);
+    }
+};
+
+static void ZerocoinSpendVerify(benchmark::State& state)
+{
+    libzerocoin::ZerocoinParams* params = Params().GetConsensus().Zerocoin_Params(false);
+    const BenchCoinSpend spend(BenchKey(0));
+
+    while (state.KeepRunning()) {
+        bool fValid = spend.HasValidSerial(params) && spend.HasValidSignature();
+        assert(fValid);
+    }
+}
+
+BENCHMARK(ZerocoinSpendVerify, 5000);
@@ -0,0 +1,150 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "consensus/consensus.h"
+#include "consensus/merkle.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <limits>
+#include <unordered_map>
+
+// smallest serialized transaction (one input, one output), bounding the transaction count of a block
+static const unsigned int MIN_SERIALIZED_TX_SIZE = 60;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) :
+        fShortIDKey(false), nShortIDKey0(0), nShortIDKey1(0),
+        header(block.GetBlockHeader()), vchBlockSig(block.vchBlockSig), nNonce(GetRand(std::numeric_limits<uint64_t>::max()))
+{
+    // the coinbase and the coinstake are never in a peer's mempool
+    const size_t nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        if (i < nPrefilled)
+            vPrefilledTxn.push_back(CPrefilledTransaction(0, block.vtx[i]));
+        else
+            vShortTxIDs.push_back(CShortTxID(GetShortID(block.vtx[i].GetHash())));
+    }
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    if (!fShortIDKey) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << header << nNonce;
+        unsigned char hashKey[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write((const unsigned char*)&ss[0], ss.size()).Finalize(hashKey);
+        nShortIDKey0 = ReadLE64(hashKey);
+        nShortIDKey1 = ReadLE64(hashKey + 8);
+        fShortIDKey = true;
+    }
+    return SipHashUint256(nShortIDKey0, nShortIDKey1, txhash) & 0xffffffffffffULL;
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool)
+{
+    if (cmpctblock.header.IsNull() || cmpctblock.vPrefilledTxn.empty())
+        return READ_STATUS_INVALID;
+    const size_t nTxCount = cmpctblock.BlockTxCount();
+    if (nTxCount > MAX_BLOCK_SIZE_CURRENT / MIN_SERIALIZED_TX_SIZE || nTxCount > std::numeric_limits<uint16_t>::max())
+        return READ_STATUS_INVALID;
+
+    header = cmpctblock.header;
+    vchBlockSig = cmpctblock.vchBlockSig;
+    vtxAvailable.assign(nTxCount, CTransaction());
+    vHave.assign(nTxCount, false);
+
+    int nLastIndex = -1;
+    for (const CPrefilledTransaction& prefilled : cmpctblock.vPrefilledTxn) {
+        nLastIndex += prefilled.index + 1;
+        if (nLastIndex >= (int)nTxCount)
+            return READ_STATUS_INVALID;
+        vtxAvailable[nLastIndex] = prefilled.tx;
+        vHave[nLastIndex] = true;
+    }
+    nPrefilled = cmpctblock.vPrefilledTxn.size();
+
+    // position in the block of each short ID, skipping the prefilled transactions
+    std::unordered_map<uint64_t, uint16_t> mapShortIDs;
+    mapShortIDs.reserve(cmpctblock.vShortTxIDs.size());
+    size_t nIndex = 0;
+    for (const CShortTxID& shortid : cmpctblock.vShortTxIDs) {
+        while (vHave[nIndex])
+            nIndex++;
+        // two transactions of the block with the same short ID can't be told apart
+        if (!mapShortIDs.insert(std::make_pair(shortid.Get(), nIndex)).second)
+            return READ_STATUS_FAILED;
+        nIndex++;
+    }
+
+    // a short ID matched by several mempool transactions stays missing
+    std::vector<bool> vCollision(nTxCount, false);
+    {
+        LOCK(pool.cs);
+        for (CTxMemPool::indexed_transaction_set::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it) {
+            const CTransaction& tx = it->GetTx();
+            std::unordered_map<uint64_t, uint16_t>::const_iterator itID = mapShortIDs.find(cmpctblock.GetShortID(tx.GetHash()));
+            if (itID == mapShortIDs.end() || vCollision[itID->second])
+                continue;
+            if (vHave[itID->second]) {
+                vHave[itID->second] = false;
+                vCollision[itID->second] = true;
+                nFromMempool--;
+                continue;
+            }
+            vtxAvailable[itID->second] = tx;
+            vHave[itID->second] = true;
+            nFromMempool++;
+        }
+    }
+
+    LogPrint("cmpctblock", "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n",
+             header.GetHash().ToString(), GetSerializeSize(cmpctblock, SER_NETWORK, PROTOCOL_VERSION));
+    return READ_STATUS_OK;
+}
+
+std::vector<uint16_t> PartiallyDownloadedBlock::GetMissing() const
+{
+    std::vector<uint16_t> vMissing;
+    for (size_t i = 0; i < vHave.size(); i++)
+        if (!vHave[i])
+            vMissing.push_back(i);
+    return vMissing;
+}
+
+ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing) const
+{
+    if (header.IsNull())
+        return READ_STATUS_INVALID;
+
+    block = CBlock(header);
+    block.vchBlockSig = vchBlockSig;
+    block.vtx.reserve(vtxAvailable.size());
+    size_t nMissing = 0;
+    for (size_t i = 0; i < vtxAvailable.size(); i++) {
+        if (vHave[i]) {
+            block.vtx.push_back(vtxAvailable[i]);
+        } else {
+            if (nMissing >= vtxMissing.size())
+                return READ_STATUS_INVALID;
+            block.vtx.push_back(vtxMissing[nMissing++]);
+        }
+    }
+    if (nMissing != vtxMissing.size())
+        return READ_STATUS_INVALID;
+
+    // A short ID collision with a mempool transaction yields a different block: fetch it in full
+    // rather than letting validation reject the block.
+    bool fMutated;
+    if (BlockMerkleRoot(block, &fMutated) != header.hashMerkleRoot || fMutated)
+        return READ_STATUS_FAILED;
+
+    return READ_STATUS_OK;
+}
@@ -0,0 +1,206 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef OASIS_BLOCKENCODINGS_H
+#define OASIS_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+
+#include <limits>
+#include <vector>
+
+class CTxMemPool;
+
+/** Short transaction ID of a compact block: the low 48 bits of a keyed SipHash of the txid */
+class CShortTxID
+{
+public:
+    uint32_t nLow;
+    uint16_t nHigh;
+
+    CShortTxID() : nLow(0), nHigh(0) {}
+    explicit CShortTxID(uint64_t nShortID) : nLow(nShortID & 0xffffffff), nHigh((nShortID >> 32) & 0xffff) {}
+
+    uint64_t Get() const { return ((uint64_t)nHigh << 32) | nLow; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nLow);
+        READWRITE(nHigh);
+    }
+};
+
+/** A transaction sent in full within a compact block. On the wire, and in this object, index is
+ *  the offset from the previous prefilled transaction (differential encoding). */
+class CPrefilledTransaction
+{
+public:
+    uint16_t index;
+    CTransaction tx;
+
+    CPrefilledTransaction() : index(0) {}
+    CPrefilledTransaction(uint16_t indexIn, const CTransaction& txIn) : index(indexIn), tx(txIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(index) + ::GetSerializeSize(tx, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, index);
+        ::Serialize(s, tx, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        uint64_t nIndex = ReadCompactSize(s);
+        if (nIndex > std::numeric_limits<uint16_t>::max())
+            throw std::ios_base::failure("prefilled transaction index overflowed 16 bits");
+        index = nIndex;
+        ::Unserialize(s, tx, nType, nVersion);
+    }
+};
+
+/**
+ * A block relayed as its header, the short IDs of its transactions and its block signature
+ * ("cmpctblock", BIP 152 layout followed by vchBlockSig), to be rebuilt by the receiver from its
+ * mempool. The coinbase, and the coinstake of a proof-of-stake block, are never in a mempool and
+ * are always sent in full.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    // SipHash key of the short IDs, derived from the header and the nonce
+    mutable bool fShortIDKey;
+    mutable uint64_t nShortIDKey0;
+    mutable uint64_t nShortIDKey1;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+    uint64_t nNonce;
+    std::vector<CShortTxID> vShortTxIDs;
+    std::vector<CPrefilledTransaction> vPrefilledTxn;
+
+    CBlockHeaderAndShortTxIDs() : fShortIDKey(false), nShortIDKey0(0), nShortIDKey1(0), nNonce(0) {}
+    explicit CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+
+    size_t BlockTxCount() const { return vShortTxIDs.size() + vPrefilledTxn.size(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(header);
+        READWRITE(nNonce);
+        READWRITE(vShortTxIDs);
+        READWRITE(vPrefilledTxn);
+        READWRITE(vchBlockSig);
+        fShortIDKey = false;
+    }
+};
+
+/** Request for the transactions of a compact block that could not be found in the mempool
+ *  ("getblocktxn"). vIndexes holds the positions in the block, sent differentially encoded. */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<uint16_t> vIndexes;
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        unsigned int nSize = ::GetSerializeSize(blockhash, nType, nVersion) + GetSizeOfCompactSize(vIndexes.size());
+        for (size_t i = 0; i < vIndexes.size(); i++)
+            nSize += GetSizeOfCompactSize(vIndexes[i] - (i == 0 ? 0 : vIndexes[i - 1] + 1));
+        return nSize;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, blockhash, nType, nVersion);
+        WriteCompactSize(s, vIndexes.size());
+        for (size_t i = 0; i < vIndexes.size(); i++)
+            WriteCompactSize(s, vIndexes[i] - (i == 0 ? 0 : vIndexes[i - 1] + 1));
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        ::Unserialize(s, blockhash, nType, nVersion);
+        uint64_t nCount = ReadCompactSize(s);
+        vIndexes.clear();
+        uint64_t nIndex = 0;
+        for (uint64_t i = 0; i < nCount; i++) {
+            nIndex += ReadCompactSize(s) + (i == 0 ? 0 : 1);
+            if (nIndex > std::numeric_limits<uint16_t>::max())
+                throw std::ios_base::failure("getblocktxn index overflowed 16 bits");
+            vIndexes.push_back(nIndex);
+        }
+    }
+};
+
+/** Answer to a CBlockTransactionsRequest ("blocktxn"), the transactions in the requested order */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> vtx;
+
+    CBlockTransactions() {}
+    explicit CBlockTransactions(const CBlockTransactionsRequest& req) : blockhash(req.blockhash), vtx(req.vIndexes.size()) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        READWRITE(vtx);
+    }
+};
+
+enum ReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, //! the peer sent a malformed compact block or transactions
+    READ_STATUS_FAILED,  //! the block could not be rebuilt (e.g. short ID collision), fetch it in full
+};
+
+/** A block being rebuilt from a compact block, the mempool and the transactions requested from the peer */
+class PartiallyDownloadedBlock
+{
+private:
+    std::vector<CTransaction> vtxAvailable;
+    std::vector<bool> vHave;
+    size_t nPrefilled;
+    size_t nFromMempool;
+
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    PartiallyDownloadedBlock() : nPrefilled(0), nFromMempool(0) {}
+
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool);
+    /** Positions of the transactions to request from the peer */
+    std::vector<uint16_t> GetMissing() const;
+    /** Assemble the block from the available transactions and vtxMissing, in the order of GetMissing() */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing) const;
+
+    size_t GetPrefilledCount() const { return nPrefilled; }
+    size_t GetMempoolCount() const { return nFromMempool; }
+};
+
+#endif // OASIS_BLOCKENCODINGS_H
@@ -0,0 +1,283 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "pubkey.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "undo.h"
+
+#include <algorithm>
+#include <ios>
+
+namespace {
+
+/** Writes bits to a byte vector, most significant bit first */
+class CBitWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+    uint8_t nBuffer{0};
+    int nOffset{0};
+
+public:
+    explicit CBitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+
+    //! Write the nBits (1 to 64) lowest bits of nData
+    void Write(uint64_t nData, int nBits)
+    {
+        while (nBits > 0) {
+            const int nChunk = std::min(8 - nOffset, nBits);
+            nBuffer |= (nData << (64 - nBits)) >> (64 - 8 + nOffset);
+            nOffset += nChunk;
+            nBits -= nChunk;
+            if (nOffset == 8)
+                Flush();
+        }
+    }
+
+    //! Write the last partial byte, padded with zeros
+    void Flush()
+    {
+        if (nOffset == 0)
+            return;
+        vch.push_back(nBuffer);
+        nBuffer = 0;
+        nOffset = 0;
+    }
+};
+
+/** Reads the bits written by a CBitWriter */
+class CBitReader
+{
+private:
+    const std::vector<unsigned char>& vch;
+    size_t nPos{0};
+    uint8_t nBuffer{0};
+    int nOffset{8};
+
+public:
+    explicit CBitReader(const std::vector<unsigned char>& vchIn) : vch(vchIn) {}
+
+    uint64_t Read(int nBits)
+    {
+        uint64_t nData = 0;
+        while (nBits > 0) {
+            if (nOffset == 8) {
+                if (nPos >= vch.size())
+                    throw std::ios_base::failure("CBitReader::Read(): end of data");
+                nBuffer = vch[nPos++];
+                nOffset = 0;
+            }
+            const int nChunk = std::min(8 - nOffset, nBits);
+            nData <<= nChunk;
+            nData |= static_cast<uint8_t>(nBuffer << nOffset) >> (8 - nChunk);
+            nOffset += nChunk;
+            nBits -= nChunk;
+        }
+        return nData;
+    }
+};
+
+void GolombRiceEncode(CBitWriter& writer, uint64_t n)
+{
+    // the quotient in unary, terminated by a zero, then the remainder
+    uint64_t q = n >> BLOCK_FILTER_P;
+    while (q > 0) {
+        const int nBits = q <= 64 ? (int)q : 64;
+        writer.Write(~0ULL, nBits);
+        q -= nBits;
+    }
+    writer.Write(0, 1);
+    writer.Write(n, BLOCK_FILTER_P);
+}
+
+uint64_t GolombRiceDecode(CBitReader& reader)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1)
+        q++;
+    const uint64_t r = reader.Read(BLOCK_FILTER_P);
+    return (q << BLOCK_FILTER_P) + r;
+}
+
+/** x * n / 2^64: maps a uniformly distributed 64-bit value into [0, n) */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)n) >> 64);
+#else
+    // high 64 bits of the product, from 32-bit halves
+    const uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    const uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    const uint64_t ac = x_hi * n_hi;
+    const uint64_t ad = x_hi * n_lo;
+    const uint64_t bc = x_lo * n_hi;
+    const uint64_t bd = x_lo * n_lo;
+    const uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+void AddKeyFilterElement(const CKeyID& keyID, BlockFilterElementSet& elements)
+{
+    const CScript script = GetScriptForDestination(keyID);
+    elements.insert(BlockFilterElement(script.begin(), script.end()));
+}
+
+} // anon namespace
+
+const BlockFilterElement& ZerocoinMintMarker()
+{
+    static const BlockFilterElement marker(1, OP_ZEROCOINMINT);
+    return marker;
+}
+
+const BlockFilterElement& ZerocoinSpendMarker()
+{
+    static const BlockFilterElement marker(1, OP_ZEROCOINSPEND);
+    return marker;
+}
+
+void AddScriptFilterElements(const CScript& script, BlockFilterElementSet& elements)
+{
+    if (script.empty() || script.IsUnspendable())
+        return;
+    elements.insert(BlockFilterElement(script.begin(), script.end()));
+
+    std::vector<valtype> vSolutions;
+    txnouttype whichType;
+    if (!Solver(script, whichType, vSolutions))
+        return;
+
+    switch (whichType) {
+    case TX_PUBKEY:
+        AddKeyFilterElement(CPubKey(vSolutions[0]).GetID(), elements);
+        break;
+    case TX_COLDSTAKE:
+        AddKeyFilterElement(CKeyID(uint160(vSolutions[0])), elements);
+        AddKeyFilterElement(CKeyID(uint160(vSolutions[1])), elements);
+        break;
+    case TX_MULTISIG:
+        for (size_t i = 1; i + 1 < vSolutions.size(); i++)
+            AddKeyFilterElement(CPubKey(vSolutions[i]).GetID(), elements);
+        break;
+    case TX_ZEROCOINMINT:
+        elements.insert(ZerocoinMintMarker());
+        break;
+    default:
+        break;
+    }
+}
+
+CBlockFilter::CBlockFilter(const uint256& hashBlockIn, const BlockFilterElementSet& elements) :
+        hashBlock(hashBlockIn), nElements(elements.size())
+{
+    SetKey();
+
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (const BlockFilterElement& element : elements)
+        vHashes.push_back(HashToRange(element));
+    std::sort(vHashes.begin(), vHashes.end());
+
+    CBitWriter writer(vData);
+    uint64_t nLast = 0;
+    for (uint64_t nHash : vHashes) {
+        GolombRiceEncode(writer, nHash - nLast);
+        nLast = nHash;
+    }
+    writer.Flush();
+}
+
+static BlockFilterElementSet BlockFilterElements(const CBlock& block, const CBlockUndo* pblockundo)
+{
+    BlockFilterElementSet elements;
+    for (const CTransaction& tx : block.vtx) {
+        for (const CTxOut& txout : tx.vout)
+            AddScriptFilterElements(txout.scriptPubKey, elements);
+        if (tx.HasZerocoinSpendInputs())
+            elements.insert(ZerocoinSpendMarker());
+    }
+    if (pblockundo) {
+        for (const CTxUndo& txundo : pblockundo->vtxundo) {
+            for (const Coin& coin : txundo.vprevout)
+                AddScriptFilterElements(coin.out.scriptPubKey, elements);
+        }
+    }
+    return elements;
+}
+
+CBlockFilter::CBlockFilter(const CBlock& block, const CBlockUndo* pblockundo) :
+        CBlockFilter(block.GetHash(), BlockFilterElements(block, pblockundo))
+{
+}
+
+void CBlockFilter::SetKey()
+{
+    k0 = ReadLE64(hashBlock.begin());
+    k1 = ReadLE64(hashBlock.begin() + 8);
+}
+
+uint64_t CBlockFilter::HashToRange(const BlockFilterElement& element) const
+{
+    const uint64_t nHash = SipHash(k0, k1, element.data(), element.size());
+    return MapIntoRange(nHash, nElements * BLOCK_FILTER_M);
+}
+
+std::vector<unsigned char> CBlockFilter::GetEncoded() const
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    WriteCompactSize(ss, nElements);
+    ss.write((const char*)vData.data(), vData.size());
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+uint256 CBlockFilter::ComputeHeader(const uint256& hashPrevHeader) const
+{
+    const std::vector<unsigned char> vEncoded = GetEncoded();
+    const uint256 hashFilter = Hash(vEncoded.begin(), vEncoded.end());
+    return Hash(hashFilter.begin(), hashFilter.end(), hashPrevHeader.begin(), hashPrevHeader.end());
+}
+
+bool CBlockFilter::MatchInternal(std::vector<uint64_t>& vQuery) const
+{
+    std::sort(vQuery.begin(), vQuery.end());
+    CBitReader reader(vData);
+    uint64_t nValue = 0;
+    std::vector<uint64_t>::const_iterator it = vQuery.begin();
+    try {
+        for (uint64_t i = 0; i < nElements && it != vQuery.end(); i++) {
+            nValue += GolombRiceDecode(reader);
+            while (it != vQuery.end() && *it < nValue)
+                it++;
+            if (it != vQuery.end() && *it == nValue)
+                return true;
+        }
+    } catch (const std::ios_base::failure&) {
+        // a truncated filter can't rule anything out
+        return true;
+    }
+    return false;
+}
+
+bool CBlockFilter::Match(const BlockFilterElement& element) const
+{
+    std::vector<uint64_t> vQuery(1, HashToRange(element));
+    return MatchInternal(vQuery);
+}
+
+bool CBlockFilter::MatchAny(const BlockFilterElementSet& elements) const
+{
+    if (nElements == 0)
+        return false;
+    std::vector<uint64_t> vQuery;
+    vQuery.reserve(elements.size());
+    for (const BlockFilterElement& element : elements)
+        vQuery.push_back(HashToRange(element));
+    return MatchInternal(vQuery);
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILTER_H
+#define BITCOIN_BLOCKFILTER_H
+
+#include "primitives/block.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <vector>
+
+class CBlockUndo;
+
+//! Golomb-Rice parameter of the block filters (BIP158 basic filter)
+static const uint8_t BLOCK_FILTER_P = 19;
+//! Inverse false positive rate of the block filters (BIP158 basic filter)
+static const uint32_t BLOCK_FILTER_M = 784931;
+//! Filter type of getcfilters and cfilter: the elements differ from BIP158's basic filter (type 0)
+static const uint8_t BLOCK_FILTER_TYPE = 0x80;
+
+typedef std::vector<unsigned char> BlockFilterElement;
+typedef std::set<BlockFilterElement> BlockFilterElementSet;
+
+/**
+ * Elements a script contributes to a block filter: the script itself, plus the P2PKH script of
+ * every key that a P2PK, P2CS (cold staking) or bare multisig script pays to, so that a
+ * wallet can look for its keys with their P2PKH scripts alone. Zerocoin mints add the
+ * ZerocoinMintMarker() as well. Empty and unspendable scripts add nothing.
+ */
+void AddScriptFilterElements(const CScript& script, BlockFilterElementSet& elements);
+
+/** Element of every block with a zerocoin mint, for the wallets that can't tell their own mints */
+const BlockFilterElement& ZerocoinMintMarker();
+/** Element of every block with a zerocoin spend, whose inputs don't spend a script */
+const BlockFilterElement& ZerocoinSpendMarker();
+
+/**
+ * Compact filter of a block (Golomb-coded set, as in BIP158) over the scripts its outputs pay
+ * to and the scripts its inputs spend (read from the block's undo data), see
+ * AddScriptFilterElements. Matching is probabilistic: a block that matches may still hold
+ * nothing of interest (1 in BLOCK_FILTER_M per element queried), one that doesn't match
+ * certainly doesn't.
+ */
+class CBlockFilter
+{
+private:
+    uint256 hashBlock;
+    //! SipHash key: the first 16 bytes of the block hash
+    uint64_t k0{0};
+    uint64_t k1{0};
+    uint64_t nElements{0};
+    //! Golomb-Rice coded deltas of the sorted element hashes
+    std::vector<unsigned char> vData;
+
+    void SetKey();
+    uint64_t HashToRange(const BlockFilterElement& element) const;
+    bool MatchInternal(std::vector<uint64_t>& vQuery) const;
+
+public:
+    CBlockFilter() {}
+    CBlockFilter(const uint256& hashBlockIn, const BlockFilterElementSet& elements);
+    //! Filter of a block, the undo data is null for the genesis block
+    CBlockFilter(const CBlock& block, const CBlockUndo* pblockundo);
+
+    const uint256& GetBlockHash() const { return hashBlock; }
+    uint64_t GetElementCount() const { return nElements; }
+    //! The filter as served to peers: CompactSize element count, then the coded set
+    std::vector<unsigned char> GetEncoded() const;
+    //! Filter header committing to this filter and the previous block's filter header
+    uint256 ComputeHeader(const uint256& hashPrevHeader) const;
+
+    bool Match(const BlockFilterElement& element) const;
+    bool MatchAny(const BlockFilterElementSet& elements) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlock);
+        READWRITE(VARINT(nElements));
+        READWRITE(vData);
+        if (ser_action.ForRead())
+            SetKey();
+    }
+};
+
+#endif // BITCOIN_BLOCKFILTER_H
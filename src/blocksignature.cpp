@@ -63,6 +63,10 @@ bool CheckBlockSignature(const CBlock& block)
     if (block.vchBlockSig.empty())
         return error("%s: vchBlockSig is empty!", __func__);
 
+    // already verified ahead of the tip by the validation pipeline
+    if (block.fSignatureChecked)
+        return true;
+
     /** Each block is signed by the private key of the input that is staked.
      * The public key that signs must match the public key associated with the first utxo of the coinstake tx.
      */
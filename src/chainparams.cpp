@@ -148,6 +148,7 @@ public:
         assert(genesis.hashMerkleRoot == uint256("92efca81c11c8026ae8ee4fc743aee0e458f5b9866b917c381b0d3a1e7edda63"));
 
         consensus.fPowAllowMinDifficultyBlocks = false;
+        consensus.hashDefaultAssumeValid = uint256("0xab424d044357b3db106a8256cf840da72fa07f93c4548f5993b7b863d618fcbe"); // block 315204
         consensus.powLimit   = ~UINT256_ZERO >> 20;   // oasis starting difficulty is 1 / 2^12
         consensus.posLimitV1 = ~UINT256_ZERO >> 24;
         consensus.posLimitV2 = ~UINT256_ZERO >> 20;
@@ -313,6 +314,7 @@ public:
         consensus.height_start_ZC_PublicSpends = 500;
         consensus.height_start_ZC_SerialsV2 = 500;
         consensus.fPowAllowMinDifficultyBlocks = true;
+        consensus.hashDefaultAssumeValid = UINT256_ZERO;
         consensus.powLimit   = ~UINT256_ZERO >> 20;   // oasis starting difficulty is 1 / 2^12
         consensus.posLimitV1 = ~UINT256_ZERO >> 24;
         consensus.posLimitV2 = ~UINT256_ZERO >> 20;
@@ -381,6 +383,7 @@ public:
         vSeeds.clear();      //! Testnet mode doesn't have any DNS seeds.
 
         consensus.fPowAllowMinDifficultyBlocks = true;
+        consensus.hashDefaultAssumeValid = UINT256_ZERO;
 
         //========================= pre oasis leap regtest params end with the last variable above this line. ========================//
 
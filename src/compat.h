@@ -11,6 +11,11 @@
 #include "config/oasis-config.h"
 #endif
 
+#if !defined(WIN32) && defined(HAVE_SYS_EPOLL_H)
+// the socket handler waits on epoll, which has no limit on descriptor numbers
+#define USE_EPOLL 1
+#endif
+
 #ifdef WIN32
 #ifdef _WIN32_WINNT
 #undef _WIN32_WINNT
@@ -95,7 +100,7 @@ size_t strnlen( const char *start, size_t max_len);
 
 bool static inline IsSelectableSocket(SOCKET s)
 {
-#ifdef WIN32
+#if defined(WIN32) || defined(USE_EPOLL)
     return true;
 #else
     return (s < FD_SETSIZE);
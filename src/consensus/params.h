@@ -19,6 +19,8 @@ namespace Consensus {
  */
 struct Params {
     uint256 hashGenesisBlock;
+    //! Default for -assumevalid: the scripts of its ancestors are not checked
+    uint256 hashDefaultAssumeValid;
     bool fPowAllowMinDifficultyBlocks;
     uint256 powLimit;
     uint256 posLimitV1;
@@ -48,6 +48,7 @@
 
 #ifdef ENABLE_WALLET
 #include "wallet/db.h"
+#include "wallet/logdb.h"
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 
@@ -149,10 +150,10 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch (const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -203,8 +204,10 @@ void PrepareShutdown()
     StopRPC();
     StopHTTPServer();
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
+    if (pwalletMain) {
         bitdb.Flush(false);
+        logdb.Flush(false);
+    }
     GenerateBitcoins(false, NULL, 0);
 #endif
     StopNode();
@@ -244,14 +247,20 @@ void PrepareShutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete pblockfilterdb;
+        pblockfilterdb = NULL;
         delete zerocoinDB;
         zerocoinDB = NULL;
         delete pSporkDB;
         pSporkDB = NULL;
+        delete pmnStateDB;
+        pmnStateDB = NULL;
     }
 #ifdef ENABLE_WALLET
-    if (pwalletMain)
+    if (pwalletMain) {
         bitdb.Flush(true);
+        logdb.Flush(true);
+    }
 #endif
 
 #if ENABLE_ZMQ
@@ -382,6 +391,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("This help message"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and skip their script and signature verification (0 to verify all, default: %s, testnet: %s)"), Params(CBaseChainParams::MAIN).GetConsensus().hashDefaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().hashDefaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-blockcheckthreads=<n>", strprintf(_("Set the number of threads pre-checking the blocks received during initial block download (%d to %d, 0 = auto, -1 = disabled, default: %d)"), -1, MAX_BLOCKCHECK_THREADS, DEFAULT_BLOCKCHECK_THREADS));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-blocksizenotify=<cmd>", _("Execute command when the best block changes and its size is over (%s in cmd is replaced by block hash, %d with the block size)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 500));
@@ -396,6 +407,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxreorg=<n>", strprintf(_("Set the Maximum reorg depth (default: %u)"), DEFAULT_MAX_REORG_DEPTH));
+    strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
@@ -408,6 +420,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain compact filters of the scripts of each block, used by wallet rescans and served to light clients (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageOpt("-forcestart", _("Attempt to force blockchain corruption recovery") + " " + _("on startup"));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -457,9 +470,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
     strUsage += HelpMessageOpt("-skipmnemonicstartupui", _("Skip the Mnemonic startup page, this would be useful in case you were testing something"));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), 100));
+    if (GetBoolArg("-help-debug", false))
+        strUsage += HelpMessageOpt("-checkbalances", strprintf("Check the cached wallet balances against a full scan of the wallet transactions on every read (default: %u)", 0));
     if (GetBoolArg("-help-debug", false))
         strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf(_("Fees (in XOS/Kb) smaller than this are considered zero fee for transaction creation (default: %s)"),
             FormatMoney(CWallet::minTxFee.GetFeePerK())));
+    strUsage += HelpMessageOpt("-migratewallet", _("Move a Berkeley DB wallet file into LevelDB (see -walletdb), keeping the file as <file>.<timestamp>.bak") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-paytxfee=<amt>", strprintf(_("Fee (in XOS/kB) to add to transactions you send (default: %s)"), FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet.dat") + " " + _("on startup"));
@@ -474,6 +490,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-hdseed", _("User defined seed for HD wallet (should be in hex). Only has effect during wallet creation/first start (default: randomly generated)"));
     strUsage += HelpMessageOpt("-upgradewallet", _("Upgrade wallet to latest format") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file (within data directory)") + " " + strprintf(_("(default: %s)"), "wallet.dat"));
+    strUsage += HelpMessageOpt("-walletdb=<type>", strprintf(_("Storage of a new wallet: bdb (a single Berkeley DB file) or leveldb (log-structured, with batched commits) (default: %s)"), DEFAULT_WALLETDB));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
     if (mode == HMM_BITCOIN_QT)
         strUsage += HelpMessageOpt("-windowtitle=<name>", _("Wallet window title"));
@@ -507,7 +524,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf(_("Stop running after importing blocks from disk (default: %u)"), 0));
         strUsage += HelpMessageOpt("-sporkkey=<privkey>", _("Enable spork administration functionality with the appropriate private key."));
     }
-    std::string debugCategories = "addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, tor, mempool, net, proxy, http, libevent, oasis, (obfuscation, swiftx, masternode, mnpayments, mnbudget, zero, staking)"; // Don't translate these and qt below
+    std::string debugCategories = "addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, tor, mempool, net, cmpctblock, proxy, http, libevent, oasis, (obfuscation, swiftx, masternode, mnpayments, mnbudget, zero, staking)"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
     strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -522,9 +539,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), 0));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), 1));
     if (GetBoolArg("-help-debug", false)) {
+        strUsage += HelpMessageOpt("-limitancestorcount=<n>", strprintf("Do not accept transactions if number of in-mempool ancestors is <n> or more (default: %u)", DEFAULT_ANCESTOR_LIMIT));
+        strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
+        strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf(_("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default:%u)"), 15));
         strUsage += HelpMessageOpt("-relaypriority", strprintf(_("Require high priority for relaying free or low-fee transactions (default:%u)"), 1));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf(_("Limit size of signature cache to <n> entries (default: %u)"), 50000));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", _("Deprecated, use -sigcachemb: limit size of signature cache to <n> entries, 0 to disable it"));
+        strUsage += HelpMessageOpt("-sigcachemb=<n>", strprintf(_("Limit size of signature cache to <n> MiB, 0 to disable it (0 to %d, default: %d)"), MAX_SIG_CACHE_MB, DEFAULT_SIG_CACHE_MB));
     }
     strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in XOS/Kb) smaller than this are considered zero fee for relaying (default: %s)"), FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -546,6 +568,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-coldstaking=<n>", strprintf(_("Enable cold staking functionality (0-1, default: %u). Disabled if staking=0"), 1));
     strUsage += HelpMessageOpt("-XOSstake=<n>", strprintf(_("Enable or disable staking functionality for XOS inputs (0-1, default: %u)"), 1));
     strUsage += HelpMessageOpt("-reservebalance=<amt>", _("Keep the specified amount available for spending at all times (default: 0)"));
+    strUsage += HelpMessageOpt("-stakingthreads=<n>", strprintf(_("Set the number of stake kernel search threads (%u to %d, 0 = auto, default: %d)"), 0, MAX_STAKING_THREADS, DEFAULT_STAKING_THREADS));
     if (GetBoolArg("-help-debug", false)) {
         strUsage += HelpMessageOpt("-printstakemodifier", _("Display the stake modifier calculations in the debug.log file."));
         strUsage += HelpMessageOpt("-printcoinstake", _("Display verbose coin stake messages in the debug.log file."));
@@ -556,6 +579,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-masternode=<n>", strprintf(_("Enable the client to act as a masternode (0-1, default: %u)"), 0));
     strUsage += HelpMessageOpt("-mnconf=<file>", strprintf(_("Specify masternode configuration file (default: %s)"), "masternode.conf"));
     strUsage += HelpMessageOpt("-mnconflock=<n>", strprintf(_("Lock masternodes from masternode configuration file (default: %u)"), 1));
+    strUsage += HelpMessageOpt("-mnmsgthreads=<n>", strprintf(_("Set the number of threads processing masternode, payment, budget and spork messages (0 to %d, 0 = use the message handler thread, default: %d)"), MAX_MASTERNODE_MESSAGE_THREADS, DEFAULT_MASTERNODE_MESSAGE_THREADS));
     strUsage += HelpMessageOpt("-masternodeprivkey=<n>", _("Set the masternode private key"));
     strUsage += HelpMessageOpt("-masternodeaddr=<n>", strprintf(_("Set external address:port to get to this masternode (example: %s)"), "128.127.106.235:2358"));
     strUsage += HelpMessageOpt("-budgetvotemode=<mode>", _("Change automatic finalized budget voting behavior. mode=auto: Vote for only exact finalized budget match to my generated budget. (string, default: auto)"));
@@ -942,7 +966,11 @@ bool AppInit2(const std::vector<std::string>& words)
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
+#ifdef USE_EPOLL
+    nMaxConnections = std::max(nMaxConnections, 0);
+#else
     nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+#endif
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -978,6 +1006,12 @@ bool AppInit2(const std::vector<std::string>& words)
     fCheckBlockIndex = GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
 
+    hashAssumeValid = uint256S(GetArg("-assumevalid", Params().GetConsensus().hashDefaultAssumeValid.GetHex()));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid signatures.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating signatures for all blocks.\n");
+
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
     if (nScriptCheckThreads <= 0)
@@ -1004,6 +1038,11 @@ bool AppInit2(const std::vector<std::string>& words)
     if (nConnectTimeout <= 0)
         nConnectTimeout = DEFAULT_CONNECT_TIMEOUT;
 
+    // the mempool must be able to hold a few blocks' worth of transactions
+    int64_t nMempoolSizeMin = 10 * MAX_BLOCK_SIZE_CURRENT;
+    if (GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000 < nMempoolSizeMin)
+        return InitError(strprintf(_("-maxmempool must be at least %d MB"), (nMempoolSizeMin + 999999) / 1000000));
+
     // Fee-per-kilobyte amount considered the same as "free"
     // If you are mining, be careful setting this:
     // if you set it to zero then
@@ -1052,10 +1091,14 @@ bool AppInit2(const std::vector<std::string>& words)
     }
     nTxConfirmTarget = GetArg("-txconfirmtarget", 1);
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", false);
+    fCheckBalances = GetBoolArg("-checkbalances", false);
     bdisableSystemnotifications = GetBoolArg("-disablesystemnotifications", false);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", false);
 
     std::string strWalletFile = GetArg("-wallet", "wallet.dat");
+    std::string strWalletDB = GetArg("-walletdb", DEFAULT_WALLETDB);
+    if (strWalletDB != "bdb" && strWalletDB != "leveldb")
+        return InitError(strprintf(_("Unknown -walletdb type: %s"), strWalletDB));
 #endif // ENABLE_WALLET
 
     fIsBareMultisigStd = GetBoolArg("-permitbaremultisig", true) != 0;
@@ -1064,6 +1107,9 @@ bool AppInit2(const std::vector<std::string>& words)
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices |= NODE_BLOOM;
 
+    // NODE_SCRIPT_FILTERS is advertised once ThreadBlockFilterIndex has caught up with the chain
+    fBlockFilterIndex = GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
@@ -1117,6 +1163,20 @@ bool AppInit2(const std::vector<std::string>& words)
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    // -blockcheckthreads=0 means autodetect, a negative value disables the validation pipeline
+    int nBlockCheckThreads = GetArg("-blockcheckthreads", DEFAULT_BLOCKCHECK_THREADS);
+    if (nBlockCheckThreads == 0)
+        nBlockCheckThreads = std::min((int)boost::thread::hardware_concurrency() - 1, MAX_BLOCKCHECK_THREADS);
+    else if (nBlockCheckThreads > MAX_BLOCKCHECK_THREADS)
+        nBlockCheckThreads = MAX_BLOCKCHECK_THREADS;
+    if (nBlockCheckThreads > 0) {
+        LogPrintf("Using %u threads for block pre-checks\n", nBlockCheckThreads);
+        SetBlockCheckThreads(nBlockCheckThreads);
+        for (int i = 0; i < nBlockCheckThreads; i++)
+            threadGroup.create_thread(&ThreadBlockCheck);
+        threadGroup.create_thread(&ThreadBlockConnect);
+    }
+
     if (mapArgs.count("-sporkkey")) // spork priv key
     {
         if (!sporkManager.SetPrivKey(GetArg("-sporkkey", "")))
@@ -1158,6 +1218,11 @@ bool AppInit2(const std::vector<std::string>& words)
                 sourcePathStr += "/" + strWalletFile;
                 boost::filesystem::path sourceFile = sourcePathStr;
                 boost::filesystem::path backupFile = backupPathStr + dateTimeStr;
+                // a wallet in LevelDB is backed up as a wallet.dat, exported from it
+                const std::string strFileExport = strWalletFile + ".export";
+                const bool fLogDB = logdb.Exists(strWalletFile);
+                if (fLogDB && CDB::Export(strWalletFile, strFileExport))
+                    sourceFile = GetDataDir() / strFileExport;
                 sourceFile.make_preferred();
                 backupFile.make_preferred();
                 if (boost::filesystem::exists(sourceFile)) {
@@ -1174,6 +1239,8 @@ bool AppInit2(const std::vector<std::string>& words)
                     dst << src.rdbuf();
 #endif
                 }
+                if (fLogDB)
+                    bitdb.RemoveDb(strFileExport);
                 // Keep only the last 10 backups, including the new one of course
                 typedef std::multimap<std::time_t, boost::filesystem::path> folder_set_t;
                 folder_set_t folder_set;
@@ -1266,13 +1333,22 @@ bool AppInit2(const std::vector<std::string>& words)
             }
         }
 
+        const bool fLogDB = logdb.Exists(strWalletFile);
         if (GetBoolArg("-salvagewallet", false)) {
-            // Recover readable keypairs:
-            if (!CWalletDB::Recover(bitdb, strWalletFile, true))
-                return false;
+            if (fLogDB) {
+                if (!logdb.Repair(strWalletFile))
+                    return InitError(_("Wallet database corrupt, repair failed"));
+            } else {
+                // Recover readable keypairs:
+                if (!CWalletDB::Recover(bitdb, strWalletFile, true))
+                    return false;
+            }
         }
 
-        if (boost::filesystem::exists(GetDataDir() / strWalletFile)) {
+        if (fLogDB && boost::filesystem::exists(GetDataDir() / strWalletFile)) {
+            InitWarning(strprintf(_("Warning: the wallet is kept in %s, %s is not used."),
+                CLogDBEnv::GetPath(strWalletFile).string(), strWalletFile));
+        } else if (boost::filesystem::exists(GetDataDir() / strWalletFile)) {
             CDBEnv::VerifyResult r = bitdb.Verify(strWalletFile, CWalletDB::Recover);
             if (r == CDBEnv::RECOVER_OK) {
                 std::string msg = strprintf(_("Warning: wallet.dat corrupt, data salvaged!"
@@ -1284,6 +1360,12 @@ bool AppInit2(const std::vector<std::string>& words)
             }
             if (r == CDBEnv::RECOVER_FAIL)
                 return InitError(_("wallet.dat corrupt, salvage failed"));
+
+            if (GetBoolArg("-migratewallet", false)) {
+                uiInterface.InitMessage(_("Migrating wallet..."));
+                if (!CDB::Migrate(strWalletFile))
+                    return InitError(strprintf(_("Failed to move %s into LevelDB, see debug.log"), strWalletFile));
+            }
         }
 
     }  // (!fDisableWallet)
@@ -1446,9 +1528,9 @@ bool AppInit2(const std::vector<std::string>& words)
     if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", true))
         nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
     nTotalCache -= nBlockTreeDBCache;
-    size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
+    size_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest goes to the in-memory UTXO cache
 
     bool fLoaded = false;
     while (!fLoaded && !ShutdownRequested()) {
@@ -1466,6 +1548,8 @@ bool AppInit2(const std::vector<std::string>& words)
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete pblockfilterdb;
+                pblockfilterdb = NULL;
                 delete zerocoinDB;
                 delete pSporkDB;
 
@@ -1474,6 +1558,8 @@ bool AppInit2(const std::vector<std::string>& words)
                 pSporkDB = new CSporkDB(0, false, false);
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                if (fBlockFilterIndex)
+                    pblockfilterdb = new CBlockFilterDB(0, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
@@ -1481,6 +1567,13 @@ bool AppInit2(const std::vector<std::string>& words)
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
 
+                // Convert a per-transaction chainstate to the per-output layout
+                if (!pcoinsdbview->Upgrade()) {
+                    if (ShutdownRequested()) break;
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
                 // End loop if shutdown was requested
                 if (ShutdownRequested()) break;
 
@@ -1736,7 +1829,7 @@ bool AppInit2(const std::vector<std::string>& words)
             uiInterface.InitMessage(_("Rescanning..."));
             LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
             const int64_t nWalletRescanTime = GetTimeMillis();
-            if (pwalletMain->ScanForWalletTransactions(pindexRescan, true, true) == -1) {
+            if (pwalletMain->ScanForWalletTransactions(pindexRescan, true, true) < 0) {
                 return error("Shutdown requested over the txs scan. Exiting.");
             }
             LogPrintf("Rescan completed in %15dms\n", GetTimeMillis() - nWalletRescanTime);
@@ -1810,36 +1903,31 @@ bool AppInit2(const std::vector<std::string>& words)
         uiInterface.NotifyBlockTip.disconnect(BlockNotifyGenesisWait);
     }
 
+    if (pblockfilterdb) {
+        InitBlockFilterIndex();
+        threadGroup.create_thread(&ThreadBlockFilterIndex);
+    }
+
     // ********************************************************* Step 10: setup ObfuScation
 
     uiInterface.InitMessage(_("Loading masternode cache..."));
 
-    CMasternodeDB mndb;
-    CMasternodeDB::ReadResult readResult = mndb.Read(mnodeman);
+    pmnStateDB = new CMasternodeStateDB(1 << 21);
+
+    CMasternodeDB::ReadResult readResult = mnodemanDB.Read(mnodeman);
     if (readResult == CMasternodeDB::FileError)
-        LogPrintf("Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CMasternodeDB::Ok) {
-        LogPrintf("Error reading mncache.dat: ");
-        if (readResult == CMasternodeDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-    }
+        LogPrintf("Missing masternode cache, will try to recreate\n");
+    else if (readResult != CMasternodeDB::Ok)
+        LogPrintf("Error reading masternode cache: data has invalid format, will try to recreate\n");
 
     uiInterface.InitMessage(_("Loading budget cache..."));
 
-    CBudgetDB budgetdb;
-    CBudgetDB::ReadResult readResult2 = budgetdb.Read(budget);
+    CBudgetDB::ReadResult readResult2 = budgetDB.Read(budget);
 
     if (readResult2 == CBudgetDB::FileError)
-        LogPrintf("Missing budget cache - budget.dat, will try to recreate\n");
-    else if (readResult2 != CBudgetDB::Ok) {
-        LogPrintf("Error reading budget.dat: ");
-        if (readResult2 == CBudgetDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-    }
+        LogPrintf("Missing budget cache, will try to recreate\n");
+    else if (readResult2 != CBudgetDB::Ok)
+        LogPrintf("Error reading budget cache: data has invalid format, will try to recreate\n");
 
     //flag our cached items so we send them to our peers
     budget.ResetSync();
@@ -1848,18 +1936,12 @@ bool AppInit2(const std::vector<std::string>& words)
 
     uiInterface.InitMessage(_("Loading masternode payment cache..."));
 
-    CMasternodePaymentDB mnpayments;
-    CMasternodePaymentDB::ReadResult readResult3 = mnpayments.Read(masternodePayments);
+    CMasternodePaymentDB::ReadResult readResult3 = masternodePaymentsDB.Read(masternodePayments);
 
     if (readResult3 == CMasternodePaymentDB::FileError)
-        LogPrintf("Missing masternode payment cache - mnpayments.dat, will try to recreate\n");
-    else if (readResult3 != CMasternodePaymentDB::Ok) {
-        LogPrintf("Error reading mnpayments.dat: ");
-        if (readResult3 == CMasternodePaymentDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-    }
+        LogPrintf("Missing masternode payment cache, will try to recreate\n");
+    else if (readResult3 != CMasternodePaymentDB::Ok)
+        LogPrintf("Error reading masternode payment cache: data has invalid format, will try to recreate\n");
 
     fMasterNode = GetBoolArg("-masternode", false);
 
@@ -1990,6 +2072,16 @@ bool AppInit2(const std::vector<std::string>& words)
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup);
 
+    // masternode-layer messages are processed by their own workers, unless there is no masternode layer
+    int nMnMessageThreads = fLiteMode ? 0 : GetArg("-mnmsgthreads", DEFAULT_MASTERNODE_MESSAGE_THREADS);
+    nMnMessageThreads = std::max(std::min(nMnMessageThreads, MAX_MASTERNODE_MESSAGE_THREADS), 0);
+    if (nMnMessageThreads > 0) {
+        LogPrintf("Using %u threads for masternode messages\n", nMnMessageThreads);
+        SetMasternodeMessageThreads(nMnMessageThreads);
+        for (int i = 0; i < nMnMessageThreads; i++)
+            threadGroup.create_thread(&ThreadMasternodeMessages);
+    }
+
     StartNode(threadGroup, scheduler);
 
 #ifdef ENABLE_WALLET
@@ -2013,6 +2105,17 @@ bool AppInit2(const std::vector<std::string>& words)
 
         // StakeMiner thread disabled by default on regtest
         if (GetBoolArg("-staking", !Params().IsRegTestNet())) {
+            // -stakingthreads=0 means autodetect, but nStakingThreads<=1 means the kernel search runs on the minter thread
+            int nStakingThreads = GetArg("-stakingthreads", DEFAULT_STAKING_THREADS);
+            if (nStakingThreads <= 0)
+                nStakingThreads += boost::thread::hardware_concurrency();
+            nStakingThreads = std::min(nStakingThreads, MAX_STAKING_THREADS);
+            if (nStakingThreads > 1) {
+                LogPrintf("Using %u threads for stake kernel search\n", nStakingThreads);
+                SetStakeKernelThreads(nStakingThreads - 1);
+                for (int i = 0; i < nStakingThreads - 1; i++)
+                    threadGroup.create_thread(&ThreadStakeKernelCheck);
+            }
             threadGroup.create_thread(boost::bind(&ThreadStakeMinter));
         }
     }
@@ -7,10 +7,15 @@
 
 #include <boost/assign/list_of.hpp>
 
+#include <atomic>
+
+#include "checkqueue.h"
+#include "crypto/common.h"
 #include "db.h"
 #include "kernel.h"
 #include "legacy/stakemodifier.h"
 #include "script/interpreter.h"
+#include "script/sigcache.h"
 #include "util.h"
 #include "stakeinput.h"
 #include "utilmoneystr.h"
@@ -76,6 +81,144 @@ bool CStakeKernel::CheckKernelHash(bool fSkipLog) const
 }
 
 
+/*
+ * Batched kernel search
+ */
+
+CStakeKernelSlot::CStakeKernelSlot(const CBlockIndex* const pindexPrev, unsigned int nBits, int nTimeTx):
+    nHeight(pindexPrev->nHeight + 1),
+    nTime(nTimeTx)
+{
+    fValid = Params().GetConsensus().IsStakeModifierV2(nHeight);
+    if (!fValid) return;
+    const uint256& nStakeModifier = pindexPrev->GetStakeModifierV2();
+    hasherModifier.Write(nStakeModifier.begin(), nStakeModifier.size());
+    bnTargetBase.SetCompact(nBits);
+}
+
+bool CStakeKernelSlot::ContextCheck(const CStakeKernelInput& input) const
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    return nHeight < consensus.height_RHF - 1 ||
+           consensus.HasStakeMinAgeOrDepth(nHeight, nTime, input.nHeightBlockFrom, input.nTimeBlockFrom);
+}
+
+uint256 CStakeKernelSlot::GetHash(const CStakeKernelInput& input) const
+{
+    // nTimeBlockFrom || nPosition || hashTx || nTime (see CPivStake::GetUniqueness)
+    unsigned char buf[4 + 4 + 32 + 4];
+    WriteLE32(buf, input.nTimeBlockFrom);
+    WriteLE32(buf + 4, input.n);
+    memcpy(buf + 8, input.hashTx.begin(), 32);
+    WriteLE32(buf + 40, (uint32_t)nTime);
+
+    uint256 hash;
+    CHash256 hasher(hasherModifier);
+    hasher.Write(buf, sizeof(buf)).Finalize((unsigned char*)&hash);
+    return hash;
+}
+
+bool CStakeKernelSlot::CheckKernelHash(const CStakeKernelInput& input) const
+{
+    uint256 bnTarget = bnTargetBase;
+    bnTarget *= (uint256(input.nValue) / 100);
+    return GetHash(input) < bnTarget;
+}
+
+/** Closure representing the kernel check of a range of stake inputs */
+class CStakeKernelCheck
+{
+private:
+    const CStakeKernelSlot* pslot{nullptr};
+    const std::vector<CStakeKernelInput>* pvInputs{nullptr};
+    size_t nBegin{0};
+    size_t nEnd{0};
+    std::atomic<int>* pnFound{nullptr};
+    std::atomic<int>* pnHashes{nullptr};
+
+public:
+    CStakeKernelCheck() {}
+    CStakeKernelCheck(const CStakeKernelSlot* pslotIn, const std::vector<CStakeKernelInput>* pvInputsIn, size_t nBeginIn, size_t nEndIn,
+                      std::atomic<int>* pnFoundIn, std::atomic<int>* pnHashesIn) :
+        pslot(pslotIn), pvInputs(pvInputsIn), nBegin(nBeginIn), nEnd(nEndIn), pnFound(pnFoundIn), pnHashes(pnHashesIn) {}
+
+    /**
+     * Stops at the first hit of the range, or as soon as a hit below it was found.
+     * Never fails: the queue would then skip the remaining ranges, including the ones
+     * below a hit, and the result would depend on scheduling. Every range below the
+     * lowest hit is searched to the end, so the lowest position wins.
+     */
+    bool operator()()
+    {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            const int nFound = pnFound->load();
+            if (nFound >= 0 && (size_t)nFound < i) return true;
+            ++(*pnHashes);
+            if (pslot->CheckKernelHash((*pvInputs)[i])) {
+                int nPrev = pnFound->load();
+                while ((nPrev < 0 || (size_t)nPrev > i) && !pnFound->compare_exchange_weak(nPrev, (int)i)) {}
+                return true;
+            }
+        }
+        return true;
+    }
+
+    void swap(CStakeKernelCheck& check)
+    {
+        std::swap(pslot, check.pslot);
+        std::swap(pvInputs, check.pvInputs);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(pnFound, check.pnFound);
+        std::swap(pnHashes, check.pnHashes);
+    }
+};
+
+// number of inputs hashed by a single check
+static const size_t STAKE_KERNEL_CHECK_RANGE = 256;
+static CCheckQueue<CStakeKernelCheck> stakekernelqueue(1);
+static std::atomic<int> nStakeKernelThreads(0);
+
+void SetStakeKernelThreads(int nThreads)
+{
+    nStakeKernelThreads = nThreads;
+}
+
+void ThreadStakeKernelCheck()
+{
+    util::ThreadRename("oasis-stakecheck");
+    stakekernelqueue.Thread();
+}
+
+int SearchStakeKernel(const CStakeKernelSlot& slot, const std::vector<CStakeKernelInput>& vInputs, size_t nStart, int& nHashes)
+{
+    assert(slot.IsValid());
+    std::atomic<int> nFound(-1);
+    std::atomic<int> nHashesDone(0);
+
+    std::vector<CStakeKernelCheck> vChecks;
+    for (size_t i = nStart; i < vInputs.size(); i += STAKE_KERNEL_CHECK_RANGE)
+        vChecks.emplace_back(&slot, &vInputs, i, std::min(i + STAKE_KERNEL_CHECK_RANGE, vInputs.size()), &nFound, &nHashesDone);
+
+    if (nStakeKernelThreads > 0 && vChecks.size() > 1) {
+        // the LIFO queue pops the last range first: push them reversed
+        std::reverse(vChecks.begin(), vChecks.end());
+        CCheckQueueControl<CStakeKernelCheck> control(&stakekernelqueue);
+        control.Add(vChecks);
+        control.Wait();
+    } else {
+        // ranges in order: the first hit is the lowest one
+        for (CStakeKernelCheck& check : vChecks) {
+            check();
+            if (nFound >= 0) break;
+        }
+    }
+
+    nHashes = nHashesDone;
+    return nFound;
+}
+
+
 /*
  * PoS Validation
  */
@@ -138,9 +281,10 @@ bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int
  * @param[out]  strError        string error (if any, else empty)
  * @param[in]   pindexPrev      index of the parent block
  *                              (if nullptr, it will be searched in mapBlockIndex)
+ * @param[in]   fCheckSignature verify the signature of the coinstake input
  * @return      bool            true if the block has a valid proof of stake
  */
-bool CheckProofOfStake(const CBlock& block, std::string& strError, const CBlockIndex* pindexPrev)
+bool CheckProofOfStake(const CBlock& block, std::string& strError, const CBlockIndex* pindexPrev, bool fCheckSignature)
 {
     // Initialize stake input
     std::unique_ptr<CStakeInput> stakeInput;
@@ -156,6 +300,7 @@ bool CheckProofOfStake(const CBlock& block, std::string& strError, const CBlockI
     }
 
     // Verify signature
+    if (fCheckSignature) {
         CTransaction txPrev;
         if (!stakeInput->GetTxFrom(txPrev)) {
             strError = "unable to get txPrev for coinstake";
@@ -165,10 +310,11 @@ bool CheckProofOfStake(const CBlock& block, std::string& strError, const CBlockI
         const CTxIn& txin = tx.vin[0];
         ScriptError serror;
         if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS,
-                 TransactionSignatureChecker(&tx, 0), &serror)) {
+                 CachingTransactionSignatureChecker(&tx, 0, true), &serror)) {
             strError = strprintf("signature fails: %s", serror ? ScriptErrorString(serror) : "");
             return false;
         }
+    }
 
     // Verify Proof Of Stake
     CStakeKernel stakeKernel(pindexPrev, stakeInput.get(), block.nBits, block.nTime);
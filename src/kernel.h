@@ -8,6 +8,7 @@
 #ifndef OASIS_KERNEL_H
 #define OASIS_KERNEL_H
 
+#include "hash.h"
 #include "main.h"
 #include "stakeinput.h"
 
@@ -40,6 +41,74 @@ private:
     CAmount stakeValue{0};     // target multiplier
 };
 
+/* Batched kernel search */
+
+// Maximum number of worker threads for the kernel search
+static const int MAX_STAKING_THREADS = 16;
+// -stakingthreads default (0 = autodetect)
+static const int DEFAULT_STAKING_THREADS = 0;
+
+/** Fields of a stake input used in the kernel message and target weight */
+struct CStakeKernelInput {
+    uint256 hashTx;
+    uint32_t n{0};
+    CAmount nValue{0};
+    int nHeightBlockFrom{0};
+    uint32_t nTimeBlockFrom{0};
+};
+
+/**
+ * Kernel data that depends only on the time slot (pindexPrev, nTime).
+ * The stake modifier is hashed into a SHA256 midstate and the compact target
+ * is expanded once, so checking an input costs a single double-SHA256 of the
+ * per-utxo fields. Only available with stake modifier v2 (IsValid()), as the
+ * v1 modifier depends on each stake input.
+ */
+class CStakeKernelSlot {
+public:
+    /**
+     * @param[in]   pindexPrev      index of the parent of the kernel block
+     * @param[in]   nBits           target difficulty bits of the kernel block
+     * @param[in]   nTimeTx         time of the kernel block
+     */
+    CStakeKernelSlot(const CBlockIndex* const pindexPrev, unsigned int nBits, int nTimeTx);
+
+    bool IsValid() const { return fValid; }
+    int GetTime() const { return nTime; }
+
+    // Stake input contextual checks (same as CStakeInput::ContextCheck)
+    bool ContextCheck(const CStakeKernelInput& input) const;
+
+    // Return stake kernel hash (same as CStakeKernel::GetHash)
+    uint256 GetHash(const CStakeKernelInput& input) const;
+
+    // Check that the kernel hash meets the target required
+    bool CheckKernelHash(const CStakeKernelInput& input) const;
+
+private:
+    bool fValid{false};
+    int nHeight{0};
+    int nTime{0};
+    CHash256 hasherModifier;    // midstate after the stake modifier
+    uint256 bnTargetBase;       // target from nBits, before weighting
+};
+
+/*
+ * SearchStakeKernel    Find the first input in vInputs[nStart..] that meets the kernel target
+ *
+ * @param[in]   slot            kernel slot data (must be valid)
+ * @param[in]   vInputs         stake inputs (already passing ContextCheck)
+ * @param[in]   nStart          first position to check
+ * @param[out]  nHashes         number of kernel hashes computed
+ * @return      int             position of the winning input, or -1 if none
+ */
+int SearchStakeKernel(const CStakeKernelSlot& slot, const std::vector<CStakeKernelInput>& vInputs, size_t nStart, int& nHashes);
+
+/** Set the number of kernel search threads (excluding the caller) */
+void SetStakeKernelThreads(int nThreads);
+/** Run a worker thread of the kernel search */
+void ThreadStakeKernelCheck();
+
 /* PoS Validation */
 
 /*
@@ -60,9 +129,11 @@ bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int
  * @param[out]  strError        string returning error message (if any, else empty)
  * @param[in]   pindexPrev      index of the parent block
  *                              (if nullptr, it will be searched in mapBlockIndex)
+ * @param[in]   fCheckSignature verify the signature of the coinstake input
+ *                              (skipped under -assumevalid, the kernel hash is always checked)
  * @return      bool            true if the block has a valid proof of stake
  */
-bool CheckProofOfStake(const CBlock& block, std::string& strError, const CBlockIndex* pindexPrev = nullptr);
+bool CheckProofOfStake(const CBlock& block, std::string& strError, const CBlockIndex* pindexPrev = nullptr, bool fCheckSignature = true);
 
 /*
  * GetStakeKernelHash   Return stake kernel of a block
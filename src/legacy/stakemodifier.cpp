@@ -7,6 +7,9 @@
 
 #include "legacy/stakemodifier.h"
 #include "main.h"   // mapBlockIndex, chainActive
+#include "txdb.h"
+
+CStakeModifierTable stakeModifierTable;
 
 /*
  * Old Modifier - Only for IBD
@@ -28,7 +31,7 @@ static int64_t GetStakeModifierSelectionIntervalSection(int nSection)
 // already selected blocks in vSelectedBlocks, and with timestamp up to
 // nSelectionIntervalStop.
 static bool SelectBlockFromCandidates(
-    std::vector<std::pair<int64_t, uint256> >& vSortedByTimestamp,
+    std::vector<std::pair<int64_t, const CBlockIndex*> >& vSortedByTimestamp,
     std::map<uint256, const CBlockIndex*>& mapSelectedBlocks,
     int64_t nSelectionIntervalStop,
     uint64_t nStakeModifierPrev,
@@ -40,10 +43,7 @@ static bool SelectBlockFromCandidates(
     uint256 hashBest;
     *pindexSelected = (const CBlockIndex*)0;
     for (const auto& item : vSortedByTimestamp) {
-        if (!mapBlockIndex.count(item.second))
-            return error("%s : failed to find block index for candidate block %s", __func__, item.second.ToString().c_str());
-
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
+        const CBlockIndex* pindex = item.second;
         if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
             break;
 
@@ -63,9 +63,9 @@ static bool SelectBlockFromCandidates(
         else
             hashProof = pindex->IsProofOfStake() ? UINT256_ZERO : pindex->GetBlockHash();
 
-        CDataStream ss(SER_GETHASH, 0);
+        CHashWriter ss(SER_GETHASH, 0);
         ss << hashProof << nStakeModifierPrev;
-        uint256 hashSelection = Hash(ss.begin(), ss.end());
+        uint256 hashSelection = ss.GetHash();
 
         // the selection hash is divided by 2**32 so that proof-of-stake block
         // is always favored over proof-of-work block. this is to preserve
@@ -91,6 +91,11 @@ static bool SelectBlockFromCandidates(
 // modifier about a selection interval later than the coin generating the kernel
 bool GetOldModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier)
 {
+    // the staker calls this without cs_main: hold it while reading chainActive
+    LOCK(cs_main);
+    if (stakeModifierTable.Get(pindexFrom, nStakeModifier))
+        return true;
+
     int64_t nStakeModifierTime = pindexFrom->GetBlockTime();
     const CBlockIndex* pindex = pindexFrom;
     CBlockIndex* pindexNext = chainActive[pindex->nHeight + 1];
@@ -107,6 +112,7 @@ bool GetOldModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier)
     } while (nStakeModifierTime < pindexFrom->GetBlockTime() + OLD_MODIFIER_INTERVAL);
 
     nStakeModifier = pindex->GetStakeModifierV1();
+    stakeModifierTable.Set(pindexFrom, pindex, nStakeModifier);
     return true;
 }
 
@@ -164,20 +170,23 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
     if (nModifierTime / MODIFIER_INTERVAL >= pindexPrev->GetBlockTime() / MODIFIER_INTERVAL)
         return true;
 
-    // Sort candidate blocks by timestamp
-    std::vector<std::pair<int64_t, uint256> > vSortedByTimestamp;
+    // Sort candidate blocks by timestamp (and hash)
+    std::vector<std::pair<int64_t, const CBlockIndex*> > vSortedByTimestamp;
     vSortedByTimestamp.reserve(64 * MODIFIER_INTERVAL  / Params().GetConsensus().nTargetSpacing);
     int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / MODIFIER_INTERVAL ) * MODIFIER_INTERVAL  - OLD_MODIFIER_INTERVAL;
     const CBlockIndex* pindex = pindexPrev;
 
     while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart) {
-        vSortedByTimestamp.push_back(std::make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
+        vSortedByTimestamp.push_back(std::make_pair(pindex->GetBlockTime(), pindex));
         pindex = pindex->pprev;
     }
 
     int nHeightFirstCandidate = pindex ? (pindex->nHeight + 1) : 0;
     std::reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    std::sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+    std::sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end(),
+              [](const std::pair<int64_t, const CBlockIndex*>& a, const std::pair<int64_t, const CBlockIndex*>& b) {
+                  return a.first < b.first || (a.first == b.first && a.second->GetBlockHash() < b.second->GetBlockHash());
+              });
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
@@ -228,3 +237,86 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
     fGeneratedStakeModifier = true;
     return true;
 }
+
+/*
+ * Kernel stake modifier table
+ */
+
+bool CStakeModifierTable::Get(const CBlockIndex* pindexFrom, uint64_t& nModifier)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+    const int nHeight = pindexFrom->nHeight;
+    if (nHeight >= 0 && nHeight < (int)vEntries.size()) {
+        const Entry& entry = vEntries[nHeight];
+        // the selected block is after pindexFrom: if it is in the active chain, so is pindexFrom
+        if (entry.pindexSelected && chainActive.Contains(entry.pindexSelected) &&
+                entry.pindexSelected->GetAncestor(nHeight) == pindexFrom) {
+            nModifier = entry.nModifier;
+            nHits++;
+            return true;
+        }
+    }
+    nMisses++;
+    return false;
+}
+
+void CStakeModifierTable::Set(const CBlockIndex* pindexFrom, const CBlockIndex* pindexSelected, uint64_t nModifier)
+{
+    LOCK(cs);
+    const int nHeight = pindexFrom->nHeight;
+    if (nHeight < 0 || nHeight >= Params().GetConsensus().height_start_StakeModifierV2) return;
+    if (nHeight >= (int)vEntries.size())
+        vEntries.resize(nHeight + 1);
+    vEntries[nHeight].nModifier = nModifier;
+    vEntries[nHeight].pindexSelected = pindexSelected;
+    setDirty.insert(nHeight);
+}
+
+bool CStakeModifierTable::Load(CBlockTreeDB* pdb)
+{
+    std::vector<std::pair<int, std::pair<uint64_t, uint256> > > vModifiers;
+    if (!pdb->ReadStakeModifiers(vModifiers))
+        return false;
+
+    LOCK(cs);
+    vEntries.clear();
+    setDirty.clear();
+    for (const auto& item : vModifiers) {
+        const int nHeight = item.first;
+        BlockMap::const_iterator mi = mapBlockIndex.find(item.second.second);
+        if (nHeight < 0 || mi == mapBlockIndex.end()) continue;
+        if (nHeight >= (int)vEntries.size())
+            vEntries.resize(nHeight + 1);
+        vEntries[nHeight].nModifier = item.second.first;
+        vEntries[nHeight].pindexSelected = mi->second;
+    }
+    LogPrintf("%s: loaded %d kernel stake modifiers\n", __func__, vModifiers.size());
+    return true;
+}
+
+bool CStakeModifierTable::Flush(CBlockTreeDB* pdb)
+{
+    std::vector<std::pair<int, std::pair<uint64_t, uint256> > > vModifiers;
+    {
+        LOCK(cs);
+        if (setDirty.empty()) return true;
+        vModifiers.reserve(setDirty.size());
+        for (const int nHeight : setDirty) {
+            const Entry& entry = vEntries[nHeight];
+            vModifiers.emplace_back(nHeight, std::make_pair(entry.nModifier, entry.pindexSelected->GetBlockHash()));
+        }
+        setDirty.clear();
+        LogPrint("stakemodifier", "%s: writing %d kernel stake modifiers (hits: %d, misses: %d)\n",
+                 __func__, vModifiers.size(), nHits, nMisses);
+    }
+    return pdb->WriteStakeModifiers(vModifiers);
+}
+
+void CStakeModifierTable::Clear()
+{
+    LOCK(cs);
+    vEntries.clear();
+    setDirty.clear();
+    nHits = nMisses = 0;
+}
@@ -10,9 +10,51 @@
 
 #include "chain.h"
 #include "stakeinput.h"
+#include "sync.h"
+
+#include <set>
+#include <vector>
+
+class CBlockTreeDB;
 
 // Old Modifier - Only for IBD
 bool GetOldStakeModifier(CStakeInput* stake, uint64_t& nStakeModifier);
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
+/**
+ * Kernel stake modifiers (v1), indexed by height of the stake input block.
+ * The modifier of a utxo is found walking the active chain forward from its
+ * block: the result depends only on the blocks up to the one providing the
+ * modifier, so each entry records it and is valid as long as that block is
+ * still in the active chain. The table is persisted in the block tree db.
+ *
+ * Lookups check the entry against chainActive, so Get() requires cs_main
+ * (always taken before the table's own lock).
+ */
+class CStakeModifierTable
+{
+private:
+    struct Entry {
+        uint64_t nModifier{0};
+        const CBlockIndex* pindexSelected{nullptr};
+    };
+
+    mutable RecursiveMutex cs;
+    std::vector<Entry> vEntries;
+    std::set<int> setDirty;
+    uint64_t nHits{0};
+    uint64_t nMisses{0};
+
+public:
+    /** Return the cached modifier of pindexFrom, if still on the active chain. Requires cs_main. */
+    bool Get(const CBlockIndex* pindexFrom, uint64_t& nModifier);
+    void Set(const CBlockIndex* pindexFrom, const CBlockIndex* pindexSelected, uint64_t nModifier);
+
+    bool Load(CBlockTreeDB* pdb);
+    bool Flush(CBlockTreeDB* pdb);
+    void Clear();
+};
+
+extern CStakeModifierTable stakeModifierTable;
+
 #endif // OASIS_LEGACY_MODIFIER_H
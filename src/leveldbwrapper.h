@@ -8,6 +8,7 @@
 #include "clientversion.h"
 #include "serialize.h"
 #include "streams.h"
+#include "support/cleanse.h"
 #include "util.h"
 #include "version.h"
 
@@ -114,6 +115,28 @@ public:
         return true;
     }
 
+    //! Read the value of key as it was serialized, wiping the copy leveldb returned
+    template <typename K>
+    bool ReadStream(const K& key, CDataStream& ssValue) const
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(ssKey.GetSerializeSize(key));
+        ssKey << key;
+        leveldb::Slice slKey(&ssKey[0], ssKey.size());
+
+        std::string strValue;
+        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        if (!status.ok()) {
+            if (status.IsNotFound())
+                return false;
+            LogPrintf("LevelDB read failure: %s\n", status.ToString());
+            HandleError(status);
+        }
+        ssValue.write(strValue.data(), strValue.size());
+        memory_cleanse(&strValue[0], strValue.size());
+        return true;
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -168,6 +191,12 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    //! Rewrite the whole database, dropping overwritten and erased values from the disk
+    void Compact()
+    {
+        pdb->CompactRange(NULL, NULL);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
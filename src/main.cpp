@@ -12,6 +12,8 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "blockencodings.h"
+#include "blockfilter.h"
 #include "blocksignature.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -26,6 +28,7 @@
 #include "masternode-budget.h"
 #include "masternode-payments.h"
 #include "masternodeman.h"
+#include "memusage.h"
 #include "merkleblock.h"
 #include "messagesigner.h"
 #include "net.h"
@@ -91,14 +94,17 @@ int nScriptCheckThreads = 0;
 std::atomic<bool> fImporting{false};
 std::atomic<bool> fReindex{false};
 bool fTxIndex = true;
+bool fBlockFilterIndex = DEFAULT_BLOCKFILTERINDEX;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 
 /* If the tip is older than this (in seconds), the node is considered to be in initial block download. */
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
 
+uint256 hashAssumeValid;
+
 /** Fees smaller than this (in upiv) are considered zero fee (for relaying and mining)
  * We are ~100 times smaller then bitcoin now (2015-06-23), set minRelayTxFee only 10 times higher
  * so it's still 10 times lower comparing to bitcoin.
@@ -194,6 +200,60 @@ int nQueuedValidatedHeaders = 0;
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
+/** Blocks downloaded ahead of their parent. Protected by cs_main. */
+CBlocksAwaitingParent blocksAwaitingParent(MAX_BLOCKS_AWAITING_PARENT_SIZE);
+
+/** Events per second over the last RATE_WINDOW seconds */
+class CRateCounter
+{
+private:
+    static const int RATE_WINDOW = 60;
+    int64_t nBucketTime[RATE_WINDOW];
+    uint64_t nBucketCount[RATE_WINDOW];
+    uint64_t nTotal;
+
+public:
+    CRateCounter() : nTotal(0)
+    {
+        for (int i = 0; i < RATE_WINDOW; i++) {
+            nBucketTime[i] = 0;
+            nBucketCount[i] = 0;
+        }
+    }
+
+    void Add(uint64_t n = 1)
+    {
+        const int64_t nNow = GetTime();
+        const int i = nNow % RATE_WINDOW;
+        if (nBucketTime[i] != nNow) {
+            nBucketTime[i] = nNow;
+            nBucketCount[i] = 0;
+        }
+        nBucketCount[i] += n;
+        nTotal += n;
+    }
+
+    double GetRate() const
+    {
+        const int64_t nNow = GetTime();
+        uint64_t nCount = 0;
+        for (int i = 0; i < RATE_WINDOW; i++)
+            if (nNow - nBucketTime[i] < RATE_WINDOW)
+                nCount += nBucketCount[i];
+        return (double)nCount / RATE_WINDOW;
+    }
+
+    uint64_t GetTotal() const { return nTotal; }
+};
+
+/** Throughput of the block download. Protected by cs_main. */
+CRateCounter rateHeaders;
+CRateCounter rateBlocksDownloaded;
+CRateCounter rateBlocksConnected;
+CRateCounter rateTxConnected;
+uint64_t nDownloadStallers = 0;
+uint64_t nHeadersSyncTimeouts = 0;
+
 /** Dirty block index entries. */
 std::set<CBlockIndex*> setDirtyBlockIndex;
 
@@ -327,6 +387,20 @@ struct CNodeState {
 
     CNodeBlocks nodeBlocks;
 
+    //! When the headers sync from this peer times out (in microseconds), if it is the sync peer.
+    int64_t nHeadersSyncTimeout;
+    //! When we last asked this peer for the headers leading to unconnected ones it sent (in seconds).
+    int64_t nUnconnectedHeadersTime;
+    //! Header-only entries this peer added to the block index, until their block is received.
+    std::vector<CBlockIndex*> vUnprovenHeaders;
+    //! Whether we stopped asking this peer for headers until more of their blocks are received.
+    bool fHeadersPaused;
+    //! When we last asked this peer which part of our best header chain it has (in seconds).
+    int64_t nHeadersProbeTime;
+
+    //! The compact block announced by this peer whose missing transactions we requested.
+    std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+
     CNodeState()
     {
         fCurrentlyConnected = false;
@@ -339,6 +413,10 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        nHeadersSyncTimeout = 0;
+        nUnconnectedHeadersTime = 0;
+        fHeadersPaused = false;
+        nHeadersProbeTime = 0;
     }
 };
 
@@ -469,6 +547,23 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256& hash)
     }
 }
 
+/** Forget the header-only entries of a peer whose block was received (or found invalid), return how many are left. */
+size_t PruneUnprovenHeaders(CNodeState* state)
+{
+    std::vector<CBlockIndex*>& vHeaders = state->vUnprovenHeaders;
+    vHeaders.erase(std::remove_if(vHeaders.begin(), vHeaders.end(), [](const CBlockIndex* pindex) {
+        return (pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_FAILED_MASK)) != 0;
+    }), vHeaders.end());
+    return vHeaders.size();
+}
+
+/** When the headers sync from a peer, starting at nNow, times out (in microseconds). */
+int64_t GetHeadersSyncTimeout(int64_t nNow)
+{
+    return nNow + HEADERS_DOWNLOAD_TIMEOUT_BASE + HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER *
+        (GetAdjustedTime() - pindexBestHeader->GetBlockTime()) / Params().GetConsensus().nTargetSpacing;
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb)
@@ -504,51 +599,6 @@ void FindNextBlocksToDownload(CNode* pnode, unsigned int count, std::vector<CBlo
     // Make sure pindexBestKnownBlock is up to date, we'll need it.
     ProcessBlockAvailability(nodeid);
 
-    // A special case to to do parallel initial download
-    if ((state->pindexBestKnownBlock == NULL) && IsInitialBlockDownload() && (pindexBestHeader != nullptr)) {
-        auto pIndexWalk = pindexBestHeader;
-
-        // Keep the last blocks for selected sync peer
-        int max_height = pindexBestHeader->nHeight - MAX_BLOCKS_IN_TRANSIT_PER_PEER;
-        max_height = std::min<int>(max_height, pnode->nStartingHeight);
-
-        // Minimize the work done on walk till the oldest not fetched blocks.
-        // There is little sense to check blocks outside of the range with fully loaded outbound peers.
-        max_height = std::min<int>(max_height, chainActive.Tip()->nHeight + (MAX_BLOCKS_IN_TRANSIT_PER_PEER * 16));
-
-        // Make sure we fetch the oldest blocks first to properly reflect our progress.
-        std::deque<CBlockIndex*> to_fetch;
-
-        for (; pIndexWalk != nullptr; pIndexWalk = pIndexWalk->pprev) {
-            if (pIndexWalk->nHeight > max_height) {
-                // optimize skip
-                continue;
-            }
-
-            if (chainActive.Contains(pIndexWalk)) {
-                break;
-            }
-
-            if (!pIndexWalk->IsValid(BLOCK_VALID_TREE)) {
-                // This should never happen by fact
-                break;
-            }
-
-            if (!(pIndexWalk->nStatus & BLOCK_HAVE_DATA) &&
-                (mapBlocksInFlight.find(pIndexWalk->GetBlockHash()) == mapBlocksInFlight.end())
-            ) {
-                if (to_fetch.size() >= count) {
-                    to_fetch.pop_front();
-                }
-
-                to_fetch.push_back(pIndexWalk);
-            }
-        }
-
-        std::copy(to_fetch.begin(), to_fetch.end(), std::back_inserter(vBlocks));
-        return;
-    }
-
     if (state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->nChainWork < chainActive.Tip()->nChainWork) {
         // This peer has nothing interesting.
         return;
@@ -597,6 +647,8 @@ void FindNextBlocksToDownload(CNode* pnode, unsigned int count, std::vector<CBlo
             if (pindex->nStatus & BLOCK_HAVE_DATA) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
+            } else if (blocksAwaitingParent.Contains(pindex->GetBlockHash())) {
+                // Downloaded, waiting for its parent to be accepted.
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
@@ -637,6 +689,32 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats)
     return true;
 }
 
+void GetSyncStatus(CSyncStatus& status)
+{
+    LOCK(cs_main);
+    status.nHeaderHeight = pindexBestHeader ? pindexBestHeader->nHeight : -1;
+    status.nBlockHeight = chainActive.Height();
+    for (const std::pair<const NodeId, CNodeState>& item : mapNodeState) {
+        if (item.second.fSyncStarted && item.second.nHeadersSyncTimeout > 0)
+            status.nHeadersSyncPeer = item.first;
+        if (item.second.nBlocksInFlight > 0)
+            status.nDownloadPeers++;
+    }
+    status.nBlocksInFlight = mapBlocksInFlight.size();
+    status.nBlocksAwaitingParent = blocksAwaitingParent.size();
+    status.nBytesAwaitingParent = blocksAwaitingParent.GetTotalSize();
+    status.nHeaders = rateHeaders.GetTotal();
+    status.nBlocksDownloaded = rateBlocksDownloaded.GetTotal();
+    status.nBlocksConnected = rateBlocksConnected.GetTotal();
+    status.nTxConnected = rateTxConnected.GetTotal();
+    status.nStallers = nDownloadStallers;
+    status.nHeadersTimeouts = nHeadersSyncTimeouts;
+    status.dHeadersRate = rateHeaders.GetRate();
+    status.dDownloadRate = rateBlocksDownloaded.GetRate();
+    status.dConnectRate = rateBlocksConnected.GetRate();
+    status.dTxConnectRate = rateTxConnected.GetRate();
+}
+
 void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.GetHeight.connect(&GetHeight);
@@ -655,6 +733,14 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals)
     nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
 }
 
+size_t BlockIndexDynamicMemoryUsage()
+{
+    LOCK(cs_main);
+    return memusage::DynamicUsage(mapBlockIndex) +
+           mapBlockIndex.size() * memusage::MallocUsage(sizeof(CBlockIndex)) +
+           memusage::MallocUsage(sizeof(CBlockIndex*) * (chainActive.Height() + 1));
+}
+
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator)
 {
     // Find the first block the caller has in the main chain
@@ -673,6 +759,103 @@ CCoinsViewCache* pcoinsTip = NULL;
 CBlockTreeDB* pblocktree = NULL;
 CZerocoinDB* zerocoinDB = NULL;
 CSporkDB* pSporkDB = NULL;
+CBlockFilterDB* pblockfilterdb = NULL;
+
+/** Last block of the active chain with an indexed filter, and its filter header (protected by cs_main) */
+static const CBlockIndex* pindexBlockFilterBest = nullptr;
+static uint256 hashBlockFilterBestHeader;
+
+/** Index the filter of pindex, the block after pindexBlockFilterBest */
+static bool IndexBlockFilter(const CBlockFilter& filter, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    assert(pindex->pprev == pindexBlockFilterBest);
+    const uint256 hashHeader = filter.ComputeHeader(hashBlockFilterBestHeader);
+    if (!pblockfilterdb->WriteFilter(filter, hashHeader))
+        return false;
+    pindexBlockFilterBest = pindex;
+    hashBlockFilterBestHeader = hashHeader;
+    return true;
+}
+
+void InitBlockFilterIndex()
+{
+    LOCK(cs_main);
+    uint256 hashBest;
+    if (!pblockfilterdb || !pblockfilterdb->ReadBestBlock(hashBest))
+        return;
+    BlockMap::iterator mi = mapBlockIndex.find(hashBest);
+    if (mi == mapBlockIndex.end()) {
+        LogPrintf("%s: last indexed block %s is unknown, rebuilding the block filter index\n", __func__, hashBest.ToString());
+        return;
+    }
+    // the index may have followed a branch the chain left while the node was down
+    const CBlockIndex* pindex = chainActive.FindFork(mi->second);
+    uint256 hashHeader;
+    if (!pindex || !pblockfilterdb->ReadFilterHeader(pindex->GetBlockHash(), hashHeader)) {
+        LogPrintf("%s: no filter for the fork point of block %s, rebuilding the block filter index\n", __func__, hashBest.ToString());
+        return;
+    }
+    pindexBlockFilterBest = pindex;
+    hashBlockFilterBestHeader = hashHeader;
+    LogPrintf("Block filter index at height %d\n", pindex->nHeight);
+}
+
+void ThreadBlockFilterIndex()
+{
+    util::ThreadRename("oasis-bfindex");
+    int64_t nLastLog = GetTime();
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        const CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = pindexBlockFilterBest ? chainActive.Next(pindexBlockFilterBest) : chainActive.Genesis();
+            if (!pindex) {
+                LogPrintf("Block filter index synced at height %d\n", chainActive.Height());
+                nLocalServices |= NODE_SCRIPT_FILTERS;
+                return;
+            }
+        }
+
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex)) {
+            LogPrintf("%s: failed to read block %s, stopping\n", __func__, pindex->GetBlockHash().ToString());
+            return;
+        }
+        if (pindex->pprev) {
+            CDiskBlockPos pos = pindex->GetUndoPos();
+            if (pos.IsNull() || !blockundo.ReadFromDisk(pos, pindex->pprev->GetBlockHash())) {
+                LogPrintf("%s: failed to read undo data of block %s, stopping\n", __func__, pindex->GetBlockHash().ToString());
+                return;
+            }
+        }
+        const CBlockFilter filter(block, pindex->pprev ? &blockundo : nullptr);
+
+        {
+            LOCK(cs_main);
+            // the chain moved while the block was read, carry on from where it is now
+            if (pindex->pprev != pindexBlockFilterBest || !chainActive.Contains(pindex))
+                continue;
+            if (!IndexBlockFilter(filter, pindex)) {
+                LogPrintf("%s: failed to write the filter of block %s, stopping\n", __func__, pindex->GetBlockHash().ToString());
+                return;
+            }
+        }
+
+        if (GetTime() >= nLastLog + 60) {
+            nLastLog = GetTime();
+            LogPrintf("Building block filter index. At block %d\n", pindex->nHeight);
+        }
+    }
+}
+
+bool GetBlockFilter(const CBlockIndex* pindex, CBlockFilter& filter, uint256& hashHeader)
+{
+    return pblockfilterdb && pblockfilterdb->ReadFilter(pindex->GetBlockHash(), filter, hashHeader);
+}
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -916,11 +1099,11 @@ int GetInputAge(CTxIn& vin)
         CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
-        const CCoins* coins = view.AccessCoins(vin.prevout.hash);
+        const Coin& coin = view.AccessCoin(vin.prevout);
 
-        if (coins) {
-            if (coins->nHeight < 0) return 0;
-            return (chainActive.Tip()->nHeight + 1) - coins->nHeight;
+        if (!coin.IsSpent()) {
+            if (coin.nHeight < 0) return 0;
+            return (chainActive.Tip()->nHeight + 1) - coin.nHeight;
         } else
             return -1;
     }
@@ -1079,14 +1262,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            if (view.HaveCoin(COutPoint(hash, i)))
+                return false;
+        }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // only helps filling in pfMissingInputs (to determine missing vs spent).
+        // Note that this does not distinguish between missing and already spent outputs,
+        // it only helps filling in pfMissingInputs.
         for (const CTxIn& txin : tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
@@ -1124,10 +1309,9 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         CAmount nValueOut = tx.GetValueOut();
         CAmount nFees = nValueIn - nValueOut;
-        double dPriority = 0;
-        view.GetPriority(tx, chainHeight);
+        double dPriority = view.GetPriority(tx, chainHeight);
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainHeight);
+        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainHeight, nSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -1167,6 +1351,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                 LogPrint("mempool", "Rate limit dFreeCount: %g => %g\n", dFreeCount, dFreeCount + nSize);
                 dFreeCount += nSize;
             }
+
+            // Once the pool had to evict transactions, only accept those paying
+            // more than what was evicted, until the minimum fee decays again.
+            // Transactions put back by a reorg (!fLimitFree) are exempt.
+            if (fLimitFree) {
+                CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+                if (mempoolRejectFee > 0 && nFees < mempoolRejectFee)
+                    return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+            }
         }
 
         if (fRejectInsaneFee && nFees > ::minRelayTxFee.GetFee(nSize) * 10000)
@@ -1181,6 +1374,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
                     __func__, hash.ToString(), nFees, ::minRelayTxFee.GetFee(nSize) * 10000);
         }
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+            return state.DoS(0, error("%s : %s", __func__, errString), REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         bool fCLTVIsActivated = (chainHeight >= consensus.height_start_BIP65);
 
         // Check against previous transactions
@@ -1210,7 +1414,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors);
+
+        // Trim the pool back to -maxmempool, which may evict this transaction again
+        pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, nullptr);
@@ -1275,14 +1484,16 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
             view.SetBackend(viewMemPool);
 
             // do we already have it?
-            if (view.HaveCoins(hash))
-                return false;
+            for (unsigned int i = 0; i < tx.vout.size(); i++) {
+                if (view.HaveCoin(COutPoint(hash, i)))
+                    return false;
+            }
 
             // do all inputs exist?
-            // Note that this does not check for the presence of actual outputs (see the next check for that),
-            // only helps filling in pfMissingInputs (to determine missing vs spent).
+            // Note that this does not distinguish between missing and already spent outputs,
+            // it only helps filling in pfMissingInputs.
             for (const CTxIn& txin : tx.vin) {
-                if (!view.HaveCoins(txin.prevout.hash)) {
+                if (!view.HaveCoin(txin.prevout)) {
                     if (pfMissingInputs)
                         *pfMissingInputs = true;
                     return false;
@@ -1457,9 +1668,9 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
             int nHeight = -1;
             {
                 CCoinsViewCache& view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(view, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -1779,14 +1990,14 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
     if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs()) {
         txundo.vprevout.reserve(tx.vin.size());
         for (const CTxIn& txin : tx.vin) {
-            txundo.vprevout.push_back(CTxInUndo());
-            bool ret = inputs.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout, txundo.vprevout.back());
-            assert(ret);
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 bool CScriptCheck::operator()()
@@ -1818,20 +2029,20 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         CAmount nFees = 0;
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             const COutPoint& prevout = tx.vin[i].prevout;
-            const CCoins* coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase() || coins->IsCoinStake()) {
-                if (nSpendHeight - coins->nHeight < Params().GetConsensus().nCoinbaseMaturity)
+            if (coin.IsCoinBase() || coin.IsCoinStake()) {
+                if (nSpendHeight - coin.nHeight < Params().GetConsensus().nCoinbaseMaturity)
                     return state.Invalid(
-                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coins->nHeight, coins->IsCoinStake()),
+                        error("CheckInputs() : tried to spend coinbase at depth %d, coinstake=%d", nSpendHeight - coin.nHeight, coin.IsCoinStake()),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!consensus.MoneyRange(coins->vout[prevout.n].nValue) || !consensus.MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!consensus.MoneyRange(coin.out.nValue) || !consensus.MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs() : txin values out of range"),
                     REJECT_INVALID, "bad-txns-inputvalues-outofrange");
         }
@@ -1862,11 +2073,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint& prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1878,7 +2089,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
+                        CScriptCheck check(coin.out, tx, i,
                             flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1943,6 +2154,33 @@ void DataBaseAccChecksum(CBlockIndex* pindex, bool fWrite)
     }
 }
 
+/**
+ * Restore the UTXO in a Coin at a given COutPoint.
+ * Returns false if the undo data did not fit cleanly into the view.
+ */
+static bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
+{
+    bool fClean = true;
+
+    if (view.HaveCoin(out))
+        fClean = error("DisconnectBlock() : undo data overwriting existing output");
+
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase/coinstake). Older versions included this
+        // information only in undo records for the last spend of a transaction's outputs.
+        // This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("DisconnectBlock() : undo data adding output to missing transaction");
+        undo.nHeight = alternate.nHeight;
+        undo.fCoinBase = alternate.fCoinBase;
+        undo.fCoinStake = alternate.fCoinStake;
+    }
+    view.AddCoin(out, std::move(undo), !fClean);
+
+    return fClean;
+}
+
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
 {
     if (pindex->GetBlockHash() != view.GetBestBlock())
@@ -2007,53 +2245,26 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
-        // exactly. Note that transactions with only provably unspendable outputs won't
-        // have outputs available even in the block itself, so we handle that case
-        // specially with outsEmpty.
-        {
-            CCoins outsEmpty;
-            CCoinsModifier outs = view.ModifyCoins(hash);
-            outs->ClearUnspendable();
-
-            CCoins outsBlock(tx, pindex->nHeight);
-            // The CCoins serialization does not serialize negative numbers.
-            // No network rules currently depend on the version here, so an inconsistency is harmless
-            // but it must be corrected before txout nversion ever influences a network rule.
-            if (outsBlock.nVersion < 0)
-                outs->nVersion = outsBlock.nVersion;
-            if (*outs != outsBlock)
-                fClean = fClean && error("DisconnectBlock() : added transaction mismatch? database corrupted");
-
-            // remove outputs
-            outs->Clear();
+        // exactly.
+        for (unsigned int o = 0; o < tx.vout.size(); o++) {
+            if (tx.vout[o].scriptPubKey.IsUnspendable())
+                continue;
+            Coin coin;
+            bool is_spent = view.SpendCoin(COutPoint(hash, o), &coin);
+            if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight ||
+                    tx.IsCoinBase() != coin.IsCoinBase() || tx.IsCoinStake() != coin.IsCoinStake())
+                fClean = fClean && error("DisconnectBlock() : added transaction output mismatch? database corrupted");
         }
 
         // restore inputs
         if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs()) { // not coinbases or zerocoinspend because they dont have traditional inputs
-            const CTxUndo& txundo = blockUndo.vtxundo[i - 1];
+            CTxUndo& txundo = blockUndo.vtxundo[i - 1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock() : transaction and undo data inconsistent - txundo.vprevout.siz=%d tx.vin.siz=%d", txundo.vprevout.size(), tx.vin.size());
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint& out = tx.vin[j].prevout;
-                const CTxInUndo& undo = txundo.vprevout[j];
-                CCoinsModifier coins = view.ModifyCoins(out.hash);
-                if (undo.nHeight != 0) {
-                    // undo data contains height: this is the last output of the prevout tx being spent
-                    if (!coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data overwriting existing transaction");
-                    coins->Clear();
-                    coins->fCoinBase = undo.fCoinBase;
-                    coins->nHeight = undo.nHeight;
-                    coins->nVersion = undo.nVersion;
-                } else {
-                    if (coins->IsPruned())
-                        fClean = fClean && error("DisconnectBlock() : undo data adding output to missing transaction");
-                }
-                if (coins->IsAvailable(out.n))
-                    fClean = fClean && error("DisconnectBlock() : undo data overwriting existing output");
-                if (coins->vout.size() < out.n + 1)
-                    coins->vout.resize(out.n + 1);
-                coins->vout[out.n] = undo.txout;
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out))
+                    fClean = false;
             }
         }
     }
@@ -2109,6 +2320,28 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
+// Only the scripts and signatures are skipped: the UTXO, amount and proof-of-stake kernel checks still run.
+bool IsBlockAssumedValid(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValid.IsNull() || pindex == NULL || pindexBestHeader == NULL)
+        return false;
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    if (it == mapBlockIndex.end())
+        return false;
+    if (it->second->GetAncestor(pindex->nHeight) != pindex || pindexBestHeader->GetAncestor(pindex->nHeight) != pindex)
+        return false;
+    return pindexBestHeader->GetBlockTime() - pindex->GetBlockTime() > ASSUMEVALID_MIN_BURIED_TIME;
+}
+
+/** Same, for a block whose header may not be known yet. Requires cs_main. */
+static bool IsBlockAssumedValid(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    BlockMap::const_iterator it = mapBlockIndex.find(hash);
+    return it != mapBlockIndex.end() && IsBlockAssumedValid(it->second);
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2154,7 +2387,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return state.DoS(100, error("ConnectBlock() : PoW period ended"),
             REJECT_INVALID, "PoW-ended");
 
-    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    bool fScriptChecks = !IsBlockAssumedValid(pindex);
 
     // If scripts won't be checked anyways, don't bother seeing if CLTV is activated
     bool fCLTVIsActivated = false;
@@ -2193,10 +2426,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // See BIP30 and http://r6.ca/blog/20120206T005236Z.html for more information.
         // This logic is not necessary for memory pool transactions, as AcceptToMemoryPool
         // already refuses previously-known transaction ids entirely.
-        const CCoins* coins = view.AccessCoins(tx.GetHash());
-        if (coins && !coins->IsPruned())
-            return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
-                             REJECT_INVALID, "bad-txns-BIP30");
+        for (unsigned int o = 0; o < tx.vout.size(); o++) {
+            if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
+                                 REJECT_INVALID, "bad-txns-BIP30");
+        }
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -2356,6 +2590,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    // extend the block filter index, unless ThreadBlockFilterIndex hasn't caught up with the chain yet
+    if (pblockfilterdb && pindexBlockFilterBest && pindex->pprev == pindexBlockFilterBest) {
+        if (!IndexBlockFilter(CBlockFilter(block, &blockundo), pindex))
+            return AbortNode(state, "Failed to write block filter");
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2401,14 +2641,14 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     static int64_t nLastWrite = 0;
     try {
         if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
-            // Typical CCoins structures on disk are around 100 bytes in size.
+            // Typical Coin structures on disk are around 48 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
             // an overestimation, as most will delete an existing entry or
             // overwrite one. Still, use a conservative safety factor of 2.
-            if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
             FlushBlockFile();
@@ -2429,6 +2669,9 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                 if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                     return AbortNode(state, "Files to write to block index database");
                 }
+                if (!stakeModifierTable.Flush(pblocktree)) {
+                    return AbortNode(state, "Failed to write stake modifiers to block index database");
+                }
             }
             // Finally flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
@@ -2467,10 +2710,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     }
 
     const CBlockIndex* pChainTip = chainActive.Tip();
-    LogPrintf("UpdateTip: new best=%s  height=%d version=%d  log2_work=%.16f  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d version=%d  log2_work=%.16f  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utxo)\n",
             pChainTip->GetBlockHash().GetHex(), pChainTip->nHeight, pChainTip->nVersion, log(pChainTip->nChainWork.getdouble()) / log(2.0), (unsigned long)pChainTip->nChainTx,
               DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pChainTip->GetBlockTime()),
-              Checkpoints::GuessVerificationProgress(pChainTip), (unsigned int)pcoinsTip->GetCacheSize());
+              Checkpoints::GuessVerificationProgress(pChainTip), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     // Check the version of the last 100 blocks to see if we need to upgrade:
     static bool fWarned = false;
@@ -2512,17 +2755,33 @@ bool static DisconnectTip(CValidationState& state)
         assert(view.Flush());
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+    if (pblockfilterdb && pindexBlockFilterBest == pindexDelete) {
+        // the filters of the disconnected blocks stay in the index, under their block hash
+        pindexBlockFilterBest = pindexDelete->pprev;
+        if (!pblockfilterdb->ReadFilterHeader(pindexBlockFilterBest->GetBlockHash(), hashBlockFilterBestHeader) ||
+                !pblockfilterdb->WriteBestBlock(pindexBlockFilterBest->GetBlockHash()))
+            return AbortNode(state, "Failed to rewind the block filter index");
+    }
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    std::vector<uint256> vHashUpdate;
     for (const CTransaction& tx : block.vtx) {
         // ignore validation errors in resurrected transactions
         std::list<CTransaction> removed;
         CValidationState stateDummy;
         if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
             mempool.remove(tx, removed, true);
-    }
+        else if (mempool.exists(tx.GetHash()))
+            vHashUpdate.push_back(tx.GetHash());
+    }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in this
+    // block that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
     mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
@@ -2602,6 +2861,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    rateBlocksConnected.Add();
+    rateTxConnected.Add(pblock->vtx.size());
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     for (const CTransaction& tx : txConflicted) {
@@ -2936,12 +3197,24 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock, bool fAlreadyChe
                 uint256 hashNewTip = pindexNewTip->GetBlockHash();
                 // Relay inventory, but don't relay old inventory during initial block download.
                 int nBlockEstimate = Checkpoints::GetTotalBlocksEstimate();
+                // Peers supporting compact blocks get the new tip itself, to rebuild from their mempool.
+                const bool fCompact = pblock && pblock->GetHash() == hashNewTip;
+                CBlockHeaderAndShortTxIDs cmpctblock;
+                if (fCompact)
+                    cmpctblock = CBlockHeaderAndShortTxIDs(*pblock);
                 {
                     LOCK(cs_vNodes);
-                    for (CNode *pnode : vNodes)
-                        if (chainActive.Height() >
+                    for (CNode *pnode : vNodes) {
+                        if (chainActive.Height() <=
                             (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                            continue;
+                        if (fCompact && pnode->fSuccessfullyConnected && pnode->nVersion >= COMPACT_BLOCKS_VERSION) {
+                            if (pnode->AddInventoryKnown(CInv(MSG_BLOCK, hashNewTip)))
+                                pnode->PushMessage("cmpctblock", cmpctblock);
+                        } else {
                             pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                        }
+                    }
                 }
                 // Notify external listeners about the new tip.
                 GetMainSignals().UpdatedBlockTip(pindexNewTip);
@@ -3036,6 +3309,21 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex)
     return true;
 }
 
+/** Compute the stake modifier of pindex, whose parent's is known, from its block */
+static void SetBlockStakeModifier(CBlockIndex* pindex, const CBlock& block)
+{
+    if (!Params().GetConsensus().IsStakeModifierV2(pindex->nHeight)) {
+        uint64_t nStakeModifier = 0;
+        bool fGeneratedStakeModifier = false;
+        if (!ComputeNextStakeModifier(pindex->pprev, nStakeModifier, fGeneratedStakeModifier))
+            LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
+        pindex->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+    } else {
+        // compute new v2 stake modifier
+        pindex->SetNewStakeModifier(block.vtx[1].vin[0].prevout.hash);
+    }
+}
+
 CBlockIndex* AddToBlockIndex(const CBlock& block)
 {
     // Check for duplicate
@@ -3064,16 +3352,9 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         if (!pindexNew->SetStakeEntropyBit(pindexNew->GetStakeEntropyBit()))
             LogPrintf("AddToBlockIndex() : SetStakeEntropyBit() failed \n");
 
-        if (!Params().GetConsensus().IsStakeModifierV2(pindexNew->nHeight)) {
-            uint64_t nStakeModifier = 0;
-            bool fGeneratedStakeModifier = false;
-            if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
-                LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
-            pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-        } else {
-            // compute new v2 stake modifier
-            pindexNew->SetNewStakeModifier(block.vtx[1].vin[0].prevout.hash);
-        }
+        // a header received ahead of its block gets its stake modifier with the block (see AcceptBlock)
+        if (!block.vtx.empty())
+            SetBlockStakeModifier(pindexNew, block);
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
@@ -3217,7 +3498,7 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
         return state.DoS(50, error("CheckBlockHeader() : proof of work failed"),
             REJECT_INVALID, "high-hash");
 
-    if (Params().IsRegTestNet()) return true;
+    return true;
 }
 
 bool CheckColdStakeFreeOutput(const CTransaction& tx, const int nHeight)
@@ -3286,8 +3567,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     // transaction validation, as otherwise we may mark the header as invalid
     // because we receive the wrong transactions for it.
 
-    // Check the merkle root.
-    if (fCheckMerkleRoot) {
+    // Check the merkle root (unless the validation pipeline already did).
+    if (fCheckMerkleRoot && !block.fMerkleChecked) {
         bool mutated;
         uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
@@ -3377,13 +3658,6 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         // The case also exists that the sending peer could not have enough data to see
         // that this block is invalid, so don't issue an outright ban.
         if (nHeight != 0 && !IsInitialBlockDownload()) {
-            // Last output of Cold-Stake is not abused
-            if (IsPoS && !CheckColdStakeFreeOutput(block.vtx[1], nHeight)) {
-                mapRejectedBlocks.insert(std::make_pair(block.GetHash(), GetTime()));
-                return state.DoS(0, error("%s : Cold stake outputs not valid", __func__),
-                        REJECT_INVALID, "bad-p2cs-outs");
-            }
-
             // set Cold Staking Spork
             fColdStakingActive = sporkManager.IsSporkActive(SPORK_17_COLDSTAKING_ENFORCEMENT);
 
@@ -3498,6 +3772,11 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
     if (!CheckBlockTime(block, state, pindexPrev))
         return false;
 
+    // Check the difficulty target, which only depends on the previous headers
+    if (!CheckWork(CBlock(block), pindexPrev))
+        return state.DoS(100, error("%s : incorrect difficulty target at height %d", __func__, nHeight),
+            REJECT_INVALID, "bad-diffbits");
+
     // Check that the block chain matches the known block chain up to a checkpoint
     if (!Checkpoints::CheckBlock(nHeight, hash))
         return state.DoS(100, error("%s : rejected by checkpoint lock-in at %d", __func__, nHeight),
@@ -3569,6 +3848,18 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
             }
     }
 
+    // Last output of Cold-Stake is not abused. Checked here, under cs_main, rather than
+    // in CheckBlock as it may have to read the staked transaction from the disk.
+    // As the other checks in CheckBlock relying on masternode/spork data, this could
+    // fail only because we are missing some data: reject the block for now, without
+    // marking it (and its descendants) as permanently invalid.
+    if (pindexPrev && block.IsProofOfStake() && !IsInitialBlockDownload() &&
+            !CheckColdStakeFreeOutput(block.vtx[1], nHeight)) {
+        mapRejectedBlocks.insert(std::make_pair(block.GetHash(), GetTime()));
+        return state.DoS(0, error("%s : Cold stake outputs not valid", __func__),
+                REJECT_INVALID, "bad-p2cs-outs", true);
+    }
+
     return true;
 }
 
@@ -3665,10 +3956,14 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
      if (block.GetHash() != Params().GetConsensus().hashGenesisBlock && !CheckWork(block, pindexPrev))
         return false;
 
+    // The stake of a block can only be checked once its parent was accepted (headers arrive first)
+    if (pindexPrev && !(pindexPrev->nStatus & BLOCK_HAVE_DATA))
+        return state.DoS(0, error("%s : prev block %s not received yet", __func__, block.hashPrevBlock.GetHex()), 0, "bad-prevblk");
+
     bool isPoS = block.IsProofOfStake();
     if (isPoS) {
         std::string strError;
-        if (!CheckProofOfStake(block, strError, pindexPrev))
+        if (!CheckProofOfStake(block, strError, pindexPrev, !IsBlockAssumedValid(block.GetHash())))
             return state.DoS(100, error("%s: proof of stake check failed (%s)", __func__, strError));
     }
 
@@ -3682,6 +3977,12 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return true;
     }
 
+    if (pindex->pprev && pindex->vStakeModifier.empty()) {
+        // header received ahead of the block
+        SetBlockStakeModifier(pindex, block);
+        setDirtyBlockIndex.insert(pindex);
+    }
+
     if ((!fAlreadyCheckedBlock && !CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -3782,18 +4083,12 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         // Check if the inputs were spent on the main chain
         const CCoinsViewCache coins(pcoinsTip);
         for (const CTxIn& in: stakeTxIn.vin) {
-            const CCoins* coin = coins.AccessCoins(in.prevout.hash);
+            const Coin& coin = coins.AccessCoin(in.prevout);
 
-            if(!coin && !isBlockFromFork){
-                // No coins on the main chain
+            if(!coin.IsAvailable() && !isBlockFromFork){
+                // No unspent output on the main chain
                 return error("%s: coin stake inputs not available on main chain, received height %d vs current %d", __func__, nHeight, chainActive.Height());
             }
-            if(coin && !coin->IsAvailable(in.prevout.n)){
-                if(!isBlockFromFork){
-                    // Coins not available
-                    return error("%s: coin stake inputs already spent in main chain", __func__);
-                }
-            }
         }
 
     }
@@ -3867,7 +4162,117 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+bool CBlocksAwaitingParent::Add(NodeId nodeid, const CBlock& block)
+{
+    const uint256 hash = block.GetHash();
+    if (mapBlocks.count(hash))
+        return true;
+    const size_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (nTotalSize + nSize > nMaxSize)
+        return false;
+    CEntry& entry = mapBlocks[hash];
+    entry.nodeid = nodeid;
+    entry.block = block;
+    entry.nSize = nSize;
+    mapByPrev.insert(std::make_pair(block.hashPrevBlock, hash));
+    nTotalSize += nSize;
+    return true;
+}
+
+std::vector<std::pair<NodeId, CBlock> > CBlocksAwaitingParent::TakeChildren(const uint256& hashParent)
+{
+    std::vector<std::pair<NodeId, CBlock> > vChildren;
+    std::pair<std::multimap<uint256, uint256>::iterator, std::multimap<uint256, uint256>::iterator> range =
+        mapByPrev.equal_range(hashParent);
+    for (std::multimap<uint256, uint256>::iterator it = range.first; it != range.second; ++it) {
+        std::map<uint256, CEntry>::iterator itBlock = mapBlocks.find(it->second);
+        if (itBlock == mapBlocks.end())
+            continue;
+        nTotalSize -= itBlock->second.nSize;
+        vChildren.push_back(std::make_pair(itBlock->second.nodeid, itBlock->second.block));
+        mapBlocks.erase(itBlock);
+    }
+    mapByPrev.erase(range.first, range.second);
+    return vChildren;
+}
+
+size_t CBlocksAwaitingParent::EraseDescendants(const uint256& hashParent)
+{
+    size_t nErased = 0;
+    std::deque<uint256> queueParents(1, hashParent);
+    while (!queueParents.empty()) {
+        for (const std::pair<NodeId, CBlock>& child : TakeChildren(queueParents.front())) {
+            queueParents.push_back(child.second.GetHash());
+            nErased++;
+        }
+        queueParents.pop_front();
+    }
+    return nErased;
+}
+
+void CBlocksAwaitingParent::clear()
+{
+    mapBlocks.clear();
+    mapByPrev.clear();
+    nTotalSize = 0;
+}
+
+static bool ProcessNewBlockInternal(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp);
+
+/**
+ * After a block was processed without success: if it failed validation, the blocks downloaded
+ * ahead of it will never connect, drop them.
+ */
+static void EraseBlocksAwaitingFailedParent(const CValidationState& state, const uint256& hash)
+{
+    LOCK(cs_main);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    if (!state.IsInvalid() && (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_FAILED_MASK)))
+        return;
+    const size_t nErased = blocksAwaitingParent.EraseDescendants(hash);
+    if (nErased)
+        LogPrint("net", "%s : dropped %u blocks descending from invalid block %s\n", __func__, nErased, hash.GetHex());
+}
+
+/** Process the blocks that were downloaded ahead of hashParent, and of their children in turn */
+static void ProcessBlocksAwaitingParent(const uint256& hashParent)
+{
+    std::deque<uint256> queueParents(1, hashParent);
+    while (!queueParents.empty()) {
+        std::vector<std::pair<NodeId, CBlock> > vChildren;
+        {
+            LOCK(cs_main);
+            vChildren = blocksAwaitingParent.TakeChildren(queueParents.front());
+        }
+        queueParents.pop_front();
+
+        for (std::pair<NodeId, CBlock>& child : vChildren) {
+            CValidationState stateChild;
+            if (ProcessNewBlockInternal(stateChild, NULL, &child.second, NULL)) {
+                queueParents.push_back(child.second.GetHash());
+                continue;
+            }
+            EraseBlocksAwaitingFailedParent(stateChild, child.second.GetHash());
+            int nDoS;
+            if (stateChild.IsInvalid(nDoS) && nDoS > 0) {
+                LOCK(cs_main);
+                Misbehaving(child.first, nDoS);
+            }
+        }
+    }
+}
+
 bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp)
+{
+    if (!ProcessNewBlockInternal(state, pfrom, pblock, dbp)) {
+        EraseBlocksAwaitingFailedParent(state, pblock->GetHash());
+        return false;
+    }
+    ProcessBlocksAwaitingParent(pblock->GetHash());
+    return true;
+}
+
+static bool ProcessNewBlockInternal(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp)
 {
     AssertLockNotHeld(cs_main);
 
@@ -3877,14 +4282,23 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     // check block
     bool checked = CheckBlock(*pblock, state);
 
-    if (!CheckBlockSignature(*pblock))
+    bool fAssumedValid;
+    {
+        LOCK(cs_main);
+        fAssumedValid = IsBlockAssumedValid(pblock->GetHash());
+    }
+    if (!fAssumedValid && !CheckBlockSignature(*pblock))
         return error("%s : bad proof-of-stake block signature", __func__);
 
     if (pblock->GetHash() != Params().GetConsensus().hashGenesisBlock && pfrom != NULL) {
         //if we get this far, check if the prev block is our prev block, if not then request sync and return false
+        LOCK(cs_main);
         BlockMap::iterator mi = mapBlockIndex.find(pblock->hashPrevBlock);
         if (mi == mapBlockIndex.end()) {
-            pfrom->PushMessage("getblocks", chainActive.GetLocator(), UINT256_ZERO);
+            if (pfrom->nVersion >= HEADERS_SYNC_VERSION)
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), pblock->GetHash());
+            else
+                pfrom->PushMessage("getblocks", chainActive.GetLocator(), UINT256_ZERO);
             return false;
         }
     }
@@ -3896,6 +4310,17 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
         if (!checked) {
             return error ("%s : CheckBlock FAILED for block %s", __func__, pblock->GetHash().GetHex());
         }
+        if (pfrom)
+            rateBlocksDownloaded.Add();
+
+        // A block downloaded ahead of its parent waits for it
+        BlockMap::iterator miPrev = mapBlockIndex.find(pblock->hashPrevBlock);
+        if (miPrev != mapBlockIndex.end() && !(miPrev->second->nStatus & BLOCK_HAVE_DATA)) {
+            if (!blocksAwaitingParent.Add(pfrom ? pfrom->GetId() : -1, *pblock))
+                return error("%s : no room for block %s downloaded ahead of its parent", __func__, pblock->GetHash().GetHex());
+            LogPrint("net", "%s : block %s waits for its parent %s\n", __func__, pblock->GetHash().GetHex(), pblock->hashPrevBlock.GetHex());
+            return false;
+        }
 
         // Store to disk
         CBlockIndex* pindex = nullptr;
@@ -3954,6 +4379,235 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     return true;
 }
 
+/**
+ * Block validation pipeline
+ *
+ * During initial block download, blocks received from the network are not
+ * validated on the message handler thread. They are queued in arrival order:
+ * a pool of pre-check threads runs the expensive context-free checks of each
+ * queued block as soon as it arrives (merkle root and block signature), while
+ * a single connect thread hands the blocks to ProcessNewBlock strictly in order.
+ * The pre-checks read no chain state, so they never wait for cs_main. They
+ * only memoize successes on the block itself: failures are found again, and
+ * reported to the peer, by the in-order validation.
+ */
+namespace {
+
+struct CPipelineBlock {
+    CBlock block;
+    CNode* pfrom;
+    bool fAssumedValid; //! under the -assumevalid block: its signatures won't be checked
+    bool fPreChecked;
+    int64_t nTimeQueued;
+
+    CPipelineBlock(CNode* pfromIn, const CBlock& blockIn, bool fAssumedValidIn) :
+        block(blockIn), pfrom(pfromIn->AddRef()), fAssumedValid(fAssumedValidIn), fPreChecked(false), nTimeQueued(GetTimeMicros()) {}
+    ~CPipelineBlock() { pfrom->Release(); }
+};
+typedef std::shared_ptr<CPipelineBlock> CPipelineBlockRef;
+
+boost::mutex cs_blockpipeline;
+boost::condition_variable condBlockCheck;     //! signals blocks waiting for a pre-check thread
+boost::condition_variable condBlockConnect;   //! signals pre-checked blocks to the connect thread
+boost::condition_variable condBlockSpace;     //! signals room in the pipeline to the message handler
+int nBlockCheckThreads = 0;
+std::deque<CPipelineBlockRef> queueBlockCheck;     //! blocks waiting for a pre-check thread
+std::deque<CPipelineBlockRef> queueBlockConnect;   //! all the queued blocks, in arrival order
+std::set<uint256> setBlockPipeline;
+CBlockPipelineStats pipelineStats;
+int64_t nPipelineActiveSince = 0;
+
+} // anon namespace
+
+/** Run the expensive context-free parts of the validation of block, memoizing the successes */
+static void PreCheckBlock(const CBlock& block, bool fAssumedValid)
+{
+    bool mutated;
+    if (BlockMerkleRoot(block, &mutated) == block.hashMerkleRoot && !mutated)
+        block.fMerkleChecked = true;
+
+    if (!block.IsProofOfStake() || fAssumedValid)
+        return;
+
+    if (CheckBlockSignature(block))
+        block.fSignatureChecked = true;
+}
+
+/** Reconstruction statistics of the compact blocks received. Requires cs_main. */
+struct CCompactBlockStats {
+    uint64_t nBlocks;       //! blocks rebuilt from a cmpctblock
+    uint64_t nTransactions; //! transactions of these blocks
+    uint64_t nPrefilled;    //! transactions sent in full in the cmpctblock
+    uint64_t nFromMempool;  //! transactions found in our mempool
+    uint64_t nRequested;    //! transactions fetched with getblocktxn
+    uint64_t nFallbacks;    //! compact blocks that had to be fetched in full
+};
+static CCompactBlockStats compactBlockStats;
+
+static void RecordCompactBlock(const PartiallyDownloadedBlock& partialBlock, const CBlock& block, size_t nRequested, NodeId nodeid)
+{
+    CCompactBlockStats& stats = compactBlockStats;
+    stats.nBlocks++;
+    stats.nTransactions += block.vtx.size();
+    stats.nPrefilled += partialBlock.GetPrefilledCount();
+    stats.nFromMempool += partialBlock.GetMempoolCount();
+    stats.nRequested += nRequested;
+    const uint64_t nShortIDs = stats.nFromMempool + stats.nRequested;
+    LogPrint("cmpctblock", "Reconstructed block %s with %u txs: %u prefilled, %u from mempool, %u requested, peer=%d "
+                           "(total: %u blocks, %.1f%% mempool hits, %u fallbacks)\n",
+             block.GetHash().ToString(), block.vtx.size(), partialBlock.GetPrefilledCount(), partialBlock.GetMempoolCount(),
+             nRequested, nodeid, stats.nBlocks, nShortIDs ? 100.0 * stats.nFromMempool / nShortIDs : 100.0, stats.nFallbacks);
+}
+
+/** Whether a received block needs no processing: its data is stored, or it waits for its parent. Requires cs_main. */
+static bool HaveBlockData(const uint256& hash)
+{
+    AssertLockHeld(cs_main);
+    BlockMap::const_iterator mi = mapBlockIndex.find(hash);
+    return (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA)) || blocksAwaitingParent.Contains(hash);
+}
+
+/** Validate a block received from pfrom and punish the peer if it is invalid */
+static void ProcessBlockFromPeer(CNode* pfrom, CBlock& block)
+{
+    CValidationState state;
+    ProcessNewBlock(state, pfrom, &block);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", std::string("block"), state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            TRY_LOCK(cs_main, lockMain);
+            if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
+void SetBlockCheckThreads(int nThreads)
+{
+    boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+    nBlockCheckThreads = nThreads;
+}
+
+bool QueueBlockForValidation(CNode* pfrom, const CBlock& block)
+{
+    const bool fInitialDownload = IsInitialBlockDownload();
+    bool fAssumedValid;
+    {
+        LOCK(cs_main);
+        fAssumedValid = IsBlockAssumedValid(block.GetHash());
+    }
+    boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+    if (nBlockCheckThreads <= 0)
+        return false;
+    // Once blocks are queued, the following ones must go through the pipeline too (to keep them in order)
+    if (!fInitialDownload && queueBlockConnect.empty())
+        return false;
+    if (setBlockPipeline.count(block.GetHash()))
+        return true;
+    while (nBlockCheckThreads > 0 && queueBlockConnect.size() >= MAX_BLOCKS_IN_PIPELINE)
+        condBlockSpace.wait(lock);
+    if (nBlockCheckThreads <= 0)
+        return false;
+
+    CPipelineBlockRef item = std::make_shared<CPipelineBlock>(pfrom, block, fAssumedValid);
+    if (queueBlockConnect.empty())
+        nPipelineActiveSince = item->nTimeQueued;
+    setBlockPipeline.insert(block.GetHash());
+    queueBlockCheck.push_back(item);
+    queueBlockConnect.push_back(item);
+    condBlockCheck.notify_one();
+    return true;
+}
+
+bool IsBlockInPipeline(const uint256& hash)
+{
+    boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+    return setBlockPipeline.count(hash) > 0;
+}
+
+void GetBlockPipelineStats(CBlockPipelineStats& stats)
+{
+    boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+    stats = pipelineStats;
+    stats.nThreads = nBlockCheckThreads;
+    stats.nQueued = queueBlockConnect.size();
+    stats.nPendingCheck = queueBlockCheck.size();
+    if (nPipelineActiveSince)
+        stats.nTimeActive += GetTimeMicros() - nPipelineActiveSince;
+}
+
+void ThreadBlockCheck()
+{
+    util::ThreadRename("oasis-blockchk");
+    while (true) {
+        CPipelineBlockRef item;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+            while (queueBlockCheck.empty())
+                condBlockCheck.wait(lock);
+            item = queueBlockCheck.front();
+            queueBlockCheck.pop_front();
+        }
+        const int64_t nStart = GetTimeMicros();
+        PreCheckBlock(item->block, item->fAssumedValid);
+        {
+            boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+            item->fPreChecked = true;
+            pipelineStats.nTimeCheck += GetTimeMicros() - nStart;
+        }
+        condBlockConnect.notify_one();
+    }
+}
+
+void ThreadBlockConnect()
+{
+    util::ThreadRename("oasis-blockcon");
+    try {
+        while (true) {
+            CPipelineBlockRef item;
+            {
+                boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+                while (queueBlockConnect.empty() || !queueBlockConnect.front()->fPreChecked)
+                    condBlockConnect.wait(lock);
+                item = queueBlockConnect.front();
+            }
+            const int64_t nStart = GetTimeMicros();
+            ProcessBlockFromPeer(item->pfrom, item->block);
+            const int64_t nEnd = GetTimeMicros();
+            size_t nQueued;
+            {
+                boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+                queueBlockConnect.pop_front();
+                setBlockPipeline.erase(item->block.GetHash());
+                pipelineStats.nBlocks++;
+                pipelineStats.nTimeConnect += nEnd - nStart;
+                pipelineStats.nTimeQueued += nStart - item->nTimeQueued;
+                if (queueBlockConnect.empty()) {
+                    pipelineStats.nTimeActive += nEnd - nPipelineActiveSince;
+                    nPipelineActiveSince = 0;
+                }
+                nQueued = queueBlockConnect.size();
+            }
+            condBlockSpace.notify_all();
+            LogPrint("bench", "    - Pipeline: block %s processed in %.2fms after %.2fms in queue (%u queued)\n",
+                     item->block.GetHash().ToString(), 0.001 * (nEnd - nStart), 0.001 * (nStart - item->nTimeQueued), nQueued);
+        }
+    } catch (const boost::thread_interrupted&) {
+        // drop the queued blocks, releasing their peers
+        {
+            boost::unique_lock<boost::mutex> lock(cs_blockpipeline);
+            nBlockCheckThreads = 0;
+            queueBlockCheck.clear();
+            queueBlockConnect.clear();
+            setBlockPipeline.clear();
+            nPipelineActiveSince = 0;
+        }
+        condBlockSpace.notify_all();
+        throw;
+    }
+}
+
 bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex* const pindexPrev, bool fCheckPOW, bool fCheckMerkleRoot)
 {
     AssertLockHeld(cs_main);
@@ -4167,6 +4821,10 @@ bool static LoadBlockIndexDB(std::string& strError)
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Load the kernel stake modifiers (v1) computed so far
+    if (!stakeModifierTable.Load(pblocktree))
+        return error("%s : failed to load kernel stake modifiers", __func__);
+
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
@@ -4238,7 +4896,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -4294,9 +4952,11 @@ void UnloadBlockIndex()
     mapBlocksInFlight.clear();
     nQueuedValidatedHeaders = 0;
     nPreferredDownload = 0;
+    blocksAwaitingParent.clear();
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
     mapNodeState.clear();
+    stakeModifierTable.Clear();
 
     for (BlockMap::value_type& entry : mapBlockIndex) {
         delete entry.second;
@@ -4639,8 +5299,11 @@ bool static AlreadyHave(const CInv& inv)
     case MSG_TX: {
         bool txInMap = false;
         txInMap = mempool.exists(inv.hash);
+        // Only the first two outputs are probed, and only in the cache, so that
+        // a peer cannot make us hit the disk with inv messages for confirmed txes.
         return txInMap || mapOrphanTransactions.count(inv.hash) ||
-               pcoinsTip->HaveCoins(inv.hash);
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) ||
+               pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
     }
     case MSG_DSTX:
         return mapObfuscationBroadcastTxes.count(inv.hash);
@@ -5170,9 +5833,16 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    if (pfrom->nVersion >= HEADERS_SYNC_VERSION) {
+                        // The headers lead to the block and to its missing ancestors, which are then
+                        // downloaded in parallel.
+                        pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                        LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    } else {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(inv);
+                        LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
                 }
             }
 
@@ -5207,7 +5877,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+    else if (strCommand == "getblocks" || (strCommand == "getheaders" && pfrom->nVersion < HEADERS_SYNC_VERSION)) {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -5245,22 +5915,20 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == "getheaders") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
         if (locator.vHave.size() > MAX_LOCATOR_SZ) {
-            LogPrint("net", "getblocks locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
+            LogPrint("net", "getheaders locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
             pfrom->fDisconnect = true;
             return true;
         }
 
         LOCK(cs_main);
 
-        if (IsInitialBlockDownload())
-            return true;
-
+        // Only the headers of the active chain are served, so this is safe during initial block download too
         CBlockIndex* pindex = NULL;
         if (locator.IsNull()) {
             // If locator is null, return the hashStop block
@@ -5441,7 +6109,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive() && !fImporting && !fReindex) // Ignore headers received while importing
+    else if (strCommand == "headers" && !fImporting && !fReindex) // Ignore headers received while importing
     {
         std::vector<CBlockHeader> headers;
 
@@ -5464,7 +6132,27 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
+
+        // Headers that don't connect: ask for the ones leading to them, at most once per
+        // UNCONNECTED_HEADERS_INTERVAL so that a peer can't make us send locators in a loop
+        if (!mapBlockIndex.count(headers[0].hashPrevBlock)) {
+            CNodeState* nodestate = State(pfrom->GetId());
+            const int64_t nNow = GetTime();
+            if (nNow - nodestate->nUnconnectedHeadersTime < UNCONNECTED_HEADERS_INTERVAL) {
+                LogPrint("net", "unconnected headers from peer=%d, getheaders already sent\n", pfrom->id);
+                return true;
+            }
+            nodestate->nUnconnectedHeadersTime = nNow;
+            LogPrint("net", "unconnected headers, getheaders (%d) to peer=%d\n", pindexBestHeader->nHeight, pfrom->id);
+            pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), UINT256_ZERO);
+            return true;
+        }
+
+        CNodeState* nodestate = State(pfrom->GetId());
+        PruneUnprovenHeaders(nodestate);
         CBlockIndex* pindexLast = NULL;
+        unsigned int nNewHeaders = 0;
+        bool fHeadersPaused = false;
         for (const CBlockHeader& header : headers) {
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
@@ -5472,10 +6160,14 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                 return error("non-continuous headers sequence");
             }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
-            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
+            // A header-only CBlock: its stake modifier is computed once the block is received (AcceptBlock)
+            const bool fNewHeader = !mapBlockIndex.count(header.GetHash());
+            if (fNewHeader && nodestate->vUnprovenHeaders.size() >= MAX_UNPROVEN_HEADERS_PER_PEER) {
+                // The stake of these headers can't be checked yet: wait for the blocks of the previous ones
+                fHeadersPaused = true;
+                break;
+            }
+            if (!AcceptBlockHeader(CBlock(header), state, &pindexLast)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -5483,13 +6175,21 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
                     std::string strError = "invalid header received " + header.GetHash().ToString();
                     return error(strError.c_str());
                 }
+            } else if (fNewHeader) {
+                nNewHeaders++;
+                nodestate->vUnprovenHeaders.push_back(pindexLast);
             }
         }
+        rateHeaders.Add(nNewHeaders);
 
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
-        if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
+        if (fHeadersPaused) {
+            LogPrint("net", "peer=%d sent %u headers ahead of their blocks, pausing its headers\n",
+                     pfrom->id, nodestate->vUnprovenHeaders.size());
+            nodestate->fHeadersPaused = true;
+        } else if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
@@ -5508,9 +6208,21 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        bool fHavePrev, fHaveBlock;
+        {
+            LOCK(cs_main);
+            fHavePrev = mapBlockIndex.count(block.hashPrevBlock) || IsBlockInPipeline(block.hashPrevBlock);
+            // the header alone is there as soon as it was accepted: only skip a block we have the data of
+            fHaveBlock = HaveBlockData(hashBlock);
+        }
+
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
-        if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+        if (!fHavePrev) {
+            LOCK(cs_main);
+            if (pfrom->nVersion >= HEADERS_SYNC_VERSION) {
+                // fetch the headers leading to it, the blocks follow
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hashBlock);
+            } else if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
                 //we already asked for this block, so lets work backwards and ask for the previous block
                 pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
                 pfrom->vBlockRequested.push_back(block.hashPrevBlock);
@@ -5522,18 +6234,10 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         } else {
             pfrom->AddInventoryKnown(inv);
 
-            CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
-                ProcessNewBlock(state, pfrom, &block);
-                int nDoS;
-                if(state.IsInvalid(nDoS)) {
-                    pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                                       state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-                    if(nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if(lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
-                }
+            if (!fHaveBlock) {
+                // during IBD, validate the block on the pipeline (else here)
+                if (!QueueBlockForValidation(pfrom, block))
+                    ProcessBlockFromPeer(pfrom, block);
                 //disconnect this node if its old protocol version
                 pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
             } else {
@@ -5542,6 +6246,162 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         }
     }
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        const uint256 hashBlock = cmpctblock.header.GetHash();
+        CInv inv(MSG_BLOCK, hashBlock);
+        LogPrint("net", "received cmpctblock %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+        pfrom->AddInventoryKnown(inv);
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            UpdateBlockAvailability(pfrom->GetId(), hashBlock);
+            if (HaveBlockData(hashBlock) || IsBlockInPipeline(hashBlock))
+                return true;
+
+            // only a block extending our chain is worth rebuilding, fetch any other the usual way
+            if ((!mapBlockIndex.count(cmpctblock.header.hashPrevBlock) && !IsBlockInPipeline(cmpctblock.header.hashPrevBlock)) ||
+                IsInitialBlockDownload()) {
+                if (!mapBlocksInFlight.count(hashBlock))
+                    pfrom->PushMessage("getdata", std::vector<CInv>(1, inv));
+                return true;
+            }
+
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = std::make_shared<PartiallyDownloadedBlock>();
+            ReadStatus status = partialBlock->InitData(cmpctblock, mempool);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("%s : invalid cmpctblock %s from peer=%d", __func__, hashBlock.ToString(), pfrom->id);
+            }
+            if (status == READ_STATUS_OK) {
+                CBlockTransactionsRequest req;
+                req.blockhash = hashBlock;
+                req.vIndexes = partialBlock->GetMissing();
+                if (!req.vIndexes.empty()) {
+                    State(pfrom->GetId())->partialBlock = partialBlock;
+                    pfrom->PushMessage("getblocktxn", req);
+                    return true;
+                }
+                status = partialBlock->FillBlock(block, std::vector<CTransaction>());
+            }
+            if (status != READ_STATUS_OK) {
+                compactBlockStats.nFallbacks++;
+                LogPrint("cmpctblock", "Failed to reconstruct block %s, fetching it from peer=%d\n", hashBlock.ToString(), pfrom->id);
+                pfrom->PushMessage("getdata", std::vector<CInv>(1, inv));
+                return true;
+            }
+            RecordCompactBlock(*partialBlock, block, 0, pfrom->id);
+        }
+
+        if (!QueueBlockForValidation(pfrom, block))
+            ProcessBlockFromPeer(pfrom, block);
+    }
+
+    else if (strCommand == "getblocktxn") {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+        CBlock block;
+        if (!ReadBlockFromDisk(block, mi->second))
+            return error("%s : cannot load block %s from disk", __func__, req.blockhash.ToString());
+
+        // a peer this far behind is better served by the whole block
+        if (mi->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            pfrom->PushMessage("block", block);
+            return true;
+        }
+
+        CBlockTransactions resp(req);
+        for (size_t i = 0; i < req.vIndexes.size(); i++) {
+            if (req.vIndexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("%s : getblocktxn with out-of-bounds tx index from peer=%d", __func__, pfrom->id);
+            }
+            resp.vtx[i] = block.vtx[req.vIndexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+    else if (strCommand == "getcfilters") {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 hashStop;
+        vRecv >> nFilterType >> nStartHeight >> hashStop;
+
+        if (!(nLocalServices & NODE_SCRIPT_FILTERS) || nFilterType != BLOCK_FILTER_TYPE) {
+            LogPrint("net", "Peer %d requested unsupported block filters, disconnecting\n", pfrom->id);
+            pfrom->fDisconnect = true;
+            return true;
+        }
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+        if (mi == mapBlockIndex.end()) {
+            LogPrint("net", "Peer %d sent a getcfilters for an unknown block %s\n", pfrom->id, hashStop.ToString());
+            return true;
+        }
+        const CBlockIndex* pindexStop = mi->second;
+        if (nStartHeight > (uint32_t)pindexStop->nHeight || pindexStop->nHeight - (int)nStartHeight >= MAX_GETCFILTERS_SIZE) {
+            Misbehaving(pfrom->GetId(), 100);
+            return error("%s : getcfilters with an invalid range from peer=%d", __func__, pfrom->id);
+        }
+
+        for (int nHeight = nStartHeight; nHeight <= pindexStop->nHeight; nHeight++) {
+            CBlockFilter filter;
+            uint256 hashHeader;
+            // the index may not have reached these blocks yet
+            if (!GetBlockFilter(pindexStop->GetAncestor(nHeight), filter, hashHeader))
+                break;
+            pfrom->PushMessage("cfilter", nFilterType, filter.GetBlockHash(), filter.GetEncoded());
+        }
+    }
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            CNodeState* state = State(pfrom->GetId());
+            std::shared_ptr<PartiallyDownloadedBlock> partialBlock = state->partialBlock;
+            if (!partialBlock || partialBlock->header.GetHash() != resp.blockhash) {
+                LogPrint("net", "Peer %d sent us a blocktxn for a block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+            state->partialBlock.reset();
+
+            CInv inv(MSG_BLOCK, resp.blockhash);
+            ReadStatus status = partialBlock->FillBlock(block, resp.vtx);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("%s : invalid blocktxn for block %s from peer=%d", __func__, resp.blockhash.ToString(), pfrom->id);
+            }
+            if (status == READ_STATUS_FAILED) {
+                compactBlockStats.nFallbacks++;
+                LogPrint("cmpctblock", "Failed to reconstruct block %s, fetching it from peer=%d\n", resp.blockhash.ToString(), pfrom->id);
+                pfrom->PushMessage("getdata", std::vector<CInv>(1, inv));
+                return true;
+            }
+            RecordCompactBlock(*partialBlock, block, resp.vtx.size(), pfrom->id);
+            if (HaveBlockData(resp.blockhash))
+                return true;
+        }
+
+        if (!QueueBlockForValidation(pfrom, block))
+            ProcessBlockFromPeer(pfrom, block);
+    }
+
     // This asymmetric behavior for inbound and outbound connections was introduced
     // to prevent a fingerprinting attack: an attacker can send specific fake addresses
     // to users' AddrMan and later request them by sending getaddr messages.
@@ -5734,7 +6594,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             }
         }
     } else {
-        //probably one the extensions
+        //probably one the extensions (unless the masternode message workers took them)
         mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
         budget.ProcessMessage(pfrom, strCommand, vRecv);
         masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
@@ -5747,6 +6607,226 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     return true;
 }
 
+/**
+ * Masternode-layer messages (masternode list, payment votes, budgets, sporks and their sync) rarely
+ * need chain state, so they are handed to a pool of worker threads instead of being processed on the
+ * message handler thread with the block and transaction messages. Each peer's messages are processed
+ * one at a time and in order, peers take turns, and each handler group only runs on one worker at a
+ * time, as its handler was written for a single thread.
+ */
+namespace {
+
+enum MasternodeMessageGroup {
+    MN_MESSAGES_MASTERNODES,
+    MN_MESSAGES_PAYMENTS,
+    MN_MESSAGES_BUDGET,
+    MN_MESSAGES_SPORKS,
+    MN_MESSAGES_SYNC,
+    MN_MESSAGES_GROUPS
+};
+
+struct CQueuedMessage {
+    std::string strCommand;
+    CDataStream vRecv;
+    int64_t nTimeQueued;
+
+    CQueuedMessage(const std::string& strCommandIn, const CDataStream& vRecvIn) :
+        strCommand(strCommandIn), vRecv(vRecvIn), nTimeQueued(GetTimeMicros()) {}
+};
+
+struct CPeerMessageQueue {
+    CNode* pnode;
+    std::deque<CQueuedMessage> queue;
+
+    CPeerMessageQueue() : pnode(NULL) {}
+};
+
+boost::mutex cs_mnmessages;
+boost::condition_variable condMnMessages;
+int nMnMessageThreads = 0;
+std::map<NodeId, CPeerMessageQueue> mapMnMessageQueues;   //! peers with messages waiting or being processed
+std::deque<NodeId> queueMnMessagePeers;                    //! peers waiting for a worker, in turn
+size_t nMnMessagesQueued = 0;
+CMessageQueueStats mnMessageStats;
+RecursiveMutex cs_mnMessageGroup[MN_MESSAGES_GROUPS];
+
+} // anon namespace
+
+/** The handler group of a masternode-layer message, -1 for the chain messages */
+static int GetMasternodeMessageGroup(const std::string& strCommand)
+{
+    if (strCommand == "mnb" || strCommand == "mnp" || strCommand == "dseg")
+        return MN_MESSAGES_MASTERNODES;
+    if (strCommand == "mnw" || strCommand == "mnget")
+        return MN_MESSAGES_PAYMENTS;
+    if (strCommand == "mprop" || strCommand == "mvote" || strCommand == "fbs" || strCommand == "fbvote" || strCommand == "mnvs")
+        return MN_MESSAGES_BUDGET;
+    if (strCommand == "spork" || strCommand == "getsporks")
+        return MN_MESSAGES_SPORKS;
+    if (strCommand == "ssc")
+        return MN_MESSAGES_SYNC;
+    // SwiftX lock requests carry transactions for the mempool and share its state, they stay with the chain messages
+    return -1;
+}
+
+/** Process a masternode-layer message on a worker thread */
+static void ProcessMasternodeMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv)
+{
+    const int nGroup = GetMasternodeMessageGroup(strCommand);
+    LOCK(cs_mnMessageGroup[nGroup]);
+    switch (nGroup) {
+    case MN_MESSAGES_MASTERNODES:
+        mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
+        break;
+    case MN_MESSAGES_PAYMENTS:
+        masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
+        break;
+    case MN_MESSAGES_BUDGET:
+        budget.ProcessMessage(pfrom, strCommand, vRecv);
+        break;
+    case MN_MESSAGES_SPORKS:
+        sporkManager.ProcessSpork(pfrom, strCommand, vRecv);
+        break;
+    case MN_MESSAGES_SYNC:
+        masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
+        break;
+    }
+}
+
+enum QueueMessageResult {
+    MESSAGE_NOT_QUEUED,   //! to be processed by the caller
+    MESSAGE_QUEUED,
+    MESSAGE_QUEUE_FULL,   //! the peer's queue is full, retry once a worker made room
+};
+
+/** Queue a masternode-layer message received from pfrom for the workers */
+static QueueMessageResult QueueMasternodeMessage(CNode* pfrom, const std::string& strCommand, const CDataStream& vRecv)
+{
+    if (GetMasternodeMessageGroup(strCommand) < 0)
+        return MESSAGE_NOT_QUEUED;
+
+    // ProcessMessage drops the messages of peers that didn't send their version (and
+    // punishes them), as well as the ones picked by -dropmessagestest: leave these to it.
+    if (pfrom->nVersion == 0 || mapArgs.count("-dropmessagestest"))
+        return MESSAGE_NOT_QUEUED;
+
+    boost::unique_lock<boost::mutex> lock(cs_mnmessages);
+    if (nMnMessageThreads <= 0)
+        return MESSAGE_NOT_QUEUED;
+
+    std::map<NodeId, CPeerMessageQueue>::iterator it = mapMnMessageQueues.find(pfrom->GetId());
+    if (it == mapMnMessageQueues.end()) {
+        it = mapMnMessageQueues.insert(std::make_pair(pfrom->GetId(), CPeerMessageQueue())).first;
+        it->second.pnode = pfrom->AddRef();
+        queueMnMessagePeers.push_back(pfrom->GetId());
+    }
+    CPeerMessageQueue& peer = it->second;
+    if (peer.queue.size() >= MAX_QUEUED_MASTERNODE_MESSAGES) {
+        pfrom->fDispatchPaused = true;
+        mnMessageStats.nDeferred++;
+        return MESSAGE_QUEUE_FULL;
+    }
+
+    LogPrint("net", "received: %s (%u bytes) peer=%d, queued\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
+    peer.queue.push_back(CQueuedMessage(strCommand, vRecv));
+    nMnMessagesQueued++;
+    mnMessageStats.nMaxQueued = std::max(mnMessageStats.nMaxQueued, nMnMessagesQueued);
+    condMnMessages.notify_one();
+    return MESSAGE_QUEUED;
+}
+
+void SetMasternodeMessageThreads(int nThreads)
+{
+    boost::unique_lock<boost::mutex> lock(cs_mnmessages);
+    nMnMessageThreads = nThreads;
+}
+
+void GetMasternodeMessageStats(CMessageQueueStats& stats)
+{
+    boost::unique_lock<boost::mutex> lock(cs_mnmessages);
+    stats = mnMessageStats;
+    stats.nThreads = nMnMessageThreads;
+    stats.nPeers = mapMnMessageQueues.size();
+    stats.nQueued = nMnMessagesQueued;
+}
+
+void ThreadMasternodeMessages()
+{
+    util::ThreadRename("oasis-mnmsg");
+    try {
+        while (true) {
+            NodeId nodeid;
+            CNode* pfrom;
+            std::unique_ptr<CQueuedMessage> msg;
+            {
+                boost::unique_lock<boost::mutex> lock(cs_mnmessages);
+                while (queueMnMessagePeers.empty())
+                    condMnMessages.wait(lock);
+                // the peer leaves the turn queue until its message is processed, keeping its messages in order
+                nodeid = queueMnMessagePeers.front();
+                queueMnMessagePeers.pop_front();
+                CPeerMessageQueue& peer = mapMnMessageQueues[nodeid];
+                pfrom = peer.pnode;
+                msg.reset(new CQueuedMessage(peer.queue.front()));
+                peer.queue.pop_front();
+                nMnMessagesQueued--;
+            }
+
+            const int64_t nStart = GetTimeMicros();
+            if (!pfrom->fDisconnect) {
+                try {
+                    ProcessMasternodeMessage(pfrom, msg->strCommand, msg->vRecv);
+                } catch (const std::ios_base::failure& e) {
+                    pfrom->PushMessage("reject", msg->strCommand, REJECT_MALFORMED, std::string("error parsing message"));
+                    LogPrintf("%s(%s, %u bytes): Exception '%s' caught\n", __func__, SanitizeString(msg->strCommand), msg->vRecv.size(), e.what());
+                } catch (const boost::thread_interrupted&) {
+                    throw;
+                } catch (const std::exception& e) {
+                    PrintExceptionContinue(&e, "ThreadMasternodeMessages()");
+                } catch (...) {
+                    PrintExceptionContinue(NULL, "ThreadMasternodeMessages()");
+                }
+            }
+            const int64_t nEnd = GetTimeMicros();
+
+            bool fResume = false;
+            {
+                boost::unique_lock<boost::mutex> lock(cs_mnmessages);
+                mnMessageStats.nProcessed++;
+                mnMessageStats.nTimeProcess += nEnd - nStart;
+                mnMessageStats.nTimeQueued += nStart - msg->nTimeQueued;
+                if (pfrom->fDispatchPaused) {
+                    pfrom->fDispatchPaused = false;
+                    fResume = true;
+                }
+                // the queues are dropped on shutdown
+                std::map<NodeId, CPeerMessageQueue>::iterator it = mapMnMessageQueues.find(nodeid);
+                if (it != mapMnMessageQueues.end()) {
+                    if (it->second.queue.empty()) {
+                        pfrom->Release();
+                        mapMnMessageQueues.erase(it);
+                    } else {
+                        queueMnMessagePeers.push_back(nodeid);
+                        condMnMessages.notify_one();
+                    }
+                }
+            }
+            if (fResume)
+                WakeMessageHandler();
+        }
+    } catch (const boost::thread_interrupted&) {
+        // drop the queued messages, releasing their peers
+        boost::unique_lock<boost::mutex> lock(cs_mnmessages);
+        nMnMessageThreads = 0;
+        for (std::map<NodeId, CPeerMessageQueue>::iterator it = mapMnMessageQueues.begin(); it != mapMnMessageQueues.end(); ++it)
+            it->second.pnode->Release();
+        mapMnMessageQueues.clear();
+        queueMnMessagePeers.clear();
+        nMnMessagesQueued = 0;
+        throw;
+    }
+}
+
 // Note: whenever a protocol update is needed toggle between both implementations (comment out the formerly active one)
 //       so we can leave the existing clients untouched (old SPORK will stay on so they don't see even older clients).
 //       Those old clients won't react to the changes of the other (new) SPORK because at the time of their implementation
@@ -5832,6 +6912,15 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
+        // Masternode-layer messages go to their workers and don't count as this call's message
+        const QueueMessageResult queued = QueueMasternodeMessage(pfrom, strCommand, vRecv);
+        if (queued == MESSAGE_QUEUED)
+            continue;
+        if (queued == MESSAGE_QUEUE_FULL) {
+            --it;
+            break;
+        }
+
         // Process message
         bool fRet = false;
         try {
@@ -5976,10 +7065,15 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), UINT256_ZERO);
-                pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO);
+                if (pto->nVersion >= HEADERS_SYNC_VERSION) {
+                    // Headers first: the blocks are then downloaded in parallel from all the peers
+                    CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), UINT256_ZERO);
+                    state.nHeadersSyncTimeout = GetHeadersSyncTimeout(GetTimeMicros());
+                } else {
+                    pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO);
+                }
             }
         }
 
@@ -6041,6 +7135,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             // should only happen during initial block download.
             LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
             pto->fDisconnect = true;
+            nDownloadStallers++;
         }
         // In case there is a block that has been in flight from this peer for (2 + 0.5 * N) times the block interval
         // (with N the number of validated blocks that were in flight at the time it was requested), disconnect due to
@@ -6052,6 +7147,53 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             pto->fDisconnect = true;
         }
 
+        // Rotate the headers sync peer if it doesn't deliver the headers in time
+        if (!pto->fDisconnect && state.fSyncStarted && state.nHeadersSyncTimeout > 0) {
+            if (pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 24 * 60 * 60) {
+                // the headers caught up with today
+                state.nHeadersSyncTimeout = 0;
+            } else if (nNow > state.nHeadersSyncTimeout && nSyncStarted == 1 && !state.fHeadersPaused) {
+                nHeadersSyncTimeouts++;
+                if (!pto->fWhitelisted) {
+                    LogPrintf("Timeout downloading headers from peer=%d, disconnecting\n", pto->id);
+                    pto->fDisconnect = true;
+                } else {
+                    LogPrintf("Timeout downloading headers from whitelisted peer=%d, syncing from another peer\n", pto->id);
+                    state.fSyncStarted = false;
+                    state.nHeadersSyncTimeout = 0;
+                    nSyncStarted--;
+                }
+            }
+        }
+
+        // Resume the headers of a peer once enough of the blocks they lead to were received
+        if (!pto->fDisconnect && state.fHeadersPaused && PruneUnprovenHeaders(&state) <= MAX_UNPROVEN_HEADERS_PER_PEER / 2) {
+            state.fHeadersPaused = false;
+            CBlockIndex* pindexStart = state.pindexBestKnownBlock ? state.pindexBestKnownBlock : pindexBestHeader;
+            LogPrint("net", "resume getheaders (%d) to peer=%d\n", pindexStart->nHeight, pto->id);
+            pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), UINT256_ZERO);
+            if (state.nHeadersSyncTimeout > 0)
+                state.nHeadersSyncTimeout = GetHeadersSyncTimeout(nNow);
+        }
+
+        // Blocks are only downloaded along the chain a peer announced. During the initial download,
+        // ask the peers other than the headers sync one which part of our best header chain they
+        // have, up to the end of the download window: they answer with a single header (or with
+        // the headers of their own chain if ours forked from it).
+        if (!pto->fDisconnect && !pto->fClient && fFetch && pto->nVersion >= HEADERS_SYNC_VERSION &&
+                state.nHeadersSyncTimeout == 0 && IsInitialBlockDownload()) {
+            ProcessBlockAvailability(pto->GetId());
+            const int nProbeHeight = std::min(pindexBestHeader->nHeight, chainActive.Height() + (int)BLOCK_DOWNLOAD_WINDOW);
+            const int64_t nTimeNow = GetTime();
+            if (nProbeHeight > chainActive.Height() &&
+                    (state.pindexBestKnownBlock == NULL || state.pindexBestKnownBlock->nHeight < nProbeHeight) &&
+                    nTimeNow - state.nHeadersProbeTime >= HEADERS_PROBE_INTERVAL) {
+                state.nHeadersProbeTime = nTimeNow;
+                CBlockIndex* pindexProbe = pindexBestHeader->GetAncestor(nProbeHeight);
+                pto->PushMessage("getheaders", chainActive.GetLocator(pindexProbe->pprev), pindexProbe->GetBlockHash());
+            }
+        }
+
         //
         // Message: getdata (blocks)
         //
@@ -50,6 +50,8 @@
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
+class CBlockFilter;
+class CBlockFilterDB;
 class CBlockTreeDB;
 class CZerocoinDB;
 class CSporkDB;
@@ -74,6 +76,16 @@ static const unsigned int MAX_ZEROCOIN_TX_SIZE = 150000;
 static const unsigned int MAX_P2SH_SIGOPS = 15;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -84,8 +96,21 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
-static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 512;
+/** Maximum number of block pre-check threads */
+static const int MAX_BLOCKCHECK_THREADS = 16;
+/** -blockcheckthreads default (0 = auto) */
+static const int DEFAULT_BLOCKCHECK_THREADS = 0;
+/** Maximum number of blocks waiting in the validation pipeline */
+static const unsigned int MAX_BLOCKS_IN_PIPELINE = 1024;
+/** Maximum number of masternode message worker threads */
+static const int MAX_MASTERNODE_MESSAGE_THREADS = 8;
+/** -mnmsgthreads default (0 = process them on the message handler thread) */
+static const int DEFAULT_MASTERNODE_MESSAGE_THREADS = 2;
+/** Maximum number of masternode-layer messages of a single peer waiting for a worker */
+static const size_t MAX_QUEUED_MASTERNODE_MESSAGES = 500;
+/** Number of blocks that can be requested at any given time from a single peer. Small enough for
+ *  several peers to share the BLOCK_DOWNLOAD_WINDOW during initial block download. */
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 128;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -96,6 +121,20 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Headers download timeout of the sync peer, in microseconds: a base, plus a time per expected header. */
+static const int64_t HEADERS_DOWNLOAD_TIMEOUT_BASE = 15 * 60 * 1000000;
+static const int64_t HEADERS_DOWNLOAD_TIMEOUT_PER_HEADER = 1000;
+/** Minimum time (in seconds) between two getheaders sent to a peer for headers that don't connect. */
+static const int64_t UNCONNECTED_HEADERS_INTERVAL = 10;
+/** Maximum number of header-only block index entries a peer can have added ahead of the blocks.
+ *  Proof-of-stake headers carry no proof: the peer gets more headers only once the blocks arrive. */
+static const size_t MAX_UNPROVEN_HEADERS_PER_PEER = 2 * MAX_HEADERS_RESULTS;
+/** Minimum time (in seconds) between two requests of the best header chain a download peer has. */
+static const int64_t HEADERS_PROBE_INTERVAL = 10;
+/** Maximum size of the blocks downloaded ahead of their parent, waiting for it to be accepted. */
+static const size_t MAX_BLOCKS_AWAITING_PARENT_SIZE = 64 * 1000 * 1000;
+/** Depth below which getblocktxn requests are answered with the full block. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
@@ -103,9 +142,15 @@ static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 
 /** Enable bloom filter */
  static const bool DEFAULT_PEERBLOOMFILTERS = true;
+/** -blockfilterindex default */
+static const bool DEFAULT_BLOCKFILTERINDEX = true;
+/** Maximum number of filters sent in answer to a getcfilters request */
+static const int MAX_GETCFILTERS_SIZE = 1000;
 
 /** If the tip is older than this (in seconds), the node is considered to be in initial block download. */
 static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
+/** Age (in seconds, from the best header) a block under the -assumevalid block must have to skip its script checks. */
+static const int64_t ASSUMEVALID_MIN_BURIED_TIME = 14 * 24 * 60 * 60;
 
 /** Default for -blockspamfilter, use header spam filter */
 static const bool DEFAULT_BLOCK_SPAM_FILTER = true;
@@ -138,11 +183,14 @@ extern std::atomic<bool> fImporting;
 extern std::atomic<bool> fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fBlockFilterIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern int64_t nMaxTipAge;
+/** Block whose ancestors are assumed to have valid scripts and signatures (-assumevalid), null to check them all */
+extern uint256 hashAssumeValid;
 extern bool fVerifyingBlocks;
 
 extern bool fLargeWorkForkFound;
@@ -204,6 +252,116 @@ bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
 
+/** Statistics of the block validation pipeline (times in microseconds) */
+struct CBlockPipelineStats {
+    int nThreads{0};
+    size_t nQueued{0};         //! blocks waiting to be connected
+    size_t nPendingCheck{0};   //! blocks waiting for a pre-check thread
+    uint64_t nBlocks{0};       //! blocks processed by the pipeline
+    int64_t nTimeActive{0};    //! wall time spent with a non-empty pipeline
+    int64_t nTimeCheck{0};     //! time spent by the pre-check threads
+    int64_t nTimeConnect{0};   //! time spent by the connect thread
+    int64_t nTimeQueued{0};    //! time spent by the blocks waiting to be connected
+};
+/** Set the number of block pre-check threads (0 = validate the blocks on the message handler thread) */
+void SetBlockCheckThreads(int nThreads);
+/** Queue a block received from pfrom for validation. Returns false if the pipeline is not in use */
+bool QueueBlockForValidation(CNode* pfrom, const CBlock& block);
+/** Check whether a block is waiting in the validation pipeline */
+bool IsBlockInPipeline(const uint256& hash);
+void GetBlockPipelineStats(CBlockPipelineStats& stats);
+/** Run an instance of the block pre-check thread */
+void ThreadBlockCheck();
+/** Run the thread connecting the pre-checked blocks, in order */
+void ThreadBlockConnect();
+
+/** Resume the block filter index from the last block it indexed on the active chain */
+void InitBlockFilterIndex();
+/** Build the filters the index is missing, until it caught up with the active chain and ConnectBlock takes over */
+void ThreadBlockFilterIndex();
+/** Filter and filter header of a block, false if the block isn't indexed (yet) */
+bool GetBlockFilter(const CBlockIndex* pindex, CBlockFilter& filter, uint256& hashHeader);
+/**
+ * Whether the script and signature checks of the block at pindex can be skipped: it is an ancestor of
+ * the -assumevalid block, on the best header chain, and buried under two weeks of blocks. Requires cs_main.
+ */
+bool IsBlockAssumedValid(const CBlockIndex* pindex);
+
+/**
+ * Blocks downloaded ahead of their parent: a proof-of-stake block can only be checked once its
+ * parent is accepted (for the stake modifier). They wait here, up to a total serialized size,
+ * and are taken out by parent once it is accepted, or dropped with all their descendants if it
+ * fails validation.
+ */
+class CBlocksAwaitingParent
+{
+private:
+    struct CEntry {
+        NodeId nodeid;
+        CBlock block;
+        size_t nSize;
+    };
+    std::map<uint256, CEntry> mapBlocks;
+    std::multimap<uint256, uint256> mapByPrev;
+    size_t nTotalSize;
+    size_t nMaxSize;
+
+public:
+    explicit CBlocksAwaitingParent(size_t nMaxSizeIn) : nTotalSize(0), nMaxSize(nMaxSizeIn) {}
+
+    //! Keep block, received from nodeid, until its parent is accepted; false if there's no room for it
+    bool Add(NodeId nodeid, const CBlock& block);
+    bool Contains(const uint256& hash) const { return mapBlocks.count(hash) > 0; }
+    //! Remove the blocks whose parent is hashParent, returning them with the peer they came from
+    std::vector<std::pair<NodeId, CBlock> > TakeChildren(const uint256& hashParent);
+    //! Drop the blocks descending from hashParent, which failed validation; returns how many were dropped
+    size_t EraseDescendants(const uint256& hashParent);
+
+    size_t size() const { return mapBlocks.size(); }
+    //! Serialized size of the blocks kept
+    size_t GetTotalSize() const { return nTotalSize; }
+    void clear();
+};
+
+/** Progress and throughput of the headers-first block download (rates per second, over the last minute) */
+struct CSyncStatus {
+    int nHeaderHeight{-1};           //! height of the best header
+    int nBlockHeight{-1};            //! height of the active chain
+    NodeId nHeadersSyncPeer{-1};     //! peer the headers are requested from, -1 if none
+    int nDownloadPeers{0};           //! peers with blocks in flight
+    size_t nBlocksInFlight{0};
+    size_t nBlocksAwaitingParent{0}; //! blocks downloaded ahead of their parent
+    size_t nBytesAwaitingParent{0};
+    uint64_t nHeaders{0};            //! headers accepted
+    uint64_t nBlocksDownloaded{0};
+    uint64_t nBlocksConnected{0};
+    uint64_t nTxConnected{0};
+    uint64_t nStallers{0};           //! peers disconnected for stalling the download window
+    uint64_t nHeadersTimeouts{0};    //! headers sync peers dropped for being too slow
+    double dHeadersRate{0};
+    double dDownloadRate{0};
+    double dConnectRate{0};
+    double dTxConnectRate{0};
+};
+void GetSyncStatus(CSyncStatus& status);
+
+/** Statistics of the masternode message workers (times in microseconds) */
+struct CMessageQueueStats {
+    int nThreads{0};
+    size_t nPeers{0};          //! peers with messages waiting or being processed
+    size_t nQueued{0};         //! messages waiting for a worker
+    size_t nMaxQueued{0};      //! highest number of messages waiting at once
+    uint64_t nProcessed{0};    //! messages processed by the workers
+    uint64_t nDeferred{0};     //! times a peer's receive buffer was paused because its queue was full
+    int64_t nTimeProcess{0};   //! time spent processing messages
+    int64_t nTimeQueued{0};    //! time spent by the messages waiting for a worker
+};
+/** Set the number of masternode message workers (0 = process those messages on the message handler thread) */
+void SetMasternodeMessageThreads(int nThreads);
+void GetMasternodeMessageStats(CMessageQueueStats& stats);
+/** Run an instance of the masternode message worker thread */
+void ThreadMasternodeMessages();
+
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core */
@@ -312,8 +470,8 @@ private:
 
 public:
     CScriptCheck() : ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-                                                                                                                                ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(outIn.scriptPubKey),
+                                                                                                                              ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
 
     bool operator()();
 
@@ -381,6 +539,9 @@ public:
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
+/** Approximate heap memory used by mapBlockIndex, its entries and the active chain. */
+size_t BlockIndexDynamicMemoryUsage();
+
 /** Mark a block as invalid. */
 bool InvalidateBlock(CValidationState& state, CBlockIndex* pindex);
 
@@ -396,6 +557,9 @@ extern CCoinsViewCache* pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
+/** Global variable that points to the block filter index, null without -blockfilterindex */
+extern CBlockFilterDB* pblockfilterdb;
+
 /** Global variable that points to the zerocoin database (protected by cs_main) */
 extern CZerocoinDB* zerocoinDB;
 
@@ -8,6 +8,7 @@
 
 #include "addrman.h"
 #include "chainparams.h"
+#include "core_memusage.h"
 #include "masternode-budget.h"
 #include "masternode-sync.h"
 #include "masternode.h"
@@ -271,127 +272,140 @@ void CBudgetManager::SubmitFinalBudget()
 // CBudgetDB
 //
 
-CBudgetDB::CBudgetDB()
+CBudgetDB budgetDB;
+
+CBudgetDB::CBudgetDB() : tableProposals(DB_BUDGET_PROPOSAL),
+                         tableFinalizedBudgets(DB_BUDGET_FINALIZED),
+                         tableSeenProposals(DB_BUDGET_SEEN_PROPOSAL),
+                         tableSeenProposalVotes(DB_BUDGET_SEEN_PROPOSAL_VOTE),
+                         tableOrphanProposalVotes(DB_BUDGET_ORPHAN_PROPOSAL_VOTE),
+                         tableSeenFinalizedBudgets(DB_BUDGET_SEEN_FINALIZED),
+                         tableSeenFinalizedBudgetVotes(DB_BUDGET_SEEN_FINALIZED_VOTE),
+                         tableOrphanFinalizedBudgetVotes(DB_BUDGET_ORPHAN_FINALIZED_VOTE)
 {
-    pathDB = GetDataDir() / "budget.dat";
     strMagicMessage = "MasternodeBudget";
 }
 
+template <typename V>
+static int StageBudgetTable(CLevelDBBatch& batch, CMasternodeStateTable<uint256>& table, const std::map<uint256, V>& mapObjects)
+{
+    int nWritten = 0;
+    for (const auto& it : mapObjects)
+        nWritten += table.Stage(batch, it.first, it.second);
+    return nWritten;
+}
+
+template <typename V>
+static void LoadBudgetTable(CMasternodeStateTable<uint256>& table, std::map<uint256, V>& mapObjects, bool fKeep)
+{
+    table.Load<V>(*pmnStateDB, [&](const uint256& hash, const V& obj) {
+        if (fKeep) mapObjects.insert(std::make_pair(hash, obj));
+    });
+}
+
 bool CBudgetDB::Write(const CBudgetManager& objToSave)
 {
-    LOCK(objToSave.cs);
+    if (pmnStateDB == NULL)
+        return false;
 
     int64_t nStart = GetTimeMillis();
+    LOCK(cs);
+
+    // serialize a snapshot, so that the budget manager isn't locked for the whole dump
+    std::map<uint256, CBudgetProposal> mapProposals;
+    std::map<uint256, CFinalizedBudget> mapFinalizedBudgets;
+    std::map<uint256, CBudgetProposalBroadcast> mapSeenMasternodeBudgetProposals;
+    std::map<uint256, CBudgetVote> mapSeenMasternodeBudgetVotes;
+    std::map<uint256, CBudgetVote> mapOrphanMasternodeBudgetVotes;
+    std::map<uint256, CFinalizedBudgetBroadcast> mapSeenFinalizedBudgets;
+    std::map<uint256, CFinalizedBudgetVote> mapSeenFinalizedBudgetVotes;
+    std::map<uint256, CFinalizedBudgetVote> mapOrphanFinalizedBudgetVotes;
+    {
+        LOCK(objToSave.cs);
+        mapProposals = objToSave.mapProposals;
+        mapFinalizedBudgets = objToSave.mapFinalizedBudgets;
+        mapSeenMasternodeBudgetProposals = objToSave.mapSeenMasternodeBudgetProposals;
+        mapSeenMasternodeBudgetVotes = objToSave.mapSeenMasternodeBudgetVotes;
+        mapOrphanMasternodeBudgetVotes = objToSave.mapOrphanMasternodeBudgetVotes;
+        mapSeenFinalizedBudgets = objToSave.mapSeenFinalizedBudgets;
+        mapSeenFinalizedBudgetVotes = objToSave.mapSeenFinalizedBudgetVotes;
+        mapOrphanFinalizedBudgetVotes = objToSave.mapOrphanFinalizedBudgetVotes;
+    }
+
+    CMasternodeStateTable<uint256>* tables[] = {&tableProposals, &tableFinalizedBudgets, &tableSeenProposals, &tableSeenProposalVotes,
+                                                &tableOrphanProposalVotes, &tableSeenFinalizedBudgets, &tableSeenFinalizedBudgetVotes, &tableOrphanFinalizedBudgetVotes};
+
+    CLevelDBBatch batch;
+    int nWritten = StageBudgetTable(batch, tableProposals, mapProposals) +
+                   StageBudgetTable(batch, tableFinalizedBudgets, mapFinalizedBudgets) +
+                   StageBudgetTable(batch, tableSeenProposals, mapSeenMasternodeBudgetProposals) +
+                   StageBudgetTable(batch, tableSeenProposalVotes, mapSeenMasternodeBudgetVotes) +
+                   StageBudgetTable(batch, tableOrphanProposalVotes, mapOrphanMasternodeBudgetVotes) +
+                   StageBudgetTable(batch, tableSeenFinalizedBudgets, mapSeenFinalizedBudgets) +
+                   StageBudgetTable(batch, tableSeenFinalizedBudgetVotes, mapSeenFinalizedBudgetVotes) +
+                   StageBudgetTable(batch, tableOrphanFinalizedBudgetVotes, mapOrphanFinalizedBudgetVotes);
+    int nErased = 0;
+    for (CMasternodeStateTable<uint256>* ptable : tables)
+        nErased += ptable->EraseUnstaged(batch);
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // masternode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
-
-    // Write and commit header, data
     try {
-        fileout << ssObj;
+        pmnStateDB->WriteBatch(batch);
     } catch (const std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+        for (CMasternodeStateTable<uint256>* ptable : tables)
+            ptable->Abort();
+        return error("%s : Database error - %s", __func__, e.what());
     }
-    fileout.fclose();
+    for (CMasternodeStateTable<uint256>* ptable : tables)
+        ptable->Commit();
 
-    LogPrint("mnbudget","Written info to budget.dat  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("mnbudget","Written %d and erased %d budget entries  %dms\n", nWritten, nErased, GetTimeMillis() - nStart);
 
     return true;
 }
 
-CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad, bool fDryRun)
+CBudgetDB::ReadResult CBudgetDB::Read(CBudgetManager& objToLoad)
 {
-    LOCK(objToLoad.cs);
-
-    int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathDB.string());
+    if (pmnStateDB == NULL)
         return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathDB);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    std::vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (const std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
 
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
+    int64_t nStart = GetTimeMillis();
+    LOCK2(cs, objToLoad.cs);
+    objToLoad.Clear();
 
+    // a budget.dat left by an older version replaces the stored entries
+    const bool fImport = ImportMasternodeStateFile("budget.dat", strMagicMessage, objToLoad);
 
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
     try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
-        ssObj >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
-
-
-        // de-serialize file header (network specific magic number) and ..
-        ssObj >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-
-        // de-serialize data into CBudgetManager object
-        ssObj >> objToLoad;
+        LoadBudgetTable(tableProposals, objToLoad.mapProposals, !fImport);
+        LoadBudgetTable(tableFinalizedBudgets, objToLoad.mapFinalizedBudgets, !fImport);
+        LoadBudgetTable(tableSeenProposals, objToLoad.mapSeenMasternodeBudgetProposals, !fImport);
+        LoadBudgetTable(tableSeenProposalVotes, objToLoad.mapSeenMasternodeBudgetVotes, !fImport);
+        LoadBudgetTable(tableOrphanProposalVotes, objToLoad.mapOrphanMasternodeBudgetVotes, !fImport);
+        LoadBudgetTable(tableSeenFinalizedBudgets, objToLoad.mapSeenFinalizedBudgets, !fImport);
+        LoadBudgetTable(tableSeenFinalizedBudgetVotes, objToLoad.mapSeenFinalizedBudgetVotes, !fImport);
+        LoadBudgetTable(tableOrphanFinalizedBudgetVotes, objToLoad.mapOrphanFinalizedBudgetVotes, !fImport);
     } catch (const std::exception& e) {
         objToLoad.Clear();
         error("%s : Deserialize or I/O error - %s", __func__, e.what());
         return IncorrectFormat;
     }
 
-    LogPrint("mnbudget","Loaded info from budget.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrint("mnbudget","  %s\n", objToLoad.ToString());
-    if (!fDryRun) {
-        LogPrint("mnbudget","Budget manager - cleaning....\n");
-        objToLoad.CheckAndRemove();
-        LogPrint("mnbudget","Budget manager - result:\n");
-        LogPrint("mnbudget","  %s\n", objToLoad.ToString());
+    if (fImport) {
+        if (Write(objToLoad))
+            boost::filesystem::remove(GetDataDir() / "budget.dat");
+        LogPrintf("Imported budget.dat into the masternode state database\n");
+    } else if (tableProposals.size() == 0 && tableFinalizedBudgets.size() == 0 && tableSeenProposals.size() == 0 &&
+               tableSeenFinalizedBudgets.size() == 0) {
+        return FileError;
     }
 
+    LogPrint("mnbudget","Loaded budgets  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("mnbudget","  %s\n", objToLoad.ToString());
+    LogPrint("mnbudget","Budget manager - cleaning....\n");
+    objToLoad.CheckAndRemove();
+    LogPrint("mnbudget","Budget manager - result:\n");
+    LogPrint("mnbudget","  %s\n", objToLoad.ToString());
+
     return Ok;
 }
 
@@ -399,25 +413,8 @@ void DumpBudgets()
 {
     int64_t nStart = GetTimeMillis();
 
-    CBudgetDB budgetdb;
-    CBudgetManager tempBudget;
-
-    LogPrint("mnbudget","Verifying budget.dat format...\n");
-    CBudgetDB::ReadResult readResult = budgetdb.Read(tempBudget, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CBudgetDB::FileError)
-        LogPrint("mnbudget","Missing budgets file - budget.dat, will try to recreate\n");
-    else if (readResult != CBudgetDB::Ok) {
-        LogPrint("mnbudget","Error reading budget.dat: ");
-        if (readResult == CBudgetDB::IncorrectFormat)
-            LogPrint("mnbudget","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("mnbudget","file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
-    LogPrint("mnbudget","Writting info to budget.dat...\n");
-    budgetdb.Write(budget);
+    LogPrint("mnbudget","Writting info to the masternode state database...\n");
+    budgetDB.Write(budget);
 
     LogPrint("mnbudget","Budget dump finished  %dms\n", GetTimeMillis() - nStart);
 }
@@ -449,6 +446,7 @@ bool CBudgetManager::AddProposal(CBudgetProposal& budgetProposal)
     }
 
     mapProposals.insert(std::make_pair(budgetProposal.GetHash(), budgetProposal));
+    fBudgetProjectionValid = false;
     LogPrint("mnbudget","CBudgetManager::AddProposal - proposal %s added\n", budgetProposal.GetName ().c_str ());
     return true;
 }
@@ -519,6 +517,7 @@ void CBudgetManager::CheckAndRemove()
     // Remove invalid entries by overwriting complete map
     mapFinalizedBudgets.swap(tmpMapFinalizedBudgets);
     mapProposals.swap(tmpMapProposals);
+    fBudgetProjectionValid = false;
 
     // clang doesn't accept copy assignemnts :-/
     // mapFinalizedBudgets = tmpMapFinalizedBudgets;
@@ -743,10 +742,10 @@ std::vector<CBudgetProposal*> CBudgetManager::GetAllProposals()
 
     std::vector<CBudgetProposal*> vBudgetProposalRet;
 
+    CheckVoteValidity();
+
     std::map<uint256, CBudgetProposal>::iterator it = mapProposals.begin();
     while (it != mapProposals.end()) {
-        (*it).second.CleanAndRemove();
-
         CBudgetProposal* pbudgetProposal = &((*it).second);
         vBudgetProposalRet.push_back(pbudgetProposal);
 
@@ -768,10 +767,27 @@ struct sortProposalsByVotes {
     }
 };
 
-//Need to review this function
-std::vector<CBudgetProposal*> CBudgetManager::GetBudget()
+void CBudgetManager::CheckVoteValidity()
 {
-    LOCK(cs);
+    AssertLockHeld(cs);
+
+    // votes only change validity when masternodes come or go
+    const uint64_t nListVersion = mnodeman.GetListVersion();
+    if (nListVersion == nVotesCheckedListVersion) return;
+
+    for (auto& it : mapProposals) {
+        if (it.second.CleanAndRemove())
+            fBudgetProjectionValid = false;
+    }
+    for (auto& it : mapFinalizedBudgets)
+        it.second.CleanAndRemove();
+
+    nVotesCheckedListVersion = nListVersion;
+}
+
+void CBudgetManager::UpdateBudgetProjection(const CBlockIndex* pindexPrev, int nBlockStart, int nBlockEnd, int mnCount)
+{
+    AssertLockHeld(cs);
 
     // ------- Sort budgets by Yes Count
 
@@ -779,7 +795,6 @@ std::vector<CBudgetProposal*> CBudgetManager::GetBudget()
 
     std::map<uint256, CBudgetProposal>::iterator it = mapProposals.begin();
     while (it != mapProposals.end()) {
-        (*it).second.CleanAndRemove();
         vBudgetPorposalsSort.push_back(std::make_pair(&((*it).second), (*it).second.GetYeas() - (*it).second.GetNays()));
         ++it;
     }
@@ -788,27 +803,21 @@ std::vector<CBudgetProposal*> CBudgetManager::GetBudget()
 
     // ------- Grab The Budgets In Order
 
-    std::vector<CBudgetProposal*> vBudgetProposalsRet;
+    vBudgetProjection.clear();
+    nProjectionExpiry = std::numeric_limits<int64_t>::max();
 
     CAmount nBudgetAllocated = 0;
-
-    CBlockIndex* pindexPrev;
-    {
-        LOCK(cs_main);
-        pindexPrev = chainActive.Tip();
-    }
-    if (pindexPrev == NULL) return vBudgetProposalsRet;
-
-    const int nBlocksPerCycle = Params().GetConsensus().nBudgetCycleBlocks;
-    int nBlockStart = pindexPrev->nHeight - pindexPrev->nHeight % nBlocksPerCycle + nBlocksPerCycle;
-    int nBlockEnd = nBlockStart + nBlocksPerCycle - 1;
-    int mnCount = mnodeman.CountEnabled(ActiveProtocol());
     CAmount nTotalBudget = GetTotalBudget(nBlockStart);
+    const int64_t nEstablishmentTime = Params().GetConsensus().nProposalEstablishmentTime;
 
     std::vector<std::pair<CBudgetProposal*, int> >::iterator it2 = vBudgetPorposalsSort.begin();
     while (it2 != vBudgetPorposalsSort.end()) {
         CBudgetProposal* pbudgetProposal = (*it2).first;
 
+        // the projection changes once this proposal is established
+        if (!pbudgetProposal->IsEstablished())
+            nProjectionExpiry = std::min(nProjectionExpiry, pbudgetProposal->nTime + nEstablishmentTime + 1);
+
         LogPrint("mnbudget","CBudgetManager::GetBudget() - Processing Budget %s\n", pbudgetProposal->strProposalName.c_str());
         //prop start/end should be inside this period
         if (pbudgetProposal->IsPassing(pindexPrev, nBlockStart, nBlockEnd, mnCount)) {
@@ -820,7 +829,7 @@ std::vector<CBudgetProposal*> CBudgetManager::GetBudget()
             if (pbudgetProposal->GetAmount() + nBudgetAllocated <= nTotalBudget) {
                 pbudgetProposal->SetAllotted(pbudgetProposal->GetAmount());
                 nBudgetAllocated += pbudgetProposal->GetAmount();
-                vBudgetProposalsRet.push_back(pbudgetProposal);
+                vBudgetProjection.push_back((*it2).first->GetHash());
                 LogPrint("mnbudget","CBudgetManager::GetBudget() -     Check 2 passed: Budget added\n");
             } else {
                 pbudgetProposal->SetAllotted(0);
@@ -830,13 +839,48 @@ std::vector<CBudgetProposal*> CBudgetManager::GetBudget()
         else {
             LogPrint("mnbudget","CBudgetManager::GetBudget() -   Check 1 failed: valid=%d | %ld <= %ld | %ld >= %ld | Yeas=%d Nays=%d Count=%d | established=%d\n",
                       pbudgetProposal->fValid, pbudgetProposal->nBlockStart, nBlockStart, pbudgetProposal->nBlockEnd,
-                      nBlockEnd, pbudgetProposal->GetYeas(), pbudgetProposal->GetNays(), mnodeman.CountEnabled(ActiveProtocol()) / 10,
+                      nBlockEnd, pbudgetProposal->GetYeas(), pbudgetProposal->GetNays(), mnCount / 10,
                       pbudgetProposal->IsEstablished());
         }
 
         ++it2;
     }
 
+    fBudgetProjectionValid = true;
+    nProjectionBlockStart = nBlockStart;
+    nProjectionMnCount = mnCount;
+}
+
+std::vector<CBudgetProposal*> CBudgetManager::GetBudget()
+{
+    LOCK(cs);
+
+    std::vector<CBudgetProposal*> vBudgetProposalsRet;
+
+    CBlockIndex* pindexPrev;
+    {
+        LOCK(cs_main);
+        pindexPrev = chainActive.Tip();
+    }
+    if (pindexPrev == NULL) return vBudgetProposalsRet;
+
+    const int nBlocksPerCycle = Params().GetConsensus().nBudgetCycleBlocks;
+    int nBlockStart = pindexPrev->nHeight - pindexPrev->nHeight % nBlocksPerCycle + nBlocksPerCycle;
+    int nBlockEnd = nBlockStart + nBlocksPerCycle - 1;
+    int mnCount = mnodeman.CountEnabled(ActiveProtocol());
+
+    CheckVoteValidity();
+    if (!fBudgetProjectionValid || nProjectionBlockStart != nBlockStart || nProjectionMnCount != mnCount ||
+        GetAdjustedTime() >= nProjectionExpiry) {
+        UpdateBudgetProjection(pindexPrev, nBlockStart, nBlockEnd, mnCount);
+    }
+
+    for (const uint256& nHash : vBudgetProjection) {
+        std::map<uint256, CBudgetProposal>::iterator it = mapProposals.find(nHash);
+        if (it != mapProposals.end())
+            vBudgetProposalsRet.push_back(&it->second);
+    }
+
     return vBudgetProposalsRet;
 }
 
@@ -998,18 +1042,8 @@ void CBudgetManager::NewBlock()
     }
 
     LogPrint("mnbudget","CBudgetManager::NewBlock - mapProposals cleanup - size: %d\n", mapProposals.size());
-    std::map<uint256, CBudgetProposal>::iterator it2 = mapProposals.begin();
-    while (it2 != mapProposals.end()) {
-        (*it2).second.CleanAndRemove();
-        ++it2;
-    }
-
     LogPrint("mnbudget","CBudgetManager::NewBlock - mapFinalizedBudgets cleanup - size: %d\n", mapFinalizedBudgets.size());
-    std::map<uint256, CFinalizedBudget>::iterator it3 = mapFinalizedBudgets.begin();
-    while (it3 != mapFinalizedBudgets.end()) {
-        (*it3).second.CleanAndRemove();
-        ++it3;
-    }
+    CheckVoteValidity();
 
     LogPrint("mnbudget","CBudgetManager::NewBlock - vecImmatureBudgetProposals cleanup - size: %d\n", vecImmatureBudgetProposals.size());
     std::vector<CBudgetProposalBroadcast>::iterator it4 = vecImmatureBudgetProposals.begin();
@@ -1417,7 +1451,13 @@ bool CBudgetManager::UpdateProposal(CBudgetVote& vote, CNode* pfrom, std::string
     }
 
 
-    return mapProposals[vote.nProposalHash].AddOrUpdateVote(vote, strError);
+    // counted only while the masternode is listed, as CheckVoteValidity would decide
+    vote.fValid = (mnodeman.Find(vote.GetVin()) != NULL);
+    if (!mapProposals[vote.nProposalHash].AddOrUpdateVote(vote, strError))
+        return false;
+
+    fBudgetProjectionValid = false;
+    return true;
 }
 
 bool CBudgetManager::UpdateFinalizedBudget(CFinalizedBudgetVote& vote, CNode* pfrom, std::string& strError)
@@ -1443,6 +1483,7 @@ bool CBudgetManager::UpdateFinalizedBudget(CFinalizedBudgetVote& vote, CNode* pf
         return false;
     }
     LogPrint("mnbudget","CBudgetManager::UpdateFinalizedBudget - Finalized Proposal %s added\n", vote.nBudgetHash.ToString());
+    vote.fValid = (mnodeman.Find(vote.GetVin()) != NULL);
     return mapFinalizedBudgets[vote.nBudgetHash].AddOrUpdateVote(vote, strError);
 }
 
@@ -1454,6 +1495,7 @@ CBudgetProposal::CBudgetProposal()
     nAmount = 0;
     nTime = 0;
     fValid = true;
+    RecalculateTally();
 }
 
 CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strURLIn, int nBlockStartIn, int nBlockEndIn, CScript addressIn, CAmount nAmountIn, uint256 nFeeTXHashIn)
@@ -1466,6 +1508,7 @@ CBudgetProposal::CBudgetProposal(std::string strProposalNameIn, std::string strU
     nAmount = nAmountIn;
     nFeeTXHash = nFeeTXHashIn;
     fValid = true;
+    RecalculateTally();
 }
 
 CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
@@ -1479,6 +1522,11 @@ CBudgetProposal::CBudgetProposal(const CBudgetProposal& other)
     nTime = other.nTime;
     nFeeTXHash = other.nFeeTXHash;
     mapVotes = other.mapVotes;
+    nYeas = other.nYeas;
+    nNays = other.nNays;
+    nAbstains = other.nAbstains;
+    nYeasAll = other.nYeasAll;
+    nNaysAll = other.nNaysAll;
     fValid = true;
 }
 
@@ -1614,79 +1662,62 @@ bool CBudgetProposal::AddOrUpdateVote(CBudgetVote& vote, std::string& strError)
         return false;
     }
 
-    mapVotes[hash] = vote;
+    std::map<uint256, CBudgetVote>::iterator it = mapVotes.find(hash);
+    if (it != mapVotes.end()) {
+        AddToTally(it->second, -1);
+        it->second = vote;
+    } else {
+        mapVotes.insert(std::make_pair(hash, vote));
+    }
+    AddToTally(vote, 1);
     LogPrint("mnbudget", "CBudgetProposal::AddOrUpdateVote - %s %s\n", strAction.c_str(), vote.GetHash().ToString().c_str());
 
     return true;
 }
 
-// If masternode voted for a proposal, but is now invalid -- remove the vote
-void CBudgetProposal::CleanAndRemove()
+void CBudgetProposal::AddToTally(const CBudgetVote& vote, int nDelta)
 {
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-
-    while (it != mapVotes.end()) {
-        CMasternode* pmn = mnodeman.Find((*it).second.GetVin());
-        (*it).second.fValid = (pmn != nullptr);
-        ++it;
-    }
+    if (vote.nVote == VOTE_YES) nYeasAll += nDelta;
+    if (vote.nVote == VOTE_NO) nNaysAll += nDelta;
+    if (!vote.fValid) return;
+    if (vote.nVote == VOTE_YES) nYeas += nDelta;
+    if (vote.nVote == VOTE_NO) nNays += nDelta;
+    if (vote.nVote == VOTE_ABSTAIN) nAbstains += nDelta;
 }
 
-double CBudgetProposal::GetRatio()
+void CBudgetProposal::RecalculateTally()
 {
-    int yeas = 0;
-    int nays = 0;
-
-    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
-
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES) yeas++;
-        if ((*it).second.nVote == VOTE_NO) nays++;
-        ++it;
-    }
-
-    if (yeas + nays == 0) return 0.0f;
-
-    return ((double)(yeas) / (double)(yeas + nays));
+    nYeas = nNays = nAbstains = nYeasAll = nNaysAll = 0;
+    for (const auto& it : mapVotes)
+        AddToTally(it.second, 1);
 }
 
-int CBudgetProposal::GetYeas() const
+// If masternode voted for a proposal, but is now invalid -- remove the vote
+bool CBudgetProposal::CleanAndRemove()
 {
-    int ret = 0;
+    bool fChanged = false;
+    std::map<uint256, CBudgetVote>::iterator it = mapVotes.begin();
 
-    std::map<uint256, CBudgetVote>::const_iterator it = mapVotes.begin();
     while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_YES && (*it).second.fValid) ret++;
+        CMasternode* pmn = mnodeman.Find((*it).second.GetVin());
+        const bool fValidVote = (pmn != nullptr);
+        if ((*it).second.fValid != fValidVote) {
+            AddToTally((*it).second, -1);
+            (*it).second.fValid = fValidVote;
+            AddToTally((*it).second, 1);
+            fChanged = true;
+        }
         ++it;
     }
 
-    return ret;
+    return fChanged;
 }
 
-int CBudgetProposal::GetNays() const
+double CBudgetProposal::GetRatio() const
 {
-    int ret = 0;
+    if (nYeasAll + nNaysAll == 0) return 0.0f;
 
-    std::map<uint256, CBudgetVote>::const_iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_NO && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
-}
-
-int CBudgetProposal::GetAbstains() const
-{
-    int ret = 0;
-
-    std::map<uint256, CBudgetVote>::const_iterator it = mapVotes.begin();
-    while (it != mapVotes.end()) {
-        if ((*it).second.nVote == VOTE_ABSTAIN && (*it).second.fValid) ret++;
-        ++it;
-    }
-
-    return ret;
+    return ((double)(nYeasAll) / (double)(nYeasAll + nNaysAll));
 }
 
 int CBudgetProposal::GetBlockStartCycle()
@@ -2296,6 +2327,53 @@ std::string CFinalizedBudgetVote::GetStrMessage() const
     return vin.prevout.ToStringShort() + nBudgetHash.ToString() + std::to_string(nTime);
 }
 
+template <typename Vote>
+static size_t VotesDynamicUsage(const std::map<uint256, Vote>& mapVotes)
+{
+    size_t nUsage = memusage::DynamicUsage(mapVotes);
+    for (const auto& it : mapVotes)
+        nUsage += it.second.GetSigDynamicUsage() + RecursiveDynamicUsage(it.second.vin);
+    return nUsage;
+}
+
+static size_t ProposalDynamicUsage(const CBudgetProposal& proposal)
+{
+    return memusage::DynamicUsage(proposal.strProposalName) + memusage::DynamicUsage(proposal.strURL) +
+           RecursiveDynamicUsage(proposal.address) + VotesDynamicUsage(proposal.mapVotes);
+}
+
+static size_t FinalizedBudgetDynamicUsage(const CFinalizedBudget& budget)
+{
+    size_t nUsage = memusage::DynamicUsage(budget.strBudgetName) + memusage::DynamicUsage(budget.vecBudgetPayments) +
+                    VotesDynamicUsage(budget.mapVotes);
+    for (const CTxBudgetPayment& payment : budget.vecBudgetPayments)
+        nUsage += RecursiveDynamicUsage(payment.payee);
+    return nUsage;
+}
+
+size_t CBudgetManager::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    size_t nUsage = memusage::DynamicUsage(mapCollateralTxids) +
+                    memusage::DynamicUsage(mapProposals) +
+                    memusage::DynamicUsage(mapFinalizedBudgets) +
+                    memusage::DynamicUsage(mapSeenMasternodeBudgetProposals) +
+                    memusage::DynamicUsage(mapSeenFinalizedBudgets) +
+                    VotesDynamicUsage(mapSeenMasternodeBudgetVotes) +
+                    VotesDynamicUsage(mapOrphanMasternodeBudgetVotes) +
+                    VotesDynamicUsage(mapSeenFinalizedBudgetVotes) +
+                    VotesDynamicUsage(mapOrphanFinalizedBudgetVotes);
+    for (const auto& it : mapProposals)
+        nUsage += ProposalDynamicUsage(it.second);
+    for (const auto& it : mapSeenMasternodeBudgetProposals)
+        nUsage += ProposalDynamicUsage(it.second);
+    for (const auto& it : mapFinalizedBudgets)
+        nUsage += FinalizedBudgetDynamicUsage(it.second);
+    for (const auto& it : mapSeenFinalizedBudgets)
+        nUsage += FinalizedBudgetDynamicUsage(it.second);
+    return nUsage;
+}
+
 std::string CBudgetManager::ToString() const
 {
     std::ostringstream info;
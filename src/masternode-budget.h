@@ -11,10 +11,13 @@
 #include "key.h"
 #include "main.h"
 #include "masternode.h"
+#include "masternodedb.h"
 #include "net.h"
 #include "sync.h"
 #include "util.h"
 
+#include <limits>
+
 
 extern RecursiveMutex cs_budget;
 
@@ -146,13 +149,22 @@ public:
     }
 };
 
-/** Save Budget Manager (budget.dat)
+/** Save Budget Manager: the budget tables of the mnstate/ store.
+ *  The budget.dat of older versions is imported on the first load.
  */
 class CBudgetDB
 {
 private:
-    boost::filesystem::path pathDB;
     std::string strMagicMessage;
+    RecursiveMutex cs;
+    CMasternodeStateTable<uint256> tableProposals;
+    CMasternodeStateTable<uint256> tableFinalizedBudgets;
+    CMasternodeStateTable<uint256> tableSeenProposals;
+    CMasternodeStateTable<uint256> tableSeenProposalVotes;
+    CMasternodeStateTable<uint256> tableOrphanProposalVotes;
+    CMasternodeStateTable<uint256> tableSeenFinalizedBudgets;
+    CMasternodeStateTable<uint256> tableSeenFinalizedBudgetVotes;
+    CMasternodeStateTable<uint256> tableOrphanFinalizedBudgetVotes;
 
 public:
     enum ReadResult {
@@ -166,10 +178,13 @@ public:
     };
 
     CBudgetDB();
+    /// Write the entries changed since the previous write
     bool Write(const CBudgetManager& objToSave);
-    ReadResult Read(CBudgetManager& objToLoad, bool fDryRun = false);
+    ReadResult Read(CBudgetManager& objToLoad);
 };
 
+extern CBudgetDB budgetDB;
+
 
 //
 // Budget Manager : Contains all proposals for the budget
@@ -181,6 +196,21 @@ private:
     // XX42    std::map<uint256, CTransaction> mapCollateral;
     std::map<uint256, uint256> mapCollateralTxids;
 
+    // masternode list version the votes were last checked against (see CheckVoteValidity)
+    uint64_t nVotesCheckedListVersion;
+
+    // cached GetBudget() projection: the funded proposals, best first. Valid while the votes,
+    // the budget cycle and the number of enabled masternodes stay the same
+    std::vector<uint256> vBudgetProjection;
+    bool fBudgetProjectionValid;
+    int nProjectionBlockStart;
+    int nProjectionMnCount;
+    // next time a pending proposal becomes established
+    int64_t nProjectionExpiry;
+
+    void CheckVoteValidity();
+    void UpdateBudgetProjection(const CBlockIndex* pindexPrev, int nBlockStart, int nBlockEnd, int mnCount);
+
 public:
     // critical section to protect the inner data structures
     mutable RecursiveMutex cs;
@@ -200,6 +230,11 @@ public:
     {
         mapProposals.clear();
         mapFinalizedBudgets.clear();
+        nVotesCheckedListVersion = std::numeric_limits<uint64_t>::max();
+        fBudgetProjectionValid = false;
+        nProjectionBlockStart = 0;
+        nProjectionMnCount = 0;
+        nProjectionExpiry = 0;
     }
 
     void ClearSeen()
@@ -255,10 +290,15 @@ public:
         mapSeenFinalizedBudgetVotes.clear();
         mapOrphanMasternodeBudgetVotes.clear();
         mapOrphanFinalizedBudgetVotes.clear();
+        nVotesCheckedListVersion = std::numeric_limits<uint64_t>::max();
+        fBudgetProjectionValid = false;
     }
     void CheckAndRemove();
     std::string ToString() const;
 
+    /// Approximate heap memory used by the proposals, budgets and seen maps
+    size_t DynamicMemoryUsage() const;
+
 
     ADD_SERIALIZE_METHODS;
 
@@ -458,6 +498,17 @@ private:
     mutable RecursiveMutex cs;
     CAmount nAlloted;
 
+protected:
+    // running tallies of mapVotes: valid votes by outcome, and yeas/nays of every vote (for GetRatio)
+    int nYeas;
+    int nNays;
+    int nAbstains;
+    int nYeasAll;
+    int nNaysAll;
+
+    void AddToTally(const CBudgetVote& vote, int nDelta);
+    void RecalculateTally();
+
 public:
     bool fValid;
     std::string strProposalName;
@@ -474,6 +525,7 @@ public:
     int64_t nTime;
     uint256 nFeeTXHash;
 
+    // only modified through AddOrUpdateVote and CleanAndRemove, which keep the tallies
     std::map<uint256, CBudgetVote> mapVotes;
     //cache object
 
@@ -501,15 +553,16 @@ public:
     int GetBlockStartCycle();
     int GetBlockCurrentCycle();
     int GetBlockEndCycle();
-    double GetRatio();
-    int GetYeas() const;
-    int GetNays() const;
-    int GetAbstains() const;
+    double GetRatio() const;
+    int GetYeas() const { return nYeas; }
+    int GetNays() const { return nNays; }
+    int GetAbstains() const { return nAbstains; }
     CAmount GetAmount() { return nAmount; }
     void SetAllotted(CAmount nAllotedIn) { nAlloted = nAllotedIn; }
     CAmount GetAllotted() { return nAlloted; }
 
-    void CleanAndRemove();
+    /// Mark the votes of masternodes no longer listed invalid (and relisted ones valid). Returns whether any vote changed.
+    bool CleanAndRemove();
 
     uint256 GetHash() const
     {
@@ -543,6 +596,8 @@ public:
 
         //for saving to the serialized db
         READWRITE(mapVotes);
+        if (ser_action.ForRead())
+            RecalculateTally();
     }
 };
 
@@ -571,6 +626,11 @@ public:
         swap(first.nTime, second.nTime);
         swap(first.nFeeTXHash, second.nFeeTXHash);
         first.mapVotes.swap(second.mapVotes);
+        swap(first.nYeas, second.nYeas);
+        swap(first.nNays, second.nNays);
+        swap(first.nAbstains, second.nAbstains);
+        swap(first.nYeasAll, second.nYeasAll);
+        swap(first.nNaysAll, second.nNaysAll);
     }
 
     CBudgetProposalBroadcast& operator=(CBudgetProposalBroadcast from)
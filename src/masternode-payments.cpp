@@ -6,6 +6,7 @@
 #include "masternode-payments.h"
 #include "addrman.h"
 #include "chainparams.h"
+#include "core_memusage.h"
 #include "masternode-budget.h"
 #include "masternode-sync.h"
 #include "masternodeman.h"
@@ -22,127 +23,103 @@ CMasternodePayments masternodePayments;
 RecursiveMutex cs_vecPayments;
 RecursiveMutex cs_mapMasternodeBlocks;
 RecursiveMutex cs_mapMasternodePayeeVotes;
+RecursiveMutex cs_mapPayeeLastPaid;
 
 //
 // CMasternodePaymentDB
 //
 
-CMasternodePaymentDB::CMasternodePaymentDB()
+CMasternodePaymentDB masternodePaymentsDB;
+
+CMasternodePaymentDB::CMasternodePaymentDB() : tableVotes(DB_PAYMENT_VOTE),
+                                               tableBlocks(DB_PAYMENT_BLOCK)
 {
-    pathDB = GetDataDir() / "mnpayments.dat";
     strMagicMessage = "MasternodePayments";
 }
 
 bool CMasternodePaymentDB::Write(const CMasternodePayments& objToSave)
 {
+    if (pmnStateDB == NULL)
+        return false;
+
     int64_t nStart = GetTimeMillis();
+    LOCK(cs);
+
+    // serialize a snapshot, so that the votes and blocks aren't locked for the whole dump
+    std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
+    std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
+    {
+        LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
+        mapMasternodePayeeVotes = objToSave.mapMasternodePayeeVotes;
+        mapMasternodeBlocks = objToSave.mapMasternodeBlocks;
+    }
+
+    CLevelDBBatch batch;
+    int nWritten = 0;
+    for (const auto& it : mapMasternodePayeeVotes)
+        nWritten += tableVotes.Stage(batch, it.first, it.second);
+    for (const auto& it : mapMasternodeBlocks)
+        nWritten += tableBlocks.Stage(batch, it.first, it.second);
+    const int nErased = tableVotes.EraseUnstaged(batch) + tableBlocks.EraseUnstaged(batch);
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-    ssObj << strMagicMessage;                   // masternode cache file specific magic message
-    ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssObj << objToSave;
-    uint256 hash = Hash(ssObj.begin(), ssObj.end());
-    ssObj << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathDB.string());
-
-    // Write and commit header, data
     try {
-        fileout << ssObj;
+        pmnStateDB->WriteBatch(batch);
     } catch (const std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+        tableVotes.Abort();
+        tableBlocks.Abort();
+        return error("%s : Database error - %s", __func__, e.what());
     }
-    fileout.fclose();
+    tableVotes.Commit();
+    tableBlocks.Commit();
 
-    LogPrint("masternode","Written info to mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("masternode","Written %d and erased %d masternode payment entries  %dms\n", nWritten, nErased, GetTimeMillis() - nStart);
 
     return true;
 }
 
-CMasternodePaymentDB::ReadResult CMasternodePaymentDB::Read(CMasternodePayments& objToLoad, bool fDryRun)
+CMasternodePaymentDB::ReadResult CMasternodePaymentDB::Read(CMasternodePayments& objToLoad)
 {
-    int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathDB.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathDB.string());
+    if (pmnStateDB == NULL)
         return FileError;
-    }
 
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathDB);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    std::vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
-
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (const std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
-
-    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
+    int64_t nStart = GetTimeMillis();
+    LOCK(cs);
+    LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
+    objToLoad.Clear();
 
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
+    // an mnpayments.dat left by an older version replaces the stored entries
+    const bool fImport = ImportMasternodeStateFile("mnpayments.dat", strMagicMessage, objToLoad);
 
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
     try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
-        ssObj >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode payement cache magic message", __func__);
-            return IncorrectMagicMessage;
-        }
-
-
-        // de-serialize file header (network specific magic number) and ..
-        ssObj >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-
-        // de-serialize data into CMasternodePayments object
-        ssObj >> objToLoad;
+        tableVotes.Load<CMasternodePaymentWinner>(*pmnStateDB, [&](const uint256& hash, const CMasternodePaymentWinner& winner) {
+            if (!fImport) objToLoad.mapMasternodePayeeVotes.insert(std::make_pair(hash, winner));
+        });
+        tableBlocks.Load<CMasternodeBlockPayees>(*pmnStateDB, [&](const int& nHeight, const CMasternodeBlockPayees& payees) {
+            if (!fImport) objToLoad.mapMasternodeBlocks.insert(std::make_pair(nHeight, payees));
+        });
     } catch (const std::exception& e) {
         objToLoad.Clear();
         error("%s : Deserialize or I/O error - %s", __func__, e.what());
         return IncorrectFormat;
     }
 
-    LogPrint("masternode","Loaded info from mnpayments.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrint("masternode","  %s\n", objToLoad.ToString());
-    if (!fDryRun) {
-        LogPrint("masternode","Masternode payments manager - cleaning....\n");
-        objToLoad.CleanPaymentList();
-        LogPrint("masternode","Masternode payments manager - result:\n");
-        LogPrint("masternode","  %s\n", objToLoad.ToString());
+    objToLoad.RebuildLastPaidIndex();
+
+    if (fImport) {
+        if (Write(objToLoad))
+            boost::filesystem::remove(GetDataDir() / "mnpayments.dat");
+        LogPrintf("Imported mnpayments.dat into the masternode state database\n");
+    } else if (tableVotes.size() == 0 && tableBlocks.size() == 0) {
+        return FileError;
     }
 
+    LogPrint("masternode","Loaded masternode payments  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("masternode","  %s\n", objToLoad.ToString());
+    LogPrint("masternode","Masternode payments manager - cleaning....\n");
+    objToLoad.CleanPaymentList();
+    LogPrint("masternode","Masternode payments manager - result:\n");
+    LogPrint("masternode","  %s\n", objToLoad.ToString());
+
     return Ok;
 }
 
@@ -203,27 +180,10 @@ void DumpMasternodePayments()
 {
     int64_t nStart = GetTimeMillis();
 
-    CMasternodePaymentDB paymentdb;
-    CMasternodePayments tempPayments;
-
-    LogPrint("masternode","Verifying mnpayments.dat format...\n");
-    CMasternodePaymentDB::ReadResult readResult = paymentdb.Read(tempPayments, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CMasternodePaymentDB::FileError)
-        LogPrint("masternode","Missing budgets file - mnpayments.dat, will try to recreate\n");
-    else if (readResult != CMasternodePaymentDB::Ok) {
-        LogPrint("masternode","Error reading mnpayments.dat: ");
-        if (readResult == CMasternodePaymentDB::IncorrectFormat)
-            LogPrint("masternode","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("masternode","file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
-    LogPrint("masternode","Writting info to mnpayments.dat...\n");
-    paymentdb.Write(masternodePayments);
+    LogPrint("masternode","Writting info to the masternode state database...\n");
+    masternodePaymentsDB.Write(masternodePayments);
 
-    LogPrint("masternode","Budget dump finished  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("masternode","Masternode payments dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
 bool IsBlockValueValid(const CBlock& block, CAmount nExpectedValue, CAmount nMinted)
@@ -559,18 +519,30 @@ bool CMasternodePayments::AddWinningMasternode(CMasternodePaymentWinner& winnerI
         }
 
         mapMasternodePayeeVotes[winnerIn.GetHash()] = winnerIn;
-
-        if (!mapMasternodeBlocks.count(winnerIn.nBlockHeight)) {
-            CMasternodeBlockPayees blockPayees(winnerIn.nBlockHeight);
-            mapMasternodeBlocks[winnerIn.nBlockHeight] = blockPayees;
-        }
     }
 
-    mapMasternodeBlocks[winnerIn.nBlockHeight].AddPayee(winnerIn.payee, 1);
+    AddBlockPayeeVote(winnerIn.nBlockHeight, winnerIn.payee);
 
     return true;
 }
 
+void CMasternodePayments::AddBlockPayeeVote(int nBlockHeight, const CScript& payee)
+{
+    LOCK(cs_mapMasternodeBlocks);
+
+    if (!mapMasternodeBlocks.count(nBlockHeight)) {
+        CMasternodeBlockPayees blockPayees(nBlockHeight);
+        mapMasternodeBlocks[nBlockHeight] = blockPayees;
+    }
+
+    CMasternodeBlockPayees& blockPayees = mapMasternodeBlocks[nBlockHeight];
+    blockPayees.AddPayee(payee, 1);
+    if (blockPayees.HasPayeeWithVotes(payee, MNPAYMENTS_LAST_PAID_VOTES)) {
+        LOCK(cs_mapPayeeLastPaid);
+        mapPayeeLastPaid[payee].insert(nBlockHeight);
+    }
+}
+
 bool CMasternodeBlockPayees::IsTransactionValid(const CTransaction& txNew)
 {
     LOCK(cs_vecPayments);
@@ -700,13 +672,63 @@ void CMasternodePayments::CleanPaymentList()
             LogPrint("mnpayments", "CMasternodePayments::CleanPaymentList - Removing old Masternode payment - block %d\n", winner.nBlockHeight);
             masternodeSync.mapSeenSyncMNW.erase((*it).first);
             mapMasternodePayeeVotes.erase(it++);
-            mapMasternodeBlocks.erase(winner.nBlockHeight);
+            std::map<int, CMasternodeBlockPayees>::iterator itBlock = mapMasternodeBlocks.find(winner.nBlockHeight);
+            if (itBlock != mapMasternodeBlocks.end()) {
+                UnindexBlockPayees(itBlock->second);
+                mapMasternodeBlocks.erase(itBlock);
+            }
         } else {
             ++it;
         }
     }
 }
 
+void CMasternodePayments::UnindexBlockPayees(const CMasternodeBlockPayees& blockPayees)
+{
+    LOCK2(cs_vecPayments, cs_mapPayeeLastPaid);
+
+    for (const CMasternodePayee& payee : blockPayees.vecPayments) {
+        std::map<CScript, std::set<int> >::iterator it = mapPayeeLastPaid.find(payee.scriptPubKey);
+        if (it == mapPayeeLastPaid.end())
+            continue;
+        it->second.erase(blockPayees.nBlockHeight);
+        if (it->second.empty())
+            mapPayeeLastPaid.erase(it);
+    }
+}
+
+void CMasternodePayments::RebuildLastPaidIndex()
+{
+    LOCK2(cs_mapMasternodeBlocks, cs_vecPayments);
+    LOCK(cs_mapPayeeLastPaid);
+    mapPayeeLastPaid.clear();
+
+    for (const auto& it : mapMasternodeBlocks) {
+        for (const CMasternodePayee& payee : it.second.vecPayments) {
+            if (payee.nVotes >= MNPAYMENTS_LAST_PAID_VOTES)
+                mapPayeeLastPaid[payee.scriptPubKey].insert(it.first);
+        }
+    }
+}
+
+bool CMasternodePayments::GetLastPaidHeight(const CScript& payee, int nTipHeight, int nMaxDepth, int& nHeightRet) const
+{
+    LOCK(cs_mapPayeeLastPaid);
+    std::map<CScript, std::set<int> >::const_iterator it = mapPayeeLastPaid.find(payee);
+    if (it == mapPayeeLastPaid.end())
+        return false;
+
+    // votes for the blocks after the tip don't count yet
+    std::set<int>::const_iterator itHeight = it->second.upper_bound(nTipHeight);
+    if (itHeight == it->second.begin())
+        return false;
+    --itHeight;
+    if (*itHeight <= 0 || nTipHeight - *itHeight >= nMaxDepth)
+        return false;
+    nHeightRet = *itHeight;
+    return true;
+}
+
 bool CMasternodePayments::ProcessBlock(int nBlockHeight)
 {
     if (!fMasterNode) return false;
@@ -808,6 +830,35 @@ void CMasternodePayments::Sync(CNode* node, int nCountNeeded)
     node->PushMessage("ssc", MASTERNODE_SYNC_MNW, nInvCount);
 }
 
+size_t CMasternodePayments::DynamicMemoryUsage() const
+{
+    size_t nUsage = 0;
+    {
+        LOCK(cs_mapMasternodePayeeVotes);
+        nUsage += memusage::DynamicUsage(mapMasternodePayeeVotes) + memusage::DynamicUsage(mapMasternodesLastVote);
+        for (const auto& it : mapMasternodePayeeVotes) {
+            const CMasternodePaymentWinner& winner = it.second;
+            nUsage += winner.GetSigDynamicUsage() + RecursiveDynamicUsage(winner.vinMasternode) + RecursiveDynamicUsage(winner.payee);
+        }
+    }
+    {
+        LOCK2(cs_mapMasternodeBlocks, cs_vecPayments);
+        nUsage += memusage::DynamicUsage(mapMasternodeBlocks);
+        for (const auto& it : mapMasternodeBlocks) {
+            nUsage += memusage::DynamicUsage(it.second.vecPayments);
+            for (const CMasternodePayee& payee : it.second.vecPayments)
+                nUsage += RecursiveDynamicUsage(payee.scriptPubKey);
+        }
+    }
+    {
+        LOCK(cs_mapPayeeLastPaid);
+        nUsage += memusage::DynamicUsage(mapPayeeLastPaid);
+        for (const auto& it : mapPayeeLastPaid)
+            nUsage += RecursiveDynamicUsage(it.first) + memusage::DynamicUsage(it.second);
+    }
+    return nUsage;
+}
+
 std::string CMasternodePayments::ToString() const
 {
     std::ostringstream info;
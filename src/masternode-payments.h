@@ -9,11 +9,14 @@
 #include "key.h"
 #include "main.h"
 #include "masternode.h"
+#include "masternodedb.h"
 
+#include <set>
 
 extern RecursiveMutex cs_vecPayments;
 extern RecursiveMutex cs_mapMasternodeBlocks;
 extern RecursiveMutex cs_mapMasternodePayeeVotes;
+extern RecursiveMutex cs_mapPayeeLastPaid;
 
 class CMasternodePayments;
 class CMasternodePaymentWinner;
@@ -23,6 +26,8 @@ extern CMasternodePayments masternodePayments;
 
 #define MNPAYMENTS_SIGNATURES_REQUIRED 6
 #define MNPAYMENTS_SIGNATURES_TOTAL 10
+// votes a payee needs on a block for the masternode to count as paid there
+#define MNPAYMENTS_LAST_PAID_VOTES 2
 
 void ProcessMessageMasternodePayments(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight);
@@ -32,13 +37,16 @@ void FillBlockPayee(CMutableTransaction& txNew, CAmount nFees, bool fProofOfStak
 
 void DumpMasternodePayments();
 
-/** Save Masternode Payment Data (mnpayments.dat)
+/** Save Masternode Payment Data: the payment tables of the mnstate/ store.
+ *  The mnpayments.dat of older versions is imported on the first load.
  */
 class CMasternodePaymentDB
 {
 private:
-    boost::filesystem::path pathDB;
     std::string strMagicMessage;
+    RecursiveMutex cs;
+    CMasternodeStateTable<uint256> tableVotes;
+    CMasternodeStateTable<int> tableBlocks;
 
 public:
     enum ReadResult {
@@ -52,10 +60,13 @@ public:
     };
 
     CMasternodePaymentDB();
+    /// Write the entries changed since the previous write
     bool Write(const CMasternodePayments& objToSave);
-    ReadResult Read(CMasternodePayments& objToLoad, bool fDryRun = false);
+    ReadResult Read(CMasternodePayments& objToLoad);
 };
 
+extern CMasternodePaymentDB masternodePaymentsDB;
+
 class CMasternodePayee
 {
 public:
@@ -232,6 +243,12 @@ private:
     int nSyncedFromPeer;
     int nLastBlockHeight;
 
+    /** Heights of the blocks in mapMasternodeBlocks where each payee script has at least
+     *  MNPAYMENTS_LAST_PAID_VOTES votes, so that last-paid lookups need no chain walk. */
+    std::map<CScript, std::set<int> > mapPayeeLastPaid;
+
+    void UnindexBlockPayees(const CMasternodeBlockPayees& blockPayees);
+
 public:
     std::map<uint256, CMasternodePaymentWinner> mapMasternodePayeeVotes;
     std::map<int, CMasternodeBlockPayees> mapMasternodeBlocks;
@@ -245,9 +262,11 @@ public:
 
     void Clear()
     {
-        LOCK2(cs_mapMasternodeBlocks, cs_mapMasternodePayeeVotes);
+        LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
         mapMasternodeBlocks.clear();
         mapMasternodePayeeVotes.clear();
+        LOCK(cs_mapPayeeLastPaid);
+        mapPayeeLastPaid.clear();
     }
 
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
@@ -255,6 +274,13 @@ public:
 
     void Sync(CNode* node, int nCountNeeded);
     void CleanPaymentList();
+
+    /// Count a winner vote for payee in block nBlockHeight
+    void AddBlockPayeeVote(int nBlockHeight, const CScript& payee);
+    /// Rebuild the last-paid index from mapMasternodeBlocks
+    void RebuildLastPaidIndex();
+    /// Highest block, in the nMaxDepth blocks up to nTipHeight, where payee has enough votes
+    bool GetLastPaidHeight(const CScript& payee, int nTipHeight, int nMaxDepth, int& nHeightRet) const;
     int LastPayment(CMasternode& mn);
 
     bool GetBlockPayee(int nBlockHeight, CScript& payee);
@@ -281,6 +307,9 @@ public:
     std::string GetRequiredPaymentsString(int nBlockHeight);
     void FillBlockPayee(CMutableTransaction& txNew, int64_t nFees, bool fProofOfStake);
     std::string ToString() const;
+
+    /// Approximate heap memory used by the payment votes and block payees
+    size_t DynamicMemoryUsage() const;
     int GetOldestBlock();
     int GetNewestBlock();
 
@@ -27,7 +27,6 @@
 class CMasternode;
 class CMasternodeBroadcast;
 class CMasternodePing;
-extern std::map<int64_t, uint256> mapCacheBlockHashes;
 
 bool GetBlockHash(uint256& hash, int nBlockHeight);
 
@@ -222,7 +221,8 @@ public:
         READWRITE(nLastScanningErrorBlockHeight);
     }
 
-    int64_t SecondsSincePayment();
+    /// nMaxDepth: blocks to look back for a payment, -1 for 1.25 times the enabled masternode count
+    int64_t SecondsSincePayment(int nMaxDepth = -1);
 
     bool UpdateFromNewBroadcast(CMasternodeBroadcast& mnb);
 
@@ -286,7 +286,7 @@ public:
         return strStatus;
     }
 
-    int64_t GetLastPaid();
+    int64_t GetLastPaid(int nMaxDepth = -1);
     bool IsValidNetAddr();
 
     /// Is the input associated with collateral public key? (and there is 285 XOS - checking if valid masternode)
@@ -0,0 +1,9 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternodedb.h"
+
+CMasternodeStateDB* pmnStateDB = NULL;
+
+CMasternodeStateDB::CMasternodeStateDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "mnstate", nCacheSize, fMemory, fWipe) {}
@@ -0,0 +1,233 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef OASIS_MASTERNODEDB_H
+#define OASIS_MASTERNODEDB_H
+
+#include "chainparams.h"
+#include "hash.h"
+#include "leveldbwrapper.h"
+#include "streams.h"
+#include "util.h"
+
+#include <map>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+
+/** LevelDB store (mnstate/) holding the masternode list, the payment votes and the budgets.
+ *  Every object lives under its own (table, key) entry, so the managers are persisted
+ *  incrementally instead of being rewritten as one blob on every dump.
+ */
+class CMasternodeStateDB : public CLevelDBWrapper
+{
+public:
+    CMasternodeStateDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+private:
+    CMasternodeStateDB(const CMasternodeStateDB&);
+    void operator=(const CMasternodeStateDB&);
+};
+
+extern CMasternodeStateDB* pmnStateDB;
+
+// table prefixes of the masternode state store
+static const char DB_MASTERNODE = 'm';
+static const char DB_MASTERNODE_BROADCAST = 'b';
+static const char DB_MASTERNODE_PING = 'p';
+static const char DB_MASTERNODE_MANAGER = 'a';
+static const char DB_PAYMENT_VOTE = 'w';
+static const char DB_PAYMENT_BLOCK = 'h';
+static const char DB_BUDGET_PROPOSAL = 'r';
+static const char DB_BUDGET_FINALIZED = 'B';
+static const char DB_BUDGET_SEEN_PROPOSAL = 'P';
+static const char DB_BUDGET_SEEN_PROPOSAL_VOTE = 'V';
+static const char DB_BUDGET_ORPHAN_PROPOSAL_VOTE = 'o';
+static const char DB_BUDGET_SEEN_FINALIZED = 'F';
+static const char DB_BUDGET_SEEN_FINALIZED_VOTE = 'f';
+static const char DB_BUDGET_ORPHAN_FINALIZED_VOTE = 'O';
+
+/** Tracks the entries of one table of the masternode state store, and the hash of the value
+ *  last written for each, so that a flush only writes the entries that changed and erases
+ *  the ones that went away.
+ */
+template <typename K>
+class CMasternodeStateTable
+{
+private:
+    struct Entry {
+        uint256 hash;
+        unsigned int nFlush;
+    };
+
+    char chTable;
+    unsigned int nFlush;
+    std::map<K, Entry> mapWritten;
+
+public:
+    explicit CMasternodeStateTable(char chTableIn) : chTable(chTableIn), nFlush(1) {}
+
+    /** Queue (key, value) into batch unless the store already holds this value. Returns whether it was queued. */
+    template <typename V>
+    bool Stage(CLevelDBBatch& batch, const K& key, const V& value)
+    {
+        const uint256 hash = SerializeHash(value, SER_DISK, CLIENT_VERSION);
+        Entry& entry = mapWritten[key];
+        entry.nFlush = nFlush;
+        if (entry.hash == hash)
+            return false;
+        entry.hash = hash;
+        batch.Write(std::make_pair(chTable, key), value);
+        return true;
+    }
+
+    /** Queue the erasure of every entry not staged since the last flush. Returns the number queued. */
+    int EraseUnstaged(CLevelDBBatch& batch)
+    {
+        int nErased = 0;
+        for (typename std::map<K, Entry>::const_iterator it = mapWritten.begin(); it != mapWritten.end(); ++it) {
+            if (it->second.nFlush != nFlush) {
+                batch.Erase(std::make_pair(chTable, it->first));
+                nErased++;
+            }
+        }
+        return nErased;
+    }
+
+    /** The batch of this flush was written: forget the erased entries and start the next flush */
+    void Commit()
+    {
+        typename std::map<K, Entry>::iterator it = mapWritten.begin();
+        while (it != mapWritten.end()) {
+            if (it->second.nFlush != nFlush)
+                mapWritten.erase(it++);
+            else
+                ++it;
+        }
+        nFlush++;
+    }
+
+    /** The batch of this flush was lost: the next flush rewrites every entry and retries the erasures */
+    void Abort()
+    {
+        for (typename std::map<K, Entry>::iterator it = mapWritten.begin(); it != mapWritten.end(); ++it)
+            it->second.hash.SetNull();
+        nFlush++;
+    }
+
+    /** Read every entry of the table, passing each one to fnLoad. Throws on a malformed entry. */
+    template <typename V, typename F>
+    void Load(CLevelDBWrapper& db, F fnLoad)
+    {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << chTable;
+        pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+
+        for (; pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != chTable)
+                break;
+            K key;
+            ssKey >> key;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            V value;
+            ssValue >> value;
+
+            Entry& entry = mapWritten[key];
+            entry.hash = Hash(slValue.data(), slValue.data() + slValue.size());
+            entry.nFlush = nFlush;
+            fnLoad(key, value);
+        }
+        HandleError(pcursor->status());
+    }
+
+    size_t size() const { return mapWritten.size(); }
+};
+
+/** Read a cache file written by older versions (mncache.dat, mnpayments.dat, budget.dat):
+ *  magic message, network magic and the serialized object, followed by a checksum of all of it.
+ */
+template <typename T>
+bool ReadMasternodeStateFile(const boost::filesystem::path& path, const std::string& strMagicMessage, T& objToLoad)
+{
+    FILE* file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : Failed to open file %s", __func__, path.string());
+
+    // use file size to size memory buffer
+    int fileSize = boost::filesystem::file_size(path);
+    int dataSize = fileSize - sizeof(uint256);
+    // Don't try to resize to a negative number if file is small
+    if (dataSize < 0)
+        dataSize = 0;
+    std::vector<unsigned char> vchData;
+    vchData.resize(dataSize);
+    uint256 hashIn;
+
+    // read data and checksum from file
+    try {
+        filein.read((char*)&vchData[0], dataSize);
+        filein >> hashIn;
+    } catch (const std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    filein.fclose();
+
+    CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
+
+    // verify stored checksum matches input data
+    uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
+    if (hashIn != hashTmp)
+        return error("%s : Checksum mismatch in %s, data corrupted", __func__, path.string());
+
+    unsigned char pchMsgTmp[4];
+    std::string strMagicMessageTmp;
+    try {
+        ssObj >> strMagicMessageTmp;
+        if (strMagicMessage != strMagicMessageTmp)
+            return error("%s : Invalid magic message in %s", __func__, path.string());
+
+        ssObj >> FLATDATA(pchMsgTmp);
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            return error("%s : Invalid network magic number in %s", __func__, path.string());
+
+        ssObj >> objToLoad;
+    } catch (const std::exception& e) {
+        objToLoad.Clear();
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    return true;
+}
+
+/** Read the cache file strFile written by an older version, if there is one. A file that can't be
+ *  read is renamed to strFile.bak, so that it isn't read (and fails) again on every start.
+ */
+template <typename T>
+bool ImportMasternodeStateFile(const std::string& strFile, const std::string& strMagicMessage, T& objToLoad)
+{
+    const boost::filesystem::path path = GetDataDir() / strFile;
+    if (!boost::filesystem::exists(path))
+        return false;
+    if (ReadMasternodeStateFile(path, strMagicMessage, objToLoad))
+        return true;
+
+    const boost::filesystem::path pathBak = GetDataDir() / (strFile + ".bak");
+    try {
+        boost::filesystem::rename(path, pathBak);
+        LogPrintf("%s : Failed to import %s, moved it to %s\n", __func__, strFile, pathBak.string());
+    } catch (const boost::filesystem::filesystem_error& e) {
+        LogPrintf("%s : Failed to import %s, and to move it away - %s\n", __func__, strFile, e.what());
+    }
+    return false;
+}
+
+#endif // OASIS_MASTERNODEDB_H
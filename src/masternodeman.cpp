@@ -6,6 +6,7 @@
 #include "masternodeman.h"
 #include "activemasternode.h"
 #include "addrman.h"
+#include "core_memusage.h"
 #include "masternode.h"
 #include "messagesigner.h"
 #include "obfuscation.h"
@@ -26,19 +27,13 @@ struct CompareLastPaid {
     }
 };
 
-struct CompareScoreTxIn {
-    bool operator()(const std::pair<int64_t, CTxIn>& t1,
-        const std::pair<int64_t, CTxIn>& t2) const
-    {
-        return t1.first < t2.first;
-    }
-};
-
-struct CompareScoreMN {
-    bool operator()(const std::pair<int64_t, CMasternode>& t1,
-        const std::pair<int64_t, CMasternode>& t2) const
+// best score first; equal compact scores are ordered by collateral so every node ranks alike
+struct CompareScoreOutPoint {
+    bool operator()(const std::pair<int64_t, COutPoint>& t1,
+        const std::pair<int64_t, COutPoint>& t2) const
     {
-        return t1.first < t2.first;
+        if (t1.first != t2.first) return t1.first > t2.first;
+        return t1.second < t2.second;
     }
 };
 
@@ -46,123 +41,128 @@ struct CompareScoreMN {
 // CMasternodeDB
 //
 
-CMasternodeDB::CMasternodeDB()
+CMasternodeDB mnodemanDB;
+
+CMasternodeDB::CMasternodeDB() : tableMasternodes(DB_MASTERNODE),
+                                 tableSeenBroadcasts(DB_MASTERNODE_BROADCAST),
+                                 tableSeenPings(DB_MASTERNODE_PING),
+                                 tableManager(DB_MASTERNODE_MANAGER)
 {
-    pathMN = GetDataDir() / "mncache.dat";
     strMagicMessage = "MasternodeCache";
 }
 
 bool CMasternodeDB::Write(const CMasternodeMan& mnodemanToSave)
 {
+    if (pmnStateDB == NULL)
+        return false;
+
     int64_t nStart = GetTimeMillis();
+    LOCK(cs);
+
+    // serialize a snapshot, so that the manager isn't locked for the whole dump
+    std::list<CMasternode> vMasternodes;
+    std::map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
+    std::map<uint256, CMasternodePing> mapSeenMasternodePing;
+    std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
+    std::map<CNetAddr, int64_t> mWeAskedForMasternodeList;
+    std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
+    int64_t nDsqCount;
+    {
+        LOCK(mnodemanToSave.cs);
+        vMasternodes = mnodemanToSave.vMasternodes;
+        mapSeenMasternodeBroadcast = mnodemanToSave.mapSeenMasternodeBroadcast;
+        mapSeenMasternodePing = mnodemanToSave.mapSeenMasternodePing;
+        mAskedUsForMasternodeList = mnodemanToSave.mAskedUsForMasternodeList;
+        mWeAskedForMasternodeList = mnodemanToSave.mWeAskedForMasternodeList;
+        mWeAskedForMasternodeListEntry = mnodemanToSave.mWeAskedForMasternodeListEntry;
+        nDsqCount = mnodemanToSave.nDsqCount;
+    }
+
+    CLevelDBBatch batch;
+    int nWritten = 0;
+    for (const CMasternode& mn : vMasternodes)
+        nWritten += tableMasternodes.Stage(batch, mn.vin.prevout, mn);
+    for (const auto& it : mapSeenMasternodeBroadcast)
+        nWritten += tableSeenBroadcasts.Stage(batch, it.first, it.second);
+    for (const auto& it : mapSeenMasternodePing)
+        nWritten += tableSeenPings.Stage(batch, it.first, it.second);
+    nWritten += tableManager.Stage(batch, 'u', mAskedUsForMasternodeList);
+    nWritten += tableManager.Stage(batch, 'w', mWeAskedForMasternodeList);
+    nWritten += tableManager.Stage(batch, 'e', mWeAskedForMasternodeListEntry);
+    nWritten += tableManager.Stage(batch, 'd', nDsqCount);
+    const int nErased = tableMasternodes.EraseUnstaged(batch) + tableSeenBroadcasts.EraseUnstaged(batch) +
+                        tableSeenPings.EraseUnstaged(batch) + tableManager.EraseUnstaged(batch);
 
-    // serialize, checksum data up to that point, then append checksum
-    CDataStream ssMasternodes(SER_DISK, CLIENT_VERSION);
-    ssMasternodes << strMagicMessage;                   // masternode cache file specific magic message
-    ssMasternodes << FLATDATA(Params().MessageStart()); // network specific magic number
-    ssMasternodes << mnodemanToSave;
-    uint256 hash = Hash(ssMasternodes.begin(), ssMasternodes.end());
-    ssMasternodes << hash;
-
-    // open output file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "wb");
-    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s : Failed to open file %s", __func__, pathMN.string());
-
-    // Write and commit header, data
     try {
-        fileout << ssMasternodes;
+        pmnStateDB->WriteBatch(batch);
     } catch (const std::exception& e) {
-        return error("%s : Serialize or I/O error - %s", __func__, e.what());
+        tableMasternodes.Abort();
+        tableSeenBroadcasts.Abort();
+        tableSeenPings.Abort();
+        tableManager.Abort();
+        return error("%s : Database error - %s", __func__, e.what());
     }
-    //    FileCommit(fileout);
-    fileout.fclose();
+    tableMasternodes.Commit();
+    tableSeenBroadcasts.Commit();
+    tableSeenPings.Commit();
+    tableManager.Commit();
 
-    LogPrint("masternode","Written info to mncache.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrint("masternode","  %s\n", mnodemanToSave.ToString());
+    LogPrint("masternode","Written %d and erased %d masternode entries  %dms\n", nWritten, nErased, GetTimeMillis() - nStart);
 
     return true;
 }
 
-CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad, bool fDryRun)
+CMasternodeDB::ReadResult CMasternodeDB::Read(CMasternodeMan& mnodemanToLoad)
 {
-    int64_t nStart = GetTimeMillis();
-    // open input file, and associate with CAutoFile
-    FILE* file = fopen(pathMN.string().c_str(), "rb");
-    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
-        error("%s : Failed to open file %s", __func__, pathMN.string());
+    if (pmnStateDB == NULL)
         return FileError;
-    }
-
-    // use file size to size memory buffer
-    int fileSize = boost::filesystem::file_size(pathMN);
-    int dataSize = fileSize - sizeof(uint256);
-    // Don't try to resize to a negative number if file is small
-    if (dataSize < 0)
-        dataSize = 0;
-    std::vector<unsigned char> vchData;
-    vchData.resize(dataSize);
-    uint256 hashIn;
 
-    // read data and checksum from file
-    try {
-        filein.read((char*)&vchData[0], dataSize);
-        filein >> hashIn;
-    } catch (const std::exception& e) {
-        error("%s : Deserialize or I/O error - %s", __func__, e.what());
-        return HashReadError;
-    }
-    filein.fclose();
+    int64_t nStart = GetTimeMillis();
+    LOCK2(cs, mnodemanToLoad.cs);
+    mnodemanToLoad.Clear();
 
-    CDataStream ssMasternodes(vchData, SER_DISK, CLIENT_VERSION);
+    // an mncache.dat left by an older version replaces the stored entries
+    const bool fImport = ImportMasternodeStateFile("mncache.dat", strMagicMessage, mnodemanToLoad);
 
-    // verify stored checksum matches input data
-    uint256 hashTmp = Hash(ssMasternodes.begin(), ssMasternodes.end());
-    if (hashIn != hashTmp) {
-        error("%s : Checksum mismatch, data corrupted", __func__);
-        return IncorrectHash;
-    }
-
-    unsigned char pchMsgTmp[4];
-    std::string strMagicMessageTmp;
     try {
-        // de-serialize file header (masternode cache file specific magic message) and ..
-
-        ssMasternodes >> strMagicMessageTmp;
-
-        // ... verify the message matches predefined one
-        if (strMagicMessage != strMagicMessageTmp) {
-            error("%s : Invalid masternode cache magic message", __func__);
-            return IncorrectMagicMessage;
+        tableMasternodes.Load<CMasternode>(*pmnStateDB, [&](const COutPoint& outpoint, const CMasternode& mn) {
+            if (!fImport) mnodemanToLoad.vMasternodes.push_back(mn);
+        });
+        tableSeenBroadcasts.Load<CMasternodeBroadcast>(*pmnStateDB, [&](const uint256& hash, const CMasternodeBroadcast& mnb) {
+            if (!fImport) mnodemanToLoad.mapSeenMasternodeBroadcast.insert(std::make_pair(hash, mnb));
+        });
+        tableSeenPings.Load<CMasternodePing>(*pmnStateDB, [&](const uint256& hash, const CMasternodePing& mnp) {
+            if (!fImport) mnodemanToLoad.mapSeenMasternodePing.insert(std::make_pair(hash, mnp));
+        });
+        if (!fImport) {
+            pmnStateDB->Read(std::make_pair(DB_MASTERNODE_MANAGER, 'u'), mnodemanToLoad.mAskedUsForMasternodeList);
+            pmnStateDB->Read(std::make_pair(DB_MASTERNODE_MANAGER, 'w'), mnodemanToLoad.mWeAskedForMasternodeList);
+            pmnStateDB->Read(std::make_pair(DB_MASTERNODE_MANAGER, 'e'), mnodemanToLoad.mWeAskedForMasternodeListEntry);
+            pmnStateDB->Read(std::make_pair(DB_MASTERNODE_MANAGER, 'd'), mnodemanToLoad.nDsqCount);
         }
-
-        // de-serialize file header (network specific magic number) and ..
-        ssMasternodes >> FLATDATA(pchMsgTmp);
-
-        // ... verify the network matches ours
-        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp))) {
-            error("%s : Invalid network magic number", __func__);
-            return IncorrectMagicNumber;
-        }
-        // de-serialize data into CMasternodeMan object
-        ssMasternodes >> mnodemanToLoad;
     } catch (const std::exception& e) {
         mnodemanToLoad.Clear();
         error("%s : Deserialize or I/O error - %s", __func__, e.what());
         return IncorrectFormat;
     }
 
-    LogPrint("masternode","Loaded info from mncache.dat  %dms\n", GetTimeMillis() - nStart);
-    LogPrint("masternode","  %s\n", mnodemanToLoad.ToString());
-    if (!fDryRun) {
-        LogPrint("masternode","Masternode manager - cleaning....\n");
-        mnodemanToLoad.CheckAndRemove(true);
-        LogPrint("masternode","Masternode manager - result:\n");
-        LogPrint("masternode","  %s\n", mnodemanToLoad.ToString());
+    if (fImport) {
+        if (Write(mnodemanToLoad))
+            boost::filesystem::remove(GetDataDir() / "mncache.dat");
+        LogPrintf("Imported mncache.dat into the masternode state database\n");
+    } else {
+        if (tableMasternodes.size() == 0 && tableSeenBroadcasts.size() == 0 && tableSeenPings.size() == 0)
+            return FileError;
+        mnodemanToLoad.RebuildIndexes();
     }
 
+    LogPrint("masternode","Loaded masternode state  %dms\n", GetTimeMillis() - nStart);
+    LogPrint("masternode","  %s\n", mnodemanToLoad.ToString());
+    LogPrint("masternode","Masternode manager - cleaning....\n");
+    mnodemanToLoad.CheckAndRemove(true);
+    LogPrint("masternode","Masternode manager - result:\n");
+    LogPrint("masternode","  %s\n", mnodemanToLoad.ToString());
+
     return Ok;
 }
 
@@ -170,32 +170,74 @@ void DumpMasternodes()
 {
     int64_t nStart = GetTimeMillis();
 
-    CMasternodeDB mndb;
-    CMasternodeMan tempMnodeman;
-
-    LogPrint("masternode","Verifying mncache.dat format...\n");
-    CMasternodeDB::ReadResult readResult = mndb.Read(tempMnodeman, true);
-    // there was an error and it was not an error on file opening => do not proceed
-    if (readResult == CMasternodeDB::FileError)
-        LogPrint("masternode","Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CMasternodeDB::Ok) {
-        LogPrint("masternode","Error reading mncache.dat: ");
-        if (readResult == CMasternodeDB::IncorrectFormat)
-            LogPrint("masternode","magic is ok but data has invalid format, will try to recreate\n");
-        else {
-            LogPrint("masternode","file format is unknown or invalid, please fix it manually\n");
-            return;
-        }
-    }
-    LogPrint("masternode","Writting info to mncache.dat...\n");
-    mndb.Write(mnodeman);
+    LogPrint("masternode","Writting info to the masternode state database...\n");
+    mnodemanDB.Write(mnodeman);
 
     LogPrint("masternode","Masternode dump finished  %dms\n", GetTimeMillis() - nStart);
 }
 
+SaltedKeyIDHasher::SaltedKeyIDHasher() : salt(GetRandHash()) {}
+
 CMasternodeMan::CMasternodeMan()
 {
     nDsqCount = 0;
+    nScoreTableHits = 0;
+    nScoreTableMisses = 0;
+    nListVersion = 0;
+}
+
+static void EraseFromKeyIndex(boost::unordered_multimap<CKeyID, CMasternode*, SaltedKeyIDHasher>& index, const CKeyID& keyID, const CMasternode* pmn)
+{
+    auto range = index.equal_range(keyID);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == pmn) {
+            index.erase(it);
+            return;
+        }
+    }
+}
+
+void CMasternodeMan::IndexMasternode(std::list<CMasternode>::iterator it)
+{
+    CMasternode* pmn = &(*it);
+    mapMasternodesByOutpoint.emplace(pmn->vin.prevout, it);
+    mapMasternodesByPubKey.emplace(pmn->pubKeyMasternode.GetID(), pmn);
+    mapMasternodesByCollateral.emplace(pmn->pubKeyCollateralAddress.GetID(), pmn);
+}
+
+void CMasternodeMan::UnindexMasternode(CMasternode* pmn)
+{
+    auto it = mapMasternodesByOutpoint.find(pmn->vin.prevout);
+    if (it != mapMasternodesByOutpoint.end() && &(*it->second) == pmn)
+        mapMasternodesByOutpoint.erase(it);
+    EraseFromKeyIndex(mapMasternodesByPubKey, pmn->pubKeyMasternode.GetID(), pmn);
+    EraseFromKeyIndex(mapMasternodesByCollateral, pmn->pubKeyCollateralAddress.GetID(), pmn);
+}
+
+void CMasternodeMan::RebuildIndexes()
+{
+    LOCK(cs);
+    mapMasternodesByOutpoint.clear();
+    mapMasternodesByPubKey.clear();
+    mapMasternodesByCollateral.clear();
+    OnListChanged();
+    std::list<CMasternode>::iterator it = vMasternodes.begin();
+    while (it != vMasternodes.end()) {
+        // drop duplicate outpoints from an old mncache.dat, Find() only ever returned the first one
+        if (mapMasternodesByOutpoint.count(it->vin.prevout)) {
+            it = vMasternodes.erase(it);
+            continue;
+        }
+        IndexMasternode(it);
+        ++it;
+    }
+}
+
+std::list<CMasternode>::iterator CMasternodeMan::EraseMasternode(std::list<CMasternode>::iterator it)
+{
+    UnindexMasternode(&(*it));
+    OnListChanged();
+    return vMasternodes.erase(it);
 }
 
 bool CMasternodeMan::Add(CMasternode& mn)
@@ -208,7 +250,8 @@ bool CMasternodeMan::Add(CMasternode& mn)
     CMasternode* pmn = Find(mn.vin);
     if (pmn == NULL) {
         LogPrint("masternode", "CMasternodeMan: Adding new Masternode %s - %i now\n", mn.vin.prevout.hash.ToString(), size() + 1);
-        vMasternodes.push_back(mn);
+        IndexMasternode(vMasternodes.insert(vMasternodes.end(), mn));
+        OnListChanged();
         return true;
     }
 
@@ -247,7 +290,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
     LOCK(cs);
 
     //remove inactive and outdated
-    std::vector<CMasternode>::iterator it = vMasternodes.begin();
+    std::list<CMasternode>::iterator it = vMasternodes.begin();
     while (it != vMasternodes.end()) {
         if ((*it).activeState == CMasternode::MASTERNODE_REMOVE ||
             (*it).activeState == CMasternode::MASTERNODE_VIN_SPENT ||
@@ -278,7 +321,7 @@ void CMasternodeMan::CheckAndRemove(bool forceExpiredRemoval)
                 }
             }
 
-            it = vMasternodes.erase(it);
+            it = EraseMasternode(it);
         } else {
             ++it;
         }
@@ -340,6 +383,10 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     vMasternodes.clear();
+    mapMasternodesByOutpoint.clear();
+    mapMasternodesByPubKey.clear();
+    mapMasternodesByCollateral.clear();
+    OnListChanged();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
@@ -437,26 +484,25 @@ void CMasternodeMan::DsegUpdate(CNode* pnode)
 
 CMasternode* CMasternodeMan::Find(const CScript& payee)
 {
-    LOCK(cs);
-    CScript payee2;
+    // masternodes are paid to the P2PKH script of their collateral key
+    CTxDestination dest;
+    if (!ExtractDestination(payee, dest))
+        return NULL;
+    const CKeyID* keyID = boost::get<CKeyID>(&dest);
+    if (!keyID || GetScriptForDestination(*keyID) != payee)
+        return NULL;
 
-    for (CMasternode& mn : vMasternodes) {
-        payee2 = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
-        if (payee2 == payee)
-            return &mn;
-    }
-    return NULL;
+    LOCK(cs);
+    auto it = mapMasternodesByCollateral.find(*keyID);
+    return it == mapMasternodesByCollateral.end() ? NULL : it->second;
 }
 
 CMasternode* CMasternodeMan::Find(const CTxIn& vin)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.vin.prevout == vin.prevout)
-            return &mn;
-    }
-    return NULL;
+    auto it = mapMasternodesByOutpoint.find(vin.prevout);
+    return it == mapMasternodesByOutpoint.end() ? NULL : &(*it->second);
 }
 
 
@@ -464,9 +510,10 @@ CMasternode* CMasternodeMan::Find(const CPubKey& pubKeyMasternode)
 {
     LOCK(cs);
 
-    for (CMasternode& mn : vMasternodes) {
-        if (mn.pubKeyMasternode == pubKeyMasternode)
-            return &mn;
+    auto range = mapMasternodesByPubKey.equal_range(pubKeyMasternode.GetID());
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second->pubKeyMasternode == pubKeyMasternode)
+            return it->second;
     }
     return NULL;
 }
@@ -486,6 +533,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     */
 
     int nMnCount = CountEnabled();
+    const int nMaxPaidDepth = nMnCount * 1.25;
     for (CMasternode& mn : vMasternodes) {
         mn.Check();
         if (!mn.IsEnabled()) continue;
@@ -502,7 +550,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
         //make sure it has as many confirmations as there are masternodes
         if (mn.GetMasternodeInputAge() < nMnCount) continue;
 
-        vecMasternodeLastPaid.push_back(std::make_pair(mn.SecondsSincePayment(), mn.vin));
+        vecMasternodeLastPaid.push_back(std::make_pair(mn.SecondsSincePayment(nMaxPaidDepth), mn.vin));
     }
 
     nCount = (int)vecMasternodeLastPaid.size();
@@ -517,7 +565,7 @@ CMasternode* CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight
     //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
     //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
     //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = CountEnabled() / 10;
+    int nTenthNetwork = nMnCount / 10;
     int nCountTenth = 0;
     uint256 nHigh;
     for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeLastPaid) {
@@ -567,48 +615,93 @@ CMasternode* CMasternodeMan::FindRandomNotInVec(std::vector<CTxIn>& vecToExclude
     return NULL;
 }
 
-CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
+void CMasternodeMan::OnListChanged()
 {
-    int64_t score = 0;
-    CMasternode* winner = NULL;
+    AssertLockHeld(cs);
+    mapScoreTables.clear();
+    nListVersion++;
+}
+
+const CMasternodeMan::CMasternodeScoreTable* CMasternodeMan::GetScoreTable(int64_t nBlockHeight)
+{
+    AssertLockHeld(cs);
+
+    //make sure we know about this block
+    uint256 hashBlock;
+    if (!GetBlockHash(hashBlock, nBlockHeight)) return NULL;
 
-    // scan for winner
+    std::map<int64_t, CMasternodeScoreTable>::iterator it = mapScoreTables.find(nBlockHeight);
+    if (it != mapScoreTables.end() && it->second.hashBlock == hashBlock) {
+        nScoreTableHits++;
+        return &it->second;
+    }
+
+    nScoreTableMisses++;
+    if (it == mapScoreTables.end()) {
+        // heights are looked up around the tip, drop the oldest one
+        if (mapScoreTables.size() >= MASTERNODES_SCORE_TABLES)
+            mapScoreTables.erase(mapScoreTables.begin());
+        it = mapScoreTables.insert(std::make_pair(nBlockHeight, CMasternodeScoreTable())).first;
+    }
+
+    CMasternodeScoreTable& table = it->second;
+    table.hashBlock = hashBlock;
+    table.vScores.clear();
+    table.vScores.reserve(vMasternodes.size());
     for (CMasternode& mn : vMasternodes) {
-        mn.Check();
-        if (mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
+        uint256 n = mn.CalculateScore(1, nBlockHeight);
+        table.vScores.push_back(std::make_pair(n.GetCompact(false), mn.vin.prevout));
+    }
+    std::sort(table.vScores.begin(), table.vScores.end(), CompareScoreOutPoint());
 
-        // calculate the score for each Masternode
-        uint256 n = mn.CalculateScore(mod, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
+    LogPrint("masternode", "CMasternodeMan::GetScoreTable -- height %d, %d masternodes\n", nBlockHeight, table.vScores.size());
+    return &table;
+}
 
-        // determine the winner
-        if (n2 > score) {
-            score = n2;
-            winner = &mn;
-        }
+void CMasternodeMan::GetScoreTableStats(uint64_t& nHits, uint64_t& nMisses) const
+{
+    LOCK(cs);
+    nHits = nScoreTableHits;
+    nMisses = nScoreTableMisses;
+}
+
+CMasternode* CMasternodeMan::GetCurrentMasterNode(int mod, int64_t nBlockHeight, int minProtocol)
+{
+    LOCK(cs);
+
+    // the score does not depend on mod, so the winner is the best scored enabled masternode
+    const CMasternodeScoreTable* pscores = GetScoreTable(nBlockHeight);
+    if (pscores == NULL) return NULL;
+
+    for (const PAIRTYPE(int64_t, COutPoint) & s : pscores->vScores) {
+        CMasternode& mn = *mapMasternodesByOutpoint.find(s.second)->second;
+        mn.Check();
+        if (mn.protocolVersion < minProtocol || !mn.IsEnabled()) continue;
+        return &mn;
     }
 
-    return winner;
+    return NULL;
 }
 
 int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
     int64_t nMasternode_Min_Age = MN_WINNER_MINIMUM_AGE;
     int64_t nMasternode_Age = 0;
 
-    //make sure we know about this block
-    uint256 hash;
-    if (!GetBlockHash(hash, nBlockHeight)) return -1;
+    const CMasternodeScoreTable* pscores = GetScoreTable(nBlockHeight);
+    if (pscores == NULL) return -1;
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
+    const bool fCheckAge = sporkManager.IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT);
+    int rank = 0;
+    for (const PAIRTYPE(int64_t, COutPoint) & s : pscores->vScores) {
+        CMasternode& mn = *mapMasternodesByOutpoint.find(s.second)->second;
         if (mn.protocolVersion < minProtocol) {
             LogPrint("masternode","Skipping Masternode with obsolete version %d\n", mn.protocolVersion);
             continue;                                                       // Skip obsolete versions
         }
 
-        if (sporkManager.IsSporkActive(SPORK_8_MASTERNODE_PAYMENT_ENFORCEMENT)) {
+        if (fCheckAge) {
             nMasternode_Age = GetAdjustedTime() - mn.sigTime;
             if ((nMasternode_Age) < nMasternode_Min_Age) {
                 if (fDebug) LogPrint("masternode","Skipping just activated Masternode. Age: %ld\n", nMasternode_Age);
@@ -619,18 +712,9 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
             mn.Check();
             if (!mn.IsEnabled()) continue;
         }
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
 
-    int rank = 0;
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
         rank++;
-        if (s.second.prevout == vin.prevout) {
+        if (s.second == vin.prevout) {
             return rank;
         }
     }
@@ -640,66 +724,53 @@ int CMasternodeMan::GetMasternodeRank(const CTxIn& vin, int64_t nBlockHeight, in
 
 std::vector<std::pair<int, CMasternode> > CMasternodeMan::GetMasternodeRanks(int64_t nBlockHeight, int minProtocol)
 {
-    std::vector<std::pair<int64_t, CMasternode> > vecMasternodeScores;
+    LOCK(cs);
     std::vector<std::pair<int, CMasternode> > vecMasternodeRanks;
 
-    //make sure we know about this block
-    uint256 hash;
-    if (!GetBlockHash(hash, nBlockHeight)) return vecMasternodeRanks;
+    const CMasternodeScoreTable* pscores = GetScoreTable(nBlockHeight);
+    if (pscores == NULL) return vecMasternodeRanks;
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
+    // enabled masternodes by score, followed by the disabled ones
+    std::vector<CMasternode*> vecDisabled;
+    int rank = 0;
+    for (const PAIRTYPE(int64_t, COutPoint) & s : pscores->vScores) {
+        CMasternode& mn = *mapMasternodesByOutpoint.find(s.second)->second;
         mn.Check();
 
         if (mn.protocolVersion < minProtocol) continue;
 
         if (!mn.IsEnabled()) {
-            vecMasternodeScores.push_back(std::make_pair(9999, mn));
+            vecDisabled.push_back(&mn);
             continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(n2, mn));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreMN());
-
-    int rank = 0;
-    for (PAIRTYPE(int64_t, CMasternode) & s : vecMasternodeScores) {
-        rank++;
-        vecMasternodeRanks.push_back(std::make_pair(rank, s.second));
+        vecMasternodeRanks.push_back(std::make_pair(++rank, mn));
     }
+    for (CMasternode* pmn : vecDisabled)
+        vecMasternodeRanks.push_back(std::make_pair(++rank, *pmn));
 
     return vecMasternodeRanks;
 }
 
 CMasternode* CMasternodeMan::GetMasternodeByRank(int nRank, int64_t nBlockHeight, int minProtocol, bool fOnlyActive)
 {
-    std::vector<std::pair<int64_t, CTxIn> > vecMasternodeScores;
+    LOCK(cs);
 
-    // scan for winner
-    for (CMasternode& mn : vMasternodes) {
+    const CMasternodeScoreTable* pscores = GetScoreTable(nBlockHeight);
+    if (pscores == NULL) return NULL;
+
+    int rank = 0;
+    for (const PAIRTYPE(int64_t, COutPoint) & s : pscores->vScores) {
+        CMasternode& mn = *mapMasternodesByOutpoint.find(s.second)->second;
         if (mn.protocolVersion < minProtocol) continue;
         if (fOnlyActive) {
             mn.Check();
             if (!mn.IsEnabled()) continue;
         }
 
-        uint256 n = mn.CalculateScore(1, nBlockHeight);
-        int64_t n2 = n.GetCompact(false);
-
-        vecMasternodeScores.push_back(std::make_pair(n2, mn.vin));
-    }
-
-    sort(vecMasternodeScores.rbegin(), vecMasternodeScores.rend(), CompareScoreTxIn());
-
-    int rank = 0;
-    for (PAIRTYPE(int64_t, CTxIn) & s : vecMasternodeScores) {
         rank++;
         if (rank == nRank) {
-            return Find(s.second);
+            return &mn;
         }
     }
 
@@ -855,15 +926,12 @@ void CMasternodeMan::Remove(CTxIn vin)
 {
     LOCK(cs);
 
-    std::vector<CMasternode>::iterator it = vMasternodes.begin();
-    while (it != vMasternodes.end()) {
-        if ((*it).vin == vin) {
-            LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", (*it).vin.prevout.hash.ToString(), size() - 1);
-            vMasternodes.erase(it);
-            break;
-        }
-        ++it;
-    }
+    auto itIndex = mapMasternodesByOutpoint.find(vin.prevout);
+    if (itIndex == mapMasternodesByOutpoint.end() || itIndex->second->vin != vin)
+        return;
+
+    LogPrint("masternode", "CMasternodeMan: Removing Masternode %s - %i now\n", vin.prevout.hash.ToString(), size() - 1);
+    EraseMasternode(itIndex->second);
 }
 
 void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
@@ -879,15 +947,63 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
         CMasternode mn(mnb);
         Add(mn);
     } else {
-        pmn->UpdateFromNewBroadcast(mnb);
+        UpdateFromNewBroadcast(*pmn, mnb);
     }
 }
 
+bool CMasternodeMan::UpdateFromNewBroadcast(CMasternode& mn, CMasternodeBroadcast& mnb)
+{
+    LOCK(cs);
+    auto itIndex = mapMasternodesByOutpoint.find(mn.vin.prevout);
+    if (itIndex == mapMasternodesByOutpoint.end() || &(*itIndex->second) != &mn)
+        return mn.UpdateFromNewBroadcast(mnb);
+
+    const std::list<CMasternode>::iterator it = itIndex->second;
+    UnindexMasternode(&mn);
+    bool fUpdated = mn.UpdateFromNewBroadcast(mnb);
+    IndexMasternode(it);
+    return fUpdated;
+}
+
+static size_t PingDynamicUsage(const CMasternodePing& mnp)
+{
+    return mnp.GetSigDynamicUsage() + RecursiveDynamicUsage(mnp.vin);
+}
+
+static size_t MasternodeDynamicUsage(const CMasternode& mn)
+{
+    return mn.GetSigDynamicUsage() + RecursiveDynamicUsage(mn.vin) + PingDynamicUsage(mn.lastPing);
+}
+
+size_t CMasternodeMan::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    size_t nUsage = memusage::DynamicUsage(vMasternodes) +
+                    memusage::DynamicUsage(mapMasternodesByOutpoint) +
+                    memusage::DynamicUsage(mapMasternodesByPubKey) +
+                    memusage::DynamicUsage(mapMasternodesByCollateral) +
+                    memusage::DynamicUsage(mAskedUsForMasternodeList) +
+                    memusage::DynamicUsage(mWeAskedForMasternodeList) +
+                    memusage::DynamicUsage(mWeAskedForMasternodeListEntry) +
+                    memusage::DynamicUsage(mapSeenMasternodeBroadcast) +
+                    memusage::DynamicUsage(mapSeenMasternodePing);
+    for (const CMasternode& mn : vMasternodes)
+        nUsage += MasternodeDynamicUsage(mn);
+    for (const auto& it : mapSeenMasternodeBroadcast)
+        nUsage += MasternodeDynamicUsage(it.second);
+    for (const auto& it : mapSeenMasternodePing)
+        nUsage += PingDynamicUsage(it.second);
+    nUsage += memusage::DynamicUsage(mapScoreTables);
+    for (const auto& it : mapScoreTables)
+        nUsage += memusage::DynamicUsage(it.second.vScores);
+    return nUsage;
+}
+
 std::string CMasternodeMan::ToString() const
 {
     std::ostringstream info;
 
-    info << "Masternodes: " << (int)vMasternodes.size() << ", peers who asked us for Masternode list: " << (int)mAskedUsForMasternodeList.size() << ", peers we asked for Masternode list: " << (int)mWeAskedForMasternodeList.size() << ", entries in Masternode list we asked for: " << (int)mWeAskedForMasternodeListEntry.size() << ", nDsqCount: " << (int)nDsqCount;
+    info << "Masternodes: " << (int)vMasternodes.size() << ", peers who asked us for Masternode list: " << (int)mAskedUsForMasternodeList.size() << ", peers we asked for Masternode list: " << (int)mWeAskedForMasternodeList.size() << ", entries in Masternode list we asked for: " << (int)mWeAskedForMasternodeListEntry.size() << ", nDsqCount: " << (int)nDsqCount << ", score tables: " << (int)mapScoreTables.size() << " (hits: " << nScoreTableHits << ", misses: " << nScoreTableMisses << ")";
 
     return info.str();
 }
@@ -10,12 +10,18 @@
 #include "key.h"
 #include "main.h"
 #include "masternode.h"
+#include "masternodedb.h"
 #include "net.h"
 #include "sync.h"
 #include "util.h"
 
+#include <list>
+
+#include <boost/unordered_map.hpp>
+
 #define MASTERNODES_DUMP_SECONDS (15 * 60)
 #define MASTERNODES_DSEG_SECONDS (3 * 60 * 60)
+#define MASTERNODES_SCORE_TABLES 32
 
 
 class CMasternodeMan;
@@ -23,13 +29,18 @@ class CMasternodeMan;
 extern CMasternodeMan mnodeman;
 void DumpMasternodes();
 
-/** Access to the MN database (mncache.dat)
+/** Access to the MN database: the masternode tables of the mnstate/ store.
+ *  The mncache.dat of older versions is imported on the first load.
  */
 class CMasternodeDB
 {
 private:
-    boost::filesystem::path pathMN;
     std::string strMagicMessage;
+    RecursiveMutex cs;
+    CMasternodeStateTable<COutPoint> tableMasternodes;
+    CMasternodeStateTable<uint256> tableSeenBroadcasts;
+    CMasternodeStateTable<uint256> tableSeenPings;
+    CMasternodeStateTable<char> tableManager;
 
 public:
     enum ReadResult {
@@ -43,21 +54,49 @@ public:
     };
 
     CMasternodeDB();
+    /// Write the entries changed since the previous write
     bool Write(const CMasternodeMan& mnodemanToSave);
-    ReadResult Read(CMasternodeMan& mnodemanToLoad, bool fDryRun = false);
+    ReadResult Read(CMasternodeMan& mnodemanToLoad);
+};
+
+extern CMasternodeDB mnodemanDB;
+
+/** Salted hasher for the masternode key indexes (see SaltedOutpointHasher) */
+class SaltedKeyIDHasher
+{
+private:
+    uint256 salt;
+
+public:
+    SaltedKeyIDHasher();
+
+    size_t operator()(const CKeyID& id) const
+    {
+        uint256 padded;
+        memcpy(padded.begin(), id.begin(), id.size());
+        return padded.GetHash(salt);
+    }
 };
 
 class CMasternodeMan
 {
+    friend class CMasternodeDB;
+
 private:
+    typedef boost::unordered_multimap<CKeyID, CMasternode*, SaltedKeyIDHasher> MasternodeKeyIndex;
+
     // critical section to protect the inner data structures
     mutable RecursiveMutex cs;
 
     // critical section to protect the inner data structures specifically on messaging
     mutable RecursiveMutex cs_process_message;
 
-    // map to hold all MNs
-    std::vector<CMasternode> vMasternodes;
+    // list to hold all MNs; list nodes keep the CMasternode* handles stable while others are added or removed
+    std::list<CMasternode> vMasternodes;
+    // lookup indexes into vMasternodes by collateral outpoint, operator key and collateral (payee) key
+    boost::unordered_map<COutPoint, std::list<CMasternode>::iterator, SaltedOutpointHasher> mapMasternodesByOutpoint;
+    MasternodeKeyIndex mapMasternodesByPubKey;
+    MasternodeKeyIndex mapMasternodesByCollateral;
     // who's asked for the Masternode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForMasternodeList;
     // who we asked for the Masternode list and the last time
@@ -65,6 +104,27 @@ private:
     // which Masternodes we've asked for
     std::map<COutPoint, int64_t> mWeAskedForMasternodeListEntry;
 
+    // masternode scores of one block height, shared by every rank and winner lookup for it
+    struct CMasternodeScoreTable {
+        // block the scores were seeded from, a reorg replaces it
+        uint256 hashBlock;
+        // (compact score, collateral) of every listed masternode, best score first
+        std::vector<std::pair<int64_t, COutPoint> > vScores;
+    };
+    std::map<int64_t, CMasternodeScoreTable> mapScoreTables;
+    uint64_t nScoreTableHits;
+    uint64_t nScoreTableMisses;
+    // bumped whenever a masternode is added to or removed from the list
+    uint64_t nListVersion;
+
+    const CMasternodeScoreTable* GetScoreTable(int64_t nBlockHeight);
+    void OnListChanged();
+
+    void IndexMasternode(std::list<CMasternode>::iterator it);
+    void UnindexMasternode(CMasternode* pmn);
+    void RebuildIndexes();
+    std::list<CMasternode>::iterator EraseMasternode(std::list<CMasternode>::iterator it);
+
 public:
     // Keep track of all broadcasts I've seen
     std::map<uint256, CMasternodeBroadcast> mapSeenMasternodeBroadcast;
@@ -80,7 +140,15 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
     {
         LOCK(cs);
-        READWRITE(vMasternodes);
+        // stored as a vector, as before the list was indexed
+        std::vector<CMasternode> vMasternodesSer;
+        if (!ser_action.ForRead())
+            vMasternodesSer.assign(vMasternodes.begin(), vMasternodes.end());
+        READWRITE(vMasternodesSer);
+        if (ser_action.ForRead()) {
+            vMasternodes.assign(vMasternodesSer.begin(), vMasternodesSer.end());
+            RebuildIndexes();
+        }
         READWRITE(mAskedUsForMasternodeList);
         READWRITE(mWeAskedForMasternodeList);
         READWRITE(mWeAskedForMasternodeListEntry);
@@ -131,7 +199,8 @@ public:
     std::vector<CMasternode> GetFullMasternodeVector()
     {
         Check();
-        return vMasternodes;
+        LOCK(cs);
+        return std::vector<CMasternode>(vMasternodes.begin(), vMasternodes.end());
     }
 
     std::vector<std::pair<int, CMasternode> > GetMasternodeRanks(int64_t nBlockHeight, int minProtocol = 0);
@@ -145,17 +214,33 @@ public:
     /// Return the number of (unique) Masternodes
     int size() { return vMasternodes.size(); }
 
+    /// Changes whenever a masternode is added to or removed from the list
+    uint64_t GetListVersion() const
+    {
+        LOCK(cs);
+        return nListVersion;
+    }
+
     /// Return the number of Masternodes older than (default) 8000 seconds
     int stable_size ();
 
     std::string ToString() const;
 
+    /// Number of rank/winner lookups served from a cached score table, and of tables computed
+    void GetScoreTableStats(uint64_t& nHits, uint64_t& nMisses) const;
+
+    /// Approximate heap memory used by the masternode list and the seen maps
+    size_t DynamicMemoryUsage() const;
+
     void Remove(CTxIn vin);
 
     int GetEstimatedMasternodes(int nBlock);
 
     /// Update masternode list and maps using provided CMasternodeBroadcast
     void UpdateMasternodeList(CMasternodeBroadcast mnb);
+
+    /// Update a listed masternode from a newer broadcast, keeping the key indexes in sync
+    bool UpdateFromNewBroadcast(CMasternode& mn, CMasternodeBroadcast& mnb);
 };
 
 #endif
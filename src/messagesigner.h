@@ -7,6 +7,7 @@
 #define MESSAGESIGNER_H
 
 #include "key.h"
+#include "memusage.h"
 #include "primitives/transaction.h" // for CTxIn
 
 enum MessageVersion {
@@ -86,6 +87,9 @@ public:
     void SetVchSig(const std::vector<unsigned char>& vchSigIn) { vchSig = vchSigIn; }
     std::vector<unsigned char> GetVchSig() const { return vchSig; }
     std::string GetSignatureBase64() const;
+
+    // Heap memory held by the signature
+    size_t GetSigDynamicUsage() const { return memusage::DynamicUsage(vchSig); }
 };
 
 #endif
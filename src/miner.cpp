@@ -14,6 +14,7 @@
 #include "consensus/merkle.h"
 #include "consensus/tx_verify.h" // needed in case of no ENABLE_WALLET
 #include "hash.h"
+#include "kernel.h"
 #include "main.h"
 #include "masternode-sync.h"
 #include "net.h"
@@ -33,7 +34,6 @@
 
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -41,49 +41,429 @@
 // oasisMiner
 //
 
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. The pool tracks, for every entry, the
+// size, fees and sigops of the entry together with all its in-pool
+// ancestors, and keeps an index sorted by that package fee rate. Block
+// assembly walks that index, adding whole packages at a time. Once a
+// package is in the block, the remaining descendants of its transactions
+// are worth more than the index says (their ancestors are already paid for),
+// so they are re-scored in a CTxMemPoolModifiedEntry set while the block is
+// being filled.
 //
-class COrphan
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpCountWithAncestors = entry->GetSigOpCountWithAncestors();
+    }
+
+    const CTransaction& GetTx() const { return iter->GetTx(); }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpCountWithAncestors;
+};
+
+/** Comparator for CTxMemPool::txiter objects.
+ *  It simply compares the internal memory address of the CTxMemPoolEntry object
+ *  pointed to. This means it has no meaning, and is only useful for using them
+ *  as key in other indexes.
+ */
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
+
+/** Same ordering as the pool's ancestor_score index, for the re-scored entries. */
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double f1 = (double)a.GetModFeesWithAncestors() * b.GetSizeWithAncestors();
+        double f2 = (double)b.GetModFeesWithAncestors() * a.GetSizeWithAncestors();
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
+};
+
+// A comparator that sorts transactions based on number of ancestors.
+// This is sufficient to sort an ancestor package in an order that is valid
+// to appear in a block.
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            // Reuse same tag from CTxMemPool's similar index
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
 {
-public:
-    const CTransaction* ptx;
-    std::set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    void operator() (CTxMemPoolModifiedEntry &e)
     {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpCountWithAncestors -= iter->GetSigOpCount();
     }
+
+    CTxMemPool::txiter iter;
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
+// We want to sort transactions by coin age priority
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+
+struct TxCoinAgePriorityCompare
+{
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b)
+    {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByAncestorFee()(*b.second, *a.second); //Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+/**
+ * The mempool transactions picked for a block on top of hashPrevBlock.
+ *
+ * A staking wallet asks for a new template every time slot. Unless the tip
+ * or the mempool changed in between, the previous pick is still the best one,
+ * so it is kept and reused instead of being assembled again.
+ */
+struct CBlockTxSelection
 {
-    bool byFee;
+    uint256 hashPrevBlock;
+    unsigned int nTransactionsUpdated;
+    int64_t nTimeSelected;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockPrioritySize;
+    unsigned int nBlockMinSize;
+
+    std::vector<CTransaction> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    uint64_t nBlockSize;
+    int nBlockSigOps;
+    CAmount nFees;
+
+    CBlockTxSelection() : nTransactionsUpdated(0), nTimeSelected(0), nBlockMaxSize(0), nBlockPrioritySize(0), nBlockMinSize(0),
+                          nBlockSize(1000), nBlockSigOps(100), nFees(0) {}
+};
+
+/** Give up on a cached selection after this many seconds, so time-locked transactions are picked up */
+static const int64_t MAX_TX_SELECTION_AGE = 60;
+
+static CBlockTxSelection cachedTxSelection; // protected by cs_main
+
+/** Temporary state while filling a CBlockTxSelection from the mempool */
+class CBlockTxSelector
+{
+private:
+    CBlockTxSelection& sel;
+    const int nHeight;
+    CTxMemPool::setEntries inBlock;
+    bool fPrintPriority;
+
+    bool TestTx(CTxMemPool::txiter iter) const
+    {
+        if (sel.nBlockSize + iter->GetTxSize() >= sel.nBlockMaxSize)
+            return false;
+        if (sel.nBlockSigOps + iter->GetSigOpCount() >= MAX_BLOCK_SIGOPS_CURRENT)
+            return false;
+        return IsFinalTx(iter->GetTx(), nHeight);
+    }
+
+    bool TestPackage(uint64_t packageSize, unsigned int packageSigOps) const
+    {
+        if (sel.nBlockSize + packageSize >= sel.nBlockMaxSize)
+            return false;
+        if (sel.nBlockSigOps + packageSigOps >= MAX_BLOCK_SIGOPS_CURRENT)
+            return false;
+        return true;
+    }
+
+    bool TestPackageFinality(const CTxMemPool::setEntries& package) const
+    {
+        for (const CTxMemPool::txiter it : package) {
+            if (!IsFinalTx(it->GetTx(), nHeight))
+                return false;
+        }
+        return true;
+    }
+
+    /** Whether an in-mempool parent of iter is not in the block yet */
+    bool IsStillDependent(CTxMemPool::txiter iter) const
+    {
+        for (CTxMemPool::txiter parent : mempool.GetMemPoolParents(iter)) {
+            if (!inBlock.count(parent))
+                return true;
+        }
+        return false;
+    }
+
+    void AddToSelection(CTxMemPool::txiter iter)
+    {
+        sel.vtx.push_back(iter->GetTx());
+        sel.vTxFees.push_back(iter->GetFee());
+        sel.vTxSigOps.push_back(iter->GetSigOpCount());
+        sel.nBlockSize += iter->GetTxSize();
+        sel.nBlockSigOps += iter->GetSigOpCount();
+        sel.nFees += iter->GetFee();
+        inBlock.insert(iter);
+
+        if (fPrintPriority) {
+            double dPriority = iter->GetPriority(nHeight);
+            CAmount dummy;
+            mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                dPriority, CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(), iter->GetTx().GetHash().ToString());
+        }
+    }
+
+    /** Add descendants of the given transactions to mapModifiedTx with ancestor
+     *  state updated assuming the given transactions are in the block. */
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx)
+    {
+        for (const CTxMemPool::txiter it : alreadyAdded) {
+            CTxMemPool::setEntries descendants;
+            mempool.CalculateDescendants(it, descendants);
+            // Insert all descendants (not yet in block) into the modified set
+            for (CTxMemPool::txiter desc : descendants) {
+                if (alreadyAdded.count(desc))
+                    continue;
+                modtxiter mit = mapModifiedTx.find(desc);
+                if (mit == mapModifiedTx.end()) {
+                    CTxMemPoolModifiedEntry modEntry(desc);
+                    modEntry.nSizeWithAncestors -= it->GetTxSize();
+                    modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                    modEntry.nSigOpCountWithAncestors -= it->GetSigOpCount();
+                    mapModifiedTx.insert(modEntry);
+                } else {
+                    mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+                }
+            }
+        }
+    }
 
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    CBlockTxSelector(CBlockTxSelection& selIn, int nHeightIn) : sel(selIn), nHeight(nHeightIn)
+    {
+        fPrintPriority = GetBoolArg("-printpriority", false);
+    }
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    /** Fill the high-priority area of the block, regardless of the fees paid */
+    void AddPriorityTxs()
     {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+        if (sel.nBlockPrioritySize == 0)
+            return;
+
+        // This vector will be sorted into a priority queue:
+        std::vector<TxCoinAgePriority> vecPriority;
+        TxCoinAgePriorityCompare pricomparer;
+        std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+        typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
+
+        vecPriority.reserve(mempool.mapTx.size());
+        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi) {
+            double dPriority = mi->GetPriority(nHeight);
+            CAmount dummy;
+            mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+            vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+        }
+        std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+        while (!vecPriority.empty()) {
+            CTxMemPool::txiter iter = vecPriority.front().second;
+            double actualPriority = vecPriority.front().first;
+            std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+            vecPriority.pop_back();
+
+            // If tx is dependent on other mempool txs which haven't yet been included
+            // then put it in the wait set
+            if (IsStillDependent(iter)) {
+                waitPriMap.insert(std::make_pair(iter, actualPriority));
+                continue;
+            }
+
+            // If this tx fits in the block add it, otherwise keep looping
+            if (!TestTx(iter))
+                continue;
+            AddToSelection(iter);
+
+            // If now that this txs is added we've surpassed our desired priority size
+            // or have dropped below the AllowFreeThreshold, then we're done adding priority txs
+            if (sel.nBlockSize >= sel.nBlockPrioritySize || !AllowFree(actualPriority))
+                break;
+
+            // This tx was successfully added, so
+            // add transactions that depend on this one to the priority queue to try again
+            for (CTxMemPool::txiter child : mempool.GetMemPoolChildren(iter)) {
+                waitPriIter wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
+                }
+            }
+        }
+    }
+
+    /** Fill the rest of the block with packages, highest ancestor fee rate first */
+    void AddPackageTxs()
+    {
+        // mapModifiedTx will store sorted packages after they are modified
+        // because some of their txs are already in the block
+        indexed_modified_transaction_set mapModifiedTx;
+        // Keep track of entries that failed inclusion, to avoid duplicate work
+        CTxMemPool::setEntries failedTx;
+
+        // Start by adding all descendants of previously added txs to mapModifiedTx
+        // and modifying them for their already included ancestors
+        UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+        CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+        CTxMemPool::txiter iter;
+        while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty()) {
+            // First try to find a new transaction in mapTx to evaluate.
+            if (mi != mempool.mapTx.get<ancestor_score>().end()) {
+                CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+                if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it)) {
+                    ++mi;
+                    continue;
+                }
+            }
+
+            // Now that mi is not stale, determine which transaction to evaluate:
+            // the next entry from mapTx, or the best from mapModifiedTx?
+            bool fUsingModified = false;
+
+            modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+            if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+                // We're out of entries in mapTx; use the entry from mapModifiedTx
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Try to compare the mapTx entry to the mapModifiedTx entry
+                iter = mempool.mapTx.project<0>(mi);
+                if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                    // The best entry in mapModifiedTx has higher score
+                    // than the one from mapTx.
+                    // Switch which transaction (package) to consider
+                    iter = modit->iter;
+                    fUsingModified = true;
+                } else {
+                    // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                    // Increment mi for the next loop iteration.
+                    ++mi;
+                }
+            }
+
+            // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+            // contain anything that is inBlock.
+            assert(!inBlock.count(iter));
+
+            uint64_t packageSize = iter->GetSizeWithAncestors();
+            CAmount packageFees = iter->GetModFeesWithAncestors();
+            unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+            if (fUsingModified) {
+                packageSize = modit->nSizeWithAncestors;
+                packageFees = modit->nModFeesWithAncestors;
+                packageSigOps = modit->nSigOpCountWithAncestors;
+            }
+
+            if (packageFees < ::minRelayTxFee.GetFee(packageSize) && sel.nBlockSize >= sel.nBlockMinSize) {
+                // Everything else we might consider has a lower fee rate
+                return;
+            }
+
+            if (!TestPackage(packageSize, packageSigOps)) {
+                if (fUsingModified) {
+                    // Since we always look at the best entry in mapModifiedTx,
+                    // we must erase failed entries so that we can consider the
+                    // next best entry on the next loop iteration
+                    mapModifiedTx.get<ancestor_score>().erase(modit);
+                    failedTx.insert(iter);
+                }
+                continue;
+            }
+
+            CTxMemPool::setEntries ancestors;
+            uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+            std::string dummy;
+            mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+            // Drop the ancestors that are already in the block
+            for (CTxMemPool::setEntries::iterator ait = ancestors.begin(); ait != ancestors.end();) {
+                if (inBlock.count(*ait))
+                    ancestors.erase(ait++);
+                else
+                    ++ait;
+            }
+            ancestors.insert(iter);
+
+            if (!TestPackageFinality(ancestors)) {
+                if (fUsingModified) {
+                    mapModifiedTx.get<ancestor_score>().erase(modit);
+                    failedTx.insert(iter);
+                }
+                continue;
+            }
+
+            // Package can be added. Sort the entries in a valid order.
+            std::vector<CTxMemPool::txiter> sortedEntries(ancestors.begin(), ancestors.end());
+            std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+
+            for (const CTxMemPool::txiter& entry : sortedEntries) {
+                AddToSelection(entry);
+                // Erase from the modified set, if present
+                mapModifiedTx.erase(entry);
+            }
+
+            // Update transactions that depend on each of these
+            UpdatePackagesForAdded(ancestors, mapModifiedTx);
         }
     }
 };
@@ -184,183 +564,40 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 
     {
         LOCK2(cs_main, mempool.cs);
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        std::list<COrphan> vOrphan; // list memory doesn't move
-        std::map<uint256, std::vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        std::vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (std::map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-
-            for (const CTxIn& txin : tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                // zXOS spends can have (had) very large priority, use non-overflowing safe functions
-                dPriority = double_safe_addition(dPriority, ((double)nValueIn * nConf));
-
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
+        // Reuse the transactions picked for the previous template when nothing changed
+        const unsigned int nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        CBlockTxSelection& sel = cachedTxSelection;
+        if (sel.hashPrevBlock != pindexPrev->GetBlockHash() ||
+            sel.nTransactionsUpdated != nTransactionsUpdated ||
+            sel.nBlockMaxSize != nBlockMaxSize ||
+            sel.nBlockPrioritySize != nBlockPrioritySize ||
+            sel.nBlockMinSize != nBlockMinSize ||
+            GetTime() - sel.nTimeSelected > MAX_TX_SELECTION_AGE) {
+            int64_t nTimeStart = GetTimeMicros();
+            sel = CBlockTxSelection();
+            sel.hashPrevBlock = pindexPrev->GetBlockHash();
+            sel.nTransactionsUpdated = nTransactionsUpdated;
+            sel.nTimeSelected = GetTime();
+            sel.nBlockMaxSize = nBlockMaxSize;
+            sel.nBlockPrioritySize = nBlockPrioritySize;
+            sel.nBlockMinSize = nBlockMinSize;
+
+            CBlockTxSelector selector(sel, nHeight);
+            selector.AddPriorityTxs();
+            selector.AddPackageTxs();
+            LogPrint("bench", "%s : selected %u of %u mempool txs in %.2fms\n", __func__,
+                sel.vtx.size(), mempool.mapTx.size(), (GetTimeMicros() - nTimeStart) * 0.001);
         }
 
         // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        std::vector<CBigNum> vBlockSerials;
-        std::vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            for (const CBigNum& bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                for (COrphan* porphan : mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
+        for (unsigned int i = 0; i < sel.vtx.size(); i++) {
+            pblock->vtx.push_back(sel.vtx[i]);
+            pblocktemplate->vTxFees.push_back(sel.vTxFees[i]);
+            pblocktemplate->vTxSigOps.push_back(sel.vTxSigOps[i]);
         }
+        uint64_t nBlockSize = sel.nBlockSize;
+        uint64_t nBlockTx = sel.vtx.size();
+        nFees = sel.nFees;
 
         if (!fProofOfStake) {
             //Masternode and general budget payments
@@ -437,6 +674,45 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
 
+bool CStakeSchedule::NeedsUpdate(const CBlockIndex* pindexPrev, int64_t nCurrentSlot, unsigned int nCandidatesVersionIn) const
+{
+    return hashTip != pindexPrev->GetBlockHash() ||
+           nCandidatesVersion != nCandidatesVersionIn ||
+           nCurrentSlot > nSlotTo ||
+           (nNextSlot != 0 && nNextSlot < nCurrentSlot);
+}
+
+void CStakeSchedule::SetWindow(const CBlockIndex* pindexPrev, int64_t nCurrentSlot, unsigned int nCandidatesVersionIn)
+{
+    const int nSlotLength = Params().GetConsensus().nTimeSlotLength;
+    hashTip = pindexPrev->GetBlockHash();
+    nCandidatesVersion = nCandidatesVersionIn;
+    nSlotFrom = std::max(nCurrentSlot, GetTimeSlot(pindexPrev->GetBlockTime()) + nSlotLength);
+    nSlotTo = nSlotFrom + STAKE_LOOKAHEAD_SLOTS * nSlotLength;
+    nNextSlot = 0;
+}
+
+int64_t FindNextStakeSlot(const std::vector<CStakeKernelInput>& vAllInputs, const CBlockIndex* pindexPrev, unsigned int nBits,
+                          int64_t nSlotFrom, int64_t nSlotTo, int& nHashes)
+{
+    nHashes = 0;
+    const int nSlotLength = Params().GetConsensus().nTimeSlotLength;
+    std::vector<CStakeKernelInput> vInputs;
+    for (int64_t nSlot = nSlotFrom; nSlot <= nSlotTo; nSlot += nSlotLength) {
+        const CStakeKernelSlot kernelSlot(pindexPrev, nBits, nSlot);
+        if (!kernelSlot.IsValid()) return 0;
+        vInputs.clear();
+        for (const CStakeKernelInput& input : vAllInputs)
+            if (kernelSlot.ContextCheck(input)) vInputs.push_back(input);
+        int nSlotHashes = 0;
+        const int nPos = SearchStakeKernel(kernelSlot, vInputs, 0, nSlotHashes);
+        nHashes += nSlotHashes;
+        if (nPos >= 0) return nSlot;
+        boost::this_thread::interruption_point();
+    }
+    return 0;
+}
+
 #ifdef ENABLE_WALLET
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -511,6 +787,27 @@ void CheckForCoins(CWallet* pwallet, const int minutes)
     }
 }
 
+/**
+ * Return the first time slot in [nSlotFrom, nSlotTo] in which one of the wallet's inputs
+ * can stake on top of pindexPrev, or 0 if there is none.
+ * With stake modifier v2 the kernel depends only on pindexPrev, the utxo and the slot,
+ * so the whole window can be checked as soon as a new tip arrives.
+ */
+static int64_t FindNextStakeSlot(CWallet* pwallet, const CBlockIndex* pindexPrev, int64_t nSlotFrom, int64_t nSlotTo, int& nHashes)
+{
+    nHashes = 0;
+    std::vector<CStakeCandidate> vCandidates;
+    if (!pwallet->GetStakeCandidates(pindexPrev, vCandidates))
+        return 0;
+
+    std::vector<CStakeKernelInput> vInputs;
+    vInputs.reserve(vCandidates.size());
+    for (const CStakeCandidate& candidate : vCandidates)
+        vInputs.push_back(candidate.GetKernelInput());
+
+    return FindNextStakeSlot(vInputs, pindexPrev, GetNextWorkRequired(pindexPrev, nullptr), nSlotFrom, nSlotTo, nHashes);
+}
+
 void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
 {
     LogPrintf("oasisMiner started\n");
@@ -522,6 +819,7 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
     // Each thread has its own key and counter
     CReserveKey reservekey(pwallet);
     unsigned int nExtraNonce = 0;
+    CStakeSchedule stakeSchedule;
 
     while (fGenerateBitcoins || fProofOfStake) {
         CBlockIndex* pindexPrev = GetChainTip();
@@ -546,6 +844,33 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
                 if (!fStakeableCoins) CheckForCoins(pwallet, 1);
             }
 
+            // Look-ahead: compute the winning slots once per tip, and sleep until the first one opens
+            if (!Params().IsRegTestNet() && Params().GetConsensus().IsStakeModifierV2(pindexPrev->nHeight + 1)) {
+                const int nSlotLength = Params().GetConsensus().nTimeSlotLength;
+                const int64_t nCurrentSlot = GetCurrentTimeSlot();
+                // the set of mature inputs only changes with the tip, or when the wallet's candidates change
+                const unsigned int nCandidatesVersion = pwallet->GetStakeCandidatesVersion();
+                if (stakeSchedule.NeedsUpdate(pindexPrev, nCurrentSlot, nCandidatesVersion)) {
+                    stakeSchedule.SetWindow(pindexPrev, nCurrentSlot, nCandidatesVersion);
+                    int nHashes = 0;
+                    stakeSchedule.nNextSlot = FindNextStakeSlot(pwallet, pindexPrev, stakeSchedule.nSlotFrom, stakeSchedule.nSlotTo, nHashes);
+                    LogPrint("staking", "%s: tip %d, slots %d-%d, next winning slot: %d (%d hashes)\n", __func__,
+                             pindexPrev->nHeight, stakeSchedule.nSlotFrom, stakeSchedule.nSlotTo, stakeSchedule.nNextSlot, nHashes);
+                    if (pwallet->pStakerStatus) {
+                        pwallet->pStakerStatus->SetLastTip(pindexPrev);
+                        pwallet->pStakerStatus->SetLastTries(nHashes);
+                        pwallet->pStakerStatus->SetLastTime(nCurrentSlot - nSlotLength);
+                    }
+                }
+                if (stakeSchedule.nNextSlot == 0 || stakeSchedule.nNextSlot > nCurrentSlot) {
+                    // wake up when the slot opens, or every half second to catch a new tip
+                    const int64_t nWaitMillis = (stakeSchedule.nNextSlot == 0 ? 500 :
+                                                 (stakeSchedule.nNextSlot - GetAdjustedTime()) * 1000);
+                    MilliSleep(std::max<int64_t>(50, std::min<int64_t>(500, nWaitMillis)));
+                    continue;
+                }
+            }
+
             //search our map of hashed blocks, see if bestblock has been hashed yet
             if (pwallet->pStakerStatus &&
                     pwallet->pStakerStatus->GetLastHash() == pindexPrev->GetBlockHash() &&
@@ -10,6 +10,7 @@
 #include "primitives/block.h"
 
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
 class CBlockHeader;
@@ -19,6 +20,32 @@ class CScript;
 class CWallet;
 
 struct CBlockTemplate;
+struct CStakeKernelInput;
+
+//! Number of time slots, after the current one, covered by the stake look-ahead
+static const int STAKE_LOOKAHEAD_SLOTS = 40;
+
+/**
+ * Winning time slots precomputed for a chain tip.
+ * The inputs mature on top of a tip don't change while it stays the tip (stake modifier v2
+ * requires a depth), so the schedule is only recomputed for a new tip, a change of the
+ * wallet's stake candidates, or when its window is over.
+ */
+struct CStakeSchedule {
+    uint256 hashTip;
+    unsigned int nCandidatesVersion{0};  // CWallet::GetStakeCandidatesVersion() when computed
+    int64_t nSlotFrom{0};   // first slot checked
+    int64_t nSlotTo{0};     // last slot checked
+    int64_t nNextSlot{0};   // first slot where one of our inputs meets the target (0 if none)
+
+    bool NeedsUpdate(const CBlockIndex* pindexPrev, int64_t nCurrentSlot, unsigned int nCandidatesVersionIn) const;
+    /** Start a new window after pindexPrev, at the current slot at the earliest */
+    void SetWindow(const CBlockIndex* pindexPrev, int64_t nCurrentSlot, unsigned int nCandidatesVersionIn);
+};
+
+/** Return the first time slot in [nSlotFrom, nSlotTo] in which one of vInputs meets the target nBits on top of pindexPrev, or 0 */
+int64_t FindNextStakeSlot(const std::vector<CStakeKernelInput>& vInputs, const CBlockIndex* pindexPrev, unsigned int nBits,
+                          int64_t nSlotFrom, int64_t nSlotTo, int& nHashes);
 
 /** Get reliable pointer to current chain tip */
 CBlockIndex* GetChainTip();
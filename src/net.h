@@ -20,6 +20,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -91,6 +92,23 @@ bool StopNode();
 void SocketSendData(CNode* pnode);
 void CheckOffsetDisconnectedPeers(const CNetAddr& ip);
 
+/** Counters of the socket handler thread, reported by getnettotals */
+struct CSocketLoopStats {
+    std::string strBackend;      //!< "epoll" or "select"
+    uint64_t nWakeups;           //!< returns from the wait for socket events
+    uint64_t nIdleWakeups;       //!< wakeups by the timeout, without any socket event
+    uint64_t nEvents;            //!< socket events reported by the wait
+    int64_t nLastIterationUsec;  //!< time spent servicing the sockets after the last wakeup
+    int64_t nMaxIterationUsec;
+    int64_t nTotalIterationUsec;
+
+    CSocketLoopStats() : nWakeups(0), nIdleWakeups(0), nEvents(0), nLastIterationUsec(0), nMaxIterationUsec(0), nTotalIterationUsec(0) {}
+};
+
+void GetSocketLoopStats(CSocketLoopStats& stats);
+/** Wake the message handler thread up, e.g. when a peer's receive buffer can be processed again */
+void WakeMessageHandler();
+
 typedef int NodeId;
 
 // Signals for message handling
@@ -135,7 +153,7 @@ bool validateMasternodeIP(const std::string& addrStr);          // valid, reacha
 
 extern bool fDiscover;
 extern bool fListen;
-extern uint64_t nLocalServices;
+extern std::atomic<uint64_t> nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
@@ -297,6 +315,10 @@ public:
     // socket
     uint64_t nServices;
     SOCKET hSocket;
+    // readiness of hSocket as last reported by the socket event loop, used by the socket handler thread only
+    bool fSocketRegistered;
+    bool fSocketRecvReady;
+    bool fSocketSendReady;
     CDataStream ssSend;
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
@@ -330,6 +352,8 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // set while the peer's masternode message queue is full: its receive buffer waits for a worker to make room
+    std::atomic<bool> fDispatchPaused;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in their version message that we should not relay tx invs
@@ -468,11 +492,12 @@ public:
     }
 
 
-    void AddInventoryKnown(const CInv& inv)
+    //! Returns false if the peer already knew inv
+    bool AddInventoryKnown(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            return setInventoryKnown.insert(inv).second;
         }
     }
 
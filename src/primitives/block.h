@@ -91,6 +91,8 @@ public:
     // memory only
     mutable CScript payee;
     mutable bool fChecked;
+    mutable bool fMerkleChecked;      // set by the validation pipeline pre-checks
+    mutable bool fSignatureChecked;   // set by the validation pipeline pre-checks
 
     CBlock()
     {
@@ -118,6 +120,8 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         fChecked = false;
+        fMerkleChecked = false;
+        fSignatureChecked = false;
         payee = CScript();
         vchBlockSig.clear();
     }
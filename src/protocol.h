@@ -86,6 +86,11 @@ enum {
     // collisions and other cases where nodes may be advertising a service they
     // do not actually support. Other service bits should be allocated via the
     // BIP process.
+
+    // NODE_SCRIPT_FILTERS means the node has indexed the compact filters of the blocks' scripts
+    // up to its tip and serves them with getcfilters (see CBlockFilter). These filters are not
+    // BIP158's, so this isn't BIP157's NODE_COMPACT_FILTERS (bit 6).
+    NODE_SCRIPT_FILTERS = (1 << 24),
 };
 
 /** A CService with information about it as peer */
@@ -326,7 +326,11 @@ void SettingsBitToolWidget::importAddressFromDecKey(){
 
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
-        pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        if (pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true) < 0) {
+            ui->statusLabel_DEC->setStyleSheet("QLabel { color: red; }");
+            ui->statusLabel_DEC->setText(tr("Key added, but the rescan was aborted or another one is running. Rescan the wallet to find its transactions."));
+            return;
+        }
     }
 
     ui->statusLabel_DEC->setStyleSheet("QLabel { color: green; }");
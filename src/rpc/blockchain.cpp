@@ -6,6 +6,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "blockfilter.h"
 #include "checkpoints.h"
 #include "clientversion.h"
 #include "kernel.h"
@@ -356,16 +357,22 @@ UniValue mempoolToJSON(bool fVerbose = false)
     if (fVerbose) {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        for (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry : mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+        for (const CTxMemPoolEntry& e : mempool.mapTx) {
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
+            info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
             info.push_back(Pair("time", e.GetTime()));
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", ValueFromAmount(e.GetModFeesWithDescendants())));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", ValueFromAmount(e.GetModFeesWithAncestors())));
             const CTransaction& tx = e.GetTx();
             std::set<std::string> setDepends;
             for (const CTxIn& txin : tx.vin) {
@@ -415,10 +422,17 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "  \"transactionid\" : {       (json object)\n"
             "    \"size\" : n,             (numeric) transaction size in bytes\n"
             "    \"fee\" : n,              (numeric) transaction fee in XOS\n"
+            "    \"modifiedfee\" : n,      (numeric) transaction fee with fee deltas used for mining priority\n"
             "    \"time\" : n,             (numeric) local time transaction entered pool in seconds since 1 Jan 1970 GMT\n"
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees (see above) of in-mempool descendants (including this one)\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees (see above) of in-mempool ancestors (including this one)\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -599,6 +613,46 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     return blockheaderToJSON(pblockindex);
 }
 
+UniValue getblockfilter(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw std::runtime_error(
+            "getblockfilter \"hash\"\n"
+            "\nReturns the compact filter of the scripts of block 'hash', built with -blockfilterindex.\n"
+
+            "\nArguments:\n"
+            "1. \"hash\"          (string, required) The block hash\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) the hex-encoded filter data\n"
+            "  \"header\" : \"hex\"    (string) the hex-encoded filter header\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getblockfilter", "\"00000000000fd08c2fb661d2fcb0d49abb3a91e5f27082ce64feed3b4dede2e2\"") +
+            HelpExampleRpc("getblockfilter", "\"00000000000fd08c2fb661d2fcb0d49abb3a91e5f27082ce64feed3b4dede2e2\""));
+
+    if (!pblockfilterdb)
+        throw JSONRPCError(RPC_MISC_ERROR, "The block filter index is disabled (see -blockfilterindex)");
+
+    uint256 hash(ParseHashV(params[0], "blockhash"));
+
+    LOCK(cs_main);
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockFilter filter;
+    uint256 hashHeader;
+    if (!GetBlockFilter(mapBlockIndex[hash], filter, hashHeader))
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not found, the block filter index may still be building");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("filter", HexStr(filter.GetEncoded())));
+    ret.push_back(Pair("header", hashHeader.GetHex()));
+    return ret;
+}
+
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -666,7 +720,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -689,33 +742,34 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        // the view still returns the outputs that mempool transactions spend
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out))
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n < 0 || (unsigned int)n >= coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex* pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if ((unsigned int)coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", pindex->nHeight - coin.nHeight + 1));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", coin.IsCoinBase()));
 
     return ret;
 }
@@ -935,6 +989,107 @@ UniValue getchaintips(const UniValue& params, bool fHelp)
     return res;
 }
 
+UniValue getvalidationinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getvalidationinfo\n"
+            "\nReturns the throughput of the block validation pipeline used during initial block download.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,                 (numeric) Number of block pre-check threads (0 = pipeline disabled)\n"
+            "  \"queued\": n,                  (numeric) Blocks waiting to be connected\n"
+            "  \"pending_checks\": n,          (numeric) Blocks waiting for a pre-check thread\n"
+            "  \"blocks\": n,                  (numeric) Blocks processed by the pipeline\n"
+            "  \"active_time\": x.xxx,         (numeric) Seconds spent with a non-empty pipeline\n"
+            "  \"blocks_per_sec\": x.xx,       (numeric) Blocks processed per second of activity\n"
+            "  \"check_ms\": x.xx,             (numeric) Average pre-check time per block\n"
+            "  \"connect_ms\": x.xx,           (numeric) Average in-order validation time per block\n"
+            "  \"queue_ms\": x.xx,             (numeric) Average time a block waits before its in-order validation\n"
+            "  \"check_occupancy\": x.xx,      (numeric) Fraction of the activity time the pre-check threads were busy\n"
+            "  \"connect_occupancy\": x.xx     (numeric) Fraction of the activity time the connect thread was busy\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getvalidationinfo", "") + HelpExampleRpc("getvalidationinfo", ""));
+
+    CBlockPipelineStats stats;
+    GetBlockPipelineStats(stats);
+    const double nBlocks = std::max<double>(stats.nBlocks, 1);
+    const double nTimeActive = std::max<double>(stats.nTimeActive, 1);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("threads", stats.nThreads));
+    ret.push_back(Pair("queued", (uint64_t) stats.nQueued));
+    ret.push_back(Pair("pending_checks", (uint64_t) stats.nPendingCheck));
+    ret.push_back(Pair("blocks", stats.nBlocks));
+    ret.push_back(Pair("active_time", 0.000001 * stats.nTimeActive));
+    ret.push_back(Pair("blocks_per_sec", 1000000.0 * stats.nBlocks / nTimeActive));
+    ret.push_back(Pair("check_ms", 0.001 * stats.nTimeCheck / nBlocks));
+    ret.push_back(Pair("connect_ms", 0.001 * stats.nTimeConnect / nBlocks));
+    ret.push_back(Pair("queue_ms", 0.001 * stats.nTimeQueued / nBlocks));
+    ret.push_back(Pair("check_occupancy", stats.nTimeCheck / (nTimeActive * std::max(stats.nThreads, 1))));
+    ret.push_back(Pair("connect_occupancy", stats.nTimeConnect / nTimeActive));
+    return ret;
+}
+
+UniValue getsyncstatus(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getsyncstatus\n"
+            "\nReturns the progress and throughput of the headers-first block download.\n"
+            "Rates are averaged over the last minute.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"headers\": n,                 (numeric) Height of the best known header\n"
+            "  \"blocks\": n,                  (numeric) Height of the active chain\n"
+            "  \"initialblockdownload\": b,    (boolean) Whether the node is in initial block download\n"
+            "  \"headers_sync_peer\": n,       (numeric) Id of the peer the headers are synced from, -1 if none\n"
+            "  \"download_peers\": n,          (numeric) Peers with blocks in flight\n"
+            "  \"blocks_in_flight\": n,        (numeric) Blocks requested and not received yet\n"
+            "  \"blocks_awaiting_parent\": n,  (numeric) Blocks downloaded ahead of their parent\n"
+            "  \"bytes_awaiting_parent\": n,   (numeric) Size of these blocks\n"
+            "  \"headers_received\": n,        (numeric) Headers accepted since startup\n"
+            "  \"blocks_downloaded\": n,       (numeric) Blocks received from peers since startup\n"
+            "  \"blocks_connected\": n,        (numeric) Blocks connected to the active chain since startup\n"
+            "  \"stalling_peers\": n,          (numeric) Peers disconnected for stalling the download window\n"
+            "  \"headers_timeouts\": n,        (numeric) Headers sync peers dropped for being too slow\n"
+            "  \"headers_per_sec\": x.xx,      (numeric) Headers accepted per second\n"
+            "  \"download_blocks_per_sec\": x.xx, (numeric) Blocks received per second\n"
+            "  \"connect_blocks_per_sec\": x.xx,  (numeric) Blocks connected per second\n"
+            "  \"connect_tx_per_sec\": x.xx      (numeric) Transactions connected per second\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getsyncstatus", "") + HelpExampleRpc("getsyncstatus", ""));
+
+    CSyncStatus status;
+    GetSyncStatus(status);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("headers", status.nHeaderHeight));
+    ret.push_back(Pair("blocks", status.nBlockHeight));
+    ret.push_back(Pair("initialblockdownload", IsInitialBlockDownload()));
+    ret.push_back(Pair("headers_sync_peer", status.nHeadersSyncPeer));
+    ret.push_back(Pair("download_peers", status.nDownloadPeers));
+    ret.push_back(Pair("blocks_in_flight", (uint64_t) status.nBlocksInFlight));
+    ret.push_back(Pair("blocks_awaiting_parent", (uint64_t) status.nBlocksAwaitingParent));
+    ret.push_back(Pair("bytes_awaiting_parent", (uint64_t) status.nBytesAwaitingParent));
+    ret.push_back(Pair("headers_received", status.nHeaders));
+    ret.push_back(Pair("blocks_downloaded", status.nBlocksDownloaded));
+    ret.push_back(Pair("blocks_connected", status.nBlocksConnected));
+    ret.push_back(Pair("stalling_peers", status.nStallers));
+    ret.push_back(Pair("headers_timeouts", status.nHeadersTimeouts));
+    ret.push_back(Pair("headers_per_sec", status.dHeadersRate));
+    ret.push_back(Pair("download_blocks_per_sec", status.dDownloadRate));
+    ret.push_back(Pair("connect_blocks_per_sec", status.dConnectRate));
+    ret.push_back(Pair("connect_tx_per_sec", status.dTxConnectRate));
+    return ret;
+}
+
 UniValue getfeeinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -980,7 +1135,10 @@ UniValue mempoolInfoToJSON()
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
-    //ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
 
     return ret;
 }
@@ -996,6 +1154,9 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee per kB a full mempool currently requires\n"
             "}\n"
 
             "\nExamples:\n" +
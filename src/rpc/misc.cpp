@@ -9,12 +9,17 @@
 #include "clientversion.h"
 #include "init.h"
 #include "main.h"
+#include "masternode-budget.h"
+#include "masternode-payments.h"
 #include "masternode-sync.h"
+#include "masternodeman.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "spork.h"
 #include "timedata.h"
+#include "txmempool.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet/wallet.h"
@@ -562,6 +567,86 @@ UniValue verifymessage(const UniValue& params, bool fHelp)
     return (pubkey.GetID() == keyID);
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the signature cache.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"bytes\": xxxxx        (numeric) Memory used by the cache\n"
+            "  \"entries\": xxxxx      (numeric) Number of signatures the cache can hold\n"
+            "  \"hits\": xxxxx         (numeric) Lookups of a cached signature\n"
+            "  \"misses\": xxxxx       (numeric) Lookups of a signature not in the cache\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getsigcacheinfo", "") + HelpExampleRpc("getsigcacheinfo", ""));
+
+    CSignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bytes", (uint64_t) stats.nBytes));
+    ret.push_back(Pair("entries", (uint64_t) stats.nEntries));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    return ret;
+}
+
+UniValue getmemoryinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getmemoryinfo\n"
+            "\nReturns the approximate heap memory used by the node's main data structures, in bytes.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"mempool\": xxxxx        (numeric) Transaction memory pool\n"
+            "  \"coinscache\": xxxxx     (numeric) In-memory UTXO cache (bounded by -dbcache)\n"
+            "  \"blockindex\": xxxxx     (numeric) Block index and active chain\n"
+            "  \"sigcache\": xxxxx       (numeric) Signature cache\n"
+            "  \"masternodes\": xxxxx    (numeric) Masternode list and seen broadcasts/pings\n"
+            "  \"mnpayments\": xxxxx     (numeric) Masternode payment votes and block payees\n"
+            "  \"budget\": xxxxx         (numeric) Budget proposals, finalized budgets and votes\n"
+            "  \"total\": xxxxx          (numeric) Sum of the above\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getmemoryinfo", "") + HelpExampleRpc("getmemoryinfo", ""));
+
+    CSignatureCacheStats sigcache;
+    GetSignatureCacheStats(sigcache);
+
+    size_t nCoinsCache = 0;
+    {
+        LOCK(cs_main);
+        nCoinsCache = pcoinsTip->DynamicMemoryUsage();
+    }
+
+    const std::vector<std::pair<std::string, size_t> > vUsage = {
+        {"mempool", mempool.DynamicMemoryUsage()},
+        {"coinscache", nCoinsCache},
+        {"blockindex", BlockIndexDynamicMemoryUsage()},
+        {"sigcache", sigcache.nBytes},
+        {"masternodes", mnodeman.DynamicMemoryUsage()},
+        {"mnpayments", masternodePayments.DynamicMemoryUsage()},
+        {"budget", budget.DynamicMemoryUsage()},
+    };
+
+    UniValue ret(UniValue::VOBJ);
+    uint64_t nTotal = 0;
+    for (const auto& usage : vUsage) {
+        ret.push_back(Pair(usage.first, (uint64_t) usage.second));
+        nTotal += usage.second;
+    }
+    ret.push_back(Pair("total", nTotal));
+    return ret;
+}
+
 UniValue setmocktime(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -352,7 +352,16 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"socketloop\": {        (json object) Socket handler thread\n"
+            "    \"backend\": \"xxxx\",          (string) How sockets are waited on (epoll or select)\n"
+            "    \"wakeups\": n,                 (numeric) Number of times the thread woke up\n"
+            "    \"idlewakeups\": n,             (numeric) Wakeups by timeout, without any socket event\n"
+            "    \"events\": n,                  (numeric) Number of socket events\n"
+            "    \"lastiterationmicros\": n,     (numeric) Time spent servicing sockets after the last wakeup\n"
+            "    \"maxiterationmicros\": n,      (numeric) Longest time spent servicing sockets after a wakeup\n"
+            "    \"avgiterationmicros\": n       (numeric) Average time spent servicing sockets after a wakeup\n"
+            "  }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -362,9 +371,59 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    CSocketLoopStats stats;
+    GetSocketLoopStats(stats);
+    UniValue socketLoop(UniValue::VOBJ);
+    socketLoop.push_back(Pair("backend", stats.strBackend));
+    socketLoop.push_back(Pair("wakeups", stats.nWakeups));
+    socketLoop.push_back(Pair("idlewakeups", stats.nIdleWakeups));
+    socketLoop.push_back(Pair("events", stats.nEvents));
+    socketLoop.push_back(Pair("lastiterationmicros", stats.nLastIterationUsec));
+    socketLoop.push_back(Pair("maxiterationmicros", stats.nMaxIterationUsec));
+    socketLoop.push_back(Pair("avgiterationmicros", stats.nWakeups ? stats.nTotalIterationUsec / (int64_t)stats.nWakeups : 0));
+    obj.push_back(Pair("socketloop", socketLoop));
     return obj;
 }
 
+UniValue getmessagequeueinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "getmessagequeueinfo\n"
+            "\nReturns the queue of the masternode, payment, budget and spork messages waiting for their worker threads.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,                 (numeric) Number of worker threads (0 = messages processed by the message handler thread)\n"
+            "  \"peers\": n,                   (numeric) Peers with messages waiting or being processed\n"
+            "  \"queued\": n,                  (numeric) Messages waiting for a worker\n"
+            "  \"max_queued\": n,              (numeric) Highest number of messages waiting at once\n"
+            "  \"processed\": n,               (numeric) Messages processed by the workers\n"
+            "  \"deferred\": n,                (numeric) Times a peer's messages were held back because its queue was full\n"
+            "  \"process_ms\": x.xx,           (numeric) Average processing time per message\n"
+            "  \"queue_ms\": x.xx              (numeric) Average time a message waits for a worker\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getmessagequeueinfo", "") + HelpExampleRpc("getmessagequeueinfo", ""));
+
+    CMessageQueueStats stats;
+    GetMasternodeMessageStats(stats);
+    const double nProcessed = std::max<double>(stats.nProcessed, 1);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("threads", stats.nThreads));
+    ret.push_back(Pair("peers", (uint64_t) stats.nPeers));
+    ret.push_back(Pair("queued", (uint64_t) stats.nQueued));
+    ret.push_back(Pair("max_queued", (uint64_t) stats.nMaxQueued));
+    ret.push_back(Pair("processed", stats.nProcessed));
+    ret.push_back(Pair("deferred", stats.nDeferred));
+    ret.push_back(Pair("process_ms", 0.001 * stats.nTimeProcess / nProcessed));
+    ret.push_back(Pair("queue_ms", 0.001 * stats.nTimeQueued / nProcessed));
+    return ret;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -429,7 +488,7 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("version", CLIENT_VERSION));
     obj.push_back(Pair("subversion",    strSubVersion));
     obj.push_back(Pair("protocolversion", PROTOCOL_VERSION));
-    obj.push_back(Pair("localservices", strprintf("%016x", nLocalServices)));
+    obj.push_back(Pair("localservices", strprintf("%016x", nLocalServices.load())));
     obj.push_back(Pair("timeoffset", GetTimeOffset()));
     obj.push_back(Pair("connections", (int)vNodes.size()));
     obj.push_back(Pair("networks", GetNetworksInfo()));
@@ -6,13 +6,16 @@
 
 #include "sigcache.h"
 
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string.h>
 
 namespace {
 
@@ -20,62 +23,137 @@ namespace {
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Entries are salted hashes of (signature hash, public key, signature), kept
+ * in a fixed-size table of 64-byte buckets holding two entries each.
+ * Lookups and insertions take no lock: the four words of an entry are read
+ * and written with relaxed atomics. Two insertions racing on one slot may
+ * leave a torn entry behind, which only ever causes misses (matching it would
+ * take a 64-bit collision of the salted hash).
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const size_t WORDS_PER_ENTRY = 4;
+    static const size_t ENTRIES_PER_BUCKET = 2;
+    static const size_t WORDS_PER_BUCKET = WORDS_PER_ENTRY * ENTRIES_PER_BUCKET;
+
+    //! Entries are SHA256(nonce || nonce || hash || pubkey || sig), the nonce filling the first block
+    CSHA256 saltedHasher;
+    std::unique_ptr<std::atomic<uint64_t>[]> vData;
+    std::atomic<uint64_t>* table;   //! vData aligned on 64 bytes
+    size_t nBucketMask;
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+
+    void ComputeEntry(uint64_t entry[WORDS_PER_ENTRY], const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+    {
+        uint256 hashEntry;
+        CSHA256(saltedHasher).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(hashEntry.begin());
+        memcpy(entry, hashEntry.begin(), 32);
+    }
+
+    std::atomic<uint64_t>* GetBucket(const uint64_t entry[WORDS_PER_ENTRY]) const
+    {
+        return table + (entry[0] & nBucketMask) * WORDS_PER_BUCKET;
+    }
+
+    static bool Matches(const std::atomic<uint64_t>* slot, const uint64_t entry[WORDS_PER_ENTRY])
+    {
+        for (size_t i = 0; i < WORDS_PER_ENTRY; i++) {
+            if (slot[i].load(std::memory_order_relaxed) != entry[i])
+                return false;
+        }
+        return true;
+    }
 
 public:
+    CSignatureCache() : nHits(0), nMisses(0)
+    {
+        uint256 nonce = GetRandHash();
+        saltedHasher.Write(nonce.begin(), 32).Write(nonce.begin(), 32);
+
+        const size_t nBudget = GetSignatureCacheBudget();
+        const uintptr_t nAlign = WORDS_PER_BUCKET * sizeof(uint64_t);
+        if (nBudget < nAlign) {
+            // -sigcachemb=0 (or -maxsigcachesize=0) disables the cache
+            table = NULL;
+            nBucketMask = 0;
+            LogPrintf("Signature cache disabled\n");
+            return;
+        }
+        // largest power of two number of buckets fitting in the budget
+        size_t nBuckets = 1;
+        while (nBuckets * 2 * nAlign <= nBudget)
+            nBuckets *= 2;
+        nBucketMask = nBuckets - 1;
+        vData.reset(new std::atomic<uint64_t>[nBuckets * WORDS_PER_BUCKET + WORDS_PER_BUCKET]());
+        table = reinterpret_cast<std::atomic<uint64_t>*>((reinterpret_cast<uintptr_t>(vData.get()) + nAlign - 1) & ~(nAlign - 1));
+        LogPrintf("Using %zu MiB for signature cache (of %zu MiB allowed), able to store %zu elements\n",
+                  (nBuckets * nAlign) >> 20, nBudget >> 20, nBuckets * ENTRIES_PER_BUCKET);
+    }
+
     bool
     Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
+        if (table == NULL) {
+            nMisses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        uint64_t entry[WORDS_PER_ENTRY];
+        ComputeEntry(entry, hash, vchSig, pubKey);
+        const std::atomic<uint64_t>* bucket = GetBucket(entry);
+        for (size_t i = 0; i < ENTRIES_PER_BUCKET; i++) {
+            if (Matches(bucket + i * WORDS_PER_ENTRY, entry)) {
+                nHits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        nMisses.fetch_add(1, std::memory_order_relaxed);
         return false;
     }
 
     void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::set<sigdata_type>::iterator it = setValid.lower_bound(sigdata_type(randomHash));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+        if (table == NULL)
+            return;
+        uint64_t entry[WORDS_PER_ENTRY];
+        ComputeEntry(entry, hash, vchSig, pubKey);
+        std::atomic<uint64_t>* bucket = GetBucket(entry);
+        // Prefer an empty slot, else evict the one picked by the (salted, so
+        // unpredictable) entry hash.
+        size_t nSlot = entry[1] % ENTRIES_PER_BUCKET;
+        for (size_t i = 0; i < ENTRIES_PER_BUCKET; i++) {
+            if (bucket[i * WORDS_PER_ENTRY].load(std::memory_order_relaxed) == 0) {
+                nSlot = i;
+                break;
+            }
         }
+        std::atomic<uint64_t>* slot = bucket + nSlot * WORDS_PER_ENTRY;
+        for (size_t i = 0; i < WORDS_PER_ENTRY; i++)
+            slot[i].store(entry[i], std::memory_order_relaxed);
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    void GetStats(CSignatureCacheStats& stats) const
+    {
+        stats.nEntries = table ? (nBucketMask + 1) * ENTRIES_PER_BUCKET : 0;
+        stats.nBytes = stats.nEntries * WORDS_PER_ENTRY * sizeof(uint64_t);
+        stats.nHits = nHits.load(std::memory_order_relaxed);
+        stats.nMisses = nMisses.load(std::memory_order_relaxed);
     }
 };
 
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache;
+    return signatureCache;
+}
+
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
@@ -87,3 +165,19 @@ bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsig
         signatureCache.Set(sighash, vchSig, pubkey);
     return true;
 }
+
+void GetSignatureCacheStats(CSignatureCacheStats& stats)
+{
+    GetSignatureCache().GetStats(stats);
+}
+
+size_t GetSignatureCacheBudget()
+{
+    const int64_t nMaxBytes = MAX_SIG_CACHE_MB << 20;
+    if (mapArgs.count("-maxsigcachesize")) {
+        const int64_t nEntries = std::max((int64_t)0, GetArg("-maxsigcachesize", 0));
+        return std::min(nEntries, nMaxBytes / (int64_t)SIG_CACHE_ENTRY_BYTES) * SIG_CACHE_ENTRY_BYTES;
+    }
+    const int64_t nMB = std::min(std::max((int64_t)0, GetArg("-sigcachemb", DEFAULT_SIG_CACHE_MB)), MAX_SIG_CACHE_MB);
+    return (size_t)nMB << 20;
+}
@@ -10,8 +10,22 @@
 
 #include <vector>
 
+/** -sigcachemb default: memory of the signature cache, in MiB */
+static const int64_t DEFAULT_SIG_CACHE_MB = 32;
+/** Maximum -sigcachemb allowed, in MiB */
+static const int64_t MAX_SIG_CACHE_MB = 16384;
+/** Memory of an entry of the signature cache, in bytes (what the deprecated -maxsigcachesize counts) */
+static const size_t SIG_CACHE_ENTRY_BYTES = 32;
+
 class CPubKey;
 
+struct CSignatureCacheStats {
+    size_t nBytes{0};       //! memory used by the table
+    size_t nEntries{0};     //! capacity of the table
+    uint64_t nHits{0};
+    uint64_t nMisses{0};
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
@@ -23,4 +37,11 @@ public:
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+void GetSignatureCacheStats(CSignatureCacheStats& stats);
+/**
+ * Memory budget of the signature cache in bytes, 0 to disable it: -sigcachemb, unless the
+ * deprecated -maxsigcachesize (a number of entries) is given
+ */
+size_t GetSignatureCacheBudget();
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
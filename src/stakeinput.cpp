@@ -31,10 +31,12 @@ bool CPivStake::InitFromTxIn(const CTxIn& txin)
     return true;
 }
 
-bool CPivStake::SetPrevout(CTransaction txPrev, unsigned int n)
+bool CPivStake::SetPrevout(CTransaction txPrev, unsigned int n, CBlockIndex* pindexFromIn)
 {
     this->txFrom = txPrev;
     this->nPosition = n;
+    // the caller may already know the block of txPrev (e.g. the wallet)
+    if (pindexFromIn) this->pindexFrom = pindexFromIn;
     return true;
 }
 
@@ -41,7 +41,7 @@ public:
     CPivStake() {}
 
     bool InitFromTxIn(const CTxIn& txin);
-    bool SetPrevout(CTransaction txPrev, unsigned int n);
+    bool SetPrevout(CTransaction txPrev, unsigned int n, CBlockIndex* pindexFromIn = nullptr);
 
     CBlockIndex* GetIndexFrom() override;
     bool GetTxFrom(CTransaction& tx) const override;
@@ -0,0 +1,203 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for the headers-first block download
+//
+
+#include "checkpoints.h"
+#include "main.h"
+#include "net.h"
+#include "pow.h"
+#include "protocol.h"
+#include "test/test_oasis.h"
+
+#include <deque>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockdownload_tests, TestingSetup)
+
+// A chain of valid proof-of-work headers building on pindexFrom. The block
+// indexes mirroring it are only used to compute the difficulty of each header.
+struct HeaderChain {
+    std::vector<CBlock> vHeaders;
+    std::deque<uint256> vHashes;
+    std::vector<std::unique_ptr<CBlockIndex> > vIndex;
+
+    HeaderChain(const CBlockIndex* pindexFrom, int nCount, uint32_t nNonce)
+    {
+        const CBlockIndex* pprev = pindexFrom;
+        for (int i = 0; i < nCount; i++) {
+            CBlock block;
+            block.nVersion = pprev->nHeight + 1 >= Params().GetConsensus().height_start_ZC ? 4 : 3;
+            block.hashPrevBlock = pprev->GetBlockHash();
+            block.nTime = pprev->nTime + 60;
+            block.nNonce = nNonce;
+            block.nBits = GetNextWorkRequired(pprev, &block);
+            vHeaders.push_back(block);
+
+            CBlockIndex* pindex = new CBlockIndex(block);
+            vHashes.push_back(block.GetHash());
+            pindex->phashBlock = &vHashes.back();
+            pindex->pprev = const_cast<CBlockIndex*>(pprev);
+            pindex->nHeight = pprev->nHeight + 1;
+            vIndex.emplace_back(pindex);
+            pprev = pindex;
+        }
+    }
+
+    std::vector<CBlock> Slice(size_t nBegin, size_t nEnd) const
+    {
+        return std::vector<CBlock>(vHeaders.begin() + nBegin, vHeaders.begin() + nEnd);
+    }
+};
+
+// Make a peer whose sent messages pile up in vSendMsg: the first slot keeps
+// the optimistic write from reaching the (invalid) socket.
+static CNode* MakePeer(uint32_t nAddr)
+{
+    struct in_addr s;
+    s.s_addr = nAddr;
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(CService(CNetAddr(s), Params().GetDefaultPort())), "", true);
+    pnode->nVersion = PROTOCOL_VERSION;
+    pnode->nStartingHeight = 2000;
+    pnode->vSendMsg.push_back(CSerializeData(CMessageHeader::HEADER_SIZE));
+    return pnode;
+}
+
+static void ReceiveHeaders(CNode* pnode, const std::vector<CBlock>& vHeaders)
+{
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload << vHeaders;
+    CMessageHeader hdr("headers", ssPayload.size());
+    const uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hdr;
+    ss += ssPayload;
+    LOCK(pnode->cs_vRecvMsg);
+    BOOST_CHECK(pnode->ReceiveMsgBytes(&ss[0], ss.size()));
+    ProcessMessages(pnode);
+    BOOST_CHECK(pnode->vRecvMsg.empty());
+}
+
+static void RunSendMessages(CNode* pnode)
+{
+    LOCK(pnode->cs_vSend);
+    SendMessages(pnode, false);
+}
+
+// The blocks requested from pnode, and how many getheaders it was sent
+static std::vector<uint256> GetBlockRequests(CNode* pnode, int& nGetHeaders)
+{
+    std::vector<uint256> vRequested;
+    nGetHeaders = 0;
+    LOCK(pnode->cs_vSend);
+    for (const CSerializeData& data : pnode->vSendMsg) {
+        CDataStream ss(data.begin(), data.end(), SER_NETWORK, PROTOCOL_VERSION);
+        if (ss.size() < CMessageHeader::HEADER_SIZE) continue;
+        CMessageHeader hdr;
+        ss >> hdr;
+        if (hdr.GetCommand() == "getheaders") nGetHeaders++;
+        if (hdr.GetCommand() != "getdata") continue;
+        std::vector<CInv> vInv;
+        ss >> vInv;
+        for (const CInv& inv : vInv)
+            if (inv.type == MSG_BLOCK) vRequested.push_back(inv.hash);
+    }
+    return vRequested;
+}
+
+static bool HaveHeader(const CBlock& header)
+{
+    LOCK(cs_main);
+    return mapBlockIndex.count(header.GetHash()) > 0;
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_unproven_headers_cap)
+{
+    const bool fCheckpoints = Checkpoints::fEnabled;
+    Checkpoints::fEnabled = false;
+    const CBlockIndex* pindexGenesis = chainActive.Genesis();
+    const HeaderChain chain(pindexGenesis, MAX_UNPROVEN_HEADERS_PER_PEER + 20, 1);
+    std::unique_ptr<CNode> peer1(MakePeer(0xa0b0d001));
+    std::unique_ptr<CNode> peer2(MakePeer(0xa0b0d002));
+
+    // a peer can add headers ahead of their blocks up to the cap
+    size_t nSent = 0;
+    while (nSent < MAX_UNPROVEN_HEADERS_PER_PEER) {
+        const size_t nNext = std::min(nSent + MAX_HEADERS_RESULTS, MAX_UNPROVEN_HEADERS_PER_PEER);
+        ReceiveHeaders(peer1.get(), chain.Slice(nSent, nNext));
+        nSent = nNext;
+    }
+    BOOST_CHECK(HaveHeader(chain.vHeaders[nSent - 1]));
+
+    // the next ones are ignored, without punishing the peer
+    ReceiveHeaders(peer1.get(), chain.Slice(nSent, nSent + 10));
+    BOOST_CHECK(!HaveHeader(chain.vHeaders[nSent]));
+    CNodeStateStats nodeStats;
+    BOOST_CHECK(GetNodeStateStats(peer1->GetId(), nodeStats));
+    BOOST_CHECK_EQUAL(nodeStats.nMisbehavior, 0);
+
+    // the cap is per peer
+    ReceiveHeaders(peer2.get(), chain.Slice(nSent, nSent + 10));
+    BOOST_CHECK(HaveHeader(chain.vHeaders[nSent + 9]));
+
+    Checkpoints::fEnabled = fCheckpoints;
+}
+
+BOOST_AUTO_TEST_CASE(blockdownload_bogus_headers_no_stall)
+{
+    const bool fCheckpoints = Checkpoints::fEnabled;
+    Checkpoints::fEnabled = false;
+    const CBlockIndex* pindexGenesis = chainActive.Genesis();
+    const HeaderChain honest(pindexGenesis, 40, 1);
+    const HeaderChain bogus(pindexGenesis, 1500, 2);
+    std::unique_ptr<CNode> peerSilent(MakePeer(0xa0b0d003));
+    std::unique_ptr<CNode> peerHonest(MakePeer(0xa0b0d004));
+    std::unique_ptr<CNode> peerBogus(MakePeer(0xa0b0d005));
+
+    ReceiveHeaders(peerHonest.get(), honest.vHeaders);
+    ReceiveHeaders(peerBogus.get(), bogus.vHeaders);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(pindexBestHeader->GetBlockHash() == bogus.vHashes.back());
+    }
+
+    // the checkpoints keep the node in initial block download
+    Checkpoints::fEnabled = true;
+    BOOST_CHECK(IsInitialBlockDownload());
+
+    // the silent peer is the headers sync one
+    RunSendMessages(peerSilent.get());
+    RunSendMessages(peerHonest.get());
+    RunSendMessages(peerBogus.get());
+
+    // blocks are only requested along the chain each peer announced
+    int nGetHeaders = 0;
+    BOOST_CHECK(GetBlockRequests(peerSilent.get(), nGetHeaders).empty());
+    BOOST_CHECK_EQUAL(nGetHeaders, 1);
+    const std::vector<uint256> vRequested = GetBlockRequests(peerHonest.get(), nGetHeaders);
+    BOOST_CHECK_EQUAL(vRequested.size(), honest.vHeaders.size());
+    for (const uint256& hash : vRequested)
+        BOOST_CHECK(std::find(honest.vHashes.begin(), honest.vHashes.end(), hash) != honest.vHashes.end());
+    // the honest peer is asked which part of the best header chain it has
+    BOOST_CHECK_EQUAL(nGetHeaders, 1);
+    BOOST_CHECK(!GetBlockRequests(peerBogus.get(), nGetHeaders).empty());
+
+    // the bogus blocks never arrive: the honest peers aren't blamed for it
+    MilliSleep((BLOCK_STALLING_TIMEOUT + 1) * 1000);
+    for (int i = 0; i < 2; i++) {
+        RunSendMessages(peerSilent.get());
+        RunSendMessages(peerHonest.get());
+        RunSendMessages(peerBogus.get());
+    }
+    BOOST_CHECK(!peerSilent->fDisconnect);
+    BOOST_CHECK(!peerHonest->fDisconnect);
+
+    Checkpoints::fEnabled = fCheckpoints;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
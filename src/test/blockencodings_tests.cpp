@@ -0,0 +1,128 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "consensus/merkle.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "test/test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, BasicTestingSetup)
+
+static CMutableTransaction SpendingTx(const uint256& hashPrev, uint32_t n)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev, n);
+    tx.vin[0].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 11000LL;
+    return tx;
+}
+
+/** A proof-of-stake block: coinbase, coinstake and three spends */
+static CBlock StakedBlock()
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1600000000;
+    block.nAccumulatorCheckpoint = InsecureRand256();
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 42 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].SetEmpty();
+    block.vtx.push_back(coinbase);
+
+    CMutableTransaction coinstake = SpendingTx(InsecureRand256(), 0);
+    coinstake.vout.resize(2);
+    coinstake.vout[0].SetEmpty();
+    coinstake.vout[1].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    coinstake.vout[1].nValue = 50000LL;
+    block.vtx.push_back(coinstake);
+
+    for (uint32_t i = 0; i < 3; i++)
+        block.vtx.push_back(SpendingTx(InsecureRand256(), i));
+
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    block.vchBlockSig = std::vector<unsigned char>(72, 0x30);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(blockencodings_reconstruct)
+{
+    SeedInsecureRand();
+    CBlock block = StakedBlock();
+    BOOST_CHECK(block.IsProofOfStake());
+
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(block.vtx[2].GetHash(), CTxMemPoolEntry(block.vtx[2], 0, 0, 0.0, 1));
+    pool.addUnchecked(block.vtx[4].GetHash(), CTxMemPoolEntry(block.vtx[4], 0, 0, 0.0, 1));
+
+    // over the wire
+    CBlockHeaderAndShortTxIDs cmpctblockSent(block);
+    BOOST_CHECK_EQUAL(cmpctblockSent.vPrefilledTxn.size(), 2U);
+    BOOST_CHECK_EQUAL(cmpctblockSent.vShortTxIDs.size(), 3U);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblockSent;
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    ss >> cmpctblock;
+    BOOST_CHECK(cmpctblock.header.GetHash() == block.GetHash());
+    BOOST_CHECK(cmpctblock.vchBlockSig == block.vchBlockSig);
+    BOOST_CHECK_EQUAL(cmpctblock.GetShortID(block.vtx[3].GetHash()), cmpctblockSent.GetShortID(block.vtx[3].GetHash()));
+
+    PartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK(partialBlock.InitData(cmpctblock, pool) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialBlock.GetPrefilledCount(), 2U);
+    BOOST_CHECK_EQUAL(partialBlock.GetMempoolCount(), 2U);
+    std::vector<uint16_t> vMissing = partialBlock.GetMissing();
+    BOOST_REQUIRE_EQUAL(vMissing.size(), 1U);
+    BOOST_CHECK_EQUAL(vMissing[0], 3);
+
+    // the requested positions survive their differential encoding
+    CBlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    req.vIndexes = {1, 3, 4, 300};
+    CDataStream ssReq(SER_NETWORK, PROTOCOL_VERSION);
+    ssReq << req;
+    BOOST_CHECK_EQUAL(ssReq.size(), req.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION));
+    CBlockTransactionsRequest reqRead;
+    ssReq >> reqRead;
+    BOOST_CHECK(reqRead.vIndexes == req.vIndexes);
+
+    // a wrong transaction is caught by the merkle root, a missing one is the peer's fault
+    CBlock blockRebuilt;
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, std::vector<CTransaction>(1, block.vtx[2])) == READ_STATUS_FAILED);
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, std::vector<CTransaction>()) == READ_STATUS_INVALID);
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, std::vector<CTransaction>(1, block.vtx[3])) == READ_STATUS_OK);
+    BOOST_CHECK(blockRebuilt.GetHash() == block.GetHash());
+    BOOST_CHECK(blockRebuilt.vchBlockSig == block.vchBlockSig);
+    BOOST_CHECK(blockRebuilt.nAccumulatorCheckpoint == block.nAccumulatorCheckpoint);
+    BOOST_CHECK(blockRebuilt.IsProofOfStake());
+}
+
+BOOST_AUTO_TEST_CASE(blockencodings_invalid)
+{
+    SeedInsecureRand();
+    CBlock block = StakedBlock();
+    CTxMemPool pool(CFeeRate(0));
+
+    // a prefilled transaction past the end of the block
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    cmpctblock.vPrefilledTxn[1].index = 10;
+    PartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK(partialBlock.InitData(cmpctblock, pool) == READ_STATUS_INVALID);
+
+    // two transactions with the same short ID can't be rebuilt
+    CBlockHeaderAndShortTxIDs cmpctblockDup(block);
+    cmpctblockDup.vShortTxIDs[1] = cmpctblockDup.vShortTxIDs[0];
+    PartiallyDownloadedBlock partialBlockDup;
+    BOOST_CHECK(partialBlockDup.InitData(cmpctblockDup, pool) == READ_STATUS_FAILED);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
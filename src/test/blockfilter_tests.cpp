@@ -0,0 +1,122 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+#include "key.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "test/test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static BlockFilterElement Element(const CScript& script)
+{
+    return BlockFilterElement(script.begin(), script.end());
+}
+
+static CScript RandomP2PKH()
+{
+    return GetScriptForDestination(CKeyID(uint160(InsecureRandBytes(20))));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_match)
+{
+    // false positives are possible, a fixed seed keeps the non-members below from hitting one
+    SeedInsecureRand(true);
+
+    BlockFilterElementSet included, excluded;
+    for (int i = 0; i < 100; i++) {
+        included.insert(Element(RandomP2PKH()));
+        excluded.insert(Element(RandomP2PKH()));
+    }
+
+    const CBlockFilter filter(InsecureRand256(), included);
+    BOOST_CHECK_EQUAL(filter.GetElementCount(), included.size());
+    for (const BlockFilterElement& element : included)
+        BOOST_CHECK(filter.Match(element));
+    BOOST_CHECK(filter.MatchAny(included));
+
+    // a false positive is 1 in BLOCK_FILTER_M per element, so none of these should match
+    for (const BlockFilterElement& element : excluded)
+        BOOST_CHECK(!filter.Match(element));
+    BOOST_CHECK(!filter.MatchAny(excluded));
+
+    BlockFilterElementSet mixed = excluded;
+    mixed.insert(*included.begin());
+    BOOST_CHECK(filter.MatchAny(mixed));
+
+    // an empty filter matches nothing
+    const CBlockFilter empty(InsecureRand256(), BlockFilterElementSet());
+    BOOST_CHECK(!empty.MatchAny(included));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_script_elements)
+{
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(true);
+    const CKeyID id1 = key1.GetPubKey().GetID();
+    const CKeyID id2 = key2.GetPubKey().GetID();
+
+    // P2PK, P2CS and multisig add the P2PKH script of their keys
+    BlockFilterElementSet elements;
+    const CScript p2pk = GetScriptForRawPubKey(key1.GetPubKey());
+    AddScriptFilterElements(p2pk, elements);
+    BOOST_CHECK_EQUAL(elements.size(), 2);
+    BOOST_CHECK(elements.count(Element(p2pk)));
+    BOOST_CHECK(elements.count(Element(GetScriptForDestination(id1))));
+
+    elements.clear();
+    const CScript p2cs = GetScriptForStakeDelegation(id1, id2);
+    AddScriptFilterElements(p2cs, elements);
+    BOOST_CHECK_EQUAL(elements.size(), 3);
+    BOOST_CHECK(elements.count(Element(GetScriptForDestination(id1))));
+    BOOST_CHECK(elements.count(Element(GetScriptForDestination(id2))));
+
+    elements.clear();
+    const CScript multisig = GetScriptForMultisig(1, {key1.GetPubKey(), key2.GetPubKey()});
+    AddScriptFilterElements(multisig, elements);
+    BOOST_CHECK_EQUAL(elements.size(), 3);
+    BOOST_CHECK(elements.count(Element(GetScriptForDestination(id2))));
+
+    // P2PKH adds only itself, empty and unspendable scripts nothing
+    elements.clear();
+    AddScriptFilterElements(GetScriptForDestination(id1), elements);
+    BOOST_CHECK_EQUAL(elements.size(), 1);
+    AddScriptFilterElements(CScript(), elements);
+    AddScriptFilterElements(CScript() << OP_RETURN << ToByteVector(id2), elements);
+    BOOST_CHECK_EQUAL(elements.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_serialization)
+{
+    SeedInsecureRand();
+
+    BlockFilterElementSet elements;
+    for (int i = 0; i < 20; i++)
+        elements.insert(Element(RandomP2PKH()));
+    const CBlockFilter filter(InsecureRand256(), elements);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << filter;
+    CBlockFilter filter2;
+    ss >> filter2;
+
+    BOOST_CHECK(filter2.GetBlockHash() == filter.GetBlockHash());
+    BOOST_CHECK(filter2.GetEncoded() == filter.GetEncoded());
+    BOOST_CHECK(filter2.MatchAny(elements));
+    for (const BlockFilterElement& element : elements)
+        BOOST_CHECK(filter2.Match(element));
+
+    // the header commits to the filter and to the previous header
+    const uint256 hashPrevHeader = InsecureRand256();
+    BOOST_CHECK(filter2.ComputeHeader(hashPrevHeader) == filter.ComputeHeader(hashPrevHeader));
+    BOOST_CHECK(filter.ComputeHeader(hashPrevHeader) != filter.ComputeHeader(uint256()));
+    const CBlockFilter other(filter.GetBlockHash(), BlockFilterElementSet());
+    BOOST_CHECK(other.ComputeHeader(hashPrevHeader) != filter.ComputeHeader(hashPrevHeader));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
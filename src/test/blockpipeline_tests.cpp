@@ -0,0 +1,145 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for the block validation pipeline
+//
+
+#include "blocksignature.h"
+#include "checkpoints.h"
+#include "consensus/merkle.h"
+#include "main.h"
+#include "net.h"
+#include "protocol.h"
+#include "test/test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockpipeline_tests, TestingSetup)
+
+// A signed proof-of-stake block building on hashPrev, with nTxs padding
+// transactions. It fails CheckBlock either on the merkle root (found by the
+// pre-check threads) or, if fBadMerkle is false, on a second coinbase (found
+// only by the in-order validation).
+static CBlock CreateBadStakeBlock(const CKey& key, const uint256& hashPrev, int nTxs, bool fBadMerkle)
+{
+    CBlock block;
+    block.nVersion = 5;
+    block.hashPrevBlock = hashPrev;
+    block.nTime = GetTime();
+
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].prevout.SetNull();
+    txCoinbase.vin[0].scriptSig = CScript() << InsecureRand32();
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].SetEmpty();
+    block.vtx.push_back(txCoinbase);
+
+    CMutableTransaction txCoinStake;
+    txCoinStake.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+    txCoinStake.vout.resize(2);
+    txCoinStake.vout[0].SetEmpty();
+    txCoinStake.vout[1] = CTxOut(100 * COIN, CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG);
+    block.vtx.push_back(txCoinStake);
+
+    for (int i = 0; i < nTxs; i++) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        tx.vout.emplace_back(CTxOut(COIN, CScript() << OP_TRUE));
+        block.vtx.push_back(tx);
+    }
+    if (!fBadMerkle) {
+        txCoinbase.vin[0].scriptSig = CScript() << InsecureRand32();
+        block.vtx.push_back(txCoinbase);
+    }
+
+    block.hashMerkleRoot = fBadMerkle ? InsecureRand256() : BlockMerkleRoot(block);
+    BOOST_CHECK(SignBlockWithKey(block, key));
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(blockpipeline_order_and_failures)
+{
+    SeedInsecureRand();
+    const bool fCheckpoints = Checkpoints::fEnabled;
+    Checkpoints::fEnabled = true; // keep the node in initial block download
+    BOOST_CHECK(IsInitialBlockDownload());
+
+    CKey key;
+    key.MakeNewKey(true);
+    CAddress addr(CService("10.0.0.1", Params().GetDefaultPort()));
+    CNode dummyNode(INVALID_SOCKET, addr, "", true);
+    dummyNode.nVersion = PROTOCOL_VERSION;
+
+    // no pre-check threads: the message handler validates the blocks itself
+    const uint256 hashGenesis = Params().GetConsensus().hashGenesisBlock;
+    BOOST_CHECK(!QueueBlockForValidation(&dummyNode, CreateBadStakeBlock(key, hashGenesis, 0, true)));
+
+    boost::thread_group threads;
+    SetBlockCheckThreads(3);
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(&ThreadBlockCheck);
+    threads.create_thread(&ThreadBlockConnect);
+
+    // blocks of different sizes, so that the pre-checks complete out of order
+    std::vector<CBlock> vBlocks;
+    for (int i = 0; i < 24; i++) {
+        vBlocks.push_back(CreateBadStakeBlock(key, hashGenesis, (int)InsecureRandRange(200), i % 2 == 0));
+        BOOST_CHECK(QueueBlockForValidation(&dummyNode, vBlocks.back()));
+        // queueing the same block again is a no-op
+        BOOST_CHECK(QueueBlockForValidation(&dummyNode, vBlocks.back()));
+    }
+
+    CBlockPipelineStats stats;
+    for (int n = 0; n < 1000; n++) {
+        GetBlockPipelineStats(stats);
+        if (stats.nQueued == 0) break;
+        MilliSleep(10);
+    }
+    BOOST_CHECK_EQUAL(stats.nQueued, 0);
+    BOOST_CHECK_EQUAL(stats.nBlocks, vBlocks.size());
+    for (const CBlock& block : vBlocks)
+        BOOST_CHECK(!IsBlockInPipeline(block.GetHash()));
+
+    threads.interrupt_all();
+    threads.join_all();
+    SetBlockCheckThreads(0);
+
+    // every block was rejected to the peer, in the order it was received
+    std::vector<std::pair<uint256, std::string> > vRejects;
+    {
+        LOCK(dummyNode.cs_vSend);
+        for (const CSerializeData& data : dummyNode.vSendMsg) {
+            CDataStream ss(data.begin(), data.end(), SER_NETWORK, PROTOCOL_VERSION);
+            CMessageHeader hdr;
+            ss >> hdr;
+            if (hdr.GetCommand() != "reject") continue;
+            std::string strMsg, strReason;
+            unsigned char ccode;
+            uint256 hash;
+            ss >> strMsg >> ccode >> strReason >> hash;
+            BOOST_CHECK_EQUAL(strMsg, "block");
+            BOOST_CHECK_EQUAL((int)ccode, (int)REJECT_INVALID);
+            vRejects.emplace_back(hash, strReason);
+        }
+    }
+    BOOST_CHECK_EQUAL(vRejects.size(), vBlocks.size());
+    for (size_t i = 0; i < std::min(vRejects.size(), vBlocks.size()); i++) {
+        BOOST_CHECK(vRejects[i].first == vBlocks[i].GetHash());
+        BOOST_CHECK_EQUAL(vRejects[i].second, i % 2 == 0 ? "bad-txnmrklroot" : "bad-cb-multiple");
+    }
+
+    // none of them was stored
+    {
+        LOCK(cs_main);
+        for (const CBlock& block : vBlocks)
+            BOOST_CHECK(!mapBlockIndex.count(block.GetHash()));
+    }
+
+    Checkpoints::fEnabled = fCheckpoints;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "masternode-budget.h"
+#include "masternodeman.h"
 #include "tinyformat.h"
 #include "utilmoneystr.h"
 #include "test_oasis.h"
@@ -30,4 +31,55 @@ BOOST_AUTO_TEST_CASE(budget_value)
     CheckBudgetValue(nHeightTest, "mainnet", 43200*COIN);
 }
 
+static CBudgetVote TallyVote(CBudgetProposal& proposal, const CTxIn& vin, int nVote, int64_t nTime)
+{
+    CBudgetVote vote(vin, proposal.GetHash(), nVote);
+    vote.nTime = nTime;
+    std::string strError;
+    BOOST_CHECK_MESSAGE(proposal.AddOrUpdateVote(vote, strError), strError);
+    return vote;
+}
+
+BOOST_AUTO_TEST_CASE(budget_vote_tally)
+{
+    SeedInsecureRand();
+    CBudgetProposal proposal("proposal", "http://example.com", 0, 1, CScript() << OP_TRUE, COIN, InsecureRand256());
+    const int64_t nTime = GetTime() - 2 * BUDGET_VOTE_UPDATE_MIN;
+
+    std::vector<CTxIn> vin;
+    for (int i = 0; i < 4; i++)
+        vin.push_back(CTxIn(COutPoint(InsecureRand256(), 0)));
+    TallyVote(proposal, vin[0], VOTE_YES, nTime);
+    TallyVote(proposal, vin[1], VOTE_YES, nTime);
+    TallyVote(proposal, vin[2], VOTE_NO, nTime);
+    TallyVote(proposal, vin[3], VOTE_ABSTAIN, nTime);
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 2);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 1);
+    BOOST_CHECK_EQUAL(proposal.GetAbstains(), 1);
+
+    // an updated vote moves between the counters
+    TallyVote(proposal, vin[1], VOTE_NO, nTime + BUDGET_VOTE_UPDATE_MIN);
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 1);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 2);
+    BOOST_CHECK_EQUAL(proposal.GetRatio(), 1.0 / 3);
+
+    // a deserialized copy recounts the same tallies
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << proposal;
+    CBudgetProposal proposalRead;
+    ss >> proposalRead;
+    BOOST_CHECK_EQUAL(proposalRead.GetYeas(), 1);
+    BOOST_CHECK_EQUAL(proposalRead.GetNays(), 2);
+    BOOST_CHECK_EQUAL(proposalRead.GetAbstains(), 1);
+
+    // votes of unknown masternodes stop counting, but still make up the ratio
+    BOOST_CHECK_EQUAL(mnodeman.size(), 0);
+    BOOST_CHECK(proposal.CleanAndRemove());
+    BOOST_CHECK(!proposal.CleanAndRemove());
+    BOOST_CHECK_EQUAL(proposal.GetYeas(), 0);
+    BOOST_CHECK_EQUAL(proposal.GetNays(), 0);
+    BOOST_CHECK_EQUAL(proposal.GetAbstains(), 0);
+    BOOST_CHECK_EQUAL(proposal.GetRatio(), 1.0 / 3);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,122 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kernel.h"
+#include "stakeinput.h"
+#include "test/test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(kernel_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(kernel_slot_matches_kernel)
+{
+    SeedInsecureRand();
+    const int nHeightV2 = Params().GetConsensus().height_start_StakeModifierV2;
+
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = nHeightV2;
+    indexPrev.nTime = 1600000000;
+    indexPrev.SetStakeModifier(InsecureRand256());
+
+    CBlockIndex indexFrom;
+    indexFrom.nHeight = nHeightV2 - 1000;
+    indexFrom.nTime = 1590000000;
+
+    CMutableTransaction txFrom;
+    txFrom.vin.resize(1);
+    for (int i = 0; i < 50; i++)
+        txFrom.vout.emplace_back(CTxOut((InsecureRandRange(100000) + 1) * COIN, CScript() << OP_TRUE));
+    const CTransaction tx(txFrom);
+
+    const int nTime = indexPrev.nTime + 15;
+    for (unsigned int nBits : {0x1e0ffff0U, 0x1d00ffffU, 0x207fffffU}) {
+        const CStakeKernelSlot slot(&indexPrev, nBits, nTime);
+        BOOST_CHECK(slot.IsValid());
+
+        std::vector<CStakeKernelInput> vInputs;
+        std::vector<bool> vHits;
+        for (unsigned int n = 0; n < tx.vout.size(); n++) {
+            CPivStake stake;
+            stake.SetPrevout(tx, n, &indexFrom);
+            const CStakeKernel kernel(&indexPrev, &stake, nBits, nTime);
+
+            CStakeKernelInput input;
+            input.hashTx = tx.GetHash();
+            input.n = n;
+            input.nValue = tx.vout[n].nValue;
+            input.nHeightBlockFrom = indexFrom.nHeight;
+            input.nTimeBlockFrom = indexFrom.nTime;
+
+            BOOST_CHECK(slot.GetHash(input) == kernel.GetHash());
+            BOOST_CHECK_EQUAL(slot.CheckKernelHash(input), kernel.CheckKernelHash(true));
+            vInputs.push_back(input);
+            vHits.push_back(kernel.CheckKernelHash(true));
+        }
+
+        // the batched search returns the first winning input
+        int nHashes = 0;
+        const int nPos = SearchStakeKernel(slot, vInputs, 0, nHashes);
+        const auto it = std::find(vHits.begin(), vHits.end(), true);
+        BOOST_CHECK_EQUAL(nPos, it == vHits.end() ? -1 : (int)(it - vHits.begin()));
+        if (nPos >= 0 && (size_t)nPos + 1 < vInputs.size()) {
+            const int nNext = SearchStakeKernel(slot, vInputs, nPos + 1, nHashes);
+            const auto itNext = std::find(it + 1, vHits.end(), true);
+            BOOST_CHECK_EQUAL(nNext, itNext == vHits.end() ? -1 : (int)(itNext - vHits.begin()));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(kernel_search_parallel)
+{
+    SeedInsecureRand(true);
+    const int nHeightV2 = Params().GetConsensus().height_start_StakeModifierV2;
+
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = nHeightV2;
+    indexPrev.nTime = 1600000000;
+    indexPrev.SetStakeModifier(InsecureRand256());
+    const CStakeKernelSlot slot(&indexPrev, 0x1d00ffff, indexPrev.nTime + 15);
+    BOOST_CHECK(slot.IsValid());
+
+    // about one hit every thousand inputs, spread over many ranges
+    std::vector<CStakeKernelInput> vInputs(8192);
+    std::vector<int> vHits;
+    for (unsigned int n = 0; n < vInputs.size(); n++) {
+        CStakeKernelInput& input = vInputs[n];
+        input.hashTx = InsecureRand256();
+        input.n = n;
+        input.nValue = (InsecureRandRange(8) + 1) * COIN;
+        input.nHeightBlockFrom = nHeightV2 - 1000;
+        input.nTimeBlockFrom = 1590000000;
+        if (slot.CheckKernelHash(input))
+            vHits.push_back(n);
+    }
+    BOOST_CHECK(vHits.size() > 1);
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(&ThreadStakeKernelCheck);
+    SetStakeKernelThreads(3);
+
+    // whichever worker finds a hit first, the search returns the lowest one
+    for (int nRound = 0; nRound < 20; nRound++) {
+        size_t nStart = 0;
+        for (size_t i = 0; i <= vHits.size(); i++) {
+            int nHashes = 0;
+            const int nPos = SearchStakeKernel(slot, vInputs, nStart, nHashes);
+            BOOST_CHECK_EQUAL(nPos, i < vHits.size() ? vHits[i] : -1);
+            BOOST_CHECK(nHashes >= (nPos < 0 ? (int)(vInputs.size() - nStart) : nPos - (int)nStart + 1));
+            if (nPos < 0) break;
+            nStart = nPos + 1;
+        }
+    }
+
+    SetStakeKernelThreads(0);
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -49,4 +49,130 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 4109975100000000ULL);
 }
 
+static CBlock BlockAwaitingParent(const uint256& hashPrev)
+{
+    CBlock block;
+    block.hashPrevBlock = hashPrev;
+    block.nNonce = InsecureRand32();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(blocks_awaiting_parent)
+{
+    SeedInsecureRand(true);
+    const uint256 hashParent = InsecureRand256();
+    // parent <- block1 <- block2, parent <- block1b, and an unrelated block
+    const CBlock block1 = BlockAwaitingParent(hashParent);
+    const CBlock block1b = BlockAwaitingParent(hashParent);
+    const CBlock block2 = BlockAwaitingParent(block1.GetHash());
+    const CBlock blockOther = BlockAwaitingParent(InsecureRand256());
+    const size_t nBlockSize = ::GetSerializeSize(block1, SER_NETWORK, PROTOCOL_VERSION);
+
+    // bounded by the total size of the blocks, a block already kept is not counted twice
+    CBlocksAwaitingParent buffer(3 * nBlockSize);
+    BOOST_CHECK(buffer.Add(1, block2));
+    BOOST_CHECK(buffer.Add(1, block1));
+    BOOST_CHECK(buffer.Add(1, block1));
+    BOOST_CHECK(buffer.Add(2, block1b));
+    BOOST_CHECK(!buffer.Add(2, blockOther));
+    BOOST_CHECK_EQUAL(buffer.size(), 3U);
+    BOOST_CHECK_EQUAL(buffer.GetTotalSize(), 3 * nBlockSize);
+    BOOST_CHECK(buffer.Contains(block2.GetHash()));
+
+    // the blocks are taken out by parent, in chain order (as ProcessBlocksAwaitingParent does)
+    BOOST_CHECK(buffer.TakeChildren(block2.GetHash()).empty());
+    std::vector<std::pair<NodeId, CBlock> > vChildren = buffer.TakeChildren(hashParent);
+    BOOST_REQUIRE_EQUAL(vChildren.size(), 2U);
+    std::set<uint256> setChildren;
+    for (const std::pair<NodeId, CBlock>& child : vChildren) {
+        setChildren.insert(child.second.GetHash());
+        BOOST_CHECK_EQUAL(child.first, child.second.GetHash() == block1.GetHash() ? 1 : 2);
+    }
+    BOOST_CHECK(setChildren.count(block1.GetHash()) && setChildren.count(block1b.GetHash()));
+    BOOST_CHECK_EQUAL(buffer.size(), 1U);
+    BOOST_CHECK_EQUAL(buffer.GetTotalSize(), nBlockSize);
+    vChildren = buffer.TakeChildren(block1.GetHash());
+    BOOST_REQUIRE_EQUAL(vChildren.size(), 1U);
+    BOOST_CHECK(vChildren[0].second.GetHash() == block2.GetHash());
+    BOOST_CHECK_EQUAL(buffer.size(), 0U);
+    BOOST_CHECK_EQUAL(buffer.GetTotalSize(), 0U);
+
+    // the descendants of an invalid block are dropped, the other blocks are kept
+    BOOST_CHECK(buffer.Add(1, block1));
+    BOOST_CHECK(buffer.Add(1, block2));
+    BOOST_CHECK(buffer.Add(1, blockOther));
+    BOOST_CHECK_EQUAL(buffer.EraseDescendants(hashParent), 2U);
+    BOOST_CHECK_EQUAL(buffer.size(), 1U);
+    BOOST_CHECK(buffer.Contains(blockOther.GetHash()));
+    BOOST_CHECK_EQUAL(buffer.GetTotalSize(), nBlockSize);
+    BOOST_CHECK_EQUAL(buffer.EraseDescendants(hashParent), 0U);
+
+    buffer.clear();
+    BOOST_CHECK_EQUAL(buffer.size(), 0U);
+    BOOST_CHECK_EQUAL(buffer.GetTotalSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(assumed_valid_blocks)
+{
+    SeedInsecureRand(true);
+    LOCK(cs_main);
+    CBlockIndex* pindexBestHeaderPrev = pindexBestHeader;
+    const uint256 hashAssumeValidPrev = hashAssumeValid;
+
+    // a chain of 100 blocks a day apart, and a fork of 20 blocks from its block 50
+    const int64_t nTimeStart = 1600000000;
+    std::vector<uint256> vHashes(120);
+    std::vector<CBlockIndex> vIndex(vHashes.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vHashes[i] = InsecureRand256();
+        CBlockIndex& index = vIndex[i];
+        index.phashBlock = &vHashes[i];
+        index.pprev = i == 0 ? NULL : i == 100 ? &vIndex[50] : &vIndex[i - 1];
+        index.nHeight = index.pprev ? index.pprev->nHeight + 1 : 0;
+        index.nTime = nTimeStart + index.nHeight * 24 * 60 * 60;
+        index.BuildSkip();
+        mapBlockIndex[vHashes[i]] = &index;
+    }
+    CBlockIndex* pindexTip = &vIndex[99];
+    CBlockIndex* pindexFork = &vIndex[119];
+    pindexBestHeader = pindexTip;
+
+    // the scripts are checked above the assumed valid block, and within two weeks of the best header
+    hashAssumeValid = vHashes[90];
+    BOOST_CHECK(IsBlockAssumedValid(&vIndex[1]));
+    BOOST_CHECK(IsBlockAssumedValid(&vIndex[50]));
+    BOOST_CHECK(IsBlockAssumedValid(&vIndex[99 - 15]));
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[99 - 14]));
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[91]));
+    hashAssumeValid = vHashes[60];
+    BOOST_CHECK(IsBlockAssumedValid(&vIndex[60]));
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[61]));
+
+    // and again on a fork that doesn't contain the assumed valid block
+    BOOST_CHECK(IsBlockAssumedValid(&vIndex[50]));
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[100]));
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[110]));
+    // ... even if the fork is the best header chain
+    pindexBestHeader = pindexFork;
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[55]));
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[101]));
+    BOOST_CHECK(IsBlockAssumedValid(&vIndex[50]));
+    pindexBestHeader = pindexTip;
+
+    // an unknown assumed valid block skips nothing
+    hashAssumeValid = InsecureRand256();
+    BOOST_CHECK(!IsBlockAssumedValid(&vIndex[1]));
+
+    // -assumevalid=0 checks every block
+    hashAssumeValid = uint256S("0");
+    BOOST_CHECK(hashAssumeValid.IsNull());
+    for (size_t i = 0; i < vIndex.size(); i++)
+        BOOST_CHECK(!IsBlockAssumedValid(&vIndex[i]));
+
+    for (const uint256& hash : vHashes)
+        mapBlockIndex.erase(hash);
+    pindexBestHeader = pindexBestHeaderPrev;
+    hashAssumeValid = hashAssumeValidPrev;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,71 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternode-payments.h"
+#include "script/standard.h"
+#include "test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternode_payments_tests, BasicTestingSetup)
+
+static CScript RandomPayee()
+{
+    return GetScriptForDestination(CKeyID(uint160(InsecureRandBytes(20))));
+}
+
+BOOST_AUTO_TEST_CASE(last_paid_index)
+{
+    SeedInsecureRand();
+    CMasternodePayments payments;
+    const CScript payee1 = RandomPayee();
+    const CScript payee2 = RandomPayee();
+    int nHeight;
+
+    BOOST_CHECK(!payments.GetLastPaidHeight(payee1, 110, 50, nHeight));
+
+    // a payee counts as paid once it has two votes on the block
+    payments.AddBlockPayeeVote(100, payee1);
+    BOOST_CHECK(!payments.GetLastPaidHeight(payee1, 110, 50, nHeight));
+    payments.AddBlockPayeeVote(100, payee1);
+    BOOST_CHECK(payments.GetLastPaidHeight(payee1, 110, 50, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 100);
+
+    // even if another payee has more votes on it
+    for (int i = 0; i < 3; i++)
+        payments.AddBlockPayeeVote(105, payee2);
+    payments.AddBlockPayeeVote(105, payee1);
+    payments.AddBlockPayeeVote(105, payee1);
+    BOOST_CHECK(payments.GetLastPaidHeight(payee1, 110, 50, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 105);
+    BOOST_CHECK(payments.GetLastPaidHeight(payee2, 110, 50, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 105);
+
+    // blocks after the tip and before the lookback are ignored
+    payments.AddBlockPayeeVote(115, payee1);
+    payments.AddBlockPayeeVote(115, payee1);
+    BOOST_CHECK(payments.GetLastPaidHeight(payee1, 110, 50, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 105);
+    BOOST_CHECK(payments.GetLastPaidHeight(payee1, 115, 50, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 115);
+    BOOST_CHECK(payments.GetLastPaidHeight(payee1, 104, 5, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 100);
+    BOOST_CHECK(!payments.GetLastPaidHeight(payee1, 104, 4, nHeight));
+    BOOST_CHECK(!payments.GetLastPaidHeight(payee1, 99, 50, nHeight));
+
+    // the index is rebuilt from the block payees, as after loading them
+    payments.RebuildLastPaidIndex();
+    BOOST_CHECK(payments.GetLastPaidHeight(payee1, 110, 50, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 105);
+    payments.mapMasternodeBlocks.erase(105);
+    payments.RebuildLastPaidIndex();
+    BOOST_CHECK(payments.GetLastPaidHeight(payee1, 110, 50, nHeight));
+    BOOST_CHECK_EQUAL(nHeight, 100);
+    BOOST_CHECK(!payments.GetLastPaidHeight(payee2, 110, 50, nHeight));
+
+    payments.Clear();
+    BOOST_CHECK(!payments.GetLastPaidHeight(payee1, 110, 50, nHeight));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,136 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternodedb.h"
+#include "masternodeman.h"
+#include "test_oasis.h"
+#include "timedata.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodedb_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(masternodedb_table_flush)
+{
+    CMasternodeStateDB db(1 << 20, true);
+    CMasternodeStateTable<int> table('t');
+
+    // first flush writes everything
+    CLevelDBBatch batch;
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK(table.Stage(batch, i, std::string(i + 1, 'x')));
+    BOOST_CHECK_EQUAL(table.EraseUnstaged(batch), 0);
+    db.WriteBatch(batch);
+    table.Commit();
+
+    // then only what changed, and the erasure of what went away
+    CLevelDBBatch batch2;
+    for (int i = 0; i < 9; i++)
+        BOOST_CHECK_EQUAL(table.Stage(batch2, i, std::string(i == 4 ? 20 : i + 1, 'x')), i == 4);
+    BOOST_CHECK_EQUAL(table.EraseUnstaged(batch2), 1);
+    db.WriteBatch(batch2);
+    table.Commit();
+    BOOST_CHECK_EQUAL(table.size(), 9U);
+
+    // a lost batch is rewritten by the next flush
+    CLevelDBBatch batch3;
+    BOOST_CHECK(table.Stage(batch3, 0, std::string(5, 'y')));
+    table.Abort();
+    CLevelDBBatch batch4;
+    for (int i = 0; i < 9; i++)
+        BOOST_CHECK(table.Stage(batch4, i, std::string(i == 4 ? 20 : i + 1, 'x')));
+    db.WriteBatch(batch4);
+    table.Commit();
+
+    // a reload knows the stored values and writes nothing back
+    CMasternodeStateTable<int> tableReload('t');
+    std::map<int, std::string> mapLoaded;
+    tableReload.Load<std::string>(db, [&](const int& n, const std::string& str) { mapLoaded[n] = str; });
+    BOOST_CHECK_EQUAL(mapLoaded.size(), 9U);
+    BOOST_CHECK_EQUAL(mapLoaded[4], std::string(20, 'x'));
+    BOOST_CHECK(!mapLoaded.count(9));
+    CLevelDBBatch batch5;
+    for (const auto& it : mapLoaded)
+        BOOST_CHECK(!tableReload.Stage(batch5, it.first, it.second));
+    BOOST_CHECK_EQUAL(tableReload.EraseUnstaged(batch5), 0);
+}
+
+static CMasternode StoredMasternode()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CMasternode mn;
+    mn.vin = CTxIn(COutPoint(InsecureRand256(), InsecureRandRange(4)));
+    mn.pubKeyCollateralAddress = key.GetPubKey();
+    mn.pubKeyMasternode = key.GetPubKey();
+    mn.protocolVersion = PROTOCOL_VERSION;
+    mn.unitTest = true;
+    mn.lastPing.vin = mn.vin;
+    mn.lastPing.sigTime = GetAdjustedTime();
+    mn.sigTime = mn.lastPing.sigTime - MASTERNODE_MIN_MNP_SECONDS - 1;
+    mn.Check(true);
+    return mn;
+}
+
+BOOST_AUTO_TEST_CASE(masternodedb_manager_roundtrip)
+{
+    SeedInsecureRand();
+    pmnStateDB = new CMasternodeStateDB(1 << 20, true);
+
+    CMasternodeDB mndb;
+    CMasternodeMan mnman;
+    BOOST_CHECK(mndb.Read(mnman) == CMasternodeDB::FileError);
+
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 10; i++) {
+        vMasternodes.push_back(StoredMasternode());
+        BOOST_CHECK(mnman.Add(vMasternodes.back()));
+    }
+    mnman.nDsqCount = 7;
+    BOOST_CHECK(mndb.Write(mnman));
+    mnman.Remove(vMasternodes[2].vin);
+    BOOST_CHECK(mndb.Write(mnman));
+
+    CMasternodeDB mndbReload;
+    CMasternodeMan mnmanReload;
+    BOOST_CHECK(mndbReload.Read(mnmanReload) == CMasternodeDB::Ok);
+    BOOST_CHECK_EQUAL(mnmanReload.size(), 9);
+    BOOST_CHECK_EQUAL(mnmanReload.nDsqCount, 7);
+    BOOST_CHECK(mnmanReload.Find(vMasternodes[2].vin) == NULL);
+    for (size_t i = 0; i < vMasternodes.size(); i++) {
+        if (i == 2) continue;
+        CMasternode* pmn = mnmanReload.Find(vMasternodes[i].vin);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->pubKeyMasternode == vMasternodes[i].pubKeyMasternode);
+        BOOST_CHECK(mnmanReload.Find(vMasternodes[i].pubKeyMasternode) == pmn);
+    }
+
+    delete pmnStateDB;
+    pmnStateDB = NULL;
+}
+
+BOOST_FIXTURE_TEST_CASE(masternodedb_legacy_import_failure, TestingSetup)
+{
+    pmnStateDB = new CMasternodeStateDB(1 << 20, true);
+    const boost::filesystem::path pathLegacy = GetDataDir() / "mncache.dat";
+    {
+        FILE* file = fopen(pathLegacy.string().c_str(), "wb");
+        BOOST_REQUIRE(file != NULL);
+        fputs("not a masternode cache", file);
+        fclose(file);
+    }
+
+    // a legacy file that can't be read is moved away, and not read again on the next start
+    CMasternodeDB mndb;
+    CMasternodeMan mnman;
+    BOOST_CHECK(mndb.Read(mnman) == CMasternodeDB::FileError);
+    BOOST_CHECK(!boost::filesystem::exists(pathLegacy));
+    BOOST_CHECK(boost::filesystem::exists(GetDataDir() / "mncache.dat.bak"));
+    BOOST_CHECK_EQUAL(mnman.size(), 0);
+
+    delete pmnStateDB;
+    pmnStateDB = NULL;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
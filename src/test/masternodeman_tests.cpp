@@ -0,0 +1,187 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "masternodeman.h"
+#include "script/standard.h"
+#include "timedata.h"
+#include "test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(masternodeman_tests, BasicTestingSetup)
+
+static CMasternode RandomMasternode()
+{
+    CKey keyCollateral, keyMasternode;
+    keyCollateral.MakeNewKey(true);
+    keyMasternode.MakeNewKey(true);
+    CMasternode mn;
+    mn.vin = CTxIn(COutPoint(InsecureRand256(), InsecureRandRange(4)));
+    mn.pubKeyCollateralAddress = keyCollateral.GetPubKey();
+    mn.pubKeyMasternode = keyMasternode.GetPubKey();
+    return mn;
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_indexes)
+{
+    SeedInsecureRand();
+    CMasternodeMan mnman;
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 20; i++) {
+        vMasternodes.push_back(RandomMasternode());
+        BOOST_CHECK(mnman.Add(vMasternodes.back()));
+    }
+    BOOST_CHECK_EQUAL(mnman.size(), 20);
+    // duplicates by collateral outpoint are rejected
+    BOOST_CHECK(!mnman.Add(vMasternodes[0]));
+
+    CMasternode* pmn5 = mnman.Find(vMasternodes[5].vin);
+    BOOST_REQUIRE(pmn5 != NULL);
+    for (const CMasternode& mn : vMasternodes) {
+        CMasternode* pmn = mnman.Find(mn.vin);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->vin == mn.vin);
+        BOOST_CHECK(mnman.Find(mn.pubKeyMasternode) == pmn);
+        BOOST_CHECK(mnman.Find(GetScriptForDestination(mn.pubKeyCollateralAddress.GetID())) == pmn);
+        // only the P2PKH payee script identifies a masternode
+        BOOST_CHECK(mnman.Find(GetScriptForRawPubKey(mn.pubKeyCollateralAddress)) == NULL);
+    }
+    BOOST_CHECK(mnman.Find(RandomMasternode().vin) == NULL);
+
+    // handles stay valid while other entries come and go
+    mnman.Remove(vMasternodes[4].vin);
+    mnman.Remove(vMasternodes[6].vin);
+    for (int i = 0; i < 10; i++) {
+        CMasternode mn = RandomMasternode();
+        BOOST_CHECK(mnman.Add(mn));
+    }
+    BOOST_CHECK(mnman.Find(vMasternodes[4].vin) == NULL);
+    BOOST_CHECK(mnman.Find(vMasternodes[4].pubKeyMasternode) == NULL);
+    BOOST_CHECK(mnman.Find(vMasternodes[5].vin) == pmn5);
+    BOOST_CHECK(pmn5->vin == vMasternodes[5].vin);
+
+    // a newer broadcast moves the key indexes along
+    CMasternode mnNew = RandomMasternode();
+    CMasternodeBroadcast mnb(*pmn5);
+    mnb.pubKeyMasternode = mnNew.pubKeyMasternode;
+    mnb.pubKeyCollateralAddress = mnNew.pubKeyCollateralAddress;
+    mnb.sigTime = pmn5->sigTime + 1;
+    mnb.lastPing = CMasternodePing();
+    BOOST_CHECK(mnman.UpdateFromNewBroadcast(*pmn5, mnb));
+    BOOST_CHECK(mnman.Find(vMasternodes[5].pubKeyMasternode) == NULL);
+    BOOST_CHECK(mnman.Find(GetScriptForDestination(vMasternodes[5].pubKeyCollateralAddress.GetID())) == NULL);
+    BOOST_CHECK(mnman.Find(mnNew.pubKeyMasternode) == pmn5);
+    BOOST_CHECK(mnman.Find(GetScriptForDestination(mnNew.pubKeyCollateralAddress.GetID())) == pmn5);
+    BOOST_CHECK(mnman.Find(vMasternodes[5].vin) == pmn5);
+
+    mnman.Clear();
+    BOOST_CHECK(mnman.Find(vMasternodes[5].vin) == NULL);
+    BOOST_CHECK(mnman.Find(mnNew.pubKeyMasternode) == NULL);
+}
+
+static CMasternode EnabledMasternode()
+{
+    CMasternode mn = RandomMasternode();
+    // enabled without a collateral lookup, and old enough to be ranked
+    mn.unitTest = true;
+    mn.lastPing.vin = mn.vin;
+    mn.lastPing.sigTime = GetAdjustedTime();
+    mn.sigTime = mn.lastPing.sigTime - 10000;
+    mn.Check(true);
+    return mn;
+}
+
+static std::vector<COutPoint> ExpectedRanks(CMasternodeMan& mnman, const std::vector<CMasternode>& vMasternodes, int nBlockHeight)
+{
+    std::vector<std::pair<int64_t, COutPoint> > vScores;
+    for (const CMasternode& mn : vMasternodes) {
+        CMasternode* pmn = mnman.Find(mn.vin);
+        if (pmn) vScores.push_back(std::make_pair(pmn->CalculateScore(1, nBlockHeight).GetCompact(false), mn.vin.prevout));
+    }
+    std::sort(vScores.begin(), vScores.end(), [](const std::pair<int64_t, COutPoint>& a, const std::pair<int64_t, COutPoint>& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    std::vector<COutPoint> vRanks;
+    for (const auto& s : vScores) vRanks.push_back(s.second);
+    return vRanks;
+}
+
+static void CheckRanks(CMasternodeMan& mnman, const std::vector<COutPoint>& vExpected, int nBlockHeight)
+{
+    for (size_t i = 0; i < vExpected.size(); i++) {
+        BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(CTxIn(vExpected[i]), nBlockHeight), (int)i + 1);
+        CMasternode* pmn = mnman.GetMasternodeByRank(i + 1, nBlockHeight);
+        BOOST_REQUIRE(pmn != NULL);
+        BOOST_CHECK(pmn->vin.prevout == vExpected[i]);
+    }
+    const std::vector<std::pair<int, CMasternode> > vRanks = mnman.GetMasternodeRanks(nBlockHeight);
+    BOOST_REQUIRE_EQUAL(vRanks.size(), vExpected.size());
+    for (size_t i = 0; i < vRanks.size(); i++) {
+        BOOST_CHECK_EQUAL(vRanks[i].first, (int)i + 1);
+        BOOST_CHECK(vRanks[i].second.vin.prevout == vExpected[i]);
+    }
+    BOOST_CHECK(mnman.GetCurrentMasterNode(1, nBlockHeight)->vin.prevout == vExpected[0]);
+}
+
+BOOST_AUTO_TEST_CASE(masternodeman_score_tables)
+{
+    SeedInsecureRand();
+    std::vector<uint256> vHashes(20);
+    std::vector<CBlockIndex> vIndex(vHashes.size());
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vHashes[i] = InsecureRand256();
+        vIndex[i].nHeight = i;
+        vIndex[i].phashBlock = &vHashes[i];
+        vIndex[i].pprev = i ? &vIndex[i - 1] : NULL;
+    }
+    chainActive.SetTip(&vIndex.back());
+
+    CMasternodeMan mnman;
+    std::vector<CMasternode> vMasternodes;
+    for (int i = 0; i < 20; i++) {
+        vMasternodes.push_back(EnabledMasternode());
+        BOOST_CHECK(mnman.Add(vMasternodes.back()));
+    }
+
+    // one table per height, every further lookup is served from it
+    uint64_t nHits, nMisses;
+    CheckRanks(mnman, ExpectedRanks(mnman, vMasternodes, 10), 10);
+    mnman.GetScoreTableStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nMisses, 1U);
+    BOOST_CHECK(nHits > 0);
+    CheckRanks(mnman, ExpectedRanks(mnman, vMasternodes, 15), 15);
+    mnman.GetScoreTableStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nMisses, 2U);
+
+    // unknown blocks have no ranks
+    BOOST_CHECK_EQUAL(mnman.GetMasternodeRank(vMasternodes[0].vin, 100), -1);
+    BOOST_CHECK(mnman.GetMasternodeByRank(1, 100) == NULL);
+
+    // GetBlockHash returns the parent of the given height, and fails outside of the chain
+    uint256 hash;
+    BOOST_CHECK(GetBlockHash(hash, 10));
+    BOOST_CHECK(hash == vHashes[9]);
+    BOOST_CHECK(GetBlockHash(hash, 0));
+    BOOST_CHECK(hash == vHashes[18]);
+    BOOST_CHECK(!GetBlockHash(hash, -1));
+    BOOST_CHECK(!GetBlockHash(hash, 100));
+
+    // a reorg below the height reseeds its table
+    vHashes[9] = InsecureRand256();
+    CheckRanks(mnman, ExpectedRanks(mnman, vMasternodes, 10), 10);
+    mnman.GetScoreTableStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nMisses, 3U);
+
+    // so do list changes
+    mnman.Remove(vMasternodes[3].vin);
+    vMasternodes.push_back(EnabledMasternode());
+    BOOST_CHECK(mnman.Add(vMasternodes.back()));
+    CheckRanks(mnman, ExpectedRanks(mnman, vMasternodes, 10), 10);
+    mnman.GetScoreTableStats(nHits, nMisses);
+    BOOST_CHECK_EQUAL(nMisses, 4U);
+
+    chainActive.SetTip(NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
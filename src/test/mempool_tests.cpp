@@ -99,4 +99,132 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+
+    // Three unrelated transactions paying 1000, 3000 and 2000 per tx, and a
+    // child of the cheapest one paying a lot
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11 << i;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+    }
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(tx[0].GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+
+    pool.addUnchecked(tx[0].GetHash(), CTxMemPoolEntry(tx[0], 1000LL, 0, 0.0, 1));
+    size_t nUsageOne = pool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsageOne > 0);
+    pool.addUnchecked(tx[1].GetHash(), CTxMemPoolEntry(tx[1], 3000LL, 0, 0.0, 1));
+    pool.addUnchecked(tx[2].GetHash(), CTxMemPoolEntry(tx[2], 2000LL, 0, 0.0, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 100000LL, 0, 0.0, 1));
+    BOOST_CHECK(pool.DynamicMemoryUsage() > nUsageOne);
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    // Nothing to do while under the limit
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    // The cheapest transaction is kept, as its child pays for it: the
+    // cheapest package goes first
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK(pool.exists(tx[0].GetHash()));
+    BOOST_CHECK(pool.exists(txChild.GetHash()));
+    BOOST_CHECK(pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(!pool.exists(tx[2].GetHash()));
+
+    // ... and raises the minimum fee above the evicted fee rate
+    CFeeRate evicted(2000LL, CTxMemPoolEntry(tx[2], 2000LL, 0, 0.0, 1).GetTxSize());
+    BOOST_CHECK(pool.GetMinFee(1) > evicted);
+
+    // Evicting a parent takes its child along
+    pool.PrioritiseTransaction(tx[0].GetHash(), tx[0].GetHash().ToString(), 0, -1000LL);
+    pool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0, -99000LL);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(tx[1].GetHash()));
+
+    pool.TrimToSize(0);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK_EQUAL(pool.DynamicMemoryUsage(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // A cheap parent with a generous child, and an unrelated transaction
+    // paying a fee in between
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txParent.vout[0].nValue = 10 * COIN;
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_11;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txChild.vout[0].nValue = 9 * COIN;
+    CMutableTransaction txOther;
+    txOther.vin.resize(1);
+    txOther.vin[0].scriptSig = CScript() << OP_12;
+    txOther.vout.resize(1);
+    txOther.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txOther.vout[0].nValue = 10 * COIN;
+
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000LL, 0, 0.0, 1, 1));
+    pool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 20000LL, 0, 0.0, 1, 2));
+    pool.addUnchecked(txOther.GetHash(), CTxMemPoolEntry(txOther, 5000LL, 0, 0.0, 1, 1));
+
+    CTxMemPool::txiter itParent = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter itChild = pool.mapTx.find(txChild.GetHash());
+    BOOST_CHECK_EQUAL(itParent->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(itParent->GetModFeesWithDescendants(), 21000LL);
+    BOOST_CHECK_EQUAL(itParent->GetSizeWithDescendants(), itParent->GetTxSize() + itChild->GetTxSize());
+    BOOST_CHECK_EQUAL(itChild->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(itChild->GetModFeesWithAncestors(), 21000LL);
+    BOOST_CHECK_EQUAL(itChild->GetSigOpCountWithAncestors(), 3);
+    BOOST_CHECK(pool.GetMemPoolChildren(itParent).count(itChild));
+    BOOST_CHECK(pool.GetMemPoolParents(itChild).count(itParent));
+
+    // The child's package outbids the unrelated transaction, the parent on its own does not
+    std::vector<uint256> vOrder;
+    for (const CTxMemPoolEntry& e : pool.mapTx.get<ancestor_score>())
+        vOrder.push_back(e.GetTx().GetHash());
+    BOOST_CHECK(vOrder[0] == txChild.GetHash());
+    BOOST_CHECK(vOrder[1] == txOther.GetHash());
+    BOOST_CHECK(vOrder[2] == txParent.GetHash());
+
+    // Prioritisation moves an entry and updates its package
+    pool.PrioritiseTransaction(txParent.GetHash(), txParent.GetHash().ToString(), 0, 100000LL);
+    BOOST_CHECK(pool.mapTx.get<ancestor_score>().begin()->GetTx().GetHash() == txParent.GetHash());
+    BOOST_CHECK_EQUAL(itChild->GetModFeesWithAncestors(), 121000LL);
+
+    // Once the parent is mined, the child stands on its own
+    std::vector<CTransaction> vtx;
+    vtx.push_back(txParent);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(vtx, 2, conflicts);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    itChild = pool.mapTx.find(txChild.GetHash());
+    BOOST_CHECK_EQUAL(itChild->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(itChild->GetModFeesWithAncestors(), 20000LL);
+    BOOST_CHECK_EQUAL(itChild->GetSigOpCountWithAncestors(), 2);
+    BOOST_CHECK(pool.GetMemPoolParents(itChild).empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,171 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for the masternode message queues
+//
+
+#include "main.h"
+#include "net.h"
+#include "protocol.h"
+#include "test/test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(mnmessagequeue_tests, TestingSetup)
+
+// Make a peer whose sent messages pile up in vSendMsg: the first slot keeps
+// the optimistic write from reaching the (invalid) socket.
+static CNode* MakePeer(uint32_t nAddr, int nVersion)
+{
+    struct in_addr s;
+    s.s_addr = nAddr;
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(CService(CNetAddr(s), Params().GetDefaultPort())), "", true);
+    pnode->nVersion = nVersion;
+    pnode->vSendMsg.push_back(CSerializeData(CMessageHeader::HEADER_SIZE));
+    return pnode;
+}
+
+// Receive a message with an empty (so malformed) payload
+static void ReceiveMessage(CNode* pnode, const std::string& strCommand)
+{
+    const std::vector<unsigned char> vPayload;
+    CMessageHeader hdr(strCommand.c_str(), vPayload.size());
+    const uint256 hash = Hash(vPayload.begin(), vPayload.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hdr;
+    LOCK(pnode->cs_vRecvMsg);
+    BOOST_CHECK(pnode->ReceiveMsgBytes(&ss[0], ss.size()));
+}
+
+static void RunProcessMessages(CNode* pnode)
+{
+    LOCK(pnode->cs_vRecvMsg);
+    ProcessMessages(pnode);
+}
+
+// The commands of the "error parsing message" rejects sent to pnode, in order
+static std::vector<std::string> GetRejectedCommands(CNode* pnode)
+{
+    std::vector<std::string> vCommands;
+    LOCK(pnode->cs_vSend);
+    for (const CSerializeData& data : pnode->vSendMsg) {
+        CDataStream ss(data.begin(), data.end(), SER_NETWORK, PROTOCOL_VERSION);
+        CMessageHeader hdr;
+        ss >> hdr;
+        if (hdr.GetCommand() != "reject") continue;
+        std::string strCommand;
+        ss >> strCommand;
+        vCommands.push_back(strCommand);
+    }
+    return vCommands;
+}
+
+static bool WaitForEmptyQueues()
+{
+    CMessageQueueStats stats;
+    for (int n = 0; n < 1000; n++) {
+        GetMasternodeMessageStats(stats);
+        if (stats.nQueued == 0 && stats.nPeers == 0) return true;
+        MilliSleep(10);
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(mnmessagequeue_peer_order)
+{
+    SeedInsecureRand();
+    std::unique_ptr<CNode> peer1(MakePeer(0xa0b0c001, PROTOCOL_VERSION));
+    std::unique_ptr<CNode> peer2(MakePeer(0xa0b0c002, PROTOCOL_VERSION));
+
+    // spork and sync messages are handled by different groups, so they can run in parallel
+    std::vector<std::string> vSent1, vSent2;
+    for (int i = 0; i < 200; i++) {
+        vSent1.push_back(InsecureRandBool() ? "spork" : "ssc");
+        vSent2.push_back(InsecureRandBool() ? "spork" : "ssc");
+        ReceiveMessage(peer1.get(), vSent1.back());
+        ReceiveMessage(peer2.get(), vSent2.back());
+    }
+
+    boost::thread_group threads;
+    SetMasternodeMessageThreads(4);
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(&ThreadMasternodeMessages);
+
+    // all the masternode messages are queued in one go
+    RunProcessMessages(peer1.get());
+    RunProcessMessages(peer2.get());
+    BOOST_CHECK(peer1->vRecvMsg.empty());
+    BOOST_CHECK(peer2->vRecvMsg.empty());
+
+    BOOST_CHECK(WaitForEmptyQueues());
+    threads.interrupt_all();
+    threads.join_all();
+    SetMasternodeMessageThreads(0);
+
+    // each peer's messages were processed in the order they were received
+    BOOST_CHECK(GetRejectedCommands(peer1.get()) == vSent1);
+    BOOST_CHECK(GetRejectedCommands(peer2.get()) == vSent2);
+}
+
+BOOST_AUTO_TEST_CASE(mnmessagequeue_bound_and_resume)
+{
+    std::unique_ptr<CNode> peer(MakePeer(0xa0b0c003, PROTOCOL_VERSION));
+    const size_t nExtra = 10;
+    for (size_t i = 0; i < MAX_QUEUED_MASTERNODE_MESSAGES + nExtra; i++)
+        ReceiveMessage(peer.get(), "spork");
+
+    // no worker is running yet: the queue fills up and pauses the peer
+    SetMasternodeMessageThreads(1);
+    RunProcessMessages(peer.get());
+    CMessageQueueStats stats;
+    GetMasternodeMessageStats(stats);
+    BOOST_CHECK_EQUAL(stats.nQueued, MAX_QUEUED_MASTERNODE_MESSAGES);
+    BOOST_CHECK_EQUAL(stats.nPeers, 1U);
+    BOOST_CHECK(stats.nDeferred > 0);
+    BOOST_CHECK(peer->fDispatchPaused);
+    BOOST_CHECK_EQUAL(peer->vRecvMsg.size(), nExtra);
+
+    // the rest of the receive buffer waits while the queue is full
+    RunProcessMessages(peer.get());
+    BOOST_CHECK_EQUAL(peer->vRecvMsg.size(), nExtra);
+
+    // a worker makes room and resumes the peer
+    boost::thread_group threads;
+    threads.create_thread(&ThreadMasternodeMessages);
+    BOOST_CHECK(WaitForEmptyQueues());
+    BOOST_CHECK(!peer->fDispatchPaused);
+
+    RunProcessMessages(peer.get());
+    BOOST_CHECK(peer->vRecvMsg.empty());
+    BOOST_CHECK(WaitForEmptyQueues());
+    threads.interrupt_all();
+    threads.join_all();
+    SetMasternodeMessageThreads(0);
+
+    BOOST_CHECK_EQUAL(GetRejectedCommands(peer.get()).size(), MAX_QUEUED_MASTERNODE_MESSAGES + nExtra);
+}
+
+BOOST_AUTO_TEST_CASE(mnmessagequeue_requires_version)
+{
+    std::unique_ptr<CNode> peer(MakePeer(0xa0b0c004, 0));
+    ReceiveMessage(peer.get(), "mnb");
+
+    SetMasternodeMessageThreads(1);
+    RunProcessMessages(peer.get());
+    CMessageQueueStats stats;
+    GetMasternodeMessageStats(stats);
+    SetMasternodeMessageThreads(0);
+
+    // not queued: handled (and punished) as any message before the version
+    BOOST_CHECK_EQUAL(stats.nQueued, 0U);
+    BOOST_CHECK(peer->vRecvMsg.empty());
+    CNodeStateStats nodeStats;
+    BOOST_CHECK(GetNodeStateStats(peer->GetId(), nodeStats));
+    BOOST_CHECK_EQUAL(nodeStats.nMisbehavior, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
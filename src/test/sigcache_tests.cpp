@@ -0,0 +1,68 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "script/sigcache.h"
+#include "test/test_oasis.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sigcache_store_and_lookup)
+{
+    SeedInsecureRand();
+    CKey key;
+    key.MakeNewKey(true);
+    const CPubKey pubkey = key.GetPubKey();
+    const CTransaction tx;
+    const CachingTransactionSignatureChecker checkerNoStore(&tx, 0, false);
+    const CachingTransactionSignatureChecker checkerStore(&tx, 0, true);
+
+    for (int i = 0; i < 20; i++) {
+        const uint256 hash = InsecureRand256();
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+
+        CSignatureCacheStats before, after;
+        GetSignatureCacheStats(before);
+        BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+        BOOST_CHECK(checkerStore.VerifySignature(vchSig, pubkey, hash));
+        BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+        GetSignatureCacheStats(after);
+        // the first two lookups miss, the last one hits
+        BOOST_CHECK_EQUAL(after.nMisses - before.nMisses, 2U);
+        BOOST_CHECK_EQUAL(after.nHits - before.nHits, 1U);
+
+        // a signature of another hash is neither valid nor cached
+        const uint256 hashOther = InsecureRand256();
+        BOOST_CHECK(!checkerStore.VerifySignature(vchSig, pubkey, hashOther));
+        BOOST_CHECK(!checkerStore.VerifySignature(vchSig, pubkey, hashOther));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_budget)
+{
+    // -sigcachemb is in MiB, clamped to its range
+    BOOST_CHECK_EQUAL(GetSignatureCacheBudget(), (size_t)DEFAULT_SIG_CACHE_MB << 20);
+    mapArgs["-sigcachemb"] = "5";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBudget(), (size_t)5 << 20);
+    mapArgs["-sigcachemb"] = "0";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBudget(), 0U);
+    mapArgs["-sigcachemb"] = "-1";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBudget(), 0U);
+    mapArgs["-sigcachemb"] = strprintf("%d", MAX_SIG_CACHE_MB + 1);
+    BOOST_CHECK_EQUAL(GetSignatureCacheBudget(), (size_t)MAX_SIG_CACHE_MB << 20);
+
+    // the deprecated -maxsigcachesize counts entries, and wins
+    mapArgs["-maxsigcachesize"] = "50000";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBudget(), 50000 * SIG_CACHE_ENTRY_BYTES);
+    mapArgs["-maxsigcachesize"] = "0";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBudget(), 0U);
+    mapArgs.erase("-maxsigcachesize");
+    mapArgs.erase("-sigcachemb");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,146 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "legacy/stakemodifier.h"
+#include "main.h"
+#include "txdb.h"
+#include "test/test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stakemodifier_tests, TestingSetup)
+
+static const int64_t BLOCK_SPACING = 60;
+
+// Append nBlocks to pprev (or start a chain), each generating a fresh v1 modifier.
+// The block indexes are owned by mapBlockIndex and freed by UnloadBlockIndex.
+static std::vector<CBlockIndex*> AddBranch(CBlockIndex* pprev, int nBlocks)
+{
+    std::vector<CBlockIndex*> vBranch;
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex* pindex = new CBlockIndex();
+        BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(InsecureRand256(), pindex)).first;
+        pindex->phashBlock = &mi->first;
+        pindex->pprev = pprev;
+        pindex->nHeight = pprev ? pprev->nHeight + 1 : 0;
+        pindex->nTime = pprev ? pprev->nTime + BLOCK_SPACING : 1500000000;
+        pindex->SetStakeModifier((uint64_t)InsecureRandBits(64), true);
+        pindex->BuildSkip();
+        vBranch.push_back(pindex);
+        pprev = pindex;
+    }
+    return vBranch;
+}
+
+static bool GetModifier(CBlockIndex* pindexFrom, uint64_t& nModifier)
+{
+    CMutableTransaction txFrom;
+    txFrom.vin.resize(1);
+    txFrom.vout.emplace_back(CTxOut(COIN, CScript() << OP_TRUE));
+    CPivStake stake;
+    stake.SetPrevout(CTransaction(txFrom), 0, pindexFrom);
+    return GetOldStakeModifier(&stake, nModifier);
+}
+
+BOOST_AUTO_TEST_CASE(stakemodifier_table_hit_miss)
+{
+    SeedInsecureRand();
+    LOCK(cs_main);
+    const std::vector<CBlockIndex*> vChain = AddBranch(nullptr, 80);
+    chainActive.SetTip(vChain.back());
+
+    CBlockIndex* pindexFrom = vChain[5];
+    uint64_t nModifier = 0;
+    BOOST_CHECK(!stakeModifierTable.Get(pindexFrom, nModifier));
+
+    // computing the modifier walks the active chain and records the result
+    BOOST_CHECK(GetModifier(pindexFrom, nModifier));
+    const int nSelected = 5 + (2087 + BLOCK_SPACING - 1) / BLOCK_SPACING;
+    BOOST_CHECK_EQUAL(nModifier, vChain[nSelected]->GetStakeModifierV1());
+
+    uint64_t nCached = 0;
+    BOOST_CHECK(stakeModifierTable.Get(pindexFrom, nCached));
+    BOOST_CHECK_EQUAL(nCached, nModifier);
+
+    // an entry is only returned for the block it was computed for
+    CBlockIndex indexOther;
+    indexOther.nHeight = pindexFrom->nHeight;
+    BOOST_CHECK(!stakeModifierTable.Get(&indexOther, nCached));
+    BOOST_CHECK(!stakeModifierTable.Get(vChain[6], nCached));
+}
+
+BOOST_AUTO_TEST_CASE(stakemodifier_table_reorg)
+{
+    SeedInsecureRand();
+    LOCK(cs_main);
+    const std::vector<CBlockIndex*> vChain = AddBranch(nullptr, 80);
+    chainActive.SetTip(vChain.back());
+
+    CBlockIndex* pindexFrom = vChain[5];
+    uint64_t nModifierA = 0;
+    BOOST_CHECK(GetModifier(pindexFrom, nModifierA));
+
+    // reorg before the selected block: the entry is stale
+    const std::vector<CBlockIndex*> vFork = AddBranch(vChain[20], 60);
+    chainActive.SetTip(vFork.back());
+    uint64_t nCached = 0;
+    BOOST_CHECK(!stakeModifierTable.Get(pindexFrom, nCached));
+
+    uint64_t nModifierB = 0;
+    BOOST_CHECK(GetModifier(pindexFrom, nModifierB));
+    BOOST_CHECK(nModifierB != nModifierA);
+    BOOST_CHECK(stakeModifierTable.Get(pindexFrom, nCached));
+    BOOST_CHECK_EQUAL(nCached, nModifierB);
+
+    // reorg after the selected block leaves the entry valid
+    const std::vector<CBlockIndex*> vTail = AddBranch(vFork[40], 10);
+    chainActive.SetTip(vTail.back());
+    BOOST_CHECK(stakeModifierTable.Get(pindexFrom, nCached));
+    BOOST_CHECK_EQUAL(nCached, nModifierB);
+}
+
+BOOST_AUTO_TEST_CASE(stakemodifier_table_reload)
+{
+    SeedInsecureRand();
+    LOCK(cs_main);
+    const std::vector<CBlockIndex*> vChain = AddBranch(nullptr, 80);
+    chainActive.SetTip(vChain.back());
+
+    std::vector<uint64_t> vModifiers;
+    for (int i = 0; i < 10; i++) {
+        uint64_t nModifier = 0;
+        BOOST_CHECK(GetModifier(vChain[i], nModifier));
+        vModifiers.push_back(nModifier);
+    }
+    BOOST_CHECK(stakeModifierTable.Flush(pblocktree));
+
+    stakeModifierTable.Clear();
+    uint64_t nCached = 0;
+    BOOST_CHECK(!stakeModifierTable.Get(vChain[0], nCached));
+
+    BOOST_CHECK(stakeModifierTable.Load(pblocktree));
+    for (int i = 0; i < 10; i++) {
+        BOOST_CHECK(stakeModifierTable.Get(vChain[i], nCached));
+        BOOST_CHECK_EQUAL(nCached, vModifiers[i]);
+    }
+    BOOST_CHECK(!stakeModifierTable.Get(vChain[10], nCached));
+
+    // entries whose selected block is unknown are dropped on load
+    const std::vector<CBlockIndex*> vFork = AddBranch(vChain[30], 40);
+    chainActive.SetTip(vFork.back());
+    uint64_t nModifier = 0;
+    BOOST_CHECK(GetModifier(vChain[30], nModifier));
+    BOOST_CHECK(stakeModifierTable.Flush(pblocktree));
+    stakeModifierTable.Clear();
+    CBlockIndex* pindexSelected = vFork[34]; // height 65
+    const uint256 hashSelected = pindexSelected->GetBlockHash();
+    mapBlockIndex.erase(hashSelected);
+    BOOST_CHECK(stakeModifierTable.Load(pblocktree));
+    pindexSelected->phashBlock = &mapBlockIndex.insert(std::make_pair(hashSelected, pindexSelected)).first->first;
+    BOOST_CHECK(!stakeModifierTable.Get(vChain[30], nCached));
+    BOOST_CHECK(GetModifier(vChain[30], nCached));
+    BOOST_CHECK_EQUAL(nCached, nModifier);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,131 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests for the stake look-ahead of the minter
+//
+
+#include "kernel.h"
+#include "miner.h"
+#include "timedata.h"
+#include "test/test_oasis.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stakeschedule_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(stake_schedule_window)
+{
+    SeedInsecureRand();
+    const int nSlotLength = Params().GetConsensus().nTimeSlotLength;
+    const uint256 hashTip = InsecureRand256();
+    CBlockIndex indexPrev;
+    indexPrev.phashBlock = &hashTip;
+    indexPrev.nHeight = Params().GetConsensus().height_start_StakeModifierV2;
+    indexPrev.nTime = 1600000000 + 7;
+    const int64_t nTipSlot = GetTimeSlot(indexPrev.nTime);
+    BOOST_CHECK_EQUAL(nTipSlot % nSlotLength, 0);
+
+    // the window starts after the slot of the tip...
+    CStakeSchedule schedule;
+    BOOST_CHECK(schedule.NeedsUpdate(&indexPrev, nTipSlot, 0));
+    schedule.SetWindow(&indexPrev, nTipSlot, 0);
+    BOOST_CHECK_EQUAL(schedule.nSlotFrom, nTipSlot + nSlotLength);
+    BOOST_CHECK_EQUAL(schedule.nSlotTo, schedule.nSlotFrom + STAKE_LOOKAHEAD_SLOTS * nSlotLength);
+    BOOST_CHECK_EQUAL(schedule.nNextSlot, 0);
+
+    // ...or at the current slot if that is later
+    const int64_t nCurrentSlot = nTipSlot + 10 * nSlotLength;
+    schedule.nNextSlot = nCurrentSlot + nSlotLength;
+    schedule.SetWindow(&indexPrev, nCurrentSlot, 3);
+    BOOST_CHECK_EQUAL(schedule.nSlotFrom, nCurrentSlot);
+    BOOST_CHECK_EQUAL(schedule.nSlotTo, nCurrentSlot + STAKE_LOOKAHEAD_SLOTS * nSlotLength);
+    BOOST_CHECK_EQUAL(schedule.nNextSlot, 0);
+    BOOST_CHECK(!schedule.NeedsUpdate(&indexPrev, nCurrentSlot, 3));
+    BOOST_CHECK(!schedule.NeedsUpdate(&indexPrev, schedule.nSlotTo, 3));
+
+    // recomputed once the window is over
+    BOOST_CHECK(schedule.NeedsUpdate(&indexPrev, schedule.nSlotTo + nSlotLength, 3));
+
+    // or when the wallet's stake candidates changed
+    BOOST_CHECK(schedule.NeedsUpdate(&indexPrev, nCurrentSlot, 4));
+
+    // or when the winning slot passed without a new tip
+    schedule.nNextSlot = nCurrentSlot + 2 * nSlotLength;
+    BOOST_CHECK(!schedule.NeedsUpdate(&indexPrev, schedule.nNextSlot, 3));
+    BOOST_CHECK(schedule.NeedsUpdate(&indexPrev, schedule.nNextSlot + nSlotLength, 3));
+
+    // or on a new tip
+    const uint256 hashOther = InsecureRand256();
+    CBlockIndex indexOther(indexPrev);
+    indexOther.phashBlock = &hashOther;
+    BOOST_CHECK(schedule.NeedsUpdate(&indexOther, nCurrentSlot, 3));
+}
+
+BOOST_AUTO_TEST_CASE(stake_schedule_next_slot)
+{
+    SeedInsecureRand();
+    const Consensus::Params& consensus = Params().GetConsensus();
+    const int nSlotLength = consensus.nTimeSlotLength;
+    const unsigned int nBits = 0x1d00ffff;
+
+    // the stake depth is enforced from the RHF upgrade
+    CBlockIndex indexPrev;
+    indexPrev.nHeight = std::max(consensus.height_start_StakeModifierV2, consensus.height_RHF);
+    indexPrev.nTime = 1600000000;
+    const int64_t nSlotFrom = GetTimeSlot(indexPrev.nTime) + nSlotLength;
+    const int64_t nSlotTo = nSlotFrom + STAKE_LOOKAHEAD_SLOTS * nSlotLength;
+
+    // mature inputs, and a few too recent to stake
+    std::vector<CStakeKernelInput> vInputs(200);
+    for (unsigned int n = 0; n < vInputs.size(); n++) {
+        CStakeKernelInput& input = vInputs[n];
+        input.hashTx = InsecureRand256();
+        input.n = n;
+        input.nValue = (InsecureRandRange(8) + 1) * COIN;
+        input.nHeightBlockFrom = indexPrev.nHeight - (n % 10 == 0 ? 1 : 1000);
+        input.nTimeBlockFrom = 1590000000;
+    }
+
+    int nFound = 0;
+    for (int nRound = 0; nRound < 20; nRound++) {
+        indexPrev.SetStakeModifier(InsecureRand256());
+
+        // the first slot of the window where a mature input wins
+        int64_t nExpected = 0;
+        for (int64_t nSlot = nSlotFrom; nSlot <= nSlotTo && nExpected == 0; nSlot += nSlotLength) {
+            const CStakeKernelSlot slot(&indexPrev, nBits, nSlot);
+            for (const CStakeKernelInput& input : vInputs) {
+                if (slot.ContextCheck(input) && slot.CheckKernelHash(input)) {
+                    nExpected = nSlot;
+                    break;
+                }
+            }
+        }
+
+        int nHashes = 0;
+        const int64_t nNextSlot = FindNextStakeSlot(vInputs, &indexPrev, nBits, nSlotFrom, nSlotTo, nHashes);
+        BOOST_CHECK_EQUAL(nNextSlot, nExpected);
+        BOOST_CHECK(nHashes > 0);
+        if (nNextSlot != 0) {
+            BOOST_CHECK_EQUAL((nNextSlot - nSlotFrom) % nSlotLength, 0);
+            nFound++;
+        }
+    }
+    BOOST_CHECK(nFound > 0);
+
+    // inputs that aren't mature yet never win
+    std::vector<CStakeKernelInput> vImmature(vInputs);
+    for (CStakeKernelInput& input : vImmature)
+        input.nHeightBlockFrom = indexPrev.nHeight;
+    int nHashes = 0;
+    BOOST_CHECK_EQUAL(FindNextStakeSlot(vImmature, &indexPrev, 0x207fffff, nSlotFrom, nSlotTo, nHashes), 0);
+    BOOST_CHECK_EQUAL(nHashes, 0);
+
+    // no schedule before stake modifier v2
+    indexPrev.nHeight = consensus.height_start_StakeModifierV2 - 2;
+    BOOST_CHECK_EQUAL(FindNextStakeSlot(vInputs, &indexPrev, 0x207fffff, nSlotFrom, nSlotTo, nHashes), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,7 @@
 #include "util.h"
 #ifdef ENABLE_WALLET
 #include "wallet/db.h"
+#include "wallet/logdb.h"
 #include "wallet/wallet.h"
 #endif
 
@@ -46,6 +47,7 @@ TestingSetup::TestingSetup()
 {
 #ifdef ENABLE_WALLET
         bitdb.MakeMock();
+        logdb.MakeMock();
 #endif
         ClearDatadirCache();
         pathTemp = GetTempPath() / strprintf("test_oasis_%lu_%i", (unsigned long)GetTime(), (int)(InsecureRandRange(100000)));
@@ -89,6 +91,7 @@ TestingSetup::~TestingSetup()
 #ifdef ENABLE_WALLET
         bitdb.Flush(true);
         bitdb.Reset();
+        logdb.Flush(true);
 #endif
         boost::filesystem::remove_all(pathTemp);
 }
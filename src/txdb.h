@@ -7,6 +7,7 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "blockfilter.h"
 #include "leveldbwrapper.h"
 #include "main.h"
 #include "zpiv/zerocoin.h"
@@ -16,7 +17,7 @@
 #include <utility>
 #include <vector>
 
-class CCoins;
+class Coin;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -63,11 +64,14 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const;
-    bool HaveCoins(const uint256& txid) const;
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const;
+    bool HaveCoin(const COutPoint& outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Attempt to update from an older database format. Returns false on error or if interrupted.
+    bool Upgrade();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -94,6 +98,9 @@ public:
     bool WriteInt(const std::string& name, int nValue);
     bool ReadInt(const std::string& name, int& nValue);
     bool LoadBlockIndexGuts();
+    /** Kernel stake modifiers (v1) by block-from height: (modifier, hash of the block providing it) */
+    bool WriteStakeModifiers(const std::vector<std::pair<int, std::pair<uint64_t, uint256> > >& vModifiers);
+    bool ReadStakeModifiers(std::vector<std::pair<int, std::pair<uint64_t, uint256> > >& vModifiers);
 };
 
 /** Zerocoin database (zerocoin/) */
@@ -126,4 +133,23 @@ public:
     bool WipeAccChecksums();
 };
 
+/** Block filter index (blocks/filter/): the compact filter and filter header of each block, by block hash */
+class CBlockFilterDB : public CLevelDBWrapper
+{
+public:
+    CBlockFilterDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+private:
+    CBlockFilterDB(const CBlockFilterDB&);
+    void operator=(const CBlockFilterDB&);
+
+public:
+    /** Write a block's filter and header, and make the block the last one indexed */
+    bool WriteFilter(const CBlockFilter& filter, const uint256& hashHeader);
+    bool ReadFilter(const uint256& hashBlock, CBlockFilter& filter, uint256& hashHeader) const;
+    bool ReadFilterHeader(const uint256& hashBlock, uint256& hashHeader) const;
+    bool WriteBestBlock(const uint256& hashBlock);
+    bool ReadBestBlock(uint256& hashBlock) const;
+};
+
 #endif // BITCOIN_TXDB_H
@@ -11,6 +11,7 @@
 #include "protocol.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "wallet/logdb.h"
 
 #include <stdint.h>
 
@@ -22,6 +23,8 @@
 #include <boost/thread.hpp>
 #include <boost/version.hpp>
 
+#include <leveldb/db.h>
+
 
 
 unsigned int nWalletDBUpdated;
@@ -232,7 +235,77 @@ void CDBEnv::lsn_reset(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDBCursor::~CDBCursor()
+{
+    if (pcursor)
+        pcursor->close();
+    delete piter;
+}
+
+int CDBCursor::Read(CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    // CLogDB::NewIterator failed
+    if (!piter && !pcursor)
+        return EINVAL;
+    if (piter) {
+        if (fFlags == DB_SET_RANGE)
+            piter->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+        else if (fFlags != DB_NEXT)
+            return EINVAL;
+        else if (fStarted)
+            piter->Next();
+        else
+            piter->SeekToFirst();
+        fStarted = true;
+        if (!piter->Valid())
+            return piter->status().ok() ? DB_NOTFOUND : 99999;
+
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write(piter->key().data(), piter->key().size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        ssValue.write(piter->value().data(), piter->value().size());
+        return 0;
+    }
+
+    // Read at cursor
+    Dbt datKey;
+    if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
+        datKey.set_data(&ssKey[0]);
+        datKey.set_size(ssKey.size());
+    }
+    Dbt datValue;
+    if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE) {
+        datValue.set_data(&ssValue[0]);
+        datValue.set_size(ssValue.size());
+    }
+    datKey.set_flags(DB_DBT_MALLOC);
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pcursor->get(&datKey, &datValue, fFlags);
+    if (ret != 0)
+        return ret;
+    else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
+        return 99999;
+
+    // Convert to streams
+    ssKey.SetType(SER_DISK);
+    ssKey.clear();
+    ssKey.write((char*)datKey.get_data(), datKey.get_size());
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+    // Clear and free memory
+    memset(datKey.get_data(), 0, datKey.get_size());
+    memset(datValue.get_data(), 0, datValue.get_size());
+    free(datKey.get_data());
+    free(datValue.get_data());
+    return 0;
+}
+
+
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), plogdb(NULL), activeTxn(NULL), pbatchTxn(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -241,6 +314,23 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
         return;
 
     bool fCreate = strchr(pszMode, 'c') != NULL;
+
+    if (logdb.IsLogDB(strFilename, fCreate)) {
+        strFile = strFilename;
+        plogdb = logdb.Open(strFile);
+        if (plogdb == NULL) {
+            strFile = "";
+            throw std::runtime_error(strprintf("CDB : can't open database %s", strFilename));
+        }
+        if (fCreate && !Exists(std::string("version"))) {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        }
+        return;
+    }
+
     unsigned int nFlags = DB_THREAD;
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -294,9 +384,17 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
 void CDB::Flush()
 {
-    if (activeTxn)
+    if (activeTxn || pbatchTxn)
         return;
 
+    if (plogdb) {
+        // commit the changes held so far, the sync is left to ThreadFlushWalletDB; on failure
+        // they stay pending for the next commit
+        if (!fReadOnly && !plogdb->Commit(false))
+            LogPrintf("CDB::Flush : Failed to commit the changes to %s\n", strFile);
+        return;
+    }
+
     // Flush database activity from memory pool to disk log
     unsigned int nMinutes = 0;
     if (fReadOnly)
@@ -307,6 +405,14 @@ void CDB::Flush()
 
 void CDB::Close()
 {
+    if (plogdb) {
+        delete pbatchTxn;
+        pbatchTxn = NULL;
+        if (fFlushOnClose)
+            Flush();
+        plogdb = NULL;
+        return;
+    }
     if (!pdb)
         return;
     if (activeTxn)
@@ -323,6 +429,113 @@ void CDB::Close()
     }
 }
 
+CDBCursor* CDB::GetCursor()
+{
+    if (plogdb) {
+        leveldb::Iterator* piter = plogdb->NewIterator();
+        return piter ? new CDBCursor(piter) : NULL;
+    }
+    if (!pdb)
+        return NULL;
+    Dbc* pcursor = NULL;
+    int ret = pdb->cursor(NULL, &pcursor, 0);
+    if (ret != 0)
+        return NULL;
+    return new CDBCursor(pcursor);
+}
+
+bool CDB::TxnBegin()
+{
+    if (plogdb) {
+        if (pbatchTxn)
+            return false;
+        pbatchTxn = new CLogDBBatch();
+        return true;
+    }
+    if (!pdb || activeTxn)
+        return false;
+    DbTxn* ptxn = bitdb.TxnBegin();
+    if (!ptxn)
+        return false;
+    activeTxn = ptxn;
+    return true;
+}
+
+bool CDB::TxnCommit()
+{
+    if (plogdb) {
+        if (!pbatchTxn)
+            return false;
+        // transactions are the changes that must not be lost, such as the encrypted keys
+        bool fSuccess = plogdb->WriteBatch(*pbatchTxn, true);
+        delete pbatchTxn;
+        pbatchTxn = NULL;
+        return fSuccess;
+    }
+    if (!pdb || !activeTxn)
+        return false;
+    int ret = activeTxn->commit(0);
+    activeTxn = NULL;
+    return (ret == 0);
+}
+
+bool CDB::TxnAbort()
+{
+    if (plogdb) {
+        if (!pbatchTxn)
+            return false;
+        delete pbatchTxn;
+        pbatchTxn = NULL;
+        return true;
+    }
+    if (!pdb || !activeTxn)
+        return false;
+    int ret = activeTxn->abort();
+    activeTxn = NULL;
+    return (ret == 0);
+}
+
+bool CDB::ReadLog(const CDataStream& ssKey, CDataStream& ssValue)
+{
+    if (pbatchTxn) {
+        switch (pbatchTxn->Lookup(ssKey, ssValue)) {
+        case CLogDBBatch::WRITTEN:
+            return true;
+        case CLogDBBatch::ERASED:
+            return false;
+        case CLogDBBatch::NOT_CHANGED:
+            break;
+        }
+    }
+    return plogdb->Read(ssKey, ssValue);
+}
+
+bool CDB::WriteLog(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite && ExistsLog(ssKey))
+        return false;
+    if (pbatchTxn) {
+        pbatchTxn->Write(ssKey, ssValue);
+        return true;
+    }
+    return plogdb->Write(ssKey, ssValue);
+}
+
+bool CDB::EraseLog(const CDataStream& ssKey)
+{
+    if (pbatchTxn) {
+        pbatchTxn->Erase(ssKey);
+        return true;
+    }
+    return plogdb->Erase(ssKey);
+}
+
+bool CDB::ExistsLog(const CDataStream& ssKey)
+{
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    return ReadLog(ssKey, ssValue);
+}
+
 void CDBEnv::CloseDb(const std::string& strFile)
 {
     {
@@ -348,6 +561,41 @@ bool CDBEnv::RemoveDb(const std::string& strFile)
 
 bool CDB::Rewrite(const std::string& strFile, const char* pszSkip)
 {
+    if (logdb.Exists(strFile)) {
+        CLogDB* plogdbRewrite = logdb.Open(strFile);
+        if (!plogdbRewrite)
+            return false;
+        LogPrintf("CDB::Rewrite : Rewriting %s...\n", strFile);
+        CLogDBBatch batch;
+        {
+            CDBCursor cursor(plogdbRewrite->NewIterator());
+            while (true) {
+                CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+                CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+                int ret = cursor.Read(ssKey, ssValue, DB_NEXT);
+                if (ret == DB_NOTFOUND)
+                    break;
+                else if (ret != 0) {
+                    LogPrintf("CDB::Rewrite : Failed to rewrite database %s\n", strFile);
+                    return false;
+                }
+                if (pszSkip &&
+                    strncmp(&ssKey[0], pszSkip, std::min(ssKey.size(), strlen(pszSkip))) == 0)
+                    batch.Erase(ssKey);
+            }
+        }
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << std::string("version");
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << CLIENT_VERSION;
+        batch.Write(ssKey, ssValue);
+        if (!plogdbRewrite->WriteBatch(batch, true))
+            return false;
+        // drop the old values (the unencrypted keys, after EncryptWallet) from the disk
+        plogdbRewrite->Compact();
+        return true;
+    }
+
     while (true) {
         {
             LOCK(bitdb.cs_db);
@@ -375,17 +623,15 @@ bool CDB::Rewrite(const std::string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess) {
                             CDataStream ssKey(SER_DISK, CLIENT_VERSION);
                             CDataStream ssValue(SER_DISK, CLIENT_VERSION);
                             int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
                             if (ret == DB_NOTFOUND) {
-                                pcursor->close();
                                 break;
                             } else if (ret != 0) {
-                                pcursor->close();
                                 fSuccess = false;
                                 break;
                             }
@@ -403,6 +649,7 @@ bool CDB::Rewrite(const std::string& strFile, const char* pszSkip)
                             if (ret2 > 0)
                                 fSuccess = false;
                         }
+                    delete pcursor;
                     if (fSuccess) {
                         db.Close();
                         bitdb.CloseDb(strFile);
@@ -429,6 +676,171 @@ bool CDB::Rewrite(const std::string& strFile, const char* pszSkip)
     return false;
 }
 
+bool CDB::Migrate(const std::string& strFile)
+{
+    const boost::filesystem::path pathLogDb = CLogDBEnv::GetPath(strFile);
+    if (logdb.Exists(strFile))
+        return error("CDB::Migrate : %s already exists", pathLogDb.string());
+
+    LogPrintf("CDB::Migrate : Moving %s to %s...\n", strFile, pathLogDb.string());
+    int64_t nStart = GetTimeMillis();
+    unsigned int nRecords = 0;
+    bool fSuccess = true;
+    { // surround usage of db with extra {}
+        CDB db(strFile.c_str(), "r");
+        CLogDB* plogdbNew = logdb.Open(strFile);
+        CDBCursor* pcursor = plogdbNew ? db.GetCursor() : NULL;
+        if (!pcursor)
+            fSuccess = false;
+
+        CLogDBBatch batch;
+        while (fSuccess) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+            if (ret == DB_NOTFOUND) {
+                break;
+            } else if (ret != 0) {
+                fSuccess = false;
+                break;
+            }
+            batch.Write(ssKey, ssValue);
+            nRecords++;
+            if (batch.GetSize() > LOGDB_MAX_PENDING_SIZE) {
+                fSuccess = plogdbNew->WriteBatch(batch, false);
+                batch.Clear();
+            }
+        }
+        delete pcursor;
+        if (fSuccess)
+            fSuccess = plogdbNew->WriteBatch(batch, true);
+
+        // read everything back before letting go of the file: as many records, each of them
+        // found with the value of the Berkeley DB file
+        if (fSuccess) {
+            unsigned int nCopied = 0;
+            CDBCursor cursor(plogdbNew->NewIterator());
+            while (true) {
+                CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+                CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+                int ret = cursor.Read(ssKey, ssValue, DB_NEXT);
+                if (ret == DB_NOTFOUND)
+                    break;
+                else if (ret != 0) {
+                    fSuccess = false;
+                    break;
+                }
+                nCopied++;
+            }
+            if (fSuccess && nCopied != nRecords) {
+                LogPrintf("CDB::Migrate : Copied %u records of %u\n", nCopied, nRecords);
+                fSuccess = false;
+            }
+        }
+        if (fSuccess) {
+            pcursor = db.GetCursor();
+            if (!pcursor)
+                fSuccess = false;
+            while (fSuccess) {
+                CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+                CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+                CDataStream ssCopy(SER_DISK, CLIENT_VERSION);
+                int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+                if (ret == DB_NOTFOUND) {
+                    break;
+                } else if (ret != 0) {
+                    fSuccess = false;
+                } else if (!plogdbNew->Read(ssKey, ssCopy) || ssCopy.str() != ssValue.str()) {
+                    LogPrintf("CDB::Migrate : Record %s wasn't copied as it is\n", HexStr(ssKey.begin(), ssKey.end()));
+                    fSuccess = false;
+                }
+            }
+            delete pcursor;
+        }
+    }
+
+    if (fSuccess) {
+        LOCK(bitdb.cs_db);
+        bitdb.CloseDb(strFile);
+        bitdb.CheckpointLSN(strFile);
+        bitdb.mapFileUseCount.erase(strFile);
+
+        std::string strFileBak = strprintf("%s.%d.bak", strFile, GetTime());
+        if (bitdb.dbenv->dbrename(NULL, strFile.c_str(), NULL, strFileBak.c_str(), DB_AUTO_COMMIT) == 0) {
+            LogPrintf("CDB::Migrate : Renamed %s to %s\n", strFile, strFileBak);
+        } else {
+            LogPrintf("CDB::Migrate : Failed to rename %s to %s\n", strFile, strFileBak);
+            fSuccess = false;
+        }
+    }
+    if (!fSuccess) {
+        LogPrintf("CDB::Migrate : Failed to move %s, it is left as it was\n", strFile);
+        logdb.Remove(strFile);
+        return false;
+    }
+    LogPrintf("CDB::Migrate : Moved %u records in %dms\n", nRecords, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool CDB::Export(const std::string& strFile, const std::string& strFileDest)
+{
+    CLogDB* plogdbExport = logdb.Open(strFile);
+    if (!plogdbExport)
+        return false;
+
+    LOCK(bitdb.cs_db);
+    if (!bitdb.Open(GetDataDir()))
+        return error("CDB::Export : Failed to open database environment");
+    // a failed export may have left its file behind
+    if (boost::filesystem::exists(GetDataDir() / strFileDest))
+        bitdb.RemoveDb(strFileDest);
+
+    bool fSuccess = true;
+    Db* pdbCopy = new Db(bitdb.dbenv, 0);
+    int ret = pdbCopy->open(NULL, // Txn pointer
+        strFileDest.c_str(),      // Filename
+        "main",                   // Logical db name
+        DB_BTREE,                 // Database type
+        DB_CREATE,                // Flags
+        0);
+    if (ret > 0) {
+        LogPrintf("CDB::Export : Can't create database file %s\n", strFileDest);
+        fSuccess = false;
+    }
+
+    {
+        CDBCursor cursor(plogdbExport->NewIterator());
+        while (fSuccess) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = cursor.Read(ssKey, ssValue, DB_NEXT);
+            if (ret == DB_NOTFOUND) {
+                break;
+            } else if (ret != 0) {
+                fSuccess = false;
+                break;
+            }
+            Dbt datKey(&ssKey[0], ssKey.size());
+            Dbt datValue(&ssValue[0], ssValue.size());
+            int ret2 = pdbCopy->put(NULL, &datKey, &datValue, DB_NOOVERWRITE);
+            if (ret2 > 0)
+                fSuccess = false;
+        }
+    }
+    if (pdbCopy->close(0))
+        fSuccess = false;
+    delete pdbCopy;
+
+    if (fSuccess) {
+        // make the file self contained, to be copied out of the environment
+        bitdb.CheckpointLSN(strFileDest);
+        bitdb.lsn_reset(strFileDest);
+    } else {
+        LogPrintf("CDB::Export : Failed to export %s to %s\n", strFile, strFileDest);
+    }
+    return fSuccess;
+}
+
 
 void CDBEnv::Flush(bool fShutdown)
 {
@@ -0,0 +1,291 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/logdb.h"
+
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+#include <leveldb/db.h>
+
+CLogDBEnv logdb;
+
+//! Bytes already serialized, to be written as they are
+static CFlatData RawData(const char* pch, size_t nSize)
+{
+    return CFlatData((void*)pch, (void*)(pch + nSize));
+}
+
+static CFlatData RawData(const CDataStream& ss)
+{
+    return RawData(ss.empty() ? NULL : &ss[0], ss.size());
+}
+
+void CLogDBBatch::Write(const CDataStream& ssKey, const CDataStream& ssValue)
+{
+    const std::string strKey(ssKey.begin(), ssKey.end());
+    setErase.erase(strKey);
+    std::map<std::string, CDataStream>::iterator it = mapWrite.find(strKey);
+    if (it != mapWrite.end())
+        it->second = ssValue;
+    else
+        mapWrite.insert(std::make_pair(strKey, ssValue));
+    nSize += strKey.size() + ssValue.size();
+}
+
+void CLogDBBatch::Erase(const CDataStream& ssKey)
+{
+    const std::string strKey(ssKey.begin(), ssKey.end());
+    mapWrite.erase(strKey);
+    setErase.insert(strKey);
+    nSize += strKey.size();
+}
+
+void CLogDBBatch::Append(const CLogDBBatch& batch)
+{
+    // a key is either written or erased in a batch, so the order doesn't matter
+    for (const std::string& strKey : batch.setErase) {
+        mapWrite.erase(strKey);
+        setErase.insert(strKey);
+    }
+    for (const std::pair<const std::string, CDataStream>& item : batch.mapWrite) {
+        setErase.erase(item.first);
+        std::map<std::string, CDataStream>::iterator it = mapWrite.find(item.first);
+        if (it != mapWrite.end())
+            it->second = item.second;
+        else
+            mapWrite.insert(item);
+    }
+    nSize += batch.nSize;
+}
+
+CLogDBBatch::LookupResult CLogDBBatch::Lookup(const CDataStream& ssKey, CDataStream& ssValue) const
+{
+    const std::string strKey(ssKey.begin(), ssKey.end());
+    if (setErase.count(strKey))
+        return ERASED;
+    std::map<std::string, CDataStream>::const_iterator it = mapWrite.find(strKey);
+    if (it == mapWrite.end())
+        return NOT_CHANGED;
+    ssValue = it->second;
+    return WRITTEN;
+}
+
+void CLogDBBatch::Clear()
+{
+    mapWrite.clear();
+    setErase.clear();
+    nSize = 0;
+}
+
+
+CLogDB::CLogDB(const boost::filesystem::path& path, bool fMemory) : db(path, LOGDB_CACHE_SIZE, fMemory), fUnsynced(false)
+{
+}
+
+bool CLogDB::Read(const CDataStream& ssKey, CDataStream& ssValue) const
+{
+    {
+        LOCK(cs_pending);
+        switch (batchPending.Lookup(ssKey, ssValue)) {
+        case CLogDBBatch::WRITTEN:
+            return true;
+        case CLogDBBatch::ERASED:
+            return false;
+        case CLogDBBatch::NOT_CHANGED:
+            break;
+        }
+    }
+    return db.ReadStream(RawData(ssKey), ssValue);
+}
+
+bool CLogDB::Exists(const CDataStream& ssKey) const
+{
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    return Read(ssKey, ssValue);
+}
+
+bool CLogDB::Write(const CDataStream& ssKey, const CDataStream& ssValue)
+{
+    LOCK(cs_pending);
+    batchPending.Write(ssKey, ssValue);
+    if (batchPending.GetSize() > LOGDB_MAX_PENDING_SIZE)
+        return Commit(false);
+    return true;
+}
+
+bool CLogDB::Erase(const CDataStream& ssKey)
+{
+    LOCK(cs_pending);
+    batchPending.Erase(ssKey);
+    if (batchPending.GetSize() > LOGDB_MAX_PENDING_SIZE)
+        return Commit(false);
+    return true;
+}
+
+bool CLogDB::WriteBatch(const CLogDBBatch& batch, bool fSync)
+{
+    LOCK(cs_pending);
+    batchPending.Append(batch);
+    return Commit(fSync);
+}
+
+bool CLogDB::Commit(bool fSync)
+{
+    LOCK(cs_pending);
+    if (batchPending.IsEmpty() && !(fSync && fUnsynced))
+        return true;
+
+    CLevelDBBatch batch;
+    for (const std::string& strKey : batchPending.setErase)
+        batch.Erase(RawData(strKey.data(), strKey.size()));
+    for (const std::pair<const std::string, CDataStream>& item : batchPending.mapWrite)
+        batch.Write(RawData(item.first.data(), item.first.size()), RawData(item.second));
+
+    const int64_t nStart = GetTimeMillis();
+    const size_t nRecords = batchPending.mapWrite.size() + batchPending.setErase.size();
+    try {
+        db.WriteBatch(batch, fSync);
+    } catch (const leveldb_error& e) {
+        return error("%s : %s", __func__, e.what());
+    }
+    LogPrint("db", "%s : %u records%s, %dms\n", __func__, nRecords, fSync ? ", synced" : "", GetTimeMillis() - nStart);
+    batchPending.Clear();
+    fUnsynced = !fSync;
+    return true;
+}
+
+leveldb::Iterator* CLogDB::NewIterator()
+{
+    // the iterator wouldn't see the changes left pending
+    if (!Commit(false))
+        return NULL;
+    return db.NewIterator();
+}
+
+void CLogDB::Compact()
+{
+    Commit(true);
+    db.Compact();
+}
+
+
+CLogDBEnv::CLogDBEnv() : fMockDb(false)
+{
+}
+
+CLogDBEnv::~CLogDBEnv()
+{
+    for (std::pair<const std::string, CLogDB*>& item : mapDb)
+        delete item.second;
+    mapDb.clear();
+}
+
+void CLogDBEnv::MakeMock()
+{
+    LOCK(cs_logdb);
+    LogPrint("db", "CLogDBEnv::MakeMock\n");
+    fMockDb = true;
+}
+
+boost::filesystem::path CLogDBEnv::GetPath(const std::string& strFile)
+{
+    return GetDataDir() / "wallets" / strFile;
+}
+
+bool CLogDBEnv::Exists(const std::string& strFile)
+{
+    LOCK(cs_logdb);
+    if (mapDb.count(strFile))
+        return true;
+    return !fMockDb && boost::filesystem::is_directory(GetPath(strFile));
+}
+
+bool CLogDBEnv::IsLogDB(const std::string& strFile, bool fCreate)
+{
+    if (Exists(strFile))
+        return true;
+    return fCreate && GetArg("-walletdb", DEFAULT_WALLETDB) == "leveldb" &&
+           !boost::filesystem::exists(GetDataDir() / strFile);
+}
+
+CLogDB* CLogDBEnv::Open(const std::string& strFile)
+{
+    LOCK(cs_logdb);
+    std::map<std::string, CLogDB*>::iterator it = mapDb.find(strFile);
+    if (it != mapDb.end())
+        return it->second;
+
+    boost::this_thread::interruption_point();
+    const boost::filesystem::path path = GetPath(strFile);
+    CLogDB* pdb = NULL;
+    try {
+        if (!fMockDb)
+            TryCreateDirectory(path.parent_path());
+        pdb = new CLogDB(path, fMockDb);
+    } catch (const std::exception& e) {
+        LogPrintf("CLogDBEnv::Open : Error opening wallet database %s: %s\n", path.string(), e.what());
+        return NULL;
+    }
+    mapDb[strFile] = pdb;
+    return pdb;
+}
+
+bool CLogDBEnv::Remove(const std::string& strFile)
+{
+    LOCK(cs_logdb);
+    std::map<std::string, CLogDB*>::iterator it = mapDb.find(strFile);
+    if (it != mapDb.end()) {
+        delete it->second;
+        mapDb.erase(it);
+    }
+    if (fMockDb)
+        return true;
+    try {
+        boost::filesystem::remove_all(GetPath(strFile));
+    } catch (const boost::filesystem::filesystem_error& e) {
+        return error("CLogDBEnv::Remove : %s", e.what());
+    }
+    return true;
+}
+
+bool CLogDBEnv::Repair(const std::string& strFile)
+{
+    LOCK(cs_logdb);
+    std::map<std::string, CLogDB*>::iterator it = mapDb.find(strFile);
+    if (it != mapDb.end()) {
+        delete it->second;
+        mapDb.erase(it);
+    }
+    const boost::filesystem::path path = GetPath(strFile);
+    LogPrintf("CLogDBEnv::Repair : Repairing %s...\n", path.string());
+    leveldb::Status status = leveldb::RepairDB(path.string(), leveldb::Options());
+    if (!status.ok())
+        return error("CLogDBEnv::Repair : %s", status.ToString());
+    // like -salvagewallet of a wallet.dat, look for the transactions that may have been lost
+    SoftSetBoolArg("-rescan", true);
+    return true;
+}
+
+bool CLogDBEnv::Flush(bool fShutdown)
+{
+    int64_t nStart = GetTimeMillis();
+    bool fSuccess = true;
+    LOCK(cs_logdb);
+    for (std::pair<const std::string, CLogDB*>& item : mapDb) {
+        LogPrint("db", "CLogDBEnv::Flush : Flushing %s...\n", item.first);
+        if (!item.second->Commit(true)) {
+            LogPrintf("CLogDBEnv::Flush : Failed to commit %s\n", item.first);
+            fSuccess = false;
+        }
+    }
+    if (fShutdown) {
+        for (std::pair<const std::string, CLogDB*>& item : mapDb)
+            delete item.second;
+        mapDb.clear();
+    }
+    LogPrint("db", "CLogDBEnv::Flush : Flush(%s) took %15dms\n", fShutdown ? "true" : "false", GetTimeMillis() - nStart);
+    return fSuccess;
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_WALLET_LOGDB_H
+#define BITCOIN_WALLET_LOGDB_H
+
+#include "leveldbwrapper.h"
+#include "streams.h"
+#include "sync.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+//! Storage of the wallets created without a wallet file: "bdb" or "leveldb"
+static const char* const DEFAULT_WALLETDB = "bdb";
+//! Cache of a wallet database in LevelDB
+static const size_t LOGDB_CACHE_SIZE = 8 << 20;
+//! Size of the uncommitted changes to a wallet database at which they are written out
+static const size_t LOGDB_MAX_PENDING_SIZE = 4 << 20;
+
+/**
+ * Changes to a wallet database, as the serialized keys and values. A key is either written
+ * or erased, the last change to it wins.
+ */
+class CLogDBBatch
+{
+    friend class CLogDB;
+
+private:
+    std::map<std::string, CDataStream> mapWrite;
+    std::set<std::string> setErase;
+    size_t nSize;
+
+public:
+    enum LookupResult {
+        NOT_CHANGED,
+        WRITTEN,
+        ERASED
+    };
+
+    CLogDBBatch() : nSize(0) {}
+
+    void Write(const CDataStream& ssKey, const CDataStream& ssValue);
+    void Erase(const CDataStream& ssKey);
+    //! Apply the changes of another batch on top of these
+    void Append(const CLogDBBatch& batch);
+    //! What this batch does to ssKey, with the written value in ssValue
+    LookupResult Lookup(const CDataStream& ssKey, CDataStream& ssValue) const;
+
+    void Clear();
+    bool IsEmpty() const { return mapWrite.empty() && setErase.empty(); }
+    //! Approximate size of the changes, in bytes
+    size_t GetSize() const { return nSize; }
+};
+
+/**
+ * A wallet database in LevelDB (-walletdb=leveldb). Records keep the keys and values of
+ * the Berkeley DB wallet.dat, only the storage differs: every change is appended to
+ * LevelDB's log, so a write doesn't rewrite any page of the database.
+ *
+ * Writes are committed in groups. They are held in memory (and seen by the reads) until
+ * a CDB that flushes on close is closed, the pending changes outgrow
+ * LOGDB_MAX_PENDING_SIZE, or a cursor is opened; all of them are then written out as a
+ * single atomic batch. Commits are not synced to the disk, like the DB_TXN_WRITE_NOSYNC
+ * transactions of the Berkeley DB environment. Syncs are left to ThreadFlushWalletDB,
+ * shutdown and transactions (CDB::TxnCommit), so a burst of writes, such as those of a
+ * new stake, costs a single sync.
+ */
+class CLogDB
+{
+private:
+    CLevelDBWrapper db;
+
+    mutable RecursiveMutex cs_pending;
+    //! changes not written to LevelDB yet
+    CLogDBBatch batchPending;
+    //! whether changes were written to LevelDB without a sync since the last one
+    bool fUnsynced;
+
+public:
+    CLogDB(const boost::filesystem::path& path, bool fMemory);
+
+    bool Read(const CDataStream& ssKey, CDataStream& ssValue) const;
+    bool Exists(const CDataStream& ssKey) const;
+    //! False if the change outgrew the pending changes and committing them failed (they are kept pending)
+    bool Write(const CDataStream& ssKey, const CDataStream& ssValue);
+    bool Erase(const CDataStream& ssKey);
+    //! Add the changes of batch and commit them all at once
+    bool WriteBatch(const CLogDBBatch& batch, bool fSync);
+
+    //! Write the pending changes to LevelDB, and sync them (and any earlier unsynced ones) if fSync
+    bool Commit(bool fSync);
+    //! Iterator over the committed records, in key order (commits the pending changes first); NULL if that commit fails
+    leveldb::Iterator* NewIterator();
+    //! Drop the overwritten and erased values from the disk
+    void Compact();
+};
+
+/** The wallet databases kept in LevelDB, each in its directory of GetDataDir()/wallets */
+class CLogDBEnv
+{
+private:
+    bool fMockDb;
+    std::map<std::string, CLogDB*> mapDb;
+
+public:
+    mutable RecursiveMutex cs_logdb;
+
+    CLogDBEnv();
+    ~CLogDBEnv();
+
+    void MakeMock();
+    bool IsMock() { return fMockDb; }
+
+    static boost::filesystem::path GetPath(const std::string& strFile);
+    //! Whether the wallet database strFile is kept in LevelDB
+    bool Exists(const std::string& strFile);
+    /**
+     * Whether CDB should open strFile in LevelDB: it is there already, or a new
+     * wallet is created (fCreate, no Berkeley DB file of that name) with -walletdb=leveldb.
+     */
+    bool IsLogDB(const std::string& strFile, bool fCreate);
+
+    //! Open the database strFile, creating it if needed; NULL on failure
+    CLogDB* Open(const std::string& strFile);
+    //! Close the database strFile and delete it from the disk
+    bool Remove(const std::string& strFile);
+    //! Close the database strFile and rebuild it from whatever LevelDB can read of it (-salvagewallet)
+    bool Repair(const std::string& strFile);
+
+    //! Commit and sync the pending changes of all the databases, and close them on shutdown; false if a commit failed
+    bool Flush(bool fShutdown);
+};
+
+extern CLogDBEnv logdb;
+
+#endif // BITCOIN_WALLET_LOGDB_H
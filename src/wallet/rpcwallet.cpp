@@ -45,6 +45,12 @@ void EnsureWalletIsUnlocked(bool fAllowAnonOnly)
         throw JSONRPCError(RPC_WALLET_UNLOCK_NEEDED, "Error: Please enter the wallet passphrase with walletpassphrase first.");
 }
 
+void EnsureWalletIsNotScanning()
+{
+    if (pwalletMain->IsScanning())
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort existing rescan or wait.");
+}
+
 void EnsureWallet()
 {
     if (!pwalletMain)
@@ -2934,6 +2940,11 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"paytxfee\": x.xxxx                       (numeric) the transaction fee configuration, set in XOS/kB\n"
             "  \"hdseedid\": \"<hash160>\"            (string, optional) the Hash160 of the HD seed (only present when HD is enabled)\n"
+            "  \"scanning\":                            (json object) current scanning details, or false if no scan is in progress\n"
+            "    {\n"
+            "      \"duration\" : xxxx                  (numeric) elapsed seconds since scan start\n"
+            "      \"progress\" : x.xxxx,               (numeric) scanning progress percentage [0.0, 1.0]\n"
+            "    }\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -2981,9 +2992,41 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
         obj.push_back(Pair("hdaccounts", accounts));
     }
     obj.push_back(Pair("paytxfee",      ValueFromAmount(payTxFee.GetFeePerK())));
+    if (pwalletMain->IsScanning()) {
+        UniValue scanning(UniValue::VOBJ);
+        scanning.push_back(Pair("duration", pwalletMain->ScanningDuration() / 1000));
+        scanning.push_back(Pair("progress", pwalletMain->ScanningProgress()));
+        obj.push_back(Pair("scanning", scanning));
+    } else {
+        obj.push_back(Pair("scanning", false));
+    }
     return obj;
 }
 
+UniValue abortrescan(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw std::runtime_error(
+            "abortrescan\n"
+            "\nStops the current wallet rescan triggered by an RPC call, e.g. by an importprivkey call.\n"
+
+            "\nResult:\n"
+            "true|false    (boolean) Whether the abort was successful\n"
+
+            "\nExamples:\n"
+            "\nImport a private key\n" +
+            HelpExampleCli("importprivkey", "\"mykey\"") +
+            "\nAbort the running wallet rescan\n" +
+            HelpExampleCli("abortrescan", "") +
+            "\nAs a JSON-RPC call\n" +
+            HelpExampleRpc("abortrescan", ""));
+
+    if (!pwalletMain->IsScanning() || pwalletMain->IsAbortingRescan())
+        return false;
+    pwalletMain->AbortRescan();
+    return true;
+}
+
 UniValue setstakesplitthreshold(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -3351,81 +3394,92 @@ UniValue upgradetohd(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_WALLET_ERROR, "Cannot upgrade a encrypted wallet to hd without the password");
     }
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
+    EnsureWalletIsNotScanning();
 
-    // Do not do anything to HD wallets
-    if (pwalletMain->IsHDEnabled()) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Cannot upgrade a wallet to hd if It is already upgraded to hd.");
-    }
+    CBlockIndex* pindexRescan;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+
+        // Do not do anything to HD wallets
+        if (pwalletMain->IsHDEnabled()) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Cannot upgrade a wallet to hd if It is already upgraded to hd.");
+        }
 
-    EnsureWalletIsUnlocked(pwalletMain);
+        EnsureWalletIsUnlocked(pwalletMain);
 
-    std::string words = params[0].get_str();
+        std::string words = params[0].get_str();
 
-    int prev_version = pwalletMain->GetVersion();
+        int prev_version = pwalletMain->GetVersion();
 
-    int nMaxVersion = GetArg("-upgradewallet", 0);
-    if (nMaxVersion == 0) // the -upgradewallet without argument case
-    {
-        LogPrintf("Performing wallet upgrade to %i\n", FEATURE_LATEST);
-        nMaxVersion = CLIENT_VERSION;
-        pwalletMain->SetMinVersion(FEATURE_LATEST); // permanently upgrade the wallet immediately
-    } else
-        LogPrintf("Allowing wallet upgrade up to %i\n", nMaxVersion);
-    if (nMaxVersion < pwalletMain->GetVersion()) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Cannot downgrade wallet");
-    }
+        int nMaxVersion = GetArg("-upgradewallet", 0);
+        if (nMaxVersion == 0) // the -upgradewallet without argument case
+        {
+            LogPrintf("Performing wallet upgrade to %i\n", FEATURE_LATEST);
+            nMaxVersion = CLIENT_VERSION;
+            pwalletMain->SetMinVersion(FEATURE_LATEST); // permanently upgrade the wallet immediately
+        } else
+            LogPrintf("Allowing wallet upgrade up to %i\n", nMaxVersion);
+        if (nMaxVersion < pwalletMain->GetVersion()) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Cannot downgrade wallet");
+        }
 
-    pwalletMain->SetMaxVersion(nMaxVersion);
+        pwalletMain->SetMaxVersion(nMaxVersion);
 
-    // Do not upgrade versions to any version between HD_SPLIT and FEATURE_PRE_SPLIT_KEYPOOL unless already supporting HD_SPLIT
-    int max_version = pwalletMain->GetVersion();
-    if (!pwalletMain->CanSupportFeature(FEATURE_HD) && max_version >=FEATURE_HD && max_version < FEATURE_PRE_SPLIT_KEYPOOL) {
-        throw JSONRPCError(RPC_WALLET_ERROR, "Cannot upgrade a non HD split wallet without upgrading to support pre split keypool. Please use -upgradewallet=169900 or -upgradewallet with no version specified.");
-    }
+        // Do not upgrade versions to any version between HD_SPLIT and FEATURE_PRE_SPLIT_KEYPOOL unless already supporting HD_SPLIT
+        int max_version = pwalletMain->GetVersion();
+        if (!pwalletMain->CanSupportFeature(FEATURE_HD) && max_version >=FEATURE_HD && max_version < FEATURE_PRE_SPLIT_KEYPOOL) {
+            throw JSONRPCError(RPC_WALLET_ERROR, "Cannot upgrade a non HD split wallet without upgrading to support pre split keypool. Please use -upgradewallet=169900 or -upgradewallet with no version specified.");
+        }
 
-    bool hd_upgrade = false;
-    bool split_upgrade = false;
-    if (pwalletMain->CanSupportFeature(FEATURE_HD) && !pwalletMain->IsHDEnabled()) {
-        LogPrintf("Upgrading wallet to HD\n");
-        pwalletMain->SetMinVersion(FEATURE_HD);
+        bool hd_upgrade = false;
+        bool split_upgrade = false;
+        if (pwalletMain->CanSupportFeature(FEATURE_HD) && !pwalletMain->IsHDEnabled()) {
+            LogPrintf("Upgrading wallet to HD\n");
+            pwalletMain->SetMinVersion(FEATURE_HD);
 
-        // generate a new master key
-        SecureString strWalletPass;
-        strWalletPass.reserve(100);
+            // generate a new master key
+            SecureString strWalletPass;
+            strWalletPass.reserve(100);
 
-        // TODO: get rid of this .c_str() by implementing SecureString::operator=(std::string)
-        // Alternately, find a way to make params[0] mlock()'d to begin with.
-        if (params.size() < 2){
-            strWalletPass = std::string().c_str();
-        } else {
-            strWalletPass = params[1].get_str().c_str();
-        }
+            // TODO: get rid of this .c_str() by implementing SecureString::operator=(std::string)
+            // Alternately, find a way to make params[0] mlock()'d to begin with.
+            if (params.size() < 2){
+                strWalletPass = std::string().c_str();
+            } else {
+                strWalletPass = params[1].get_str().c_str();
+            }
 
-        pwalletMain->GenerateNewHDChain(words, strWalletPass);
+            pwalletMain->GenerateNewHDChain(words, strWalletPass);
 
-        hd_upgrade = true;
-    }
+            hd_upgrade = true;
+        }
 
-    // Upgrade to HD chain split if necessary
-    if (pwalletMain->CanSupportFeature(FEATURE_HD)) {
-        LogPrintf("Upgrading wallet to use HD chain split\n");
-        pwalletMain->SetMinVersion(FEATURE_PRE_SPLIT_KEYPOOL);
-        split_upgrade = FEATURE_HD > prev_version;
-    }
+        // Upgrade to HD chain split if necessary
+        if (pwalletMain->CanSupportFeature(FEATURE_HD)) {
+            LogPrintf("Upgrading wallet to use HD chain split\n");
+            pwalletMain->SetMinVersion(FEATURE_PRE_SPLIT_KEYPOOL);
+            split_upgrade = FEATURE_HD > prev_version;
+        }
 
-    // Mark all keys currently in the keypool as pre-split
-    if (split_upgrade) {
-        pwalletMain->MarkPreSplitKeys();
-    }
-    // Regenerate the keypool if upgraded to HD
-    if (hd_upgrade) {
-        if (!pwalletMain->TopUpKeyPool()) {
-            throw JSONRPCError(RPC_WALLET_ERROR, "Unable to generate keys\n");
+        // Mark all keys currently in the keypool as pre-split
+        if (split_upgrade) {
+            pwalletMain->MarkPreSplitKeys();
         }
+        // Regenerate the keypool if upgraded to HD
+        if (hd_upgrade) {
+            if (!pwalletMain->TopUpKeyPool()) {
+                throw JSONRPCError(RPC_WALLET_ERROR, "Unable to generate keys\n");
+            }
+        }
+
+        pindexRescan = chainActive.Genesis();
     }
 
-    pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+    int ret = pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+    if (ret == -2)
+        throw JSONRPCError(RPC_WALLET_ERROR, "Wallet is currently rescanning. Abort existing rescan or wait.");
+    if (ret == -1)
+        throw JSONRPCError(RPC_MISC_ERROR, "Rescan aborted by user.");
 
     return NullUniValue;
 }
@@ -0,0 +1,136 @@
+// Copyright (c) 2020 The oasis developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "wallet/logdb.h"
+#include "wallet/wallet.h"
+#include "wallet/walletdb.h"
+
+#include "key.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+#include "test_oasis.h"
+
+/** Creates the new wallet databases in LevelDB */
+struct LogDBTestingSetup : public TestingSetup {
+    LogDBTestingSetup() { mapArgs["-walletdb"] = "leveldb"; }
+    ~LogDBTestingSetup() { mapArgs.erase("-walletdb"); }
+};
+
+BOOST_FIXTURE_TEST_SUITE(logdb_tests, LogDBTestingSetup)
+
+static CKeyPool NewKeyPool()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    return CKeyPool(key.GetPubKey(), false);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_batch)
+{
+    CLogDBBatch batch;
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION), ssRead(SER_DISK, CLIENT_VERSION);
+    ssKey << std::string("name") << 1;
+    ssValue << std::string("first");
+    BOOST_CHECK(batch.IsEmpty());
+    BOOST_CHECK(batch.Lookup(ssKey, ssRead) == CLogDBBatch::NOT_CHANGED);
+
+    batch.Write(ssKey, ssValue);
+    BOOST_CHECK(batch.Lookup(ssKey, ssRead) == CLogDBBatch::WRITTEN);
+    BOOST_CHECK(ssRead.str() == ssValue.str());
+
+    // the last change to a key wins
+    CLogDBBatch batch2;
+    batch2.Erase(ssKey);
+    batch.Append(batch2);
+    BOOST_CHECK(batch.Lookup(ssKey, ssRead) == CLogDBBatch::ERASED);
+    batch.Write(ssKey, ssValue);
+    BOOST_CHECK(batch.Lookup(ssKey, ssRead) == CLogDBBatch::WRITTEN);
+
+    batch.Clear();
+    BOOST_CHECK(batch.IsEmpty());
+    BOOST_CHECK_EQUAL(batch.GetSize(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(logdb_walletdb)
+{
+    const std::string strFile = "logdb_walletdb.dat";
+    const CKeyPool keypool1 = NewKeyPool(), keypool2 = NewKeyPool();
+    CKeyPool keypool;
+    // the writes of a database that doesn't flush on close are held back, but seen
+    {
+        CWalletDB walletdb(strFile, "cr+", false);
+        BOOST_CHECK(logdb.Exists(strFile));
+        BOOST_CHECK(walletdb.WritePool(1, keypool1));
+        BOOST_CHECK(walletdb.ReadPool(1, keypool));
+        BOOST_CHECK(keypool.vchPubKey == keypool1.vchPubKey);
+    }
+
+    {
+        CWalletDB walletdb(strFile, "r+");
+        BOOST_CHECK(walletdb.ReadPool(1, keypool));
+        BOOST_CHECK(keypool.vchPubKey == keypool1.vchPubKey);
+
+        // an aborted transaction leaves nothing behind
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WritePool(2, keypool2));
+        BOOST_CHECK(walletdb.ErasePool(1));
+        BOOST_CHECK(walletdb.ReadPool(2, keypool));
+        BOOST_CHECK(!walletdb.ReadPool(1, keypool));
+        BOOST_CHECK(walletdb.TxnAbort());
+        BOOST_CHECK(!walletdb.ReadPool(2, keypool));
+        BOOST_CHECK(walletdb.ReadPool(1, keypool));
+
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WritePool(2, keypool2));
+        BOOST_CHECK(walletdb.TxnCommit());
+    }
+    {
+        CWalletDB walletdb(strFile, "r");
+        BOOST_CHECK(walletdb.ReadPool(2, keypool));
+        BOOST_CHECK(keypool.vchPubKey == keypool2.vchPubKey);
+    }
+
+    // rewriting drops the skipped records
+    BOOST_CHECK(CDB::Rewrite(strFile, "\x04pool"));
+    {
+        CWalletDB walletdb(strFile, "r");
+        BOOST_CHECK(!walletdb.ReadPool(1, keypool));
+        BOOST_CHECK(!walletdb.ReadPool(2, keypool));
+        int nVersion;
+        BOOST_CHECK(walletdb.ReadVersion(nVersion));
+        BOOST_CHECK_EQUAL(nVersion, CLIENT_VERSION);
+    }
+    BOOST_CHECK(logdb.Remove(strFile));
+    BOOST_CHECK(!logdb.Exists(strFile));
+}
+
+BOOST_AUTO_TEST_CASE(logdb_loadwallet)
+{
+    const std::string strFile = "logdb_loadwallet.dat";
+    CKey key;
+    key.MakeNewKey(true);
+    const CKeyID keyID = key.GetPubKey().GetID();
+    bool fFirstRun;
+    {
+        CWallet wallet(strFile);
+        BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+        BOOST_CHECK(fFirstRun);
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK(wallet.AddKeyPubKey(key, key.GetPubKey()));
+        BOOST_CHECK(wallet.SetAddressBook(keyID, "logdb", "receive"));
+    }
+
+    // the records are read back with a cursor over the LevelDB database
+    CWallet wallet(strFile);
+    BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+    BOOST_CHECK(!fFirstRun);
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK(wallet.HaveKey(keyID));
+    BOOST_CHECK(wallet.mapAddressBook.count(keyID));
+    BOOST_CHECK_EQUAL(wallet.mapAddressBook[keyID].name, "logdb");
+    BOOST_CHECK(logdb.Remove(strFile));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,10 @@
 
 #include "wallet/wallet.h"
 
+#include "consensus/merkle.h"
+#include "random.h"
+#include "txmempool.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -23,6 +27,8 @@
 
 typedef std::set<std::pair<const CWalletTx*,unsigned int> > CoinSet;
 
+extern CWallet* pwalletMain;
+
 BOOST_FIXTURE_TEST_SUITE(wallet_tests, TestingSetup)
 
 static CWallet wallet;
@@ -305,4 +311,214 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(available_coins_unspent_index)
+{
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    CKey key;
+    key.MakeNewKey(true);
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    // the cached balances are checked against a full scan on every read
+    fCheckBalances = true;
+
+    // a payment to us (and to someone else), in the mempool
+    CMutableTransaction txPay;
+    txPay.vin.resize(1);
+    txPay.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txPay.vout.resize(2);
+    txPay.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    txPay.vout[0].nValue = 5 * COIN;
+    txPay.vout[1].scriptPubKey = CScript() << OP_TRUE;
+    txPay.vout[1].nValue = COIN;
+    mempool.addUnchecked(txPay.GetHash(), CTxMemPoolEntry(txPay, 0, 0, 0.0, 1));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, txPay), false, &walletdb));
+
+    std::vector<COutput> vAvailable;
+    BOOST_CHECK(pwalletMain->AvailableCoins(&vAvailable, false));
+    BOOST_REQUIRE_EQUAL(vAvailable.size(), 1U);
+    BOOST_CHECK(vAvailable[0].tx->GetHash() == txPay.GetHash());
+    BOOST_CHECK_EQUAL(vAvailable[0].i, 0);
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), 5 * COIN);
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), 0);
+
+    // spent by a wallet transaction, also once the index is rebuilt from mapWallet
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(txPay.GetHash(), 0);
+    txSpend.vout.resize(1);
+    txSpend.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    txSpend.vout[0].nValue = 4 * COIN;
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, txSpend), false, &walletdb));
+    BOOST_CHECK(!pwalletMain->AvailableCoins(&vAvailable, false));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), 0);
+    pwalletMain->MarkDirty();
+    BOOST_CHECK(!pwalletMain->AvailableCoins(&vAvailable, false));
+
+    // abandoning the spender makes the output available again
+    BOOST_CHECK(pwalletMain->AbandonTransaction(txSpend.GetHash()));
+    BOOST_CHECK(pwalletMain->AvailableCoins(&vAvailable, false));
+    BOOST_CHECK_EQUAL(vAvailable.size(), 1U);
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), 5 * COIN);
+
+    // locked coins move to the locked balance once confirmed, not before
+    pwalletMain->LockCoin(COutPoint(txPay.GetHash(), 0));
+    BOOST_CHECK(!pwalletMain->AvailableCoins(&vAvailable, false));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), 5 * COIN);
+    BOOST_CHECK_EQUAL(pwalletMain->GetLockedCoins(), 0);
+    pwalletMain->UnlockAllCoins();
+
+    fCheckBalances = false;
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(rescan_filter)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    const CScript scriptRedeem = GetScriptForMultisig(1, std::vector<CPubKey>(1, keyOther.GetPubKey()));
+    const CScript scriptWatch = CScript() << OP_RETURN << ToByteVector(GetRandHash());
+
+    CWalletScanFilter filter;
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+        BOOST_CHECK(pwalletMain->AddCScript(scriptRedeem));
+        BOOST_CHECK(pwalletMain->AddWatchOnly(scriptWatch));
+        filter = pwalletMain->GetScanFilter();
+    }
+
+    // our key in every output template, a script we know and a watched script
+    BOOST_CHECK(filter.IsRelevant(GetScriptForDestination(key.GetPubKey().GetID())));
+    BOOST_CHECK(filter.IsRelevant(CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG));
+    BOOST_CHECK(filter.IsRelevant(GetScriptForStakeDelegation(keyOther.GetPubKey().GetID(), key.GetPubKey().GetID())));
+    BOOST_CHECK(filter.IsRelevant(GetScriptForStakeDelegation(key.GetPubKey().GetID(), keyOther.GetPubKey().GetID())));
+    BOOST_CHECK(filter.IsRelevant(GetScriptForMultisig(1, {keyOther.GetPubKey(), key.GetPubKey()})));
+    BOOST_CHECK(filter.IsRelevant(GetScriptForDestination(CScriptID(scriptRedeem))));
+    BOOST_CHECK(filter.IsRelevant(scriptWatch));
+    BOOST_CHECK(!filter.IsRelevant(GetScriptForDestination(keyOther.GetPubKey().GetID())));
+    BOOST_CHECK(!filter.IsRelevant(CScript() << OP_TRUE));
+
+    // a payment to someone else is only picked up when it spends a wallet transaction
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = GetScriptForDestination(keyOther.GetPubKey().GetID());
+    tx.vout[0].nValue = COIN;
+    BOOST_CHECK(!filter.IsRelevant(CTransaction(tx)));
+    filter.AddTx(tx.vin[0].prevout.hash);
+    BOOST_CHECK(filter.IsRelevant(CTransaction(tx)));
+
+    // or double-spends an output a wallet transaction spends
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 1);
+    BOOST_CHECK(!filter.IsRelevant(CTransaction(tx)));
+    filter.AddSpent(tx.vin[0].prevout);
+    BOOST_CHECK(filter.IsRelevant(CTransaction(tx)));
+    tx.vin[0].prevout.n = 0;
+    BOOST_CHECK(!filter.IsRelevant(CTransaction(tx)));
+}
+
+// Connect a block with vtx on top of the active chain, and let the wallet see it
+static CBlockIndex* ConnectWalletBlock(const std::vector<CMutableTransaction>& vtx)
+{
+    AssertLockHeld(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    CBlock block;
+    block.nVersion = 3;
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.nTime = pindexPrev->nTime + 60;
+    for (const CMutableTransaction& tx : vtx)
+        block.vtx.push_back(tx);
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    CBlockIndex* pindex = new CBlockIndex(block);
+    BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(block.GetHash(), pindex)).first;
+    pindex->phashBlock = &mi->first;
+    pindex->pprev = pindexPrev;
+    pindex->nHeight = pindexPrev->nHeight + 1;
+    pindex->BuildSkip();
+    chainActive.SetTip(pindex);
+    for (const CTransaction& tx : block.vtx)
+        pwalletMain->SyncTransaction(tx, &block);
+    return pindex;
+}
+
+// The stake candidates on top of a block at nHeight, checked against a full rebuild
+static std::set<COutPoint> GetStakeCandidates(int nHeight)
+{
+    CBlockIndex indexTip;
+    indexTip.nHeight = nHeight;
+    std::set<COutPoint> setCandidates, setRebuilt;
+    std::vector<CStakeCandidate> vCandidates;
+    pwalletMain->GetStakeCandidates(&indexTip, vCandidates);
+    for (const CStakeCandidate& candidate : vCandidates)
+        setCandidates.emplace(candidate.tx->GetHash(), candidate.i);
+
+    pwalletMain->MarkStakeCandidatesDirty();
+    pwalletMain->GetStakeCandidates(&indexTip, vCandidates);
+    for (const CStakeCandidate& candidate : vCandidates)
+        setRebuilt.emplace(candidate.tx->GetHash(), candidate.i);
+    BOOST_CHECK(setCandidates == setRebuilt);
+    return setCandidates;
+}
+
+static CMutableTransaction CreatePayment(const COutPoint& prevout, const CScript& scriptPubKey, std::vector<CAmount> vValues)
+{
+    CMutableTransaction tx;
+    tx.vin.emplace_back(prevout);
+    for (const CAmount& nValue : vValues)
+        tx.vout.emplace_back(nValue, scriptPubKey);
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(stake_candidates_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+    const int nMinDepth = Params().GetConsensus().nStakeMinDepth;
+
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    BOOST_CHECK(GetStakeCandidates(nMinDepth).empty());
+
+    // received: candidates once mature
+    unsigned int nVersion = pwalletMain->GetStakeCandidatesVersion();
+    const CMutableTransaction txReceive = CreatePayment(COutPoint(GetRandHash(), 0), scriptMine, {10 * COIN, 20 * COIN});
+    const int nHeight1 = ConnectWalletBlock({txReceive})->nHeight;
+    BOOST_CHECK(pwalletMain->GetStakeCandidatesVersion() != nVersion);
+    const COutPoint out1(txReceive.GetHash(), 0), out2(txReceive.GetHash(), 1);
+    BOOST_CHECK(GetStakeCandidates(nHeight1 + nMinDepth - 2).empty());
+    BOOST_CHECK(GetStakeCandidates(nHeight1 + nMinDepth - 1) == std::set<COutPoint>({out1, out2}));
+
+    // received later: mature one block later
+    const CMutableTransaction txReceive2 = CreatePayment(COutPoint(GetRandHash(), 0), scriptMine, {30 * COIN});
+    ConnectWalletBlock({txReceive2});
+    const COutPoint out3(txReceive2.GetHash(), 0);
+    BOOST_CHECK(GetStakeCandidates(nHeight1 + nMinDepth - 1) == std::set<COutPoint>({out1, out2}));
+    BOOST_CHECK(GetStakeCandidates(nHeight1 + nMinDepth) == std::set<COutPoint>({out1, out2, out3}));
+
+    // spent in the mempool
+    nVersion = pwalletMain->GetStakeCandidatesVersion();
+    const CMutableTransaction txSpend = CreatePayment(out1, CScript() << OP_TRUE, {9 * COIN});
+    pwalletMain->SyncTransaction(txSpend, nullptr);
+    BOOST_CHECK(pwalletMain->GetStakeCandidatesVersion() != nVersion);
+    BOOST_CHECK(GetStakeCandidates(nHeight1 + nMinDepth) == std::set<COutPoint>({out2, out3}));
+
+    // spent in a block, to a new output of ours
+    const CMutableTransaction txSpend2 = CreatePayment(out2, scriptMine, {19 * COIN});
+    const int nHeight3 = ConnectWalletBlock({txSpend2})->nHeight;
+    const COutPoint out4(txSpend2.GetHash(), 0);
+    BOOST_CHECK(GetStakeCandidates(nHeight1 + nMinDepth) == std::set<COutPoint>({out3}));
+    BOOST_CHECK(GetStakeCandidates(nHeight3 + nMinDepth - 1) == std::set<COutPoint>({out3, out4}));
+
+    // locked coins can't stake
+    pwalletMain->LockCoin(out3);
+    BOOST_CHECK(GetStakeCandidates(nHeight3 + nMinDepth - 1) == std::set<COutPoint>({out4}));
+    pwalletMain->UnlockCoin(out3);
+    BOOST_CHECK(GetStakeCandidates(nHeight3 + nMinDepth - 1) == std::set<COutPoint>({out3, out4}));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -28,6 +28,7 @@ CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
 CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 unsigned int nTxConfirmTarget = 1;
 bool bSpendZeroConfChange = true;
+bool fCheckBalances = false;
 bool bdisableSystemnotifications = false; // Those bubbles can be annoying and slow down the UI when you get lots of trx
 bool fSendFreeTransactions = false;
 bool fPayAtLeastCustomFee = true;
@@ -381,6 +382,8 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    MarkUnspentDirty();
+    MarkStakeCandidatesDirty();
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -405,6 +408,8 @@ bool CWallet::AddWatchOnly(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    MarkUnspentDirty();
+    MarkStakeCandidatesDirty();
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -417,6 +422,8 @@ bool CWallet::RemoveWatchOnly(const CScript& dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveWatchOnly(dest))
         return false;
+    fWalletUnspentDirty = true;
+    MarkStakeCandidatesDirty();
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -435,6 +442,8 @@ bool CWallet::AddMultiSig(const CScript& dest)
 {
     if (!CCryptoKeyStore::AddMultiSig(dest))
         return false;
+    MarkUnspentDirty();
+    MarkStakeCandidatesDirty();
     nTimeFirstKey = 1; // No birthday information
     NotifyMultiSigChanged(true);
     if (!fFileBacked)
@@ -447,6 +456,8 @@ bool CWallet::RemoveMultiSig(const CScript& dest)
     AssertLockHeld(cs_wallet);
     if (!CCryptoKeyStore::RemoveMultiSig(dest))
         return false;
+    fWalletUnspentDirty = true;
+    MarkStakeCandidatesDirty();
     if (!HaveMultiSig())
         NotifyMultiSigChanged(false);
     if (fFileBacked)
@@ -779,6 +790,8 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(std::make_pair(outpoint, wtxid));
     setLockedCoins.erase(outpoint);
+    mapWalletUnspent.erase(outpoint);
+    setBalancesDirtyTxs.insert(outpoint.hash);
 
     std::pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -1077,6 +1090,9 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         for (PAIRTYPE(const uint256, CWalletTx) & item : mapWallet)
             item.second.MarkDirty();
+        // outputs may have become mine
+        fWalletUnspentDirty = true;
+        MarkStakeCandidatesDirty();
     }
 }
 
@@ -1103,6 +1119,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             wtxOrdered.insert(std::make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
             wtx.UpdateTimeSmart();
             AddToSpends(hash);
+            AddToUnspent(wtx);
             for (const CTxIn& txin : wtx.vin) {
                 if (mapWallet.count(txin.prevout.hash)) {
                     CWalletTx& prevtx = mapWallet[txin.prevout.hash];
@@ -1218,6 +1235,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
     if (origtx.GetDepthInMainChain() > 0 || origtx.InMempool()) {
         return false;
     }
+    MarkStakeCandidatesDirty();
 
     todo.insert(hashTx);
 
@@ -1253,6 +1271,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             {
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
+                AddToUnspent(txin.prevout);
             }
         }
     }
@@ -1273,6 +1292,9 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
     }
     assert(conflictconfirms < 0);
 
+    // Spent outputs may be available again
+    MarkStakeCandidatesDirty();
+
     // Do not flush the wallet here for performance reasons
     CWalletDB walletdb(strWalletFile, "r+", false);
 
@@ -1309,6 +1331,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             {
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
+                AddToUnspent(txin.prevout);
             }
         }
     }
@@ -1320,6 +1343,14 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
 
+    UpdateStakeCandidates(tx, pblock);
+
+    // A coinstake out of the chain doesn't spend its inputs anymore
+    if (!pblock && tx.IsCoinStake()) {
+        for (const CTxIn& txin : tx.vin)
+            AddToUnspent(txin.prevout);
+    }
+
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
     // recomputed, also:
@@ -1337,6 +1368,9 @@ void CWallet::EraseFromWallet(const uint256& hash)
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        MarkStakeCandidatesDirty();
+        fWalletUnspentDirty = true;
+        fBalancesDirty = true;
         LogPrintf("%s: Erased wtx %s from wallet\n", __func__, hash.GetHex());
     }
     return;
@@ -1856,53 +1890,397 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+CWalletScanFilter::CWalletScanFilter()
+{
+    // like IsRelevant, leave the zerocoin transactions to the wallet
+    setBlockFilterElements.insert(ZerocoinMintMarker());
+    setBlockFilterElements.insert(ZerocoinSpendMarker());
+}
+
+void CWalletScanFilter::AddKey(const CKeyID& keyID)
+{
+    setKeys.insert(keyID);
+    // the block filters list the keys of P2PK, P2CS and multisig scripts as P2PKH
+    const CScript script = GetScriptForDestination(keyID);
+    setBlockFilterElements.insert(BlockFilterElement(script.begin(), script.end()));
+}
+
+void CWalletScanFilter::AddScript(const CScriptID& scriptID)
+{
+    setScripts.insert(scriptID);
+    const CScript script = GetScriptForDestination(scriptID);
+    setBlockFilterElements.insert(BlockFilterElement(script.begin(), script.end()));
+}
+
+void CWalletScanFilter::AddWholeScript(const CScript& script)
+{
+    setWholeScripts.insert(script);
+    setBlockFilterElements.insert(BlockFilterElement(script.begin(), script.end()));
+}
+
+void CWalletScanFilter::AddSpentScript(const CScript& script)
+{
+    BlockFilterElementSet elements;
+    AddScriptFilterElements(script, elements);
+    // a script the block filters leave out can't be looked for
+    if (elements.empty())
+        fSkipBlocks = false;
+    setBlockFilterElements.insert(elements.begin(), elements.end());
+}
+
+bool CWalletScanFilter::IsRelevant(const CScript& scriptPubKey) const
+{
+    if (setWholeScripts.count(scriptPubKey))
+        return true;
+
+    std::vector<valtype> vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions))
+        return false;
+
+    switch (whichType) {
+    case TX_ZEROCOINMINT:
+    case TX_PUBKEY:
+        return setKeys.count(CPubKey(vSolutions[0]).GetID());
+    case TX_PUBKEYHASH:
+        return setKeys.count(CKeyID(uint160(vSolutions[0])));
+    case TX_SCRIPTHASH:
+        return setScripts.count(CScriptID(uint160(vSolutions[0])));
+    case TX_COLDSTAKE:
+        return setKeys.count(CKeyID(uint160(vSolutions[0]))) || setKeys.count(CKeyID(uint160(vSolutions[1])));
+    case TX_MULTISIG:
+        // IsMine wants all the keys, any one of them is enough to look closer
+        for (size_t i = 1; i + 1 < vSolutions.size(); i++) {
+            if (setKeys.count(CPubKey(vSolutions[i]).GetID()))
+                return true;
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+bool CWalletScanFilter::IsRelevant(const CTransaction& tx) const
+{
+    // zerocoin spends are recognised by their serials, leave them to the wallet
+    if (tx.ContainsZerocoins())
+        return true;
+    for (const CTxIn& txin : tx.vin) {
+        if (setTxids.count(txin.prevout.hash) || setSpent.count(txin.prevout))
+            return true;
+    }
+    for (const CTxOut& txout : tx.vout) {
+        if (IsRelevant(txout.scriptPubKey))
+            return true;
+    }
+    return false;
+}
+
+CWalletScanFilter CWallet::GetScanFilter() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    CWalletScanFilter filter;
+
+    std::set<CKeyID> setKeyIDs;
+    GetKeys(setKeyIDs);
+    for (const CKeyID& keyID : setKeyIDs)
+        filter.AddKey(keyID);
+    {
+        LOCK(cs_KeyStore);
+        for (const auto& it : mapScripts)
+            filter.AddScript(it.first);
+        for (const CScript& script : setWatchOnly)
+            filter.AddWholeScript(script);
+        for (const CScript& script : setMultiSig)
+            filter.AddWholeScript(script);
+    }
+    for (const auto& it : mapWallet)
+        filter.AddTx(it.first);
+    for (const auto& it : mapTxSpends)
+        filter.AddSpent(it.first);
+
+    // a block conflicting an unconfirmed wallet transaction spends one of its inputs, which
+    // the block filters only know by the script spent: add the scripts, or give up skipping
+    for (const auto& it : mapWallet) {
+        const CWalletTx& wtx = it.second;
+        if (wtx.HasZerocoinSpendInputs() || wtx.GetDepthInMainChain() != 0)
+            continue;
+        for (const CTxIn& txin : wtx.vin) {
+            std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(txin.prevout.hash);
+            Coin coin;
+            CTransaction txPrev;
+            if (mi != mapWallet.end() && txin.prevout.n < mi->second.vout.size())
+                filter.AddSpentScript(mi->second.vout[txin.prevout.n].scriptPubKey);
+            else if (pcoinsTip->GetCoin(txin.prevout, coin))
+                filter.AddSpentScript(coin.out.scriptPubKey);
+            else if (mempool.lookup(txin.prevout.hash, txPrev) && txin.prevout.n < txPrev.vout.size())
+                filter.AddSpentScript(txPrev.vout[txin.prevout.n].scriptPubKey);
+            else
+                filter.DisableBlockSkip();
+        }
+    }
+    return filter;
+}
+
+//! Blocks the rescan reads ahead of the one it is applying
+static const unsigned int RESCAN_READAHEAD_BLOCKS = 64;
+
+/** A block ahead of the rescan, with the transactions the scan filter matched (none if skipped) */
+struct CRescanBlock {
+    CBlockIndex* pindex{nullptr};
+    CBlock block;
+    std::vector<bool> vMatch;
+    bool fMatched{false};
+};
+typedef std::shared_ptr<CRescanBlock> CRescanBlockRef;
+
+/**
+ * Rescan stages running off the wallet's thread: a reader walks the active chain, and a pool
+ * of workers skips the blocks whose filter (-blockfilterindex) holds none of the wallet's
+ * scripts, then reads the others from disk and runs the scan filter over their transactions.
+ * Next() hands the blocks back in chain order, so that only the matching transactions need
+ * the wallet and chain locks.
+ */
+class CRescanPipeline
+{
+private:
+    const CWalletScanFilter& filter;
+    CBlockIndex* pindexStart;
+
+    boost::mutex cs;
+    //! a block left the read-ahead window
+    boost::condition_variable condRead;
+    //! a block is waiting to be matched
+    boost::condition_variable condMatch;
+    //! the oldest block was matched, or the reader reached the tip
+    boost::condition_variable condNext;
+    //! blocks in chain order, from read to handed back
+    std::deque<CRescanBlockRef> queueWindow;
+    //! blocks waiting for a worker
+    std::deque<CRescanBlockRef> queueMatch;
+    bool fReadDone{false};
+    bool fStop{false};
+    boost::thread_group threads;
+
+    void ThreadRead();
+    void ThreadMatch();
+
+public:
+    CRescanPipeline(const CWalletScanFilter& filterIn, CBlockIndex* pindexStartIn, int nWorkers) :
+            filter(filterIn), pindexStart(pindexStartIn)
+    {
+        threads.create_thread(boost::bind(&CRescanPipeline::ThreadRead, this));
+        for (int i = 0; i < nWorkers; i++)
+            threads.create_thread(boost::bind(&CRescanPipeline::ThreadMatch, this));
+    }
+
+    ~CRescanPipeline()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+        }
+        condRead.notify_all();
+        condMatch.notify_all();
+        threads.join_all();
+    }
+
+    /** The next block of the chain once matched, or null after the tip */
+    CRescanBlockRef Next()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (queueWindow.empty() ? !fReadDone : !queueWindow.front()->fMatched)
+            condNext.wait(lock);
+        if (queueWindow.empty())
+            return nullptr;
+        CRescanBlockRef item = queueWindow.front();
+        queueWindow.pop_front();
+        condRead.notify_one();
+        return item;
+    }
+};
+
+void CRescanPipeline::ThreadRead()
+{
+    util::ThreadRename("oasis-rescanrd");
+    CBlockIndex* pindex = pindexStart;
+    while (pindex) {
+        CRescanBlockRef item = std::make_shared<CRescanBlock>();
+        item->pindex = pindex;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fStop && queueWindow.size() >= RESCAN_READAHEAD_BLOCKS)
+                condRead.wait(lock);
+            if (fStop)
+                return;
+            queueWindow.push_back(item);
+            queueMatch.push_back(item);
+        }
+        condMatch.notify_one();
+
+        // a reorg may have moved the chain away from the blocks queued so far
+        LOCK(cs_main);
+        if (chainActive.Contains(pindex))
+            pindex = chainActive.Next(pindex);
+        else
+            pindex = chainActive.Next(chainActive.FindFork(pindex));
+    }
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fReadDone = true;
+    }
+    condMatch.notify_all();
+    condNext.notify_all();
+}
+
+void CRescanPipeline::ThreadMatch()
+{
+    util::ThreadRename("oasis-rescanmt");
+    while (true) {
+        CRescanBlockRef item;
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fStop && !fReadDone && queueMatch.empty())
+                condMatch.wait(lock);
+            if (fStop || queueMatch.empty())
+                return;
+            item = queueMatch.front();
+            queueMatch.pop_front();
+        }
+
+        std::vector<bool> vMatch;
+        CBlockFilter blockfilter;
+        uint256 hashHeader;
+        if (!filter.CanSkipBlocks() || !GetBlockFilter(item->pindex, blockfilter, hashHeader) ||
+            blockfilter.MatchAny(filter.GetBlockFilterElements())) {
+            if (!ReadBlockFromDisk(item->block, item->pindex))
+                LogPrintf("%s: failed to read block %s at height %d\n", __func__, item->pindex->GetBlockHash().ToString(), item->pindex->nHeight);
+            vMatch.resize(item->block.vtx.size(), false);
+            for (size_t i = 0; i < item->block.vtx.size(); i++)
+                vMatch[i] = filter.IsRelevant(item->block.vtx[i]);
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            item->vMatch.swap(vMatch);
+            item->fMatched = true;
+        }
+        condNext.notify_all();
+    }
+}
+
+/** Clears CWallet::fScanningWallet when the rescan returns or throws */
+class CScanningWalletReset
+{
+private:
+    std::atomic<bool>& fScanning;
+
+public:
+    explicit CScanningWalletReset(std::atomic<bool>& fScanningIn) : fScanning(fScanningIn) {}
+    ~CScanningWalletReset() { fScanning = false; }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
- * @returns -1 if process was cancelled or the number of tx added to the wallet.
+ * Blocks are read and filtered by a CRescanPipeline, which skips without reading them
+ * the blocks whose compact filter (see CBlockFilter) matches none of the wallet's scripts.
+ * cs_main and cs_wallet are only held to add the matching transactions of a block.
+ * @returns -1 if process was cancelled, -2 if another rescan is running, or the number of tx added to the wallet.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate, bool fromStartup)
 {
+    // the pipeline's reader takes cs_main
+    AssertLockNotHeld(cs_main);
+    AssertLockNotHeld(cs_wallet);
+
+    bool fExpected = false;
+    if (!fScanningWallet.compare_exchange_strong(fExpected, true)) {
+        LogPrintf("%s: a rescan is already in progress\n", __func__);
+        return -2;
+    }
+    CScanningWalletReset scanningReset(fScanningWallet);
+    fAbortRescan = false;
+    nScanStartTime = GetTimeMillis();
+    dScanProgress = 0.0;
+
     int ret = 0;
     int64_t nNow = GetTime();
 
     CBlockIndex* pindex = pindexStart;
+    CWalletScanFilter filter;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
+        MarkStakeCandidatesDirty();
+        fWalletUnspentDirty = true;
 
         // no need to read and scan block, if block was created before
         // our wallet birthday (as adjusted for block time variability)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)) && pindex->nHeight <= Params().GetConsensus().height_start_ZC)
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+        filter = GetScanFilter();
+    }
+
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    if (pindex) {
+        CRescanPipeline pipeline(filter, pindex, std::max(1, nScriptCheckThreads));
+        // spends of the transactions found by this scan and double-spends of their inputs,
+        // which the filter doesn't know about
         std::set<uint256> setAddedToWallet;
-        while (pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+        std::set<COutPoint> setAddedSpent;
+        CRescanBlockRef item;
+        while ((item = pipeline.Next())) {
+            pindex = item->pindex;
+            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
+                dScanProgress = std::max(0.0, std::min(1.0, (Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart)));
+                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)(dScanProgress * 100))));
+            }
 
-            if (fromStartup && ShutdownRequested()) {
-                return -1;
+            if (fAbortRescan || (fromStartup && ShutdownRequested())) {
+                LogPrintf("Rescan aborted at block %d\n", pindex->nHeight);
+                ret = -1;
+                break;
             }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            for (CTransaction& tx : block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+            const CBlock& block = item->block;
+            std::vector<const CTransaction*> vApply;
+            for (size_t i = 0; i < block.vtx.size(); i++) {
+                const CTransaction& tx = block.vtx[i];
+                bool fApply = item->vMatch[i];
+                for (size_t j = 0; !fApply && j < tx.vin.size(); j++)
+                    fApply = setAddedToWallet.count(tx.vin[j].prevout.hash) || setAddedSpent.count(tx.vin[j].prevout);
+                if (fApply)
+                    vApply.push_back(&tx);
+            }
+
+            if (!vApply.empty()) {
+                LOCK2(cs_main, cs_wallet);
+                // disconnected while queued, the pipeline continues on the new branch
+                if (!chainActive.Contains(pindex))
+                    continue;
+                for (const CTransaction* ptx : vApply) {
+                    if (AddToWalletIfInvolvingMe(*ptx, &block, fUpdate)) {
+                        setAddedToWallet.insert(ptx->GetHash());
+                        for (const CTxIn& txin : ptx->vin)
+                            setAddedSpent.insert(txin.prevout);
+                        ret++;
+                    }
+                }
             }
 
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
     return ret;
 }
 
@@ -2021,134 +2399,355 @@ void CWallet::ResendWalletTransactions()
  * @{
  */
 
-CAmount CWallet::loopTxsBalance(std::function<void(const uint256&, const CWalletTx&, CAmount&)> method) const
+/** Credit of an unspent output of type mine, as summed by CWalletTx::GetUnspentCredit(filter) */
+static CAmount GetUnspentOutputCredit(isminetype mine, isminefilter filter, CAmount nValue)
 {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (const auto& it : mapWallet) {
-            method(it.first, it.second, nTotal);
+    static const isminetype flags[] = {ISMINE_SPENDABLE, ISMINE_WATCH_ONLY, ISMINE_COLD, ISMINE_SPENDABLE_DELEGATED};
+    CAmount nCredit = 0;
+    for (isminetype flag : flags) {
+        if ((filter & flag) && (mine & flag))
+            nCredit += nValue;
+    }
+    return nCredit;
+}
+
+bool CWalletBalances::IsNull() const
+{
+    return nAvailable == 0 && nColdStaking == 0 && nStaking == 0 && nStakingCold == 0 && nDelegated == 0 &&
+           nLocked == 0 && nUnlocked == 0 && nUnconfirmed == 0 && nImmature == 0 && nImmatureColdStaking == 0 &&
+           nImmatureDelegated == 0 && nWatchOnly == 0 && nUnconfirmedWatchOnly == 0 && nImmatureWatchOnly == 0 &&
+           nLockedWatchOnly == 0;
+}
+
+void CWalletBalances::Add(const CWalletBalances& b, int nSign)
+{
+    nAvailable += nSign * b.nAvailable;
+    nColdStaking += nSign * b.nColdStaking;
+    nStaking += nSign * b.nStaking;
+    nStakingCold += nSign * b.nStakingCold;
+    nDelegated += nSign * b.nDelegated;
+    nLocked += nSign * b.nLocked;
+    nUnlocked += nSign * b.nUnlocked;
+    nUnconfirmed += nSign * b.nUnconfirmed;
+    nImmature += nSign * b.nImmature;
+    nImmatureColdStaking += nSign * b.nImmatureColdStaking;
+    nImmatureDelegated += nSign * b.nImmatureDelegated;
+    nWatchOnly += nSign * b.nWatchOnly;
+    nUnconfirmedWatchOnly += nSign * b.nUnconfirmedWatchOnly;
+    nImmatureWatchOnly += nSign * b.nImmatureWatchOnly;
+    nLockedWatchOnly += nSign * b.nLockedWatchOnly;
+}
+
+/**
+ * Contribution of wtx to the balances, from its outputs in mapWalletUnspent.
+ * Returns whether it may still change with the tip or the mempool alone (see setBalancesPending).
+ */
+bool CWallet::ComputeTxBalances(const CWalletTx& wtx, CWalletBalances& balances) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    balances = CWalletBalances();
+    const uint256& hash = wtx.GetHash();
+    const int nStakeMinDepth = Params().GetConsensus().nStakeMinDepth;
+    const bool fTrusted = wtx.IsTrusted();
+    const int nDepth = wtx.GetDepthInMainChain();
+    const bool fImmature = wtx.GetBlocksToMaturity() > 0;
+    const bool fImmatureCoinBase = fImmature && wtx.IsCoinBase();
+    const bool fInMainChainImmature = wtx.IsInMainChainImmature();
+    const bool fPending = nDepth < nStakeMinDepth || nDepth <= 0 || fImmature;
+
+    // credits of the unspent outputs of wtx
+    CAmount nAvailable = 0, nCold = 0, nDelegated = 0, nLocked = 0, nUnlocked = 0, nWatchOnly = 0, nLockedWatchOnly = 0;
+    CAmount nImmature = 0, nImmatureCold = 0, nImmatureDelegated = 0, nImmatureWatchOnly = 0;
+    std::map<COutPoint, CWalletUnspent>::const_iterator it = mapWalletUnspent.lower_bound(COutPoint(hash, 0));
+    if (it == mapWalletUnspent.end() || it->first.hash != hash)
+        return fPending;
+    for (; it != mapWalletUnspent.end() && it->first.hash == hash; ++it) {
+        const unsigned int i = it->first.n;
+        const isminetype mine = it->second.mine;
+        const CAmount nValue = wtx.vout[i].nValue;
+        if (IsSpent(hash, i))
+            continue;
+        if (!fImmature) {
+            nAvailable += GetUnspentOutputCredit(mine, ISMINE_SPENDABLE_ALL, nValue);
+            nCold += GetUnspentOutputCredit(mine, ISMINE_COLD, nValue);
+            nDelegated += GetUnspentOutputCredit(mine, ISMINE_SPENDABLE_DELEGATED, nValue);
+        }
+        if (!fImmatureCoinBase) {
+            const bool fLocked = IsLockedCoin(hash, i);
+            const bool fCollateral = fMasterNode && nValue == 285 * COIN;
+            if (fLocked && (mine & ISMINE_SPENDABLE_ALL)) nLocked += nValue;
+            if (!fLocked && fCollateral && (mine & ISMINE_SPENDABLE)) nLocked += nValue;
+            if (!fLocked && !fCollateral && (mine & ISMINE_SPENDABLE)) nUnlocked += nValue;
+            if (mine & ISMINE_WATCH_ONLY) {
+                nWatchOnly += nValue;
+                if (fLocked || fCollateral) nLockedWatchOnly += nValue;
+            }
+        }
+        if (fInMainChainImmature) {
+            if (mine & ISMINE_SPENDABLE_ALL) nImmature += nValue;
+            if (mine & ISMINE_COLD) nImmatureCold += nValue;
+            if (mine & ISMINE_SPENDABLE_DELEGATED) nImmatureDelegated += nValue;
+            if (mine & ISMINE_WATCH_ONLY) nImmatureWatchOnly += nValue;
         }
     }
-    return nTotal;
+
+    if (fTrusted) {
+        balances.nAvailable = nAvailable;
+        balances.nWatchOnly = nWatchOnly;
+        if (wtx.HasP2CSOutputs()) {
+            balances.nColdStaking = nCold;
+            balances.nDelegated = nDelegated;
+        }
+        if (nDepth >= nStakeMinDepth) {
+            balances.nStaking = nAvailable - nDelegated - nLocked;
+            balances.nStakingCold = nCold;
+        }
+        if (nDepth > 0) {
+            balances.nLocked = nLocked;
+            balances.nUnlocked = nUnlocked;
+            balances.nLockedWatchOnly = nLockedWatchOnly;
+        }
+    } else if (nDepth == 0 && wtx.InMempool()) {
+        balances.nUnconfirmed = nAvailable;
+        balances.nUnconfirmedWatchOnly = nWatchOnly;
+    }
+    balances.nImmature = nImmature;
+    balances.nImmatureColdStaking = nImmatureCold;
+    balances.nImmatureDelegated = nImmatureDelegated;
+    balances.nImmatureWatchOnly = nImmatureWatchOnly;
+    return fPending;
+}
+
+/** Replace the contribution of the wallet tx hash in the ledger (dropped if it left mapWallet) */
+void CWallet::UpdateTxBalances(const uint256& hash) const
+{
+    AssertLockHeld(cs_wallet);
+    std::map<uint256, CWalletBalances>::iterator it = mapTxBalances.find(hash);
+    if (it != mapTxBalances.end()) {
+        cachedBalances -= it->second;
+        mapTxBalances.erase(it);
+    }
+    setBalancesPending.erase(hash);
+
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end())
+        return;
+    CWalletBalances balances;
+    if (ComputeTxBalances(mi->second, balances))
+        setBalancesPending.insert(hash);
+    if (!balances.IsNull()) {
+        cachedBalances += balances;
+        mapTxBalances.emplace(hash, balances);
+    }
+}
+
+/** Rebuild the whole ledger from mapWallet */
+void CWallet::ComputeBalances(CWalletBalances& balances) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (fWalletUnspentDirty)
+        RebuildUnspent();
+
+    balances = CWalletBalances();
+    mapTxBalances.clear();
+    setBalancesDirtyTxs.clear();
+    setBalancesPending.clear();
+    for (const auto& it : mapWallet) {
+        CWalletBalances txBalances;
+        if (ComputeTxBalances(it.second, txBalances))
+            setBalancesPending.insert(it.first);
+        if (!txBalances.IsNull()) {
+            balances += txBalances;
+            mapTxBalances.emplace(it.first, txBalances);
+        }
+    }
+    LogPrint("coinselection", "%s: %d wallet transactions with a balance, %d pending\n", __func__, mapTxBalances.size(), setBalancesPending.size());
+}
+
+/** Same as ComputeBalances, from the credits of every transaction of mapWallet */
+void CWallet::ComputeBalancesFull(CWalletBalances& balances) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    balances = CWalletBalances();
+    const int nStakeMinDepth = Params().GetConsensus().nStakeMinDepth;
+    for (const auto& it : mapWallet) {
+        const CWalletTx& pcoin = it.second;
+        const int nDepth = pcoin.GetDepthInMainChain();
+        if (pcoin.IsTrusted()) {
+            balances.nAvailable += pcoin.GetAvailableCredit();
+            balances.nWatchOnly += pcoin.GetAvailableWatchOnlyCredit(false);
+            if (pcoin.HasP2CSOutputs()) {
+                balances.nColdStaking += pcoin.GetColdStakingCredit();
+                balances.nDelegated += pcoin.GetStakeDelegationCredit();
+            }
+            if (nDepth >= nStakeMinDepth) {
+                balances.nStaking += pcoin.GetAvailableCredit() - pcoin.GetStakeDelegationCredit() - pcoin.GetLockedCredit();
+                balances.nStakingCold += pcoin.GetColdStakingCredit();
+            }
+            if (nDepth > 0) {
+                balances.nLocked += pcoin.GetLockedCredit();
+                balances.nUnlocked += pcoin.GetUnlockedCredit();
+                balances.nLockedWatchOnly += pcoin.GetLockedWatchOnlyCredit();
+            }
+        } else if (nDepth == 0 && pcoin.InMempool()) {
+            balances.nUnconfirmed += pcoin.GetAvailableCredit();
+            balances.nUnconfirmedWatchOnly += pcoin.GetAvailableWatchOnlyCredit(false);
+        }
+        balances.nImmature += pcoin.GetImmatureCredit(false);
+        balances.nImmatureColdStaking += pcoin.GetImmatureCredit(false, ISMINE_COLD);
+        balances.nImmatureDelegated += pcoin.GetImmatureCredit(false, ISMINE_SPENDABLE_DELEGATED);
+        balances.nImmatureWatchOnly += pcoin.GetImmatureWatchOnlyCredit(false);
+    }
+}
+
+/** -checkbalances: compare the balances ledger with a full scan of mapWallet */
+void CWallet::CheckBalances(const CWalletBalances& balances) const
+{
+    CWalletBalances full;
+    ComputeBalancesFull(full);
+    bool fConsistent = true;
+    auto check = [&fConsistent](const char* strName, CAmount nCached, CAmount nFull) {
+        if (nCached != nFull) {
+            LogPrintf("CWallet::CheckBalances: %s balance %s, expected %s\n", strName, FormatMoney(nCached), FormatMoney(nFull));
+            fConsistent = false;
+        }
+    };
+    check("available", balances.nAvailable, full.nAvailable);
+    check("coldstaking", balances.nColdStaking, full.nColdStaking);
+    check("staking", balances.nStaking, full.nStaking);
+    check("stakingcold", balances.nStakingCold, full.nStakingCold);
+    check("delegated", balances.nDelegated, full.nDelegated);
+    check("locked", balances.nLocked, full.nLocked);
+    check("unlocked", balances.nUnlocked, full.nUnlocked);
+    check("unconfirmed", balances.nUnconfirmed, full.nUnconfirmed);
+    check("immature", balances.nImmature, full.nImmature);
+    check("immaturecoldstaking", balances.nImmatureColdStaking, full.nImmatureColdStaking);
+    check("immaturedelegated", balances.nImmatureDelegated, full.nImmatureDelegated);
+    check("watchonly", balances.nWatchOnly, full.nWatchOnly);
+    check("unconfirmedwatchonly", balances.nUnconfirmedWatchOnly, full.nUnconfirmedWatchOnly);
+    check("immaturewatchonly", balances.nImmatureWatchOnly, full.nImmatureWatchOnly);
+    check("lockedwatchonly", balances.nLockedWatchOnly, full.nLockedWatchOnly);
+    assert(fConsistent);
+}
+
+CWalletBalances CWallet::GetBalances() const
+{
+    LOCK2(cs_main, cs_wallet);
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    const unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    const bool fTipMoved = pindexTip != pindexBalancesTip;
+    // a reorg can take any tx back under the staking and maturity depths
+    const bool fReorg = fTipMoved && (!pindexBalancesTip || !chainActive.Contains(pindexBalancesTip));
+    if (fBalancesDirty || fWalletUnspentDirty || fReorg) {
+        ComputeBalances(cachedBalances);
+        fBalancesDirty = false;
+    } else {
+        if (fTipMoved || nMempoolUpdated != nBalancesMempoolUpdated) {
+            for (const uint256& hash : setBalancesPending) {
+                setBalancesDirtyTxs.insert(hash);
+                // an unconfirmed spender leaving the mempool (orphaned coinstake) unspends its inputs
+                const CWalletTx& wtx = mapWallet.at(hash);
+                if (wtx.GetDepthInMainChain() > 0)
+                    continue;
+                for (const CTxIn& txin : wtx.vin) {
+                    if (mapWallet.count(txin.prevout.hash))
+                        setBalancesDirtyTxs.insert(txin.prevout.hash);
+                }
+            }
+        }
+        for (const uint256& hash : setBalancesDirtyTxs)
+            UpdateTxBalances(hash);
+        setBalancesDirtyTxs.clear();
+    }
+    pindexBalancesTip = pindexTip;
+    nBalancesMempoolUpdated = nMempoolUpdated;
+    if (fCheckBalances)
+        CheckBalances(cachedBalances);
+    return cachedBalances;
+}
+
+void CWallet::MarkBalancesDirty(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    setBalancesDirtyTxs.insert(hash);
 }
 
 CAmount CWallet::GetBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal){
-        if (pcoin.IsTrusted())
-            nTotal += pcoin.GetAvailableCredit();
-    });
+    return GetBalances().nAvailable;
 }
 
 CAmount CWallet::GetColdStakingBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-        if (pcoin.HasP2CSOutputs() && pcoin.IsTrusted())
-            nTotal += pcoin.GetColdStakingCredit();
-    });
+    return GetBalances().nColdStaking;
 }
 
 CAmount CWallet::GetStakingBalance(const bool fIncludeColdStaking) const
 {
-    return std::max(CAmount(0), loopTxsBalance(
-            [fIncludeColdStaking](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-        if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() >= Params().GetConsensus().nStakeMinDepth) {
-            nTotal += pcoin.GetAvailableCredit();       // available coins
-            nTotal -= pcoin.GetStakeDelegationCredit(); // minus delegated coins, if any
-            nTotal -= pcoin.GetLockedCredit();          // minus locked coins, if any
-            if (fIncludeColdStaking)
-                nTotal += pcoin.GetColdStakingCredit(); // plus cold coins, if any and if requested
-        }
-    }));
+    const CWalletBalances balances = GetBalances();
+    return std::max(CAmount(0), balances.nStaking + (fIncludeColdStaking ? balances.nStakingCold : 0));
 }
 
 CAmount CWallet::GetDelegatedBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.HasP2CSOutputs() && pcoin.IsTrusted())
-                nTotal += pcoin.GetStakeDelegationCredit();
-    });
+    return GetBalances().nDelegated;
 }
 
 CAmount CWallet::GetUnlockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() > 0)
-                nTotal += pcoin.GetUnlockedCredit();
-    });
+    return GetBalances().nUnlocked;
 }
 
 CAmount CWallet::GetLockedCoins() const
 {
     if (fLiteMode) return 0;
 
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() > 0)
-                nTotal += pcoin.GetLockedCredit();
-    });
+    return GetBalances().nLocked;
 }
 
 CAmount CWallet::GetUnconfirmedBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (!pcoin.IsTrusted() && pcoin.GetDepthInMainChain() == 0 && pcoin.InMempool())
-                nTotal += pcoin.GetAvailableCredit();
-    });
+    return GetBalances().nUnconfirmed;
 }
 
 CAmount CWallet::GetImmatureBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureCredit(false);
-    });
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetImmatureColdStakingBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureCredit(false, ISMINE_COLD);
-    });
+    return GetBalances().nImmatureColdStaking;
 }
 
 CAmount CWallet::GetImmatureDelegatedBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureCredit(false, ISMINE_SPENDABLE_DELEGATED);
-    });
+    return GetBalances().nImmatureDelegated;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted())
-                nTotal += pcoin.GetAvailableWatchOnlyCredit();
-    });
+    return GetBalances().nWatchOnly;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (!pcoin.IsTrusted() && pcoin.GetDepthInMainChain() == 0 && pcoin.InMempool())
-                nTotal += pcoin.GetAvailableWatchOnlyCredit();
-    });
+    return GetBalances().nUnconfirmedWatchOnly;
 }
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            nTotal += pcoin.GetImmatureWatchOnlyCredit();
-    });
+    return GetBalances().nImmatureWatchOnly;
 }
 
 CAmount CWallet::GetLockedWatchOnlyBalance() const
 {
-    return loopTxsBalance([](const uint256& id, const CWalletTx& pcoin, CAmount& nTotal) {
-            if (pcoin.IsTrusted() && pcoin.GetDepthInMainChain() > 0)
-                nTotal += pcoin.GetLockedWatchOnlyCredit();
-    });
+    return GetBalances().nLockedWatchOnly;
 }
 
 void CWallet::GetAvailableP2CSCoins(std::vector<COutput>& vCoins) const {
@@ -2266,8 +2865,56 @@ bool CWallet::GetMasternodeVinAndKeys(CTxIn& txinRet, CPubKey& pubKeyRet, CKey&
             keyRet);
 }
 
+void CWallet::AddToUnspent(const CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    if (fWalletUnspentDirty) return;
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        isminetype mine = IsMine(wtx.vout[i]);
+        if (mine != ISMINE_NO)
+            mapWalletUnspent[COutPoint(hash, i)] = CWalletUnspent(&wtx, mine);
+    }
+}
+
+void CWallet::AddToUnspent(const COutPoint& outpoint)
+{
+    AssertLockHeld(cs_wallet);
+    if (fWalletUnspentDirty) return;
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+    if (mi == mapWallet.end() || outpoint.n >= mi->second.vout.size()) return;
+    isminetype mine = IsMine(mi->second.vout[outpoint.n]);
+    if (mine != ISMINE_NO)
+        mapWalletUnspent[outpoint] = CWalletUnspent(&mi->second, mine);
+}
+
+void CWallet::RebuildUnspent() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    mapWalletUnspent.clear();
+    for (const auto& it : mapWallet) {
+        const CWalletTx& wtx = it.second;
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            isminetype mine = IsMine(wtx.vout[i]);
+            if (mine != ISMINE_NO && !IsSpent(it.first, i))
+                mapWalletUnspent[COutPoint(it.first, i)] = CWalletUnspent(&wtx, mine);
+        }
+    }
+    fWalletUnspentDirty = false;
+    fBalancesDirty = true;
+    LogPrint("coinselection", "%s: %d unspent outputs in %d wallet transactions\n", __func__, mapWalletUnspent.size(), mapWallet.size());
+}
+
+void CWallet::MarkUnspentDirty()
+{
+    LOCK(cs_wallet);
+    fWalletUnspentDirty = true;
+}
+
 /**
  * populate vCoins with vector of available COutputs.
+ * Only the outputs of mapWalletUnspent are visited.
  */
 bool CWallet::AvailableCoins(
         std::vector<COutput>* pCoins,
@@ -2288,64 +2935,77 @@ bool CWallet::AvailableCoins(
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
-
-            // Check if the tx is selectable
-            int nDepth;
-            if (!CheckTXAvailability(pcoin, fOnlyConfirmed, fUseIX, nDepth))
+        if (fWalletUnspentDirty)
+            RebuildUnspent();
+
+        // the outputs of a tx are next to each other: check its availability once
+        const CWalletTx* pcoinLast = nullptr;
+        bool fAvailable = false;
+        int nDepth = 0;
+        for (std::map<COutPoint, CWalletUnspent>::iterator it = mapWalletUnspent.begin(); it != mapWalletUnspent.end(); ) {
+            const uint256& wtxid = it->first.hash;
+            const unsigned int i = it->first.n;
+            const CWalletTx* pcoin = it->second.tx;
+            const isminetype mine = it->second.mine;
+            if (IsSpent(wtxid, i)) {
+                // until a spender is conflicted, abandoned or disconnected, which puts it back
+                it = mapWalletUnspent.erase(it);
                 continue;
-
-            // Check min depth requirement for stake inputs
-            if (nCoinType == STAKEABLE_COINS && nDepth < Params().GetConsensus().nStakeMinDepth) continue;
-
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
-                bool found = false;
-                if (nCoinType == ONLY_DENOMINATED) {
-                    found = IsDenominatedAmount(pcoin->vout[i].nValue);
-                } else if (nCoinType == ONLY_NOT285IFMN) {
-                    found = !(fMasterNode && pcoin->vout[i].nValue == 285 * COIN);
-                } else if (nCoinType == ONLY_NONDENOMINATED_NOT285IFMN) {
-                    if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
-                    found = !IsDenominatedAmount(pcoin->vout[i].nValue);
-                    if (found && fMasterNode) found = pcoin->vout[i].nValue != 285 * COIN; // do not use Hot MN funds
-                } else if (nCoinType == ONLY_285) {
-                    found = pcoin->vout[i].nValue == 285 * COIN;
-                } else {
-                    found = true;
-                }
-                if (!found) continue;
-
-                if (nCoinType == STAKEABLE_COINS && pcoin->vout[i].IsZerocoinMint()) continue;
-                if (IsSpent(wtxid, i)) continue;
-
-                isminetype mine = IsMine(pcoin->vout[i]);
-                if (  (mine == ISMINE_NO) ||
-                      ((mine == ISMINE_MULTISIG || mine == ISMINE_SPENDABLE) && nWatchonlyConfig == 2) ||
-                      (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1) ||
-                      (IsLockedCoin((*it).first, i) && nCoinType != ONLY_285) ||
-                      (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue) ||
-                      (fCoinsSelected && !coinControl->fAllowOtherInputs && !coinControl->IsSelected((*it).first, i))
-                   ) continue;
-
-                // --Skip P2CS outputs
-                // skip cold coins
-                if (mine == ISMINE_COLD && (!fIncludeColdStaking || !HasDelegator(pcoin->vout[i]))) continue;
-                // skip delegated coins
-                if (mine == ISMINE_SPENDABLE_DELEGATED && !fIncludeDelegated) continue;
-                // skip auto-delegated coins
-                if (mine == ISMINE_SPENDABLE_STAKEABLE && !fIncludeColdStaking && !fIncludeDelegated) continue;
-
-                bool fIsValid = (
-                        ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
-                        ((mine & (ISMINE_MULTISIG | (fIncludeColdStaking ? ISMINE_COLD : ISMINE_NO) |
-                                (fIncludeDelegated ? ISMINE_SPENDABLE_DELEGATED : ISMINE_NO) )) != ISMINE_NO));
-
-                // found valid coin
-                if (!pCoins) return true;
-                pCoins->emplace_back(COutput(pcoin, i, nDepth, fIsValid));
             }
+            ++it;
+
+            if (pcoin != pcoinLast) {
+                pcoinLast = pcoin;
+                // Check if the tx is selectable
+                fAvailable = CheckTXAvailability(pcoin, fOnlyConfirmed, fUseIX, nDepth);
+                // Check min depth requirement for stake inputs
+                if (fAvailable && nCoinType == STAKEABLE_COINS && nDepth < Params().GetConsensus().nStakeMinDepth)
+                    fAvailable = false;
+            }
+            if (!fAvailable) continue;
+
+            bool found = false;
+            if (nCoinType == ONLY_DENOMINATED) {
+                found = IsDenominatedAmount(pcoin->vout[i].nValue);
+            } else if (nCoinType == ONLY_NOT285IFMN) {
+                found = !(fMasterNode && pcoin->vout[i].nValue == 285 * COIN);
+            } else if (nCoinType == ONLY_NONDENOMINATED_NOT285IFMN) {
+                if (IsCollateralAmount(pcoin->vout[i].nValue)) continue; // do not use collateral amounts
+                found = !IsDenominatedAmount(pcoin->vout[i].nValue);
+                if (found && fMasterNode) found = pcoin->vout[i].nValue != 285 * COIN; // do not use Hot MN funds
+            } else if (nCoinType == ONLY_285) {
+                found = pcoin->vout[i].nValue == 285 * COIN;
+            } else {
+                found = true;
+            }
+            if (!found) continue;
+
+            if (nCoinType == STAKEABLE_COINS && pcoin->vout[i].IsZerocoinMint()) continue;
+
+            if (  (mine == ISMINE_NO) ||
+                  ((mine == ISMINE_MULTISIG || mine == ISMINE_SPENDABLE) && nWatchonlyConfig == 2) ||
+                  (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1) ||
+                  (IsLockedCoin(wtxid, i) && nCoinType != ONLY_285) ||
+                  (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue) ||
+                  (fCoinsSelected && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(wtxid, i))
+               ) continue;
+
+            // --Skip P2CS outputs
+            // skip cold coins
+            if (mine == ISMINE_COLD && (!fIncludeColdStaking || !HasDelegator(pcoin->vout[i]))) continue;
+            // skip delegated coins
+            if (mine == ISMINE_SPENDABLE_DELEGATED && !fIncludeDelegated) continue;
+            // skip auto-delegated coins
+            if (mine == ISMINE_SPENDABLE_STAKEABLE && !fIncludeColdStaking && !fIncludeDelegated) continue;
+
+            bool fIsValid = (
+                    ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
+                    ((mine & (ISMINE_MULTISIG | (fIncludeColdStaking ? ISMINE_COLD : ISMINE_NO) |
+                            (fIncludeDelegated ? ISMINE_SPENDABLE_DELEGATED : ISMINE_NO) )) != ISMINE_NO));
+
+            // found valid coin
+            if (!pCoins) return true;
+            pCoins->emplace_back(COutput(pcoin, i, nDepth, fIsValid));
         }
         return (pCoins && pCoins->size() > 0);
     }
@@ -2437,10 +3097,144 @@ bool less_then_denom(const COutput& out1, const COutput& out2)
 
 bool CWallet::StakeableCoins(std::vector<COutput>* pCoins)
 {
+    if (pCoins) pCoins->clear();
+
+    LOCK2(cs_main, cs_wallet);
+    std::vector<CStakeCandidate> vCandidates;
+    if (!GetStakeCandidates(chainActive.Tip(), vCandidates))
+        return false;
+    if (!pCoins)
+        return true;
+
+    const int nTipHeight = chainActive.Height();
+    pCoins->reserve(vCandidates.size());
+    for (const CStakeCandidate& candidate : vCandidates)
+        pCoins->emplace_back(COutput(candidate.tx, candidate.i, nTipHeight - candidate.pindexFrom->nHeight + 1, true));
+    return true;
+}
+
+CStakeKernelInput CStakeCandidate::GetKernelInput() const
+{
+    CStakeKernelInput input;
+    input.hashTx = tx->GetHash();
+    input.n = i;
+    input.nValue = nValue;
+    input.nHeightBlockFrom = pindexFrom->nHeight;
+    input.nTimeBlockFrom = pindexFrom->nTime;
+    return input;
+}
+
+/**
+ * Check whether output i of wtx can be used as stake input, ignoring its depth
+ * (mirrors the STAKEABLE_COINS filter of AvailableCoins).
+ */
+bool CWallet::IsStakeCandidate(const CWalletTx& wtx, unsigned int i, bool fIncludeCold) const
+{
+    AssertLockHeld(cs_wallet);
+    const CTxOut& txout = wtx.vout[i];
+    if (txout.nValue <= 0 || txout.IsZerocoinMint()) return false;
+    const uint256& hash = wtx.GetHash();
+    if (IsSpent(hash, i) || IsLockedCoin(hash, i)) return false;
+
+    isminetype mine = IsMine(txout);
+    if (mine == ISMINE_NO || mine == ISMINE_WATCH_ONLY || mine == ISMINE_SPENDABLE_DELEGATED) return false;
+    if (mine == ISMINE_COLD && (!fIncludeCold || !HasDelegator(txout))) return false;
+    if (mine == ISMINE_SPENDABLE_STAKEABLE && !fIncludeCold) return false;
+    return true;
+}
+
+void CWallet::AddStakeCandidates(const CWalletTx& wtx, bool fIncludeCold)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    if (wtx.hashUnset() || wtx.nIndex < 0 || !CheckFinalTx(wtx)) return;
+    BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) return;
+
+    const bool fCoinBaseOrStake = wtx.IsCoinBase() || wtx.IsCoinStake();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsStakeCandidate(wtx, i, fIncludeCold))
+            mapStakeCandidates[COutPoint(wtx.GetHash(), i)] = CStakeCandidate(&wtx, i, wtx.vout[i].nValue, mi->second, fCoinBaseOrStake);
+    }
+}
+
+void CWallet::RebuildStakeCandidates(bool fIncludeCold)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    mapStakeCandidates.clear();
+    for (const auto& it : mapWallet)
+        AddStakeCandidates(it.second, fIncludeCold);
+    fStakeCandidatesCold = fIncludeCold;
+    fStakeCandidatesDirty = false;
+    LogPrint("staking", "%s: %d stake candidates\n", __func__, mapStakeCandidates.size());
+}
+
+void CWallet::UpdateStakeCandidates(const CTransaction& tx, const CBlock* pblock)
+{
+    AssertLockHeld(cs_wallet);
+    if (fStakeCandidatesDirty) return;
+
+    // Outputs spent by this tx (in a block or in the mempool) can't stake anymore
+    bool fChanged = false;
+    for (const CTxIn& txin : tx.vin) {
+        if (!txin.IsZerocoinSpend())
+            fChanged |= (mapStakeCandidates.erase(txin.prevout) > 0);
+    }
+    if (fChanged) nStakeCandidatesVersion++;
+
+    const uint256& hash = tx.GetHash();
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end()) return;
+
+    if (pblock) {
+        const size_t nCandidates = mapStakeCandidates.size();
+        AddStakeCandidates(mi->second, fStakeCandidatesCold);
+        if (mapStakeCandidates.size() != nCandidates) nStakeCandidatesVersion++;
+    } else {
+        // tx is unconfirmed: either new in the mempool, or its block was disconnected.
+        // In the latter case the outputs it spent may be spendable again: rebuild lazily.
+        bool fWasConfirmed = false;
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+            fWasConfirmed |= (mapStakeCandidates.erase(COutPoint(hash, i)) > 0);
+        if (fWasConfirmed) MarkStakeCandidatesDirty();
+    }
+}
+
+void CWallet::MarkStakeCandidatesDirty()
+{
+    LOCK(cs_wallet);
+    fStakeCandidatesDirty = true;
+    nStakeCandidatesVersion++;
+}
+
+/**
+ * Populate vCandidates with the outputs that can stake on top of pindexPrev.
+ * Only maturity is evaluated here, everything else is kept up to date by
+ * SyncTransaction, so this is a flat walk of the in-memory candidate set.
+ */
+bool CWallet::GetStakeCandidates(const CBlockIndex* pindexPrev, std::vector<CStakeCandidate>& vCandidates)
+{
+    vCandidates.clear();
+    if (!pindexPrev) return false;
+
     const bool fIncludeCold = (sporkManager.IsSporkActive(SPORK_17_COLDSTAKING_ENFORCEMENT) &&
                                GetBoolArg("-coldstaking", true));
+    const Consensus::Params& consensus = Params().GetConsensus();
+
+    LOCK2(cs_main, cs_wallet);
+    if (fStakeCandidatesDirty || fIncludeCold != fStakeCandidatesCold)
+        RebuildStakeCandidates(fIncludeCold);
 
-    return AvailableCoins(pCoins, true, nullptr, false, STAKEABLE_COINS,  false, 1, fIncludeCold, false);
+    vCandidates.reserve(mapStakeCandidates.size());
+    for (const auto& it : mapStakeCandidates) {
+        const CStakeCandidate& candidate = it.second;
+        const int nDepth = pindexPrev->nHeight - candidate.pindexFrom->nHeight + 1;
+        if (nDepth < consensus.nStakeMinDepth) continue;
+        if (candidate.fCoinBaseOrStake && nDepth <= consensus.nCoinbaseMaturity) continue;
+        vCandidates.push_back(candidate);
+    }
+    return !vCandidates.empty();
 }
 
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
@@ -2880,20 +3674,12 @@ bool CWallet::CreateCoinStake(
         )
 {
     // Get the list of stakable utxos
-    std::vector<COutput> vCoins;
-    if (!StakeableCoins(&vCoins)) {
+    std::vector<CStakeCandidate> vCandidates;
+    if (!GetStakeCandidates(pindexPrev, vCandidates)) {
         LogPrintf("%s: No coin available to stake.\n", __func__);
         return false;
     }
 
-    // Parse utxos into CPivStakes
-    std::list<std::unique_ptr<CStakeInput> > listInputs;
-    for (const COutput &out : vCoins) {
-        std::unique_ptr<CPivStake> input(new CPivStake());
-        input->SetPrevout((CTransaction) *out.tx, out.i);
-        listInputs.emplace_back(std::move(input));
-    }
-
     // Mark coin stake transaction
     txNew.vin.clear();
     txNew.vout.clear();
@@ -2901,30 +3687,73 @@ bool CWallet::CreateCoinStake(
 
     // update staker status (hash)
     pStakerStatus->SetLastTip(pindexPrev);
-    pStakerStatus->SetLastCoins(listInputs.size());
+    pStakerStatus->SetLastCoins(vCandidates.size());
+
+    // With stake modifier v2 the kernel depends only on the time slot and the utxo:
+    // hash all the candidates for the current slot in one batch.
+    const bool fRegTest = Params().IsRegTestNet();
+    const int64_t nTimeSlot = (fRegTest ? GetAdjustedTime() : GetCurrentTimeSlot());
+    const CStakeKernelSlot kernelSlot(pindexPrev, nBits, nTimeSlot);
+    const bool fBatchSearch = kernelSlot.IsValid();
+    std::vector<CStakeKernelInput> vKernelInputs;
+    std::vector<size_t> vKernelPos;
+    if (fBatchSearch) {
+        if (nTimeSlot <= pindexPrev->nTime && !fRegTest) return false;
+        vKernelInputs.reserve(vCandidates.size());
+        vKernelPos.reserve(vCandidates.size());
+        for (size_t i = 0; i < vCandidates.size(); i++) {
+            const CStakeKernelInput& input = vCandidates[i].GetKernelInput();
+            if (!kernelSlot.ContextCheck(input)) continue;
+            vKernelInputs.push_back(input);
+            vKernelPos.push_back(i);
+        }
+    }
 
     // Kernel Search
     CAmount nCredit;
     CScript scriptPubKeyKernel;
     bool fKernelFound = false;
     int nAttempts = 0;
-    for (std::unique_ptr<CStakeInput>& stakeInput : listInputs) {
+    size_t nNext = 0;
+    while (true) {
         //new block came in, move on
         if (chainActive.Height() != pindexPrev->nHeight) return false;
 
         // Make sure the wallet is unlocked and shutdown hasn't been requested
         if (IsLocked() || ShutdownRequested()) return false;
 
-        nCredit = 0;
+        // Parse the next winning utxo into a CPivStake (block-from index is already known)
+        std::unique_ptr<CPivStake> stakeInput(new CPivStake());
+        if (fBatchSearch) {
+            int nHashes = 0;
+            const int nPos = SearchStakeKernel(kernelSlot, vKernelInputs, nNext, nHashes);
+            nAttempts += nHashes;
+            nTxNewTime = nTimeSlot;
+
+            // update staker status (time, attempts)
+            pStakerStatus->SetLastTime(nTxNewTime);
+            pStakerStatus->SetLastTries(nAttempts);
+
+            if (nPos < 0) break;
+            nNext = nPos + 1;
+            const CStakeCandidate& candidate = vCandidates[vKernelPos[nPos]];
+            stakeInput->SetPrevout((CTransaction) *candidate.tx, candidate.i, candidate.pindexFrom);
+        } else {
+            if (nNext >= vCandidates.size()) break;
+            const CStakeCandidate& candidate = vCandidates[nNext++];
+            stakeInput->SetPrevout((CTransaction) *candidate.tx, candidate.i, candidate.pindexFrom);
 
-        nAttempts++;
-        fKernelFound = Stake(pindexPrev, stakeInput.get(), nBits, nTxNewTime);
+            nAttempts++;
+            const bool fHit = Stake(pindexPrev, stakeInput.get(), nBits, nTxNewTime);
 
-        // update staker status (time, attempts)
-        pStakerStatus->SetLastTime(nTxNewTime);
-        pStakerStatus->SetLastTries(nAttempts);
+            // update staker status (time, attempts)
+            pStakerStatus->SetLastTime(nTxNewTime);
+            pStakerStatus->SetLastTries(nAttempts);
 
-        if (!fKernelFound) continue;
+            if (!fHit) continue;
+        }
+
+        nCredit = 0;
 
         // Found a kernel
         LogPrintf("CreateCoinStake : kernel found\n");
@@ -2978,6 +3807,7 @@ bool CWallet::CreateCoinStake(
         }
         txNew.vin.emplace_back(in);
 
+        fKernelFound = true;
         break;
     }
     LogPrint("staking", "%s: attempted staking %d times\n", __func__, nAttempts);
@@ -3146,8 +3976,13 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const std::string& s
     {
         LOCK(cs_wallet); // mapAddressBook
         mapAddressBook[address].name = strName;
-        if (!strPurpose.empty()) /* update purpose only if requested */
+        if (!strPurpose.empty() && mapAddressBook[address].purpose != strPurpose) { /* update purpose only if requested */
+            // cold stakes of a delegator are stake candidates (HasDelegator)
+            if (strPurpose == AddressBook::AddressBookPurpose::DELEGATOR ||
+                mapAddressBook[address].purpose == AddressBook::AddressBookPurpose::DELEGATOR)
+                MarkStakeCandidatesDirty();
             mapAddressBook[address].purpose = strPurpose;
+        }
     }
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address) != ISMINE_NO,
             mapAddressBook.at(address).purpose, (fUpdated ? CT_UPDATED : CT_NEW));
@@ -3173,6 +4008,8 @@ bool CWallet::DelAddressBook(const CTxDestination& address, const CChainParams::
             }
         }
         mapAddressBook.erase(address);
+        if (purpose == AddressBook::AddressBookPurpose::DELEGATOR)
+            MarkStakeCandidatesDirty();
     }
 
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address) != ISMINE_NO, purpose, CT_DELETED);
@@ -3641,18 +4478,24 @@ bool CWallet::UpdatedTransaction(const uint256& hashTx)
 void CWallet::LockCoin(const COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
+    MarkStakeCandidatesDirty();
+    setBalancesDirtyTxs.insert(output.hash);
     setLockedCoins.insert(output);
 }
 
 void CWallet::UnlockCoin(const COutPoint& output)
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
+    MarkStakeCandidatesDirty();
+    setBalancesDirtyTxs.insert(output.hash);
     setLockedCoins.erase(output);
 }
 
 void CWallet::UnlockAllCoins()
 {
     AssertLockHeld(cs_wallet); // setLockedCoins
+    MarkStakeCandidatesDirty();
+    fBalancesDirty = true;
     setLockedCoins.clear();
 }
 
@@ -4464,6 +5307,8 @@ void CWalletTx::MarkDirty()
     fColdCreditCached = false;
     fDelegatedDebitCached = false;
     fDelegatedCreditCached = false;
+    if (pwallet)
+        pwallet->MarkBalancesDirty(GetHash());
 }
 
 void CWalletTx::BindWallet(CWallet* pwalletIn)
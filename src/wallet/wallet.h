@@ -11,6 +11,7 @@
 #include "addressbook.h"
 #include "amount.h"
 #include "base58.h"
+#include "blockfilter.h"
 #include "consensus/tx_verify.h"
 #include "crypter.h"
 #include "kernel.h"
@@ -30,6 +31,7 @@
 #include "zpiv/zpivmodule.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -38,6 +40,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/unordered_set.hpp>
+
 /**
  * Settings
  */
@@ -48,6 +52,7 @@ extern bool bSpendZeroConfChange;
 extern bool bdisableSystemnotifications;
 extern bool fSendFreeTransactions;
 extern bool fPayAtLeastCustomFee;
+extern bool fCheckBalances;
 
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
@@ -192,6 +197,106 @@ public:
     bool IsActive() const { return (nTime + 30) >= GetTime(); }
 };
 
+/** Wallet output that can be used as stake input.
+ *  The block the output was confirmed in is resolved when the output enters
+ *  the wallet's candidate set, so the kernel search does not need any
+ *  transaction index lookup.
+**/
+class CStakeCandidate
+{
+public:
+    const CWalletTx* tx{nullptr};
+    unsigned int i{0};
+    CAmount nValue{0};
+    CBlockIndex* pindexFrom{nullptr};
+    bool fCoinBaseOrStake{false};
+
+    CStakeCandidate() {}
+    CStakeCandidate(const CWalletTx* txIn, unsigned int iIn, CAmount nValueIn, CBlockIndex* pindexFromIn, bool fCoinBaseOrStakeIn) :
+        tx(txIn), i(iIn), nValue(nValueIn), pindexFrom(pindexFromIn), fCoinBaseOrStake(fCoinBaseOrStakeIn) {}
+
+    CStakeKernelInput GetKernelInput() const;
+};
+
+/** Balances of the wallet in every category (see CWallet::GetBalances) */
+struct CWalletBalances {
+    CAmount nAvailable{0};
+    CAmount nColdStaking{0};
+    CAmount nStaking{0};        //! staking balance, without the cold staking part
+    CAmount nStakingCold{0};    //! cold staking part of the staking balance
+    CAmount nDelegated{0};
+    CAmount nLocked{0};
+    CAmount nUnlocked{0};
+    CAmount nUnconfirmed{0};
+    CAmount nImmature{0};
+    CAmount nImmatureColdStaking{0};
+    CAmount nImmatureDelegated{0};
+    CAmount nWatchOnly{0};
+    CAmount nUnconfirmedWatchOnly{0};
+    CAmount nImmatureWatchOnly{0};
+    CAmount nLockedWatchOnly{0};
+
+    CWalletBalances& operator+=(const CWalletBalances& b) { Add(b, 1); return *this; }
+    CWalletBalances& operator-=(const CWalletBalances& b) { Add(b, -1); return *this; }
+    bool IsNull() const;
+
+private:
+    void Add(const CWalletBalances& b, int nSign);
+};
+
+/** Wallet output that is mine and may be unspent, with its ownership type (see mapWalletUnspent) */
+class CWalletUnspent
+{
+public:
+    const CWalletTx* tx{nullptr};
+    isminetype mine{ISMINE_NO};
+
+    CWalletUnspent() {}
+    CWalletUnspent(const CWalletTx* txIn, isminetype mineIn) : tx(txIn), mine(mineIn) {}
+};
+
+/**
+ * What the wallet can recognise in a block, captured before a rescan so that the rescan's
+ * worker threads can pick out candidate transactions without cs_wallet (see
+ * CWallet::GetScanFilter). It matches a superset of IsMine/IsFromMe: a matched transaction is
+ * still checked by AddToWalletIfInvolvingMe.
+ */
+class CWalletScanFilter
+{
+private:
+    std::set<CKeyID> setKeys;
+    std::set<CScriptID> setScripts;
+    //! watch-only and multisig scripts, matched whole
+    std::set<CScript> setWholeScripts;
+    //! wallet transactions, whose outputs an input may spend
+    boost::unordered_set<uint256, SaltedTxidHasher> setTxids;
+    //! outputs spent by wallet transactions, whose double-spends conflict them (MarkConflicted)
+    boost::unordered_set<COutPoint, SaltedOutpointHasher> setSpent;
+    //! scripts of the above, as found in the block filters (see AddScriptFilterElements)
+    BlockFilterElementSet setBlockFilterElements;
+    //! whether a block matching none of setBlockFilterElements may be skipped
+    bool fSkipBlocks{true};
+
+public:
+    CWalletScanFilter();
+
+    void AddKey(const CKeyID& keyID);
+    void AddScript(const CScriptID& scriptID);
+    void AddWholeScript(const CScript& script);
+    void AddTx(const uint256& txid) { setTxids.insert(txid); }
+    void AddSpent(const COutPoint& outpoint) { setSpent.insert(outpoint); }
+    //! Script spent by an unconfirmed wallet transaction, which a conflicting spend in a block spends too
+    void AddSpentScript(const CScript& script);
+    //! Read every block, for a spent output whose script is unknown
+    void DisableBlockSkip() { fSkipBlocks = false; }
+
+    bool IsRelevant(const CScript& scriptPubKey) const;
+    bool IsRelevant(const CTransaction& tx) const;
+    //! Elements to query the block filters with, a block matching none of them is skipped if CanSkipBlocks
+    const BlockFilterElementSet& GetBlockFilterElements() const { return setBlockFilterElements; }
+    bool CanSkipBlocks() const { return fSkipBlocks; }
+};
+
 /**
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -229,6 +334,63 @@ private:
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
+
+    /**
+     * Outputs that can stake once mature, keyed by outpoint.
+     * Updated by SyncTransaction on every connected block / mempool tx,
+     * and fully rebuilt from mapWallet only when flagged dirty (wallet load,
+     * rescan, conflicts, coin locking, script imports, delegator address book changes).
+     */
+    std::map<COutPoint, CStakeCandidate> mapStakeCandidates;
+    bool fStakeCandidatesDirty{true};
+    bool fStakeCandidatesCold{false};
+    std::atomic<unsigned int> nStakeCandidatesVersion{0};
+    bool IsStakeCandidate(const CWalletTx& wtx, unsigned int i, bool fIncludeCold) const;
+    void AddStakeCandidates(const CWalletTx& wtx, bool fIncludeCold);
+    void RebuildStakeCandidates(bool fIncludeCold);
+    void UpdateStakeCandidates(const CTransaction& tx, const CBlock* pblock);
+
+    /**
+     * Outputs that are mine and may be unspent, keyed by outpoint, so that AvailableCoins
+     * doesn't walk the whole mapWallet. A superset of the unspent outputs: an output leaves it
+     * when a wallet tx spends it, comes back when its spender is conflicted, abandoned or
+     * disconnected (coinstake), and outputs found spent are pruned by AvailableCoins.
+     * Fully rebuilt from mapWallet only when flagged dirty (wallet load, rescan, key and
+     * script imports, erased transactions).
+     */
+    mutable std::map<COutPoint, CWalletUnspent> mapWalletUnspent;
+    mutable bool fWalletUnspentDirty{true};
+    void AddToUnspent(const CWalletTx& wtx);
+    void AddToUnspent(const COutPoint& outpoint);
+    void RebuildUnspent() const;
+    void MarkUnspentDirty();
+
+    /**
+     * Ledger of the balances of every category: the contribution of each wallet tx, from its
+     * outputs in mapWalletUnspent, and their sum in cachedBalances. A tx that changes (added,
+     * spent, confirmed, conflicted, abandoned, coins locked or unlocked) only has its own
+     * contribution replaced. A new tip or mempool change only re-evaluates the txs still moving
+     * between categories: unconfirmed, or not yet past the staking and maturity depths. The
+     * ledger is rebuilt from mapWallet on a reorg, a rebuilt mapWalletUnspent or UnlockAllCoins.
+     */
+    mutable CWalletBalances cachedBalances;
+    mutable std::map<uint256, CWalletBalances> mapTxBalances;
+    mutable std::set<uint256> setBalancesDirtyTxs;  // txs whose contribution is out of date
+    mutable std::set<uint256> setBalancesPending;   // txs whose contribution changes with the tip or the mempool
+    mutable bool fBalancesDirty{true};              // rebuild the whole ledger
+    mutable const CBlockIndex* pindexBalancesTip{nullptr};
+    mutable unsigned int nBalancesMempoolUpdated{0};
+    bool ComputeTxBalances(const CWalletTx& wtx, CWalletBalances& balances) const;
+    void UpdateTxBalances(const uint256& hash) const;
+    void ComputeBalances(CWalletBalances& balances) const;
+    void ComputeBalancesFull(CWalletBalances& balances) const;
+    void CheckBalances(const CWalletBalances& balances) const;
+
+    /** State of the running rescan, read without locks by abortrescan and getwalletinfo */
+    std::atomic<bool> fScanningWallet{false};
+    std::atomic<bool> fAbortRescan{false};
+    std::atomic<int64_t> nScanStartTime{0};
+    std::atomic<double> dScanProgress{0.0};
     /* HD derive new child key (on internal or external chain) */
     void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
 
@@ -241,6 +403,11 @@ public:
     static const int DEFAULT_STAKE_SPLIT_THRESHOLD = 2000;
 
     bool StakeableCoins(std::vector<COutput>* pCoins = nullptr);
+    bool GetStakeCandidates(const CBlockIndex* pindexPrev, std::vector<CStakeCandidate>& vCandidates);
+    //! Rebuild the stake candidates on the next GetStakeCandidates, after a change to what is stakeable
+    void MarkStakeCandidatesDirty();
+    //! Changes whenever outputs enter or leave the stake candidates (maturity aside)
+    unsigned int GetStakeCandidatesVersion() const { return nStakeCandidatesVersion; }
     bool IsCollateralAmount(CAmount nInputAmount) const;
 
     /*
@@ -432,11 +599,18 @@ public:
      * Upgrade wallet to HD if needed. Does nothing if not.
      */
 
+    CWalletScanFilter GetScanFilter() const;
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false, bool fromStartup = false);
+    void AbortRescan() { fAbortRescan = true; }
+    bool IsAbortingRescan() const { return fAbortRescan; }
+    bool IsScanning() const { return fScanningWallet; }
+    int64_t ScanningDuration() const { return fScanningWallet ? GetTimeMillis() - nScanStartTime : 0; }
+    double ScanningProgress() const { return fScanningWallet ? dScanProgress.load() : 0.0; }
     void ReacceptWalletTransactions(bool fFirstLoad = false);
     void ResendWalletTransactions();
 
-    CAmount loopTxsBalance(std::function<void(const uint256&, const CWalletTx&, CAmount&)>method) const;
+    CWalletBalances GetBalances() const;
+    void MarkBalancesDirty(const uint256& hash) const;
     CAmount GetBalance() const;
     CAmount GetColdStakingBalance() const;  // delegated coins for which we have the staking key
     CAmount GetImmatureColdStakingBalance() const;
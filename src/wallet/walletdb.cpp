@@ -14,6 +14,7 @@
 #include "txdb.h"
 #include "util.h"
 #include "utiltime.h"
+#include "wallet/logdb.h"
 #include "wallet/wallet.h"
 #include <zpiv/deterministicmint.h>
 
@@ -290,7 +291,7 @@ void CWalletDB::ListAccountCreditDebit(const std::string& strAccount, std::list<
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw std::runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -305,7 +306,7 @@ void CWalletDB::ListAccountCreditDebit(const std::string& strAccount, std::list<
         if (ret == DB_NOTFOUND)
             break;
         else if (ret != 0) {
-            pcursor->close();
+            delete pcursor;
             throw std::runtime_error("CWalletDB::ListAccountCreditDebit() : error scanning DB");
         }
 
@@ -324,7 +325,7 @@ void CWalletDB::ListAccountCreditDebit(const std::string& strAccount, std::list<
         entries.push_back(acentry);
     }
 
-    pcursor->close();
+    delete pcursor;
 }
 
 DBErrors CWalletDB::ReorderTransactions(CWallet* pwallet)
@@ -725,7 +726,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor) {
             LogPrintf("Error getting wallet database cursor\n");
             return DB_CORRUPT;
@@ -740,6 +741,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 break;
             else if (ret != 0) {
                 LogPrintf("Error reading next record from wallet database\n");
+                delete pcursor;
                 return DB_CORRUPT;
             }
 
@@ -761,7 +763,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
         }
-        pcursor->close();
+        delete pcursor;
     } catch (const boost::thread_interrupted&) {
         throw;
     } catch (...) {
@@ -822,7 +824,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, std::vector<uint256>& vTxHash
         }
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor) {
             LogPrintf("Error getting wallet database cursor\n");
             return DB_CORRUPT;
@@ -837,6 +839,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, std::vector<uint256>& vTxHash
                 break;
             else if (ret != 0) {
                 LogPrintf("Error reading next record from wallet database\n");
+                delete pcursor;
                 return DB_CORRUPT;
             }
 
@@ -853,7 +856,7 @@ DBErrors CWalletDB::FindWalletTx(CWallet* pwallet, std::vector<uint256>& vTxHash
                 vWtx.push_back(wtx);
             }
         }
-        pcursor->close();
+        delete pcursor;
     } catch (const boost::thread_interrupted&) {
         throw;
     } catch (...) {
@@ -907,6 +910,14 @@ void ThreadFlushWalletDB(const std::string& strFile)
         }
 
         if (nLastFlushed != nWalletDBUpdated && GetTime() - nLastWalletUpdate >= 2) {
+            if (logdb.Exists(strFile)) {
+                // sync the commits of the writes since the last flush, all at once
+                boost::this_thread::interruption_point();
+                nLastFlushed = nWalletDBUpdated;
+                logdb.Flush(false);
+                continue;
+            }
+
             TRY_LOCK(bitdb.cs_db, lockDb);
             if (lockDb) {
                 // Don't do this if any databases are in use
@@ -986,6 +997,17 @@ bool BackupWallet(const CWallet& wallet, const boost::filesystem::path& strDest,
                 // Copy wallet.dat
                 boost::filesystem::path pathDest(strDest);
                 boost::filesystem::path pathSrc = GetDataDir() / wallet.strWalletFile;
+
+                // a wallet in LevelDB is backed up as a wallet.dat too, exported from it
+                const std::string strFileExport = wallet.strWalletFile + ".export";
+                const bool fLogDB = logdb.Exists(wallet.strWalletFile);
+                if (fLogDB) {
+                    if (!CDB::Export(wallet.strWalletFile, strFileExport)) {
+                        NotifyBacked(wallet, false, strprintf("Failed to export %s for the backup\n", wallet.strWalletFile));
+                        return false;
+                    }
+                    pathSrc = GetDataDir() / strFileExport;
+                }
                 if (is_directory(pathDest)) {
                     if(!exists(pathDest)) create_directory(pathDest);
                     pathDest /= wallet.strWalletFile;
@@ -1047,6 +1069,8 @@ bool BackupWallet(const CWallet& wallet, const boost::filesystem::path& strDest,
                     AttemptBackupWallet(wallet, pathSrc.string(), pathWithFile.string());
                 }
 
+                if (fLogDB)
+                    bitdb.RemoveDb(strFileExport);
                 return defaultPath;
             }
         }
@@ -1397,7 +1421,7 @@ bool CWalletDB::WriteMintPoolPair(const uint256& hashMasterSeed, const uint256&
 std::map<uint256, std::vector<std::pair<uint256, uint32_t> > > CWalletDB::MapMintPool()
 {
     std::map<uint256, std::vector<std::pair<uint256, uint32_t> > > mapPool;
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw std::runtime_error(std::string(__func__)+" : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -1414,7 +1438,7 @@ std::map<uint256, std::vector<std::pair<uint256, uint32_t> > > CWalletDB::MapMin
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw std::runtime_error(std::string(__func__)+" : error scanning DB");
         }
 
@@ -1445,7 +1469,7 @@ std::map<uint256, std::vector<std::pair<uint256, uint32_t> > > CWalletDB::MapMin
         }
     }
 
-    pcursor->close();
+    delete pcursor;
 
     return mapPool;
 }
@@ -1453,7 +1477,7 @@ std::map<uint256, std::vector<std::pair<uint256, uint32_t> > > CWalletDB::MapMin
 std::list<CDeterministicMint> CWalletDB::ListDeterministicMints()
 {
     std::list<CDeterministicMint> listMints;
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw std::runtime_error(std::string(__func__)+" : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -1470,7 +1494,7 @@ std::list<CDeterministicMint> CWalletDB::ListDeterministicMints()
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw std::runtime_error(std::string(__func__)+" : error scanning DB");
         }
 
@@ -1489,14 +1513,14 @@ std::list<CDeterministicMint> CWalletDB::ListDeterministicMints()
         listMints.emplace_back(mint);
     }
 
-    pcursor->close();
+    delete pcursor;
     return listMints;
 }
 
 std::list<CZerocoinMint> CWalletDB::ListMintedCoins()
 {
     std::list<CZerocoinMint> listPubCoin;
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw std::runtime_error(std::string(__func__)+" : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -1515,7 +1539,7 @@ std::list<CZerocoinMint> CWalletDB::ListMintedCoins()
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw std::runtime_error(std::string(__func__)+" : error scanning DB");
         }
 
@@ -1534,14 +1558,14 @@ std::list<CZerocoinMint> CWalletDB::ListMintedCoins()
         listPubCoin.emplace_back(mint);
     }
 
-    pcursor->close();
+    delete pcursor;
     return listPubCoin;
 }
 
 std::list<CZerocoinSpend> CWalletDB::ListSpentCoins()
 {
     std::list<CZerocoinSpend> listCoinSpend;
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw std::runtime_error(std::string(__func__)+" : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -1558,7 +1582,7 @@ std::list<CZerocoinSpend> CWalletDB::ListSpentCoins()
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw std::runtime_error(std::string(__func__)+" : error scanning DB");
         }
 
@@ -1577,7 +1601,7 @@ std::list<CZerocoinSpend> CWalletDB::ListSpentCoins()
         listCoinSpend.push_back(zerocoinSpendItem);
     }
 
-    pcursor->close();
+    delete pcursor;
     return listCoinSpend;
 }
 
@@ -1596,7 +1620,7 @@ std::list<CBigNum> CWalletDB::ListSpentCoinsSerial()
 std::list<CZerocoinMint> CWalletDB::ListArchivedZerocoins()
 {
     std::list<CZerocoinMint> listMints;
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw std::runtime_error(std::string(__func__)+" : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -1613,7 +1637,7 @@ std::list<CZerocoinMint> CWalletDB::ListArchivedZerocoins()
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw std::runtime_error(std::string(__func__)+" : error scanning DB");
         }
 
@@ -1632,14 +1656,14 @@ std::list<CZerocoinMint> CWalletDB::ListArchivedZerocoins()
         listMints.push_back(mint);
     }
 
-    pcursor->close();
+    delete pcursor;
     return listMints;
 }
 
 std::list<CDeterministicMint> CWalletDB::ListArchivedDeterministicMints()
 {
     std::list<CDeterministicMint> listMints;
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw std::runtime_error(std::string(__func__)+" : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -1656,7 +1680,7 @@ std::list<CDeterministicMint> CWalletDB::ListArchivedDeterministicMints()
             break;
         else if (ret != 0)
         {
-            pcursor->close();
+            delete pcursor;
             throw std::runtime_error(std::string(__func__)+" : error scanning DB");
         }
 
@@ -1675,6 +1699,6 @@ std::list<CDeterministicMint> CWalletDB::ListArchivedDeterministicMints()
         listMints.emplace_back(dMint);
     }
 
-    pcursor->close();
+    delete pcursor;
     return listMints;
 }
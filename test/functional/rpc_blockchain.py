@@ -13,6 +13,7 @@ Test the following RPCs:
     - getblockheader
     - getchaintxstats
     - getnetworkhashps
+    - getsyncstatus
     - verifychain
 
 Tests correspond to code in rpc/blockchain.cpp.
@@ -41,6 +42,7 @@ class BlockchainTest(oasisTestFramework):
         #self._test_getblockchaininfo()
         self._test_gettxoutsetinfo()
         self._test_getblockheader()
+        self._test_getsyncstatus()
         #self._test_getdifficulty()
         self.nodes[0].verifychain(0)
 
@@ -61,6 +63,15 @@ class BlockchainTest(oasisTestFramework):
         # result should have these additional pruning keys if manual pruning is enabled
         assert_equal(sorted(res.keys()), sorted(keys))
 
+    def _test_getsyncstatus(self):
+        self.log.info("Test getsyncstatus")
+        res = self.nodes[0].getsyncstatus()
+        assert_equal(res['blocks'], 200)
+        assert_equal(res['headers'], 200)
+        assert_equal(res['blocks_in_flight'], 0)
+        assert_equal(res['blocks_awaiting_parent'], 0)
+        assert_greater_than_or_equal(res['connect_blocks_per_sec'], 0)
+
     def _test_gettxoutsetinfo(self):
         node = self.nodes[0]
         res = node.gettxoutsetinfo()
@@ -52,6 +52,13 @@ class NetTest(oasisTestFramework):
         assert_greater_than_or_equal(peers_sent, net_totals_before['totalbytessent'])
         assert_greater_than_or_equal(net_totals_after['totalbytessent'], peers_sent)
 
+        # the socket handler thread has been woken up by the peers' traffic
+        socket_loop = net_totals_after['socketloop']
+        assert socket_loop['backend'] in ('epoll', 'select')
+        assert_greater_than_or_equal(socket_loop['wakeups'], net_totals_before['socketloop']['wakeups'])
+        assert_greater_than_or_equal(socket_loop['events'], 1)
+        assert_greater_than_or_equal(socket_loop['maxiterationmicros'], socket_loop['lastiterationmicros'])
+
         # test getnettotals and getpeerinfo by doing a ping
         # the bytes sent/received should change
         # note ping and pong are 32 bytes each
@@ -677,6 +677,7 @@ class P2PHeaderAndShortIDs():
         self.shortids = []
         self.prefilled_txn_length = 0
         self.prefilled_txn = []
+        self.block_sig = b""
 
     def deserialize(self, f):
         self.header.deserialize(f)
@@ -688,6 +689,7 @@ class P2PHeaderAndShortIDs():
             self.shortids.append(struct.unpack("<Q", f.read(6) + b'\x00\x00')[0])
         self.prefilled_txn = deser_vector(f, PrefilledTransaction)
         self.prefilled_txn_length = len(self.prefilled_txn)
+        self.block_sig = deser_string(f)
 
     # When using version 2 compact blocks, we must serialize with_witness.
     def serialize(self, with_witness=False):
@@ -702,6 +704,7 @@ class P2PHeaderAndShortIDs():
             r += ser_vector(self.prefilled_txn, "serialize_with_witness")
         else:
             r += ser_vector(self.prefilled_txn, "serialize_without_witness")
+        r += ser_string(self.block_sig)
         return r
 
     def __repr__(self):
@@ -727,11 +730,13 @@ class HeaderAndShortIDs():
         self.nonce = 0
         self.shortids = []
         self.prefilled_txn = []
+        self.block_sig = b""
         self.use_witness = False
 
         if p2pheaders_and_shortids != None:
             self.header = p2pheaders_and_shortids.header
             self.nonce = p2pheaders_and_shortids.nonce
+            self.block_sig = p2pheaders_and_shortids.block_sig
             self.shortids = p2pheaders_and_shortids.shortids
             last_index = -1
             for x in p2pheaders_and_shortids.prefilled_txn:
@@ -745,6 +750,7 @@ class HeaderAndShortIDs():
             ret = P2PHeaderAndShortIDs()
         ret.header = self.header
         ret.nonce = self.nonce
+        ret.block_sig = self.block_sig
         ret.shortids_length = len(self.shortids)
         ret.shortids = self.shortids
         ret.prefilled_txn_length = len(self.prefilled_txn)
@@ -767,6 +773,7 @@ class HeaderAndShortIDs():
     def initialize_from_block(self, block, nonce=0, prefill_list = [0], use_witness = False):
         self.header = CBlockHeader(block)
         self.nonce = nonce
+        self.block_sig = getattr(block, 'vchBlockSig', b"")
         self.prefilled_txn = [ PrefilledTransaction(i, block.vtx[i]) for i in prefill_list ]
         self.shortids = []
         self.use_witness = use_witness